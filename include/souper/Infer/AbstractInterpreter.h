@@ -19,6 +19,7 @@
 #include "llvm/IR/ConstantRange.h"
 
 #include "souper/Inst/Inst.h"
+#include "souper/Inst/InstIndexMap.h"
 #include "souper/Infer/Interpreter.h"
 
 #include <unordered_map>
@@ -58,7 +59,7 @@ namespace souper {
                   bool ConsiderHoles = true);
 
   class KnownBitsAnalysis {
-    std::unordered_map<Inst*, llvm::KnownBits> KBCache;
+    InstIndexMap<llvm::KnownBits> KBCache;
 
     // Checks the cache or instruction metadata for knonwbits information
     bool cacheHasValue(Inst *I);
@@ -67,15 +68,14 @@ namespace souper {
     KnownBitsAnalysis() {}
     KnownBitsAnalysis(std::unordered_map<Inst*, llvm::KnownBits> &Assumptions) {
       for (auto &P : Assumptions) {
-        if (KBCache.find(P.first) != KBCache.end()) {
-          llvm::KnownBits Existing = KBCache.find(P.first)->second;
+        if (auto Existing = KBCache.lookup(P.first)) {
           llvm::KnownBits Join;
-          Join.Zero = P.second.Zero | Existing.Zero;
-          Join.One = P.second.One | Existing.One;
+          Join.Zero = P.second.Zero | Existing->Zero;
+          Join.One = P.second.One | Existing->One;
           // What if this leads to a conflict?
-          KBCache.insert({P.first, Join});
+          KBCache.emplace(P.first, Join);
         } else {
-          KBCache.insert({P.first, P.second});
+          KBCache.emplace(P.first, P.second);
         }
       }
     }
@@ -97,7 +97,7 @@ namespace souper {
   };
 
   class ConstantRangeAnalysis {
-    std::unordered_map<Inst*, llvm::ConstantRange> CRCache;
+    InstIndexMap<llvm::ConstantRange> CRCache;
 
     // checks the cache or instruction metadata for cr information
     bool cacheHasValue(Inst *I);
@@ -106,13 +106,12 @@ namespace souper {
     ConstantRangeAnalysis() {}
     ConstantRangeAnalysis(std::unordered_map<Inst*, llvm::ConstantRange> &Assumptions) {
       for (auto &P : Assumptions) {
-        if (CRCache.find(P.first) != CRCache.end()) {
-          llvm::ConstantRange Existing = CRCache.find(P.first)->second;
-          llvm::ConstantRange Join = Existing.intersectWith(P.second);
-          CRCache.insert({P.first, Join});
+        if (auto Existing = CRCache.lookup(P.first)) {
+          llvm::ConstantRange Join = Existing->intersectWith(P.second);
+          CRCache.emplace(P.first, Join);
           // TODO Attn: Is there a situation where this needs to be union?
         } else {
-          CRCache.insert({P.first, P.second});
+          CRCache.emplace(P.first, P.second);
         }
       }
     }
@@ -167,14 +166,20 @@ namespace souper {
   };
 
   struct RestrictedBitsAnalysis {
-    std::unordered_map<Inst *, llvm::APInt> RBCache;
+    InstIndexMap<llvm::APInt> RBCache;
+
+    RestrictedBitsAnalysis() {}
+    RestrictedBitsAnalysis(const std::unordered_map<Inst *, llvm::APInt> &Assumptions) {
+      for (auto &P : Assumptions)
+        RBCache[P.first] = P.second;
+    }
     llvm::APInt findRestrictedBits(souper::Inst *I);
   };
 
   class MustDemandedBitsAnalysis {
     UseMap Uses;
     RestrictedBitsAnalysis RB;
-    std::unordered_map<Inst *, std::unordered_map<Inst *, llvm::APInt>> Cache;
+    InstIndexMap<InputVarInfo> Cache;
 
     InputVarInfo findMustDemandedBitsImpl(souper::Inst *I);
 
@@ -192,15 +197,13 @@ namespace souper {
 
   class HoleAnalysis {
   public:
-    std::unordered_map<souper::Inst *, bool> Cache;
+    InstIndexMap<bool> Cache;
     bool findIfHole(souper::Inst *I);
   };
 
   class ForcedValueAnalysis {
   public:
-    ForcedValueAnalysis(Inst *RHS_) : RHS(RHS_), Conflict(false) {
-      countSymbolicInsts(RHS);
-    }
+    ForcedValueAnalysis(Inst *RHS_) : RHS(RHS_), Conflict(false) {}
     class Value {
     public:
       Value() : hasValue(false) {}
@@ -274,9 +277,6 @@ namespace souper {
       return Conflict;
     }
 
-    // Counts uses, not defs.
-    void countSymbolicInsts(Inst *I);
-
     Inst *RHS;
     bool Conflict;
   };
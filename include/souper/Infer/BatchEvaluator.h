@@ -0,0 +1,88 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_BATCH_EVALUATOR_H
+#define SOUPER_BATCH_EVALUATOR_H
+
+#include "souper/Inst/Inst.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace souper {
+
+// Input sets in structure-of-arrays form: one column of NumLanes values per
+// input, each zero-extended to 64 bits.
+struct BatchInputs {
+  size_t NumLanes = 0;
+  std::unordered_map<Inst *, std::vector<uint64_t>> Columns;
+};
+
+// The value of a root on each lane. A lane is UB if its UB flag is set,
+// otherwise poison if its poison flag is set, otherwise Vals holds its value.
+struct BatchResult {
+  std::vector<uint64_t> Vals;
+  std::vector<uint8_t> Poison;
+  std::vector<uint8_t> UB;
+
+  bool hasValue(size_t Lane) const { return !Poison[Lane] && !UB[Lane]; }
+};
+
+struct BatchInstruction {
+  Inst::Kind K;
+  unsigned Width;
+  // Width of the first operand
+  unsigned OpWidth;
+  unsigned Dest;
+  unsigned Ops[3];
+};
+
+// An Inst DAG with no value wider than 64 bits, lowered for evaluation on
+// many input sets at once.
+//
+// Like BytecodeProgram, every Inst gets a register, but a register holds a
+// block of lanes of the narrowest unsigned type that fits every width in the
+// DAG, along with per lane poison and UB masks. Each instruction is a
+// branch-free loop over the lanes of its operands, which the compiler turns
+// into vector code; on x86-64 the loops are also built for AVX2 and
+// AVX-512, picked when the program is loaded. The lane results agree with
+// ConcreteInterpreter::evaluateInst(), poison and UB included.
+class BatchProgram {
+public:
+  // Phi, freeze and the overflow aggregates are not supported, nor are
+  // holes, reserved constants, or anything wider than 64 bits
+  static bool isSupported(Inst *Root);
+
+  explicit BatchProgram(Inst *Root);
+
+  // Returns false, leaving Result alone, if an input of the DAG has no
+  // column in Inputs
+  bool evaluate(const BatchInputs &Inputs, BatchResult &Result) const;
+
+private:
+  std::vector<BatchInstruction> Code;
+  // Registers holding constants, and their values
+  std::vector<std::pair<unsigned, uint64_t>> Consts;
+  // Registers filled from the input columns, and the leaves they hold
+  std::vector<std::pair<unsigned, Inst *>> Loads;
+  unsigned NumRegs = 0;
+  unsigned RootReg;
+  // Bytes per lane
+  unsigned LaneBytes = 1;
+};
+
+}
+
+#endif  // SOUPER_BATCH_EVALUATOR_H
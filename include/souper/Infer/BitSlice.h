@@ -0,0 +1,85 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_BIT_SLICE_H
+#define SOUPER_BIT_SLICE_H
+
+#include "souper/Inst/Inst.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace souper {
+
+constexpr unsigned BitSliceWords = 8;
+constexpr unsigned BitSliceLanes = 64 * BitSliceWords;
+
+// One bit of every lane of a slice: lane L is bit L % 64 of Words[L / 64]
+struct BitPlane {
+  uint64_t Words[BitSliceWords];
+};
+
+// A value of at most BitSlicedProgram::MaxWidth bits on every lane of a
+// slice. Bits[B] holds bit B of each lane, planes past the width are zero.
+// A lane is UB if its UB bit is set, otherwise poison if its poison bit is.
+struct BitSlicedValue {
+  BitPlane Bits[8];
+  BitPlane Poison;
+  BitPlane UB;
+};
+
+// The bit planes of each input, low bit first
+using BitSlicedInputs = std::unordered_map<Inst *, std::vector<BitPlane>>;
+
+// An Inst DAG over values of at most 8 bits, evaluated on BitSliceLanes
+// input sets at once by bit slicing.
+//
+// Every register holds one plane per bit, so and/or/xor take a single word
+// operation per 64 lanes, and everything else is built from those: ripple
+// carry adders for addition, subtraction and comparisons, shift-and-add
+// multiplication, restoring division and barrel shifters. This makes
+// exhaustive checks over a few input bits nearly free. The lane results
+// agree with ConcreteInterpreter::evaluateInst(), poison and UB included.
+class BitSlicedProgram {
+public:
+  static constexpr unsigned MaxWidth = 8;
+
+  // Phi, freeze, byte swaps and the overflow aggregates are not supported,
+  // nor are holes, reserved constants or anything wider than MaxWidth
+  static bool isSupported(Inst *Root);
+
+  explicit BitSlicedProgram(Inst *Root);
+
+  // Returns false if an input of the DAG has no planes in Inputs
+  bool evaluate(const BitSlicedInputs &Inputs, BitSlicedValue &Result);
+
+private:
+  struct Instruction {
+    Inst *I;
+    unsigned Dest;
+    unsigned Ops[3];
+  };
+
+  std::vector<Instruction> Code;
+  // Registers filled from the inputs, and the leaves they hold
+  std::vector<std::pair<unsigned, Inst *>> Loads;
+  std::vector<BitSlicedValue> Regs;
+  unsigned RootReg;
+};
+
+}
+
+#endif  // SOUPER_BIT_SLICE_H
@@ -0,0 +1,67 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_BYTECODE_H
+#define SOUPER_BYTECODE_H
+
+#include "llvm/ADT/SmallVector.h"
+
+#include "souper/Infer/Interpreter.h"
+#include "souper/Inst/Inst.h"
+
+#include <utility>
+#include <vector>
+
+namespace souper {
+
+// An Inst DAG lowered to straight-line register code, for evaluating the
+// same DAG on many input sets.
+//
+// Every distinct Inst gets one register. Constants are materialized once at
+// compile time, other leaves (vars, reserved consts, ...) are loaded from
+// the input set, and the remaining Insts become instructions ordered so
+// that operands are computed before their users. Evaluation is a single
+// pass over that array with no recursion, hashing or allocation, and
+// applies evaluateSingleInst() to every instruction, so the results are
+// those of ConcreteInterpreter::evaluateInst() over the same inputs,
+// including its poison and UB semantics.
+class BytecodeProgram {
+public:
+  explicit BytecodeProgram(Inst *Root);
+
+  EvalValue evaluate(const ValueCache &Inputs);
+
+  size_t getNumInstructions() const { return Code.size(); }
+
+private:
+  struct Instruction {
+    Inst *I;
+    unsigned Dest;
+    // Operand registers are Operands[FirstOp, FirstOp + NumOps)
+    unsigned FirstOp;
+    unsigned NumOps;
+  };
+
+  std::vector<Instruction> Code;
+  std::vector<unsigned> Operands;
+  // Registers filled from the input set, and the leaves they hold
+  std::vector<std::pair<unsigned, Inst *>> Loads;
+  std::vector<EvalValue> Regs;
+  unsigned RootReg;
+  llvm::SmallVector<EvalValue, 3> Args;
+};
+
+}
+
+#endif  // SOUPER_BYTECODE_H
@@ -29,7 +29,10 @@ class PruningManager;
 
 class ConstantSynthesis {
 public:
-  ConstantSynthesis(PruningManager *P = nullptr) : Pruner(P) {}
+  // The input sets of P seed the starts of a multi-start search; unless
+  // SpecializeFirstQuery is false they also constrain the sequential search
+  ConstantSynthesis(PruningManager *P = nullptr, bool SpecializeFirstQuery = true)
+    : Pruner(P), SpecializeFirstQuery(SpecializeFirstQuery) {}
 
   // Synthesize a set of constants from the specification in LHS
   std::error_code synthesize(SMTLIBSolver *SMTSolver,
@@ -42,6 +45,19 @@ public:
 
 private:
   PruningManager *Pruner = nullptr;
+  bool SpecializeFirstQuery = true;
+
+  // Runs NumStarts CEGIS loops, each seeded with its own share of the
+  // pruner's input sets, whose solver queries are issued concurrently. All
+  // loops share counterexamples and rejected constants; the first constant
+  // set that verifies wins.
+  std::error_code synthesizeMultiStart(SMTLIBSolver *SMTSolver,
+                                       const BlockPCs &BPCs,
+                                       const std::vector<InstMapping> &PCs,
+                                       InstMapping Mapping, std::set <Inst *> &ConstSet,
+                                       std::map <Inst *, llvm::APInt> &ResultMap,
+                                       InstContext &IC, unsigned MaxTries, unsigned Timeout,
+                                       bool AvoidNops, unsigned NumStarts);
 };
 }
 
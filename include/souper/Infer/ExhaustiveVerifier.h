@@ -0,0 +1,92 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_EXHAUSTIVE_VERIFIER_H
+#define SOUPER_EXHAUSTIVE_VERIFIER_H
+
+#include "llvm/ADT/APInt.h"
+
+#include "souper/Infer/BitSlice.h"
+#include "souper/Infer/Interpreter.h"
+#include "souper/Inst/Inst.h"
+
+#include <vector>
+
+namespace souper {
+
+// Decides whether a concrete RHS refines an LHS by running both sides
+// through the concrete interpreter on every input, instead of asking the
+// solver. Only usable when the variables of the LHS and its path
+// conditions, plus the predecessor choices of its blocks, span at most
+// MaxInputBits bits.
+//
+// The answer mirrors the query built by BuildQuery: inputs violating the
+// dataflow facts of a var, a PC, or a blockpc on the active phi path are
+// skipped, as are inputs where the LHS is poison or UB. On every other
+// input the RHS must produce a value equal to the LHS under its demanded
+// bits. Where the interpreter's semantics can drift from the solver's
+// (UB hiding in a select or phi operand that was not taken, a blockpc
+// that is itself poison) the result is Unknown and the caller should fall
+// back to the solver.
+//
+// Guesses of at most BitSlicedProgram::MaxWidth bits over an LHS without
+// phis are checked by the bit-sliced evaluator, a slice of inputs at a time.
+class ExhaustiveVerifier {
+public:
+  enum class Result { Valid, Invalid, Unknown };
+
+  ExhaustiveVerifier(Inst *LHS, const std::vector<InstMapping> &PCs,
+                     const BlockPCs &BPCs, unsigned MaxInputBits);
+
+  // False if the input space exceeds the budget or the LHS contains
+  // something the interpreter can't evaluate deterministically
+  bool isApplicable() { return Applicable; }
+
+  Result verify(Inst *RHS);
+
+private:
+  enum class InputKind : char { Skip, Check, Unknown };
+
+  Inst *LHS;
+  const std::vector<InstMapping> &PCs;
+  const BlockPCs &BPCs;
+  bool Applicable = false;
+  bool LHSPathSensitive = false;
+  bool TableBuilt = false;
+
+  std::vector<Inst *> Vars;
+  std::vector<Block *> Blocks;
+  uint64_t NumInputs = 0;
+
+  // Indexed by input number, filled in lazily on the first query
+  std::vector<InputKind> Kinds;
+  std::vector<llvm::APInt> LHSValues;
+
+  // The same table as bit planes, one entry per slice of inputs, and the
+  // LHS values with LHS->Width planes per slice
+  bool SlicedTableBuilt = false;
+  std::vector<BitPlane> CheckPlanes;
+  std::vector<BitPlane> UnknownPlanes;
+  std::vector<BitPlane> LHSPlanes;
+
+  void buildTable();
+  void buildSlicedTable();
+  Result verifySliced(Inst *RHS, bool RHSPathSensitive);
+  void setInput(uint64_t Index, ValueCache &Cache);
+  bool blockPCsHold(ConcreteInterpreter &CI, bool &Uncertain);
+};
+
+}
+
+#endif  // SOUPER_EXHAUSTIVE_VERIFIER_H
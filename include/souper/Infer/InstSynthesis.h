@@ -317,6 +317,13 @@ private:
   Inst *initConcreteInputWirings(Inst *Query, Inst *WiringQuery,
                                  unsigned Refinements,
                                  std::vector<std::map<Inst *, Inst *>> &S);
+  /// Copy of WiringQuery for one concrete input set. With a non-empty
+  /// Suffix, the component inputs are replaced by fresh vars named with it
+  Inst *getConcreteInputWiring(Inst *WiringQuery,
+                               std::map<Inst *, Inst *> InputMap,
+                               const std::string &Suffix);
+  /// Add constraint C to an incremental solver session
+  std::error_code assertConstraint(SMTLIBSolverSession &Session, Inst *C);
   void constrainConstWiring(const Inst *Cand,
                             const ProgramWiring &CandWiring,
                             std::map<ProgramWiring, unsigned> &NotWorkingConstWirings,
@@ -16,10 +16,12 @@
 #define SOUPER_INTERPRTER_H
 
 #include "souper/Extractor/Solver.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/Support/KnownBits.h"
 #include "llvm/IR/ConstantRange.h"
 
 #include "souper/Inst/Inst.h"
+#include "souper/Inst/InstIndexMap.h"
 
 #include <unordered_map>
 
@@ -37,11 +39,11 @@ struct EvalValue {
   // undef, etc for freeze to work
   unsigned BitWidth = 0;
 
-  bool hasValue() {
+  bool hasValue() const {
     return K == ValueKind::Val;
   }
 
-  llvm::APInt getValue() {
+  llvm::APInt getValue() const {
     if (K != ValueKind::Val) {
       llvm::errs() << "Interpreter: expected number but got ";
       print(llvm::errs());
@@ -77,7 +79,7 @@ struct EvalValue {
   }
 
   template <typename Stream>
-  void print(Stream &&Out) {
+  void print(Stream &&Out) const {
     Out << "Value: ";
     switch (K) {
       case ValueKind::Val : Out << Value; break;
@@ -108,21 +110,40 @@ EvalValue evaluateShl(llvm::APInt A, llvm::APInt B);
 EvalValue evaluateLShr(llvm::APInt A, llvm::APInt B);
 EvalValue evaluateAShr(llvm::APInt A, llvm::APInt B);
 
+// Evaluates I from the values of its operands. With EvalPhiFirstBranch, a
+// phi whose block has no concrete predecessor takes its first operand.
+EvalValue evaluateSingleInst(Inst *I, llvm::ArrayRef<EvalValue> Args,
+                             bool EvalPhiFirstBranch = false);
+
   class ConcreteInterpreter {
-    ValueCache Cache;
+    // The inputs, and the Insts evaluated by the constructor
+    InstIndexMap<EvalValue> Cache;
+    // Everything else evaluated by the current evaluateInst() call, so
+    // guesses are evaluated on top of Cache without copying or changing it
+    InstIndexMap<EvalValue> Overlay;
     bool CacheWritable = false;
     bool EvalPhiFirstBranch = false;
-    EvalValue evaluateSingleInst(Inst *I, std::vector<EvalValue> &Args);
+    bool Memoize = false;
+
+    EvalValue evaluate(Inst *I);
 
   public:
     ConcreteInterpreter() {}
-    ConcreteInterpreter(ValueCache &Input) : Cache(Input) {}
-    ConcreteInterpreter(Inst *I, ValueCache &Input) : Cache(Input) {
+    ConcreteInterpreter(ValueCache &Input) {
+      for (auto &P : Input)
+        Cache[P.first] = P.second;
+    }
+    ConcreteInterpreter(Inst *I, ValueCache &Input) : ConcreteInterpreter(Input) {
       CacheWritable = true;
       evaluateInst(I);
       CacheWritable = false;
     }
     void setEvalPhiFirstBranch() {EvalPhiFirstBranch = true;};
+    // Keeps the overlay across evaluateInst() calls, so Insts shared by
+    // successive roots are evaluated once. Only sound while no Inst changes
+    // meaning, e.g. through the concrete predecessor of a block.
+    void setMemoize(bool M) {Memoize = M;};
+    void clearMemo() {Overlay.clear();};
     EvalValue evaluateInst(Inst *Root);
   };
 
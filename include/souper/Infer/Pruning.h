@@ -19,9 +19,12 @@
 
 #include "souper/Extractor/Solver.h"
 #include "souper/Infer/AbstractInterpreter.h"
+#include "souper/Infer/BatchEvaluator.h"
 #include "souper/Infer/Interpreter.h"
 #include "souper/Inst/Inst.h"
 
+#include <array>
+#include <chrono>
 #include <unordered_map>
 
 namespace souper {
@@ -40,10 +43,25 @@ class PruningManager {
 public:
   PruningManager(SynthesisContext &SC_, std::vector< souper::Inst *> &Inputs_,
                  unsigned int StatsLevel_);
+  // Adds the counters to the STATISTICs and appends them to the
+  // souper-dataflow-pruning-stats-json file
+  ~PruningManager();
   PruneFunc getPruneFunc() {return DataflowPrune;}
-  void printStats(llvm::raw_ostream &out) {
-    out << "Dataflow Pruned " << NumPruned << "/" << TotalGuesses << "\n";
-  }
+  void printStats(llvm::raw_ostream &out);
+  // One JSON object with the guess counts and, per technique, how often it
+  // ran, how often it pruned and the microseconds it took
+  void printStatsJSON(llvm::raw_ostream &out);
+
+  enum Technique {
+#define PRUNING_TECHNIQUE(Name, Key, Desc) Prune##Name,
+#include "souper/Infer/PruningTechniques.def"
+    NumTechniques
+  };
+  struct TechniqueStats {
+    uint64_t Checks = 0;
+    uint64_t Pruned = 0;
+    std::chrono::nanoseconds Time{0};
+  };
 
   bool isInfeasible(Inst *RHS, unsigned StatsLevel);
   bool isInfeasibleWithSolver(Inst *RHS, unsigned StatsLevel);
@@ -52,6 +70,11 @@ public:
   // not be called when pruning is disabled
 
   auto &getInputVals() {return InputVals;}
+  // Turns an input on which the solver refuted a guess into a pruning
+  // input, so later guesses are checked against it. Returns false if the
+  // model misses an input, is already known or fails the PCs.
+  bool addCounterexample(const std::vector<Inst *> &ModelInsts,
+                         const std::vector<llvm::APInt> &ModelVals);
 private:
   SynthesisContext &SC;
   std::vector<ConcreteInterpreter> ConcreteInterpreters;
@@ -68,9 +91,38 @@ private:
   unsigned NumPruned;
   unsigned TotalGuesses;
   int StatsLevel;
+  std::array<TechniqueStats, NumTechniques> Stats;
+  // Timing every check is not free, so it is only done when someone looks
+  bool TimeTechniques = false;
+  bool pruned(Technique T) {
+    ++Stats[T].Pruned;
+    return true;
+  }
   std::vector<ValueCache> InputVals;
   std::vector<Inst *> &InputVars;
   std::vector<ValueCache> generateInputSets(std::vector<Inst *> &Inputs);
+  // Analysis results for the Insts of earlier guesses on each input set, in
+  // step with InputVals; empty when memoization is off. Guesses are
+  // hash-consed, so a subterm shared by many guesses is analyzed once per
+  // input, and only the new top nodes of a guess cost anything.
+  struct InputMemo {
+    KnownBitsAnalysis KB;
+    ConstantRangeAnalysis CR;
+  };
+  std::vector<InputMemo> Memos;
+  unsigned MemoizedGuesses = 0;
+  void clearMemos();
+  llvm::KnownBits findKnownBits(Inst *RHS, unsigned Input);
+  llvm::ConstantRange findConstantRange(Inst *RHS, unsigned Input);
+  // Counterexamples sit at the front of InputVals, newest first
+  unsigned NumCounterexamples = 0;
+  unsigned getInputDistance(ValueCache &A, ValueCache &B);
+  void evictCounterexample();
+  // Random inputs satisfying the PCs, on which concrete guesses are
+  // evaluated all at once, and the LHS value on each of them
+  BatchInputs BatchInputVals;
+  std::vector<uint64_t> BatchLHSVals;
+  void initBatchInputs();
   void setPhiConcretePreds(Inst *Root);
   // For the LHS contained in @SC, check if the given input in @Cache is valid.
   bool isInputValid(ValueCache &Cache);
@@ -0,0 +1,120 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_REWRITE_DATABASE_H
+#define SOUPER_REWRITE_DATABASE_H
+
+#include "llvm/ADT/APInt.h"
+
+#include "souper/Inst/Inst.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace souper {
+
+// Rewrites learned from earlier infer() results, generalized so that they
+// also fire on LHSs differing only in their constants or bit widths.
+//
+// A learned LHS -> RHS first has all of its LHS constants turned into
+// pattern constants; if that no longer verifies, the constants are kept
+// concrete. Vars of the LHS become wildcards that match any subtree, and
+// widths are matched up to a monotonic renaming (i1 only matches i1), so a
+// rule found at i8 is offered for the same shape at i32.
+//
+// Rules are indexed by a discrimination tree over the preorder Inst::Kind
+// sequence of their LHS, so a lookup only unifies against rules whose shape
+// can match. Generalization is only checked at the width it was learned
+// at: callers must verify every instantiated RHS against the actual LHS and
+// its path conditions.
+class RewriteDatabase {
+public:
+  // Decides whether a rule built in the database's own InstContext holds
+  // without any path conditions
+  using CheckFn = std::function<bool(InstContext &IC, InstMapping Rule)>;
+
+  RewriteDatabase(CheckFn Check) : Check(Check) {}
+
+  // Returns true if some generalization of Mapping verified and is stored
+  bool learn(InstMapping Mapping);
+
+  // Instantiates all rules matching LHS in IC, rules with concrete
+  // constants first
+  void lookup(Inst *LHS, InstContext &IC, std::vector<Inst *> &RHSs);
+
+  size_t size() { return Rules.size(); }
+
+private:
+  struct PatternNode {
+    Inst::Kind K;
+    unsigned Width;
+    // Vars and generalized constants are bound while matching
+    int Slot = -1;
+    llvm::APInt Val;
+    // LHS nodes are followed by their operands in preorder
+    unsigned NumOps = 0;
+    // RHS nodes refer to earlier nodes by index
+    std::vector<unsigned> Ops;
+  };
+  using Pattern = std::vector<PatternNode>;
+
+  struct Rule {
+    // One preorder flattening per order of commutative operands
+    std::vector<Pattern> LHSVariants;
+    // Topologically sorted, root last
+    Pattern RHS;
+    unsigned NumSlots;
+    bool Generalized;
+  };
+
+  struct TrieNode {
+    std::map<unsigned, std::unique_ptr<TrieNode>> Children;
+    // (rule, variant) pairs whose LHS ends here
+    std::vector<std::pair<unsigned, unsigned>> Leaves;
+  };
+
+  struct FlatTerm {
+    std::vector<Inst *> Insts;
+    // Index just past the subtree rooted at each position
+    std::vector<unsigned> Next;
+  };
+
+  CheckFn Check;
+  InstContext PatternIC;
+  std::vector<Rule> Rules;
+  std::set<std::string> Known;
+  TrieNode Root;
+
+  bool flattenLHS(Inst *I, std::map<Inst *, int> &Slots, bool GeneralizeConsts,
+                  unsigned Mask, unsigned &CommIdx, Pattern &Out);
+  bool flattenTarget(Inst *I, FlatTerm &T);
+  bool buildRule(InstMapping Mapping, bool GeneralizeConsts, Rule &R);
+  InstMapping buildMapping(const Rule &R);
+  void insert(Rule R);
+  void search(TrieNode *N, unsigned Pos, const FlatTerm &T,
+              std::vector<std::pair<unsigned, unsigned>> &Matches);
+  bool unify(const Pattern &P, const FlatTerm &T,
+             std::vector<Inst *> &Bindings,
+             std::map<unsigned, unsigned> &Widths);
+  Inst *instantiate(const Rule &R, std::vector<Inst *> &Bindings,
+                    std::map<unsigned, unsigned> &Widths, InstContext &IC);
+};
+
+}
+
+#endif  // SOUPER_REWRITE_DATABASE_H
@@ -0,0 +1,112 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_SMALL_KNOWN_BITS_H
+#define SOUPER_SMALL_KNOWN_BITS_H
+
+#include "llvm/Support/KnownBits.h"
+
+#include <cstdint>
+
+namespace souper {
+
+// Known bits of a value of at most 64 bits, with both masks held in plain
+// words. Bits at or above Width are always clear.
+struct SmallKnownBits {
+  static constexpr unsigned MaxWidth = 64;
+
+  uint64_t Zero = 0;
+  uint64_t One = 0;
+  unsigned Width;
+
+  explicit SmallKnownBits(unsigned Width) : Width(Width) {}
+  explicit SmallKnownBits(const llvm::KnownBits &KB)
+    : Zero(KB.Zero.getZExtValue()), One(KB.One.getZExtValue()),
+      Width(KB.getBitWidth()) {}
+
+  static bool fits(const llvm::KnownBits &KB) {
+    return KB.getBitWidth() <= MaxWidth;
+  }
+
+  llvm::KnownBits toKnownBits() const {
+    llvm::KnownBits KB(Width);
+    KB.Zero = llvm::APInt(Width, Zero);
+    KB.One = llvm::APInt(Width, One);
+    return KB;
+  }
+
+  // The low N bits of a word, N <= 64
+  static uint64_t lowBits(unsigned N) {
+    return N >= 64 ? ~0ULL : (1ULL << N) - 1;
+  }
+
+  uint64_t mask() const { return lowBits(Width); }
+  uint64_t signBit() const { return 1ULL << (Width - 1); }
+  // The high N bits of the value, N <= Width
+  uint64_t highBits(unsigned N) const { return mask() & ~lowBits(Width - N); }
+
+  bool isConstant() const { return (Zero | One) == mask(); }
+  bool isSignKnown() const { return (Zero | One) & signBit(); }
+  bool isNegative() const { return One & signBit(); }
+  bool isNonNegative() const { return Zero & signBit(); }
+
+  uint64_t getUMin() const { return One; }
+  uint64_t getUMax() const { return ~Zero & mask(); }
+  int64_t getSMin() const {
+    return signExtend(isSignKnown() ? One : One | signBit());
+  }
+  int64_t getSMax() const {
+    return signExtend(isSignKnown() ? getUMax() : getUMax() & ~signBit());
+  }
+
+  unsigned countMinTrailingZeros() const;
+  unsigned countMinLeadingZeros() const;
+  unsigned countMinLeadingOnes() const;
+  unsigned countMaxLeadingZeros() const;
+
+private:
+  int64_t signExtend(uint64_t V) const {
+    unsigned Shift = 64 - Width;
+    return (int64_t)(V << Shift) >> Shift;
+  }
+};
+
+// The transfer functions of BinaryTransferFunctionsKB over words. Each one
+// gives exactly the result of its APInt counterpart, which dispatches here
+// whenever the operands fit and are too wide for the TransferTables.
+namespace SmallTransferFunctionsKB {
+  SmallKnownBits add(const SmallKnownBits &LHS, const SmallKnownBits &RHS,
+                     bool NSW);
+  SmallKnownBits sub(const SmallKnownBits &LHS, const SmallKnownBits &RHS,
+                     bool NSW);
+  SmallKnownBits mul(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits udiv(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits urem(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits and_(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits or_(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits xor_(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits shl(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits lshr(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits ashr(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits eq(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits ne(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits ult(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits slt(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits ule(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+  SmallKnownBits sle(const SmallKnownBits &LHS, const SmallKnownBits &RHS);
+}
+
+}
+
+#endif  // SOUPER_SMALL_KNOWN_BITS_H
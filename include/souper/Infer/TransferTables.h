@@ -0,0 +1,52 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_TRANSFER_TABLES_H
+#define SOUPER_TRANSFER_TABLES_H
+
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/Support/KnownBits.h"
+
+#include <optional>
+
+namespace souper {
+
+// Transfer functions for narrow operands, looked up in tables that
+// souper-gen-transfer-tables computes at build time by evaluating each
+// operation on every pair of concrete operands. A table entry is the most
+// precise result that holds for every value the operation takes without UB
+// or poison, so it is at least as precise as any transfer function.
+namespace TransferTables {
+  enum Op {
+#define TRANSFER_TABLE_OP(Name, HasKB, HasCR, IsCmp) Name,
+#include "souper/Infer/TransferTableOps.def"
+  };
+
+  // The widths up to which the tables cover all operands
+  constexpr unsigned MaxKBWidth = 5;
+  constexpr unsigned MaxCRWidth = 4;
+
+  // Nothing if the operands are wider than the tables, have conflicting known
+  // bits, or Op has no table. When no pair of operand values is defined, the
+  // result is unknown.
+  std::optional<llvm::KnownBits> lookupKB(Op O, const llvm::KnownBits &LHS,
+                                          const llvm::KnownBits &RHS);
+  std::optional<llvm::ConstantRange> lookupCR(Op O,
+                                              const llvm::ConstantRange &LHS,
+                                              const llvm::ConstantRange &RHS);
+}
+
+}
+
+#endif  // SOUPER_TRANSFER_TABLES_H
@@ -17,14 +17,27 @@
 
 #include "llvm/ADT/APInt.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Recycler.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/ConstantRange.h"
 #include "llvm/IR/Value.h"
 
 #include "souper/SMTLIB2/Solver.h"
 
+#include <array>
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <unordered_set>
@@ -35,6 +48,8 @@ namespace souper {
 enum class HarvestType { HarvestedFromDef, HarvestedFromUse };
 
 const unsigned MaxPreds = 100000;
+// The widest integer type LLVM has, llvm::IntegerType::MAX_INT_BITS
+const unsigned MaxInstWidth = 1 << 23;
 extern const std::string ReservedConstPrefix;
 extern const std::string ReservedInstPrefix;
 extern const std::string BlockPred;
@@ -49,6 +64,22 @@ struct Block {
   std::vector<Inst *> PredVars;
 };
 
+// What is known about the values of a Var, from its declaration or from
+// LLVM's analyses when it was harvested. Other Insts have none of this, so
+// it lives outside of Inst.
+struct VarFacts {
+  llvm::APInt KnownZeros;
+  llvm::APInt KnownOnes;
+  bool NonZero;
+  bool NonNegative;
+  bool PowOfTwo;
+  bool Negative;
+  unsigned NumSignBits;
+  llvm::ConstantRange Range=llvm::ConstantRange(1, true);
+  // Set by pruning for synthesis constants
+  std::vector<llvm::ConstantRange> RangeRefinement;
+};
+
 struct Inst : llvm::FoldingSetNode {
   typedef enum {
     Const,
@@ -128,20 +159,39 @@ struct Inst : llvm::FoldingSetNode {
     None,
 } Kind;
 
+  // Hot fields first: these are what traversals look at
   Kind K;
-  unsigned Number;
   unsigned Width;
+  // Dense number of the Inst among all Insts of its InstContext, for
+  // InstIndexMap
+  unsigned Index = 0;
+  unsigned Number;
+  // Only Phis have more than three operands
+  llvm::SmallVector<Inst *, 3> Ops;
+  llvm::APInt Val;
+  llvm::APInt DemandedBits;
   Block *B;
+  // Only set for Vars; allocated by the InstContext
+  VarFacts *Facts = nullptr;
   bool Available = true;
-  llvm::APInt Val;
+
   std::string Name;
-  std::unordered_set<Inst *> DepsWithExternalUses;
-  std::vector<Inst *> Ops;
-  mutable std::vector<Inst *> OrderedOps;
-  std::vector<llvm::Value *> Origins;
+  llvm::DenseSet<Inst *> DepsWithExternalUses;
+  // Ops in the order they are printed in, if it differs from Ops. Set when
+  // the Inst is created, like everything derived from the operands, so that
+  // threads sharing the Inst only read it.
+  std::vector<Inst *> OrderedOps;
+  // Memoized by cost() and instCount(), -1 until then. The operands of an
+  // Inst never change, so neither do these; threads sharing the Inst may
+  // race to store them, but they all store the same value. Only accessed
+  // through std::atomic_ref.
+  mutable int CachedCost = -1;
+  mutable int CachedInstCount = -1;
+  // Usually the one value the Inst was harvested from
+  llvm::SmallVector<llvm::Value *, 1> Origins;
 
   bool operator<(const Inst &I) const;
-  const std::vector<Inst *> &orderedOps() const;
+  llvm::ArrayRef<Inst *> orderedOps() const;
   bool hasOrigin(llvm::Value *V) const;
 
   void Profile(llvm::FoldingSetNodeID &ID) const;
@@ -155,7 +205,7 @@ struct Inst : llvm::FoldingSetNode {
   static std::string getMoreKnownBitsString(bool NonZero, bool NonNegative,
                                             bool PowOfTwo, bool Negative);
   static std::string getDemandedBitsString(llvm::APInt DBVal);
-  static Kind getKind(std::string Name);
+  static Kind getKind(llvm::StringRef Name);
 
   static bool isAssociative(Kind K);
   static bool isCmp(Kind K);
@@ -170,21 +220,13 @@ struct Inst : llvm::FoldingSetNode {
   static bool isShift(Kind K);
   static bool isDivRem(Kind K);
   static int getCost(Kind K);
-  llvm::APInt KnownZeros;
-  llvm::APInt KnownOnes;
-  bool NonZero;
-  bool NonNegative;
-  bool PowOfTwo;
-  bool Negative;
-  unsigned NumSignBits;
-  llvm::APInt DemandedBits;
   unsigned SynthesisConstID;
   HarvestType HarvestKind;
   llvm::BasicBlock* HarvestFrom;
-  llvm::ConstantRange Range=llvm::ConstantRange(1, true);
-  std::vector<llvm::ConstantRange> RangeRefinement;
-  int nReservedConsts = -1;
-  int nHoles = -1;
+  // Uses of reserved constants and of holes in the Inst and its operands,
+  // counted once per path and saturating
+  unsigned nReservedConsts = 0;
+  unsigned nHoles = 0;
 };
 
 /// A mapping from an Inst to a replacement. This may either represent a
@@ -212,8 +254,8 @@ typedef std::vector<BlockPCMapping> BlockPCs;
 class ReplacementContext {
   llvm::DenseMap<Inst *, std::string> InstNames;
   llvm::DenseMap<Block *, std::string> BlockNames;
-  std::map<std::string, Inst *> NameToInst;
-  std::map<std::string, Block *> NameToBlock;
+  llvm::StringMap<Inst *> NameToInst;
+  llvm::StringMap<Block *> NameToBlock;
   std::string printInstImpl(Inst *I, llvm::raw_ostream &Out, bool printNames, Inst *OrigI);
 
 public:
@@ -231,19 +273,109 @@ public:
   bool empty();
 };
 
-class InstContext {
-  typedef llvm::DenseMap<unsigned, std::vector<std::unique_ptr<Block>>>
-      BlockMap;
-  BlockMap BlocksByPreds;
+// Prints replacements to the same text as PrintReplacement and friends do
+// with a fresh ReplacementContext, for the keys of caches and profiles.
+// Names are kept in a table indexed by Inst::Index and the text is written
+// to a buffer that is reused by the next call, so once warmed up printing
+// hardly allocates. The returned text is valid until the next call. The
+// Insts of a replacement must all belong to one InstContext.
+class ReplacementPrinter {
+  llvm::SmallString<512> Buf;
+  // InstNames[I->Index] is one more than the name of I, or 0 if I has none
+  std::vector<unsigned> InstNames;
+  // The indices and Insts named by the last call, in the order they were
+  // named. The printer may outlive the context of these Insts, so only the
+  // indices are used to forget them.
+  std::vector<std::pair<unsigned, Inst *>> Named;
+  llvm::SmallVector<std::pair<Block *, unsigned>, 4> BlockNames;
+  unsigned NumNames = 0;
+
+  void reset();
+  void printInst(llvm::raw_ostream &OS, Inst *I, Inst *OrigI,
+                 bool printNames);
+  void printRef(llvm::raw_ostream &OS, Inst *I);
+  unsigned printBlock(llvm::raw_ostream &OS, Block *B);
+  void printPCs(llvm::raw_ostream &OS, const BlockPCs &BPCs,
+                const std::vector<InstMapping> &PCs, bool printNames);
+  void printAttributes(llvm::raw_ostream &OS, Inst *LHS);
+
+public:
+  llvm::StringRef printReplacement(const BlockPCs &BPCs,
+                                   const std::vector<InstMapping> &PCs,
+                                   InstMapping Mapping,
+                                   bool printNames = false);
+  llvm::StringRef printLHS(const BlockPCs &BPCs,
+                           const std::vector<InstMapping> &PCs, Inst *LHS,
+                           bool printNames = false);
+  // Like PrintReplacementRHS with the context of the last printLHS
+  llvm::StringRef printRHS(Inst *RHS, bool printNames = false);
+  // Names in Context what the last call named, for parsing text that was
+  // printed against it
+  void getContext(ReplacementContext &Context) const;
+};
 
-  typedef llvm::DenseMap<unsigned, std::vector<std::unique_ptr<Inst>>> InstMap;
+// Creates and owns Insts and Blocks. Any number of threads may create them
+// at the same time, for instance guesses over a shared LHS.
+class InstContext {
+public:
+  // Hash-consing tables, arenas and creation logs are split into shards so
+  // that threads building Insts at the same time rarely wait for each other
+  static constexpr unsigned NumShards = 16;
+
+private:
+  struct Shard {
+    std::mutex Lock;
+    llvm::FoldingSet<Inst> InstSet;
+    // Insts are bump allocated, which keeps them together in memory and
+    // makes creating them cheap. The memory of those released by rollback()
+    // is reused.
+    llvm::BumpPtrAllocator Allocator;
+    llvm::Recycler<Inst> InstRecycler;
+    // The live Insts of the shard, in the order they were created
+    std::vector<Inst *> Insts;
+  };
+  std::array<Shard, NumShards> Shards;
+
+  // Guards the members up to FreeIndices. Taken before a shard's lock when
+  // both are needed.
+  mutable std::mutex Lock;
+  llvm::BumpPtrAllocator Allocator;
+  llvm::Recycler<Block> BlockRecycler;
+  llvm::Recycler<VarFacts> FactsRecycler;
+  // The live Blocks, in the order they were created
+  std::vector<Block *> Blocks;
+  // Blocks are numbered per number of predecessors
+  llvm::DenseMap<unsigned, unsigned> NumBlocksByPreds;
+  typedef llvm::DenseMap<unsigned, std::vector<Inst *>> InstMap;
   InstMap VarInstsByWidth;
 
-  std::vector<std::unique_ptr<Inst>> Insts;
-  llvm::FoldingSet<Inst> InstSet;
-  unsigned ReservedConstCounter = 0;
+  // Indices of released Insts, handed out again before new ones. Only
+  // rollback() adds to it, so it is popped from without a lock; the first
+  // NumFreeIndices entries are the ones left.
+  std::vector<unsigned> FreeIndices;
+  std::atomic<size_t> NumFreeIndices{0};
+  std::atomic<unsigned> NumInsts{0};
+  std::atomic<unsigned> ReservedConstCounter{0};
+
+  // Hash-consed Insts live in the shard of their kind, width, operands and
+  // value or block, which setAttributes() leaves alone; the others in the
+  // shard of the thread that created them. The lock of the shard I hashes
+  // to also guards the attributes of I.
+  Shard &getShard(llvm::hash_code Structure);
+  Shard &getShard(const Inst *I);
+  Shard &getThreadShard();
+  // A new Inst owned by the context, with an unused Index. The lock of S
+  // must be held.
+  Inst *newInst(Shard &S);
+  Inst *newInst();
+  void releaseInst(Shard &S, Inst *I);
 
 public:
+  InstContext() = default;
+  InstContext(const InstContext &) = delete;
+  InstContext &operator=(const InstContext &) = delete;
+  ~InstContext();
+
   Inst *getConst(const llvm::APInt &I);
   Inst *getUntypedConst(const llvm::APInt &I);
   Inst *getReservedConst();
@@ -267,9 +399,50 @@ public:
                 bool Available=true);
   Inst *getInst(Inst::Kind K, unsigned Width, const std::vector<Inst *> &Ops,
                 llvm::APInt DemandedBits, bool Available);
+  // Sets attributes of I that hash-consing looks at, for the case where
+  // other threads look up or set attributes of Insts at the same time. I is
+  // hash-consed under its new attributes, unless an equal Inst already is.
+  void setAttributes(Inst *I, const llvm::APInt &DemandedBits,
+                     HarvestType HarvestKind);
+  // Adds Dep to I->DepsWithExternalUses, for the same case
+  void addDepWithExternalUses(Inst *I, Inst *Dep);
 
   std::vector<Inst *> getVariables() const;
   std::vector<Inst *> getVariablesFor(Inst *Root) const;
+
+  // One more than the largest Index of an Inst of this context
+  unsigned getNumInsts() const { return NumInsts; }
+
+  // Checkpoints mark a point in the life of the context that it can go back
+  // to, releasing what was created since. They nest: rolling back to a
+  // checkpoint invalidates all later ones.
+  struct Checkpoint {
+    std::array<size_t, NumShards> NumInsts;
+    size_t NumBlocks;
+    unsigned ReservedConstCounter;
+  };
+  Checkpoint checkpoint() const;
+  // Releases the Insts and Blocks created since C, except for those that
+  // the Insts in Keep reach. Pointers to released ones dangle afterwards.
+  // Unlike the rest of the context, this and checkpoint() must not run
+  // concurrently with other uses of it.
+  void rollback(const Checkpoint &C, llvm::ArrayRef<Inst *> Keep = {});
+};
+
+// Rolls IC back to the point where the scope was entered when it is left,
+// keeping what the Insts in Keep reach at that time. For the temporaries of
+// a computation that only hands back a few Insts.
+class InstContextScope {
+  InstContext &IC;
+  InstContext::Checkpoint C;
+  const std::vector<Inst *> &Keep;
+
+public:
+  InstContextScope(InstContext &IC, const std::vector<Inst *> &Keep)
+    : IC(IC), C(IC.checkpoint()), Keep(Keep) {}
+  InstContextScope(const InstContextScope &) = delete;
+  InstContextScope &operator=(const InstContextScope &) = delete;
+  ~InstContextScope() { IC.rollback(C, Keep); }
 };
 
 struct SynthesisContext {
@@ -287,6 +460,9 @@ int cost(Inst *I, bool IgnoreDepsWithExternalUses = false);
 int backendCost(Inst *I, bool IgnoreDepsWithExternalUses = false);
 int countHelper(Inst *I, std::set<Inst *> &Visited);
 int instCount(Inst *I);
+// The instructions of I that are not in Free and not only reachable
+// through it, for guesses built on top of parts of an LHS
+int instCount(Inst *I, const llvm::DenseSet<Inst *> &Free);
 int benefit(Inst *LHS, Inst *RHS);
 
 void PrintReplacement(llvm::raw_ostream &Out, const BlockPCs &BPCs,
@@ -322,6 +498,10 @@ Inst *getInstCopy(Inst *I, InstContext &IC,
 Inst *instJoin(Inst *I, Inst *Reserved, Inst *NewInst,
                std::map<Inst *, Inst *> &InstCache, InstContext &IC);
 
+// Calls Visit on Root and on each Inst it reaches, once each, breadth
+// first. Uses no recursion, so it is safe on deep DAGs.
+void forEachInst(Inst *Root, llvm::function_ref<void(Inst *)> Visit);
+
 void findVars(Inst *Root, std::vector<Inst *> &Vars);
 void findInsts(Inst *Root, std::vector<Inst *> &Insts, std::function<bool(Inst*)> Condition);
 
@@ -31,7 +31,7 @@ template<> struct llvm::GraphTraits<souper::Inst*> {
 
   static NodeRef getEntryNode(souper::Inst* instr) { return instr; }
 
-  using ChildIteratorType = std::vector<NodeRef>::iterator;
+  using ChildIteratorType = decltype(souper::Inst::Ops)::iterator;
 
   static ChildIteratorType child_begin(NodeRef N) {
     return N->Ops.begin();
@@ -0,0 +1,139 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_INST_INDEX_MAP_H
+#define SOUPER_INST_INDEX_MAP_H
+
+#include "souper/Inst/Inst.h"
+
+#include <cassert>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace souper {
+
+// A map from Insts to T, stored in an array indexed by Inst::Index rather
+// than in a hash table.
+//
+// The array is split into pages that are only allocated once an Inst
+// indexing into them is added, so a map holding a few Insts of a large
+// context stays small. clear() takes constant time: it starts a new
+// generation, and entries of earlier generations read as missing. An Inst
+// whose slot is held by an Inst of another context goes to a hash table.
+template <typename T> class InstIndexMap {
+  static constexpr unsigned PageBits = 7;
+  static constexpr unsigned PageSize = 1 << PageBits;
+
+  struct Slot {
+    Inst *Key = nullptr;
+    unsigned Generation = 0;
+    std::optional<T> Value;
+  };
+
+  std::vector<std::vector<Slot>> Pages;
+  std::unordered_map<Inst *, T> Overflow;
+  unsigned Generation = 1;
+
+  Slot *getSlot(Inst *I, bool Create) {
+    unsigned Page = I->Index >> PageBits;
+    if (Page >= Pages.size()) {
+      if (!Create)
+        return nullptr;
+      Pages.resize(Page + 1);
+    }
+    auto &Slots = Pages[Page];
+    if (Slots.empty()) {
+      if (!Create)
+        return nullptr;
+      Slots.resize(PageSize);
+    }
+    return &Slots[I->Index & (PageSize - 1)];
+  }
+
+public:
+  // Returns null if I has no entry
+  T *lookup(Inst *I) {
+    Slot *S = getSlot(I, /*Create=*/false);
+    if (S && S->Generation == Generation && S->Key == I)
+      return &*S->Value;
+    if (!Overflow.empty()) {
+      auto It = Overflow.find(I);
+      if (It != Overflow.end())
+        return &It->second;
+    }
+    return nullptr;
+  }
+
+  bool count(Inst *I) { return lookup(I) != nullptr; }
+
+  T &at(Inst *I) {
+    T *V = lookup(I);
+    assert(V && "Inst not in the map");
+    return *V;
+  }
+
+  // Like std::unordered_map::emplace(), an existing entry is kept. Returns
+  // the entry and whether it was added.
+  template <typename... ArgsTy>
+  std::pair<T *, bool> emplace(Inst *I, ArgsTy &&... Args) {
+    Slot *S = getSlot(I, /*Create=*/true);
+    if (S->Generation == Generation) {
+      if (S->Key == I)
+        return {&*S->Value, false};
+      auto Result = Overflow.try_emplace(I, std::forward<ArgsTy>(Args)...);
+      return {&Result.first->second, Result.second};
+    }
+    S->Key = I;
+    S->Generation = Generation;
+    S->Value.emplace(std::forward<ArgsTy>(Args)...);
+    return {&*S->Value, true};
+  }
+
+  T &operator[](Inst *I) { return *emplace(I).first; }
+
+  void clear() {
+    Overflow.clear();
+    if (++Generation == 0) {
+      for (auto &Slots : Pages)
+        for (auto &S : Slots)
+          S.Generation = 0;
+      Generation = 1;
+    }
+  }
+};
+
+// A set of Insts for one traversal of a DAG. Each thread keeps the
+// InstIndexMaps of finished traversals and hands them to the next ones, so
+// starting a traversal allocates nothing and clearing a set only starts a
+// new generation. Traversals may nest.
+class InstVisitedSet {
+  std::unique_ptr<InstIndexMap<bool>> Set;
+
+public:
+  InstVisitedSet();
+  ~InstVisitedSet();
+  InstVisitedSet(const InstVisitedSet &) = delete;
+  InstVisitedSet &operator=(const InstVisitedSet &) = delete;
+
+  // Returns whether I was not in the set yet
+  bool insert(Inst *I) { return Set->emplace(I).second; }
+  bool count(Inst *I) { return Set->count(I); }
+};
+
+}
+
+#endif  // SOUPER_INST_INDEX_MAP_H
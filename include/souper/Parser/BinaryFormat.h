@@ -0,0 +1,49 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUPER_PARSER_BINARYFORMAT_H
+#define SOUPER_PARSER_BINARYFORMAT_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include "souper/Parser/Parser.h"
+
+#include <string>
+#include <vector>
+
+namespace souper {
+
+// A compact encoding of replacements that loads without lexing or parsing.
+// Each replacement is a table of its Insts and Blocks, operands before
+// users, so shared nodes are stored once. Numbers are ULEB128 encoded and
+// constants are stored as their raw little-endian words. See
+// lib/Parser/BinaryFormat.cpp for the layout.
+//
+// The reader checks that the input is well formed and type checks the Insts
+// as the text parser does, so a malformed or truncated file is reported in
+// ErrStr rather than trusted.
+
+// Whether Buf starts like the output of WriteBinaryReplacements
+bool isBinaryReplacements(llvm::StringRef Buf);
+
+void WriteBinaryReplacements(llvm::raw_ostream &OS,
+                             llvm::ArrayRef<ParsedReplacement> Reps);
+
+std::vector<ParsedReplacement> ReadBinaryReplacements(InstContext &IC,
+    llvm::StringRef Filename, llvm::StringRef Buf, std::string &ErrStr);
+
+}
+
+#endif  // SOUPER_PARSER_BINARYFORMAT_H
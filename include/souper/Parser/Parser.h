@@ -15,6 +15,7 @@
 #ifndef SOUPER_PARSER_PARSER_H
 #define SOUPER_PARSER_PARSER_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
 #include "souper/Extractor/Candidates.h"
 
@@ -56,6 +57,17 @@ struct ParsedReplacement {
 
 void TestLexer(llvm::StringRef Str);
 
+// The checks the parser makes on the operands and width of an Inst before
+// creating it. Untyped constant operands are given the width of the others,
+// and Width is set if it is 0. ErrStr is set without a location.
+bool typeCheckOpsMatchingWidths(InstContext &IC,
+                                llvm::MutableArrayRef<Inst *> Ops,
+                                std::string &ErrStr);
+bool typeCheckPhi(InstContext &IC, unsigned Width, Block *B,
+                  std::vector<Inst *> &Ops, std::string &ErrStr);
+bool typeCheckInst(InstContext &IC, Inst::Kind IK, unsigned &Width,
+                   std::vector<Inst *> &Ops, std::string &ErrStr);
+
 ParsedReplacement ParseReplacement(InstContext &IC, llvm::StringRef Filename,
                                    llvm::StringRef Str, std::string &ErrStr);
 ParsedReplacement ParseReplacementLHS(InstContext &IC, llvm::StringRef Filename,
@@ -67,15 +79,52 @@ ParsedReplacement ParseReplacementRHS(InstContext &IC, llvm::StringRef Filename,
                                       ReplacementContext &Pr,
                                       std::string &ErrStr);
 
+/// FirstLine is the line of the file that Str starts on, for error messages
 std::vector<ParsedReplacement> ParseReplacements(InstContext &IC,
-    llvm::StringRef Filename, llvm::StringRef Str, std::string &ErrStr);
+    llvm::StringRef Filename, llvm::StringRef Str, std::string &ErrStr,
+    unsigned FirstLine = 1);
 std::vector<ParsedReplacement> ParseReplacementLHSs(InstContext &IC,
     llvm::StringRef Filename, llvm::StringRef Str,
-    std::vector<ReplacementContext> &Contexts, std::string &ErrStr);
+    std::vector<ReplacementContext> &Contexts, std::string &ErrStr,
+    unsigned FirstLine = 1);
 std::vector<ParsedReplacement> ParseReplacementRHSs(InstContext &IC,
     llvm::StringRef Filename, llvm::StringRef Str,
     std::vector<ReplacementContext> &Contexts, std::string &ErrStr);
 
+/// Like ParseReplacements and ParseReplacementLHSs, but Str is split with
+/// SplitReplacements and runs of replacements are parsed on Threads
+/// threads (0 for one per core) into IC. The result is in the order of
+/// the input, and on an error it holds the replacements before the first
+/// one that failed to parse, as a sequential parse would.
+///
+/// Insts that depend on no var are shared between replacements by IC, as
+/// in a sequential parse. The attributes replacements give them, such as
+/// demandedBits or hasExternalUses, are set under the locks of IC; if two
+/// replacements give one such Inst different demandedBits, which it ends
+/// up with depends on timing.
+std::vector<ParsedReplacement> ParseReplacementsParallel(InstContext &IC,
+    llvm::StringRef Filename, llvm::StringRef Str, std::string &ErrStr,
+    unsigned Threads = 0);
+std::vector<ParsedReplacement> ParseReplacementLHSsParallel(InstContext &IC,
+    llvm::StringRef Filename, llvm::StringRef Str,
+    std::vector<ReplacementContext> &Contexts, std::string &ErrStr,
+    unsigned Threads = 0);
+
+/// The text of one replacement of a larger input
+struct ReplacementSlice {
+  llvm::StringRef Str;
+  /// The line of the input that Str starts on
+  unsigned Line;
+};
+
+/// Splits Str into the text of its replacements, to parse them one at a
+/// time. Only the first word of each line is looked at: replacements end
+/// with 'cand' or 'result', or with 'infer' if LHSOnly, so statements must
+/// not span lines. Comments and blank lines go with the replacement before
+/// them.
+std::vector<ReplacementSlice> SplitReplacements(llvm::StringRef Str,
+                                                bool LHSOnly);
+
 }
 
 #endif  // SOUPER_PARSER_PARSER_H
@@ -29,9 +29,29 @@ typedef std::function<
         llvm::StringRef RedirectOut, llvm::StringRef RedirectErr,
         unsigned Timeout)> SolverProgram;
 
+// An interactive solver process that keeps its assertions between checks.
+// Queries are handed over as complete scripts, as built by BuildQuery; only
+// their assertions and the symbols not declared yet reach the solver, so a
+// formula that grows over many checks is parsed once.
+class SMTLIBSolverSession {
+public:
+  virtual ~SMTLIBSolverSession();
+  virtual std::error_code assertQuery(llvm::StringRef Query) = 0;
+  virtual std::error_code push() = 0;
+  virtual std::error_code pop() = 0;
+  // On SAT, evaluates the get-value commands of ModelQuery, whose symbols
+  // are declared first if needed. Its assertions are ignored.
+  virtual std::error_code checkSat(bool &Result, llvm::StringRef ModelQuery,
+                                   unsigned NumModels,
+                                   std::vector<llvm::APInt> *Models,
+                                   unsigned Timeout = 0) = 0;
+};
+
 class SMTLIBSolver {
 public:
   virtual ~SMTLIBSolver();
+  // Returns null if the solver can't be run interactively
+  virtual std::unique_ptr<SMTLIBSolverSession> startSession();
   virtual std::string getName() const = 0;
   virtual std::error_code isSatisfiable(llvm::StringRef Query, bool &Result,
                                         unsigned NumModels,
@@ -42,7 +62,9 @@ public:
 SolverProgram makeExternalSolverProgram(llvm::StringRef Path);
 SolverProgram makeInternalSolverProgram(int MainPtr(int argc, char **argv));
 
-std::unique_ptr<SMTLIBSolver> createZ3Solver(SolverProgram Prog, bool Keep);
+// With the path of the solver executable, sessions can be started as well
+std::unique_ptr<SMTLIBSolver> createZ3Solver(SolverProgram Prog, bool Keep,
+                                             llvm::StringRef SessionPath = "");
 
 }
 
@@ -50,7 +50,7 @@ llvm::Type *Codegen::GetInstReturnType(llvm::LLVMContext &Context, Inst *I) {
 }
 
 llvm::Value *Codegen::getValue(Inst *I) {
-  const std::vector<Inst *> &Ops = I->orderedOps();
+  llvm::ArrayRef<Inst *> Ops = I->orderedOps();
   if (I->K == Inst::UntypedConst) {
     // FIXME: We only get here because it is the second argument of
     // extractvalue instrs. This is not otherwise reachable.
@@ -64,7 +64,7 @@ bool ExprBuilder::getUBPaths(Inst *I, UBPath *Current,
       break;
   }
 
-  const std::vector<Inst *> &Ops = I->orderedOps();
+  llvm::ArrayRef<Inst *> Ops = I->orderedOps();
   if (I->K == Inst::Phi) {
     // Early terminate because this phi has been processed.
     // We will use its cached predicates.
@@ -130,7 +130,7 @@ void ExprBuilder::getBlockPCPhiPaths(
     std::vector<std::unique_ptr<BlockPCPhiPath>> &Paths,
     UBPathInstMap &CachedPhis) {
 
-  const std::vector<Inst *> &Ops = I->orderedOps();
+  llvm::ArrayRef<Inst *> Ops = I->orderedOps();
   if (I->K != Inst::Phi) {
     for (unsigned J = 0; J < Ops.size(); ++J)
       getBlockPCPhiPaths(Ops[J], Current, Paths, CachedPhis);
@@ -326,33 +326,34 @@ Inst *ExprBuilder::getDataflowConditions(Inst *I) {
   if (I->K != Inst::Var)
     return Result;
 
+  const VarFacts &F = *I->Facts;
   unsigned Width = I->Width;
   Inst *Zero = LIC->getConst(llvm::APInt(Width, 0));
   Inst *One = LIC->getConst(llvm::APInt(Width, 1));
 
-  if (I->KnownZeros.getBoolValue()) {
+  if (F.KnownZeros.getBoolValue()) {
     Inst *AllOnes = LIC->getConst(llvm::APInt::getAllOnes(Width));
     Inst *NotZeros = LIC->getInst(Inst::Xor, Width,
-                                  {LIC->getConst(I->KnownZeros), AllOnes});
+                                  {LIC->getConst(F.KnownZeros), AllOnes});
     Inst *VarNotZero = LIC->getInst(Inst::Or, Width, {I, NotZeros});
     Inst *ZeroBits = LIC->getInst(Inst::Eq, 1, {VarNotZero, NotZeros});
     Result = LIC->getInst(Inst::And, 1, {Result, ZeroBits});
   }
-  if (I->KnownOnes.getBoolValue()) {
-    Inst *Ones = LIC->getConst(I->KnownOnes);
+  if (F.KnownOnes.getBoolValue()) {
+    Inst *Ones = LIC->getConst(F.KnownOnes);
     Inst *VarAndOnes = LIC->getInst(Inst::And, Width, {I, Ones});
     Inst *OneBits = LIC->getInst(Inst::Eq, 1, {VarAndOnes, Ones});
     Result = LIC->getInst(Inst::And, 1, {Result, OneBits});
   }
-  if (I->NonZero) {
+  if (F.NonZero) {
     Inst *NonZeroBits = LIC->getInst(Inst::Ne, 1, {I, Zero});
     Result = LIC->getInst(Inst::And, 1, {Result, NonZeroBits});
   }
-  if (I->NonNegative) {
+  if (F.NonNegative) {
     Inst *NonNegBits = LIC->getInst(Inst::Sle, 1, {Zero, I});
     Result = LIC->getInst(Inst::And, 1, {Result, NonNegBits});
   }
-  if (I->PowOfTwo) {
+  if (F.PowOfTwo) {
     Inst *And = LIC->getInst(Inst::And, Width,
                              {I, LIC->getInst(Inst::Sub, Width, {I, One})});
     Inst *PowerTwoBits = LIC->getInst(Inst::And, 1,
@@ -360,12 +361,12 @@ Inst *ExprBuilder::getDataflowConditions(Inst *I) {
                                        LIC->getInst(Inst::Eq, 1, {And, Zero})});
     Result = LIC->getInst(Inst::And, 1, {Result, PowerTwoBits});
   }
-  if (I->Negative) {
+  if (F.Negative) {
     Inst *NegBits = LIC->getInst(Inst::Slt, 1, {I, Zero});
     Result = LIC->getInst(Inst::And, 1, {Result, NegBits});
   }
-  if (I->NumSignBits > 1) {
-    Inst *Diff = LIC->getConst(llvm::APInt(Width, Width - I->NumSignBits));
+  if (F.NumSignBits > 1) {
+    Inst *Diff = LIC->getConst(llvm::APInt(Width, Width - F.NumSignBits));
     Inst *Res = LIC->getInst(Inst::AShr, Width, {I, Diff});
     Diff = LIC->getConst(llvm::APInt(Width, Width-1));
     Inst *TestOnes = LIC->getInst(Inst::AShr, Width,
@@ -397,12 +398,12 @@ Inst *ExprBuilder::getDataflowConditions(Inst *I) {
     }
   };
 
-  if (auto Cond = mkCRCond(I->Range)) {
+  if (auto Cond = mkCRCond(F.Range)) {
     Result = LIC->getInst(Inst::And, 1, {Result, Cond});
   }
 
   std::vector<Inst *> CRConds;
-  for (auto R : I->RangeRefinement) {
+  for (auto R : F.RangeRefinement) {
     if (auto Cond = mkCRCond(R)) {
       CRConds.push_back(Cond);
     }
@@ -526,7 +527,7 @@ Inst *ExprBuilder::getImpliesInst(Inst *Ante, Inst *I) {
 }
 
 Inst *ExprBuilder::addnswUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -539,7 +540,7 @@ Inst *ExprBuilder::addnswUB(Inst *I) {
 }
 
 Inst *ExprBuilder::addnuwUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -552,7 +553,7 @@ Inst *ExprBuilder::addnuwUB(Inst *I) {
 }
 
 Inst *ExprBuilder::subnswUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -565,7 +566,7 @@ Inst *ExprBuilder::subnswUB(Inst *I) {
 }
 
 Inst *ExprBuilder::subnuwUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -578,7 +579,7 @@ Inst *ExprBuilder::subnuwUB(Inst *I) {
 }
 
 Inst *ExprBuilder::mulnswUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    // The computation below has to be performed on the operands of
    // multiplication instruction. The instruction using mulnswUB()
    // can be of different width, for instance in SMulO instruction
@@ -595,7 +596,7 @@ Inst *ExprBuilder::mulnswUB(Inst *I) {
 }
 
 Inst *ExprBuilder::mulnuwUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -608,14 +609,14 @@ Inst *ExprBuilder::mulnuwUB(Inst *I) {
 }
 
 Inst *ExprBuilder::udivUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto R = Ops[1];
    return LIC->getInst(Inst::Ne, 1,
                        {R, LIC->getConst(llvm::APInt(R->Width, 0))});
 }
 
 Inst *ExprBuilder::udivExactUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -625,7 +626,7 @@ Inst *ExprBuilder::udivExactUB(Inst *I) {
 }
 
 Inst *ExprBuilder::sdivUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -642,7 +643,7 @@ Inst *ExprBuilder::sdivUB(Inst *I) {
 }
 
 Inst *ExprBuilder::sdivExactUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -652,7 +653,7 @@ Inst *ExprBuilder::sdivExactUB(Inst *I) {
 }
 
 Inst *ExprBuilder::shiftUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -661,7 +662,7 @@ Inst *ExprBuilder::shiftUB(Inst *I) {
 }
 
 Inst *ExprBuilder::shlnswUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -671,7 +672,7 @@ Inst *ExprBuilder::shlnswUB(Inst *I) {
 }
 
 Inst *ExprBuilder::shlnuwUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -681,7 +682,7 @@ Inst *ExprBuilder::shlnuwUB(Inst *I) {
 }
 
 Inst *ExprBuilder::lshrExactUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -691,7 +692,7 @@ Inst *ExprBuilder::lshrExactUB(Inst *I) {
 }
 
 Inst *ExprBuilder::ashrExactUB(Inst *I) {
-   const std::vector<Inst *> &Ops = I->orderedOps();
+   llvm::ArrayRef<Inst *> Ops = I->orderedOps();
    auto L = Ops[0];
    auto R = Ops[1];
    unsigned Width = L->Width;
@@ -123,7 +123,7 @@ private:
   }
 
   ref<Expr> build(Inst *I) {
-    const std::vector<Inst *> &Ops = I->orderedOps();
+    llvm::ArrayRef<Inst *> Ops = I->orderedOps();
     switch (I->K) {
     case Inst::UntypedConst:
       assert(0 && "unexpected kind");
@@ -455,7 +455,7 @@ private:
     // since we will be appending new entries at the end.
     for (size_t InstNum = 0; InstNum < AllInst.size(); InstNum++) {
       Inst *CurrInst = AllInst[InstNum];
-      const std::vector<Inst *> &Ops = CurrInst->orderedOps();
+      llvm::ArrayRef<Inst *> Ops = CurrInst->orderedOps();
       AllInst.insert(AllInst.end(), Ops.rbegin(), Ops.rend());
     }
 
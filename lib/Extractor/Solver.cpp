@@ -19,6 +19,7 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/KnownBits.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "souper/Codegen/Codegen.h"
 #include "souper/Extractor/Solver.h"
 #include "souper/Infer/AliveDriver.h"
@@ -27,6 +28,7 @@
 #include "souper/Infer/InstSynthesis.h"
 #include "souper/Infer/Preconditions.h"
 #include "souper/Infer/Pruning.h"
+#include "souper/Infer/RewriteDatabase.h"
 #include "souper/KVStore/KVStore.h"
 #include "souper/Parser/Parser.h"
 
@@ -40,6 +42,8 @@ STATISTIC(MemHitsIsValid, "Number of internal cache hits for isValid()");
 STATISTIC(MemMissesIsValid, "Number of internal cache misses for isValid()");
 STATISTIC(ExternalHits, "Number of external cache hits");
 STATISTIC(ExternalMisses, "Number of external cache misses");
+STATISTIC(RewriteDBHits, "Number of infer() results taken from the rewrite database");
+STATISTIC(RewriteDBRules, "Number of rules learned by the rewrite database");
 
 using namespace souper;
 using namespace llvm;
@@ -58,41 +62,38 @@ static cl::opt<int> MaxLHSSize("souper-max-lhs-size",
 static cl::opt<int> MaxConstantSynthesisTries("souper-max-constant-synthesis-tries",
     cl::desc("Max number of constant synthesis tries. (default=30)"),
     cl::init(30));
+static cl::opt<bool> UseRewriteDB("souper-use-rewrite-db",
+    cl::desc("Try rewrites generalized from earlier infer() results before "
+             "synthesizing (default=false)"),
+    cl::init(false));
+static cl::opt<std::string> RewriteDBFile("souper-rewrite-db-file",
+    cl::desc("Seed the rewrite database with the replacements in this file"),
+    cl::init(""));
 
 
 class BaseSolver : public Solver {
   std::unique_ptr<SMTLIBSolver> SMTSolver;
   unsigned Timeout;
+  RewriteDatabase RewriteDB;
+  bool RewriteDBSeeded = false;
 
 public:
   BaseSolver(std::unique_ptr<SMTLIBSolver> SMTSolver, unsigned Timeout)
-      : SMTSolver(std::move(SMTSolver)), Timeout(Timeout) {}
-
-  void findVarsAndWidth(Inst *Node, std::map<std::string, unsigned> &VarsVect,
-                        std::set<Inst *> &Visited) {
-    if (!Visited.insert(Node).second)
-      return;
-    if (Node->K == Inst::Var) {
-      std::string Name = Node->Name;
-      VarsVect.insert(std::pair<std::string, unsigned>(Name, Node->Width));
-    }
-    for (auto const &Op : Node->Ops) {
-      findVarsAndWidth(Op, VarsVect, Visited);
-    }
-  }
-
-  void findMoreVarsViaPC(Inst *Node,
-                         std::map<std::string, unsigned> &VarsVect,
-                         std::set<Inst *> &Visited) {
-    if (!Visited.insert(Node).second)
-      return;
-    if (Node->K == Inst::Var) {
-      std::string Name = Node->Name;
-      VarsVect.insert(std::pair<std::string, unsigned>(Name, Node->Width));
-    }
-    for (auto const &Op : Node->Ops) {
-      findMoreVarsViaPC(Op, VarsVect, Visited);
-    }
+      : SMTSolver(std::move(SMTSolver)), Timeout(Timeout),
+        RewriteDB([this](InstContext &IC, InstMapping Rule) {
+          bool IsValid = false;
+          if (isValid(IC, BlockPCs(), std::vector<InstMapping>(), Rule,
+                      IsValid, nullptr))
+            return false;
+          return IsValid;
+        }) {}
+
+  void findVarsAndWidth(Inst *Root,
+                        std::map<std::string, unsigned> &VarsVect) {
+    forEachInst(Root, [&](Inst *I) {
+      if (I->K == Inst::Var)
+        VarsVect.insert(std::pair<std::string, unsigned>(I->Name, I->Width));
+    });
   }
 
   llvm::APInt getClearedBit(unsigned Pos, unsigned W) {
@@ -177,14 +178,11 @@ public:
     std::map<Block *, Block *> BlockCache;
 
     std::map<std::string, unsigned> VarsVect;
-    std::set<Inst *> Visited;
-    findVarsAndWidth(LHS, VarsVect, Visited);
+    findVarsAndWidth(LHS, VarsVect);
 
     for (auto const &PC : PCs) {
-      Visited.clear();
-      findMoreVarsViaPC(PC.LHS, VarsVect, Visited);
-      Visited.clear();
-      findMoreVarsViaPC(PC.RHS, VarsVect, Visited);
+      findVarsAndWidth(PC.LHS, VarsVect);
+      findVarsAndWidth(PC.RHS, VarsVect);
     }
 
     for (std::map<std::string,unsigned>::iterator it = VarsVect.begin();
@@ -462,11 +460,69 @@ public:
     return EC;
   }
 
+  void seedRewriteDB() {
+    RewriteDBSeeded = true;
+    if (RewriteDBFile.empty())
+      return;
+    auto MB = MemoryBuffer::getFileOrSTDIN(RewriteDBFile);
+    if (!MB)
+      llvm::report_fatal_error(("cannot read rewrite database " +
+                                RewriteDBFile).c_str());
+    InstContext SeedIC;
+    std::string ErrStr;
+    auto Reps = ParseReplacements(SeedIC, RewriteDBFile,
+                                  (*MB)->getBuffer(), ErrStr);
+    if (!ErrStr.empty())
+      llvm::report_fatal_error(ErrStr.c_str());
+    for (auto &R : Reps)
+      if (RewriteDB.learn(R.Mapping))
+        ++RewriteDBRules;
+  }
+
+  // Instantiates learned rules for LHS, and returns the first one that is
+  // cheaper and valid under the actual path conditions
+  Inst *findRewrite(const BlockPCs &BPCs, const std::vector<InstMapping> &PCs,
+                    Inst *LHS, InstContext &IC) {
+    if (!RewriteDBSeeded)
+      seedRewriteDB();
+    std::vector<Inst *> Cands;
+    RewriteDB.lookup(LHS, IC, Cands);
+    int LHSCost = souper::cost(LHS, /*IgnoreDepsWithExternalUses=*/true);
+    for (auto RHS : Cands) {
+      if (RHS == LHS || souper::cost(RHS) >= LHSCost)
+        continue;
+      bool IsValid;
+      if (isValid(IC, BPCs, PCs, InstMapping(LHS, RHS), IsValid, nullptr))
+        continue;
+      if (IsValid)
+        return RHS;
+    }
+    return nullptr;
+  }
+
   std::error_code infer(const BlockPCs &BPCs,
                         const std::vector<InstMapping> &PCs,
                         Inst *LHS, std::vector<Inst *> &RHSs,
                         bool AllowMultipleRHSs, InstContext &IC) override {
+    // Guesses, sketches and query helpers are only needed until the RHSs
+    // are found, so that memory use stays flat over many LHSs
+    InstContextScope Scope(IC, RHSs);
+    bool TryRewriteDB = UseRewriteDB && !AllowMultipleRHSs &&
+                        LHS->HarvestKind != HarvestType::HarvestedFromUse;
+    if (TryRewriteDB) {
+      if (Inst *RHS = findRewrite(BPCs, PCs, LHS, IC)) {
+        ++RewriteDBHits;
+        if (DebugLevel > 2)
+          llvm::errs() << "rewrite db hit\n";
+        RHSs.emplace_back(RHS);
+        return std::error_code();
+      }
+    }
+
     auto EC = inferHelper(BPCs, PCs, LHS, RHSs, AllowMultipleRHSs, IC);
+    if (TryRewriteDB && !EC && !RHSs.empty() &&
+        RewriteDB.learn(InstMapping(LHS, RHSs.front())))
+      ++RewriteDBRules;
     if (RHSs.size() <= 1)
       return EC;
 
@@ -659,6 +715,7 @@ class MemCachingSolver : public Solver {
   std::unordered_map<std::string, std::pair<std::error_code, bool>> IsValidCache;
   std::unordered_map<std::string, std::pair<std::error_code, std::string>>
     InferCache;
+  ReplacementPrinter Printer;
 
 public:
   MemCachingSolver(std::unique_ptr<Solver> UnderlyingSolver)
@@ -668,8 +725,7 @@ public:
                         const std::vector<InstMapping> &PCs,
                         Inst *LHS, std::vector<Inst *> &RHSs,
                         bool AllowMultipleRHSs, InstContext &IC) override {
-    ReplacementContext Context;
-    std::string Repl = GetReplacementLHSString(BPCs, PCs, LHS, Context);
+    std::string Repl = Printer.printLHS(BPCs, PCs, LHS).str();
     const auto &ent = InferCache.find(Repl);
     if (ent == InferCache.end()) {
       ++MemMissesInfer;
@@ -678,7 +734,7 @@ public:
       std::string RHSStr;
       if (!EC && !RHSs.empty()) {
         // TODO: support multi RHSs caching
-        RHSStr = GetReplacementRHSString(RHSs.front(), Context);
+        RHSStr = Printer.printRHS(RHSs.front()).str();
       }
       InferCache.emplace(Repl, std::make_pair(EC, RHSStr));
       return EC;
@@ -689,6 +745,8 @@ public:
       if (S == "") {
         RHSs.clear();
       } else {
+        ReplacementContext Context;
+        Printer.getContext(Context);
         ParsedReplacement R = ParseReplacementRHS(IC, "<cache>", S, Context, ES);
         if (ES != "")
           return std::make_error_code(std::errc::protocol_error);
@@ -722,7 +780,7 @@ public:
     if (Model)
       return UnderlyingSolver->isValid(IC, BPCs, PCs, Mapping, IsValid, Model);
 
-    std::string Repl = GetReplacementString(BPCs, PCs, Mapping);
+    std::string Repl = Printer.printReplacement(BPCs, PCs, Mapping).str();
     const auto &ent = IsValidCache.find(Repl);
     if (ent == IsValidCache.end()) {
       ++MemMissesIsValid;
@@ -803,6 +861,7 @@ public:
 class ExternalCachingSolver : public Solver {
   std::unique_ptr<Solver> UnderlyingSolver;
   KVStore *KV;
+  ReplacementPrinter Printer;
 
 public:
   ExternalCachingSolver(std::unique_ptr<Solver> UnderlyingSolver, KVStore *KV)
@@ -824,8 +883,7 @@ public:
                         Inst *LHS, std::vector<Inst *> &RHSs,
                         bool AllowMultipleRHSs,
                         InstContext &IC) override {
-    ReplacementContext Context;
-    std::string LHSStr = GetReplacementLHSString(BPCs, PCs, LHS, Context);
+    std::string LHSStr = Printer.printLHS(BPCs, PCs, LHS).str();
     if (LHSStr.length() > MaxLHSSize)
       return std::make_error_code(std::errc::value_too_large);
     std::string S;
@@ -837,6 +895,8 @@ public:
         RHSs.clear();
       } else {
         std::string ES;
+        ReplacementContext Context;
+        Printer.getContext(Context);
         ParsedReplacement R = ParseReplacementRHS(IC, "<cache>", S, Context, ES);
         if (ES != "")
           return std::make_error_code(std::errc::protocol_error);
@@ -857,7 +917,7 @@ public:
       std::string RHSStr;
       if (!EC && !RHSs.empty()) {
         // TODO: support multi RHSs caching
-        RHSStr = GetReplacementRHSString(RHSs.front(), Context);
+        RHSStr = Printer.printRHS(RHSs.front()).str();
       }
       KV->hSet(LHSStr, "rhs", RHSStr);
       return EC;
@@ -15,6 +15,8 @@
 #include "souper/Extractor/Solver.h"
 #include "souper/Infer/Interpreter.h"
 #include "souper/Infer/AbstractInterpreter.h"
+#include "souper/Infer/SmallKnownBits.h"
+#include "souper/Infer/TransferTables.h"
 #include "souper/Extractor/Candidates.h"
 #include "souper/Util/LLVMUtils.h"
 
@@ -51,6 +53,46 @@ namespace {
     return Max;
   }
 
+  // The table that has the constant range of an instruction of kind K
+  std::optional<souper::TransferTables::Op> getCRTableOp(souper::Inst::Kind K) {
+    using namespace souper;
+    switch (K) {
+    case Inst::Add:
+    case Inst::AddNUW:
+    case Inst::AddNW:
+      return TransferTables::Add;
+    case Inst::AddNSW:
+      return TransferTables::AddNSW;
+    case Inst::Sub:
+    case Inst::SubNSW:
+    case Inst::SubNUW:
+    case Inst::SubNW:
+      return TransferTables::Sub;
+    case Inst::Mul:
+    case Inst::MulNSW:
+    case Inst::MulNUW:
+    case Inst::MulNW:
+      return TransferTables::Mul;
+    case Inst::UDiv:
+      return TransferTables::UDiv;
+    case Inst::And:
+      return TransferTables::And;
+    case Inst::Or:
+      return TransferTables::Or;
+    case Inst::Shl:
+    case Inst::ShlNSW:
+    case Inst::ShlNUW:
+    case Inst::ShlNW:
+      return TransferTables::Shl;
+    case Inst::LShr:
+      return TransferTables::LShr;
+    case Inst::AShr:
+      return TransferTables::AShr;
+    default:
+      return std::nullopt;
+    }
+  }
+
 } // anonymous
 
 namespace souper {
@@ -92,26 +134,51 @@ namespace souper {
 
   namespace BinaryTransferFunctionsKB {
     llvm::KnownBits add(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Add, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::add(
+          SmallKnownBits(LHS), SmallKnownBits(RHS), /*NSW=*/false).toKnownBits();
       return llvm::KnownBits::computeForAddSub(/*Add=*/true, /*NSW=*/false,
                                                LHS, RHS);
     }
 
     llvm::KnownBits addnsw(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::AddNSW, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::add(
+          SmallKnownBits(LHS), SmallKnownBits(RHS), /*NSW=*/true).toKnownBits();
       return llvm::KnownBits::computeForAddSub(/*Add=*/true, /*NSW=*/true,
                                                LHS, RHS);
     }
 
     llvm::KnownBits sub(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Sub, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::sub(
+          SmallKnownBits(LHS), SmallKnownBits(RHS), /*NSW=*/false).toKnownBits();
       return llvm::KnownBits::computeForAddSub(/*Add=*/false, /*NSW=*/false,
                                                LHS, RHS);
     }
 
     llvm::KnownBits subnsw(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::SubNSW, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::sub(
+          SmallKnownBits(LHS), SmallKnownBits(RHS), /*NSW=*/true).toKnownBits();
       return llvm::KnownBits::computeForAddSub(/*Add=*/false, /*NSW=*/true,
                                                LHS, RHS);
     }
 
     llvm::KnownBits mul(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Mul, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::mul(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(LHS.getBitWidth());
 
       // TODO: Below only takes into account leading and trailing zeros. Maybe
@@ -136,6 +203,11 @@ namespace souper {
     }
 
     llvm::KnownBits udiv(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::UDiv, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::udiv(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(LHS.getBitWidth());
       const auto width = Result.getBitWidth();
 
@@ -148,6 +220,11 @@ namespace souper {
     }
 
     llvm::KnownBits urem(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::URem, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::urem(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(LHS.getBitWidth());
       const auto width = Result.getBitWidth();
 
@@ -170,6 +247,9 @@ namespace souper {
     }
 
     llvm::KnownBits and_(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::and_(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       auto result = LHS;
       result.One &= RHS.One;
       result.Zero |= RHS.Zero;
@@ -177,6 +257,9 @@ namespace souper {
     }
 
     llvm::KnownBits or_(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::or_(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       auto result = LHS;
       result.One |= RHS.One;
       result.Zero &= RHS.Zero;
@@ -184,6 +267,9 @@ namespace souper {
     }
 
     llvm::KnownBits xor_(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::xor_(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       auto result = LHS;
       llvm::APInt KnownZeroOut =
         (LHS.Zero & RHS.Zero) | (LHS.One & RHS.One);
@@ -194,6 +280,11 @@ namespace souper {
     }
 
     llvm::KnownBits shl(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Shl, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::shl(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(LHS.getBitWidth());
       const auto width = Result.getBitWidth();
 
@@ -218,6 +309,11 @@ namespace souper {
     }
 
     llvm::KnownBits lshr(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::LShr, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::lshr(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(LHS.getBitWidth());
       const auto width = Result.getBitWidth();
 
@@ -241,6 +337,11 @@ namespace souper {
     }
 
     llvm::KnownBits ashr(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::AShr, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::ashr(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(LHS.getBitWidth());
       const auto width = Result.getBitWidth();
 
@@ -256,6 +357,11 @@ namespace souper {
     }
 
     llvm::KnownBits eq(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Eq, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::eq(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(1);
       if (LHS.isConstant() && RHS.isConstant() && (LHS.getConstant() == RHS.getConstant())) {
         Result.One.setBit(0);
@@ -269,6 +375,11 @@ namespace souper {
     }
 
     llvm::KnownBits ne(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Ne, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::ne(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(1);
 
       if (LHS.isConstant() && RHS.isConstant() && (LHS.getConstant() == RHS.getConstant()))
@@ -279,6 +390,11 @@ namespace souper {
     }
 
     llvm::KnownBits ult(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Ult, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::ult(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(1);
       if (getUMax(LHS).ult(getUMin(RHS)))
         Result.One.setBit(0);
@@ -288,6 +404,11 @@ namespace souper {
     }
 
     llvm::KnownBits slt(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Slt, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::slt(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(1);
       if (getSMax(LHS).slt(getSMin(RHS)))
         Result.One.setBit(0);
@@ -297,6 +418,11 @@ namespace souper {
     }
 
     llvm::KnownBits ule(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Ule, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::ule(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(1);
       if (getUMax(LHS).ule(getUMin(RHS)))
         Result.One.setBit(0);
@@ -306,6 +432,11 @@ namespace souper {
     }
 
     llvm::KnownBits sle(const llvm::KnownBits &LHS, const llvm::KnownBits &RHS) {
+      if (auto Best = TransferTables::lookupKB(TransferTables::Sle, LHS, RHS))
+        return *Best;
+      if (SmallKnownBits::fits(LHS))
+        return SmallTransferFunctionsKB::sle(
+          SmallKnownBits(LHS), SmallKnownBits(RHS)).toKnownBits();
       llvm::KnownBits Result(1);
       if (getSMax(LHS).sle(getSMin(RHS)))
         Result.One.setBit(0);
@@ -387,23 +518,6 @@ namespace souper {
   }
 
   bool isConcrete(Inst *I, bool ConsiderConsts, bool ConsiderHoles) {
-    std::vector<Inst *> Insts;
-    if (I->nReservedConsts == -1) {
-      Insts.clear();
-      findInsts(I, Insts, [](Inst *instr) {
-        return isReservedConst(instr);
-      });
-      I->nReservedConsts = Insts.size();
-    }
-
-    if (I->nHoles == -1) {
-      Insts.clear();
-      findInsts(I, Insts, [](Inst *instr) {
-        return isHole(instr);
-      });
-      I->nHoles = Insts.size();
-    }
-
     bool retval = true;
     if (ConsiderConsts)
       retval &= I->nReservedConsts == 0;
@@ -460,13 +574,13 @@ namespace souper {
   }
 
   bool KnownBitsAnalysis::cacheHasValue(Inst *I) {
-    if (KBCache.find(I) != KBCache.end())
+    if (KBCache.count(I))
       return true;
 
-    if (I->K == Inst::Var && (I->KnownZeros.getBoolValue() || I->KnownOnes.getBoolValue())) {
+    if (I->K == Inst::Var && (I->Facts->KnownZeros.getBoolValue() || I->Facts->KnownOnes.getBoolValue())) {
       llvm::KnownBits metadataKB;
-      metadataKB.Zero = I->KnownZeros;
-      metadataKB.One = I->KnownOnes;
+      metadataKB.Zero = I->Facts->KnownZeros;
+      metadataKB.One = I->Facts->KnownOnes;
 
       KBCache.emplace(I, std::move(metadataKB));
       return true;
@@ -750,11 +864,11 @@ namespace souper {
 #define CR2 findConstantRange(I->Ops[2], CI, UsePartialEval)
 
   bool ConstantRangeAnalysis::cacheHasValue(Inst *I) {
-    if (CRCache.find(I) != CRCache.end())
+    if (CRCache.count(I))
       return true;
 
-    if (I->K == Inst::Var && !I->Range.isFullSet()) {
-      CRCache.emplace(I, I->Range);
+    if (I->K == Inst::Var && !I->Facts->Range.isFullSet()) {
+      CRCache.emplace(I, I->Facts->Range);
       return true;
     }
 
@@ -777,6 +891,15 @@ namespace souper {
     }
     }
 
+    if (I->Width <= TransferTables::MaxCRWidth) {
+      if (auto Op = getCRTableOp(I->K)) {
+        if (auto Best = TransferTables::lookupCR(*Op, CR0, CR1)) {
+          CRCache.emplace(I, *Best);
+          return CRCache.at(I);
+        }
+      }
+    }
+
     switch (I->K) {
     case Inst::Freeze: {
       Result = CR0;
@@ -930,8 +1053,8 @@ namespace souper {
     llvm::APInt Result(I->Width, 0);
     llvm::APInt AllZeroes = Result;
     Result.setAllBits();
-    if (RBCache.find(I) != RBCache.end()) {
-      llvm::APInt CachedResult = RBCache[I];
+    if (auto Cached = RBCache.lookup(I)) {
+      llvm::APInt CachedResult = *Cached;
       if (I->K == Inst::Var) {
         RBCache[I] = Result; // set to all ones after 'first' use
       }
@@ -1061,8 +1184,8 @@ namespace souper {
 #define IVARS Uses.independentVars(I->Ops[0], I->Ops[1])
 
   InputVarInfo MustDemandedBitsAnalysis::findMustDemandedBitsImpl(souper::Inst *I) {
-    if (Cache.find(I) != Cache.end()) {
-      return Cache[I];
+    if (auto Cached = Cache.lookup(I)) {
+      return *Cached;
     }
     InputVarInfo Result;
     switch (I->K) {
@@ -1183,8 +1306,8 @@ s.push(); s.add(ForAll(z, y != (x < z))); print("slt", s.check()); s.pop()
 **END SCRIPT*/
 
   bool HoleAnalysis::findIfHole(souper::Inst *I) {
-    if (Cache.find(I) != Cache.end()) {
-      return Cache[I];
+    if (auto Cached = Cache.lookup(I)) {
+      return *Cached;
     }
 
     if (I->K == Inst::Hole || I->K == Inst::ReservedInst) {
@@ -1475,18 +1598,6 @@ s.push(); s.add(ForAll(z, y != (x < z))); print("slt", s.check()); s.pop()
     return false;
   }
 
-  void ForcedValueAnalysis::countSymbolicInsts(Inst *I) {
-    I->nReservedConsts = isReservedConst(I) ? 1 : 0;
-    I->nHoles = isHole(I) ? 1 : 0;
-    for (auto Op : I->Ops) {
-      if (Op->nReservedConsts == -1 || Op->nHoles == -1) {
-        countSymbolicInsts(Op);
-      }
-      I->nReservedConsts += Op->nReservedConsts;
-      I->nHoles += Op->nHoles;
-    }
-  }
-
   bool ForcedValueAnalysis::force(llvm::APInt Result, ConcreteInterpreter &CI) {
     Worklist ToDo{{RHS, {Result}}};
     while (!ToDo.empty()) {
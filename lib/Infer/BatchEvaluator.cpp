@@ -0,0 +1,625 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "souper/Infer/BatchEvaluator.h"
+
+#include "llvm/ADT/bit.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <algorithm>
+#include <cassert>
+#include <type_traits>
+#include <unordered_set>
+
+using namespace souper;
+
+// On x86-64 ELF targets the lane kernels are built once per vector extension
+// and the loader picks the widest one the host supports. Elsewhere they are
+// left to the auto-vectorizer for the baseline target.
+#if defined(__x86_64__) && defined(__ELF__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define SOUPER_LANE_KERNEL \
+  __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef SOUPER_LANE_KERNEL
+#define SOUPER_LANE_KERNEL
+#endif
+
+namespace {
+
+// Lanes are evaluated in blocks, so that all registers stay in cache
+constexpr size_t BlockSize = 256;
+
+bool isSupportedKind(Inst::Kind K) {
+  switch (K) {
+  case Inst::Const:
+  case Inst::Var:
+  case Inst::Add:
+  case Inst::AddNSW:
+  case Inst::AddNUW:
+  case Inst::AddNW:
+  case Inst::Sub:
+  case Inst::SubNSW:
+  case Inst::SubNUW:
+  case Inst::SubNW:
+  case Inst::Mul:
+  case Inst::MulNSW:
+  case Inst::MulNUW:
+  case Inst::MulNW:
+  case Inst::UDiv:
+  case Inst::SDiv:
+  case Inst::UDivExact:
+  case Inst::SDivExact:
+  case Inst::URem:
+  case Inst::SRem:
+  case Inst::And:
+  case Inst::Or:
+  case Inst::Xor:
+  case Inst::Shl:
+  case Inst::ShlNSW:
+  case Inst::ShlNUW:
+  case Inst::ShlNW:
+  case Inst::LShr:
+  case Inst::LShrExact:
+  case Inst::AShr:
+  case Inst::AShrExact:
+  case Inst::Select:
+  case Inst::ZExt:
+  case Inst::SExt:
+  case Inst::Trunc:
+  case Inst::Eq:
+  case Inst::Ne:
+  case Inst::Ult:
+  case Inst::Slt:
+  case Inst::Ule:
+  case Inst::Sle:
+  case Inst::CtPop:
+  case Inst::Ctlz:
+  case Inst::Cttz:
+  case Inst::FShl:
+  case Inst::FShr:
+  case Inst::SAddSat:
+  case Inst::UAddSat:
+  case Inst::SSubSat:
+  case Inst::USubSat:
+  case Inst::SAddO:
+  case Inst::UAddO:
+  case Inst::SSubO:
+  case Inst::USubO:
+  case Inst::SMulO:
+  case Inst::UMulO:
+    return true;
+  default:
+    return false;
+  }
+}
+
+template <typename T> struct Lane {
+  // Arithmetic is done in at least unsigned int, since narrower lanes would
+  // be promoted to (signed) int
+  using U = std::conditional_t<(sizeof(T) < sizeof(unsigned)), unsigned, T>;
+  using S = std::make_signed_t<U>;
+  static constexpr unsigned UBits = sizeof(U) * 8;
+
+  static T mask(unsigned W) {
+    return W >= UBits ? T(~U(0)) : T((U(1) << W) - 1);
+  }
+  // A W bit lane read as a signed number
+  static S sext(T V, unsigned W) {
+    return S(U(V) << (UBits - W)) >> (UBits - W);
+  }
+  static T all(bool B) { return B ? T(~U(0)) : T(0); }
+};
+
+template <typename T>
+LLVM_ATTRIBUTE_ALWAYS_INLINE void
+runInstruction(const BatchInstruction &I, T *Val, T *Poison, T *UB,
+               size_t N) {
+  using L = Lane<T>;
+  using U = typename L::U;
+  using S = typename L::S;
+
+  T *R = Val + I.Dest * BlockSize;
+  T *RP = Poison + I.Dest * BlockSize;
+  T *RU = UB + I.Dest * BlockSize;
+  const T *A = Val + I.Ops[0] * BlockSize;
+  const T *B = Val + I.Ops[1] * BlockSize;
+  const T *C = Val + I.Ops[2] * BlockSize;
+  const T *AP = Poison + I.Ops[0] * BlockSize;
+  const T *BP = Poison + I.Ops[1] * BlockSize;
+  const T *CP = Poison + I.Ops[2] * BlockSize;
+  const T *AU = UB + I.Ops[0] * BlockSize;
+  const T *BU = UB + I.Ops[1] * BlockSize;
+  const T *CU = UB + I.Ops[2] * BlockSize;
+
+  // Operand width, which is also the result width of arithmetic
+  const unsigned W = I.OpWidth;
+  const T M = L::mask(W);
+  const T Sign = T(U(1) << (W - 1));
+  const T RM = L::mask(I.Width);
+
+  // UB propagates unconditionally, poison only from the chosen input of a
+  // select and from all inputs of anything else
+  if (I.K == Inst::Select) {
+    for (size_t J = 0; J != N; ++J) {
+      bool Cond = A[J] != 0;
+      R[J] = Cond ? B[J] : C[J];
+      RP[J] = AP[J] | (Cond ? BP[J] : CP[J]);
+      RU[J] = AU[J] | BU[J] | CU[J];
+    }
+    return;
+  }
+  for (size_t J = 0; J != N; ++J) {
+    RP[J] = AP[J] | BP[J] | CP[J];
+    RU[J] = AU[J] | BU[J] | CU[J];
+  }
+
+  // A poisoned operand makes the result poison rather than UB, so UB raised
+  // by an instruction itself is masked with the operand poison, before any
+  // poison the instruction raises is added
+  switch (I.K) {
+  case Inst::Add:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = T((U(A[J]) + U(B[J])) & M);
+    break;
+  case Inst::AddNSW:
+  case Inst::AddNUW:
+  case Inst::AddNW:
+  case Inst::SAddSat:
+  case Inst::UAddSat:
+  case Inst::SAddO:
+  case Inst::UAddO:
+    for (size_t J = 0; J != N; ++J) {
+      T Sum = T((U(A[J]) + U(B[J])) & M);
+      bool SOv = ((A[J] ^ Sum) & (B[J] ^ Sum) & Sign) != 0;
+      bool UOv = Sum < A[J];
+      switch (I.K) {
+      case Inst::AddNSW:
+        R[J] = Sum;
+        RP[J] |= L::all(SOv);
+        break;
+      case Inst::AddNUW:
+        R[J] = Sum;
+        RP[J] |= L::all(UOv);
+        break;
+      case Inst::AddNW:
+        R[J] = Sum;
+        RP[J] |= L::all(SOv || UOv);
+        break;
+      case Inst::SAddSat:
+        R[J] = SOv ? ((A[J] & Sign) ? Sign : T(Sign - 1)) : Sum;
+        break;
+      case Inst::UAddSat:
+        R[J] = UOv ? M : Sum;
+        break;
+      case Inst::SAddO:
+        R[J] = SOv;
+        break;
+      default:
+        R[J] = UOv;
+        break;
+      }
+    }
+    break;
+  case Inst::Sub:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = T((U(A[J]) - U(B[J])) & M);
+    break;
+  case Inst::SubNSW:
+  case Inst::SubNUW:
+  case Inst::SubNW:
+  case Inst::SSubSat:
+  case Inst::USubSat:
+  case Inst::SSubO:
+  case Inst::USubO:
+    for (size_t J = 0; J != N; ++J) {
+      T Diff = T((U(A[J]) - U(B[J])) & M);
+      bool SOv = ((A[J] ^ B[J]) & (A[J] ^ Diff) & Sign) != 0;
+      bool UOv = A[J] < B[J];
+      switch (I.K) {
+      case Inst::SubNSW:
+        R[J] = Diff;
+        RP[J] |= L::all(SOv);
+        break;
+      case Inst::SubNUW:
+        R[J] = Diff;
+        RP[J] |= L::all(UOv);
+        break;
+      case Inst::SubNW:
+        R[J] = Diff;
+        RP[J] |= L::all(SOv || UOv);
+        break;
+      case Inst::SSubSat:
+        R[J] = SOv ? ((A[J] & Sign) ? Sign : T(Sign - 1)) : Diff;
+        break;
+      case Inst::USubSat:
+        R[J] = UOv ? T(0) : Diff;
+        break;
+      case Inst::SSubO:
+        R[J] = SOv;
+        break;
+      default:
+        R[J] = UOv;
+        break;
+      }
+    }
+    break;
+  case Inst::Mul:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = T((U(A[J]) * U(B[J])) & M);
+    break;
+  case Inst::MulNSW:
+  case Inst::MulNUW:
+  case Inst::MulNW:
+  case Inst::SMulO:
+  case Inst::UMulO:
+    for (size_t J = 0; J != N; ++J) {
+      T Prod = T((U(A[J]) * U(B[J])) & M);
+      // Overflow iff dividing the wrapped product doesn't give back the
+      // other factor; -1 * MIN is the one case that can't be divided back
+      U Den = A[J] ? U(A[J]) : U(1);
+      bool UOv = A[J] != 0 && U(Prod) / Den != U(B[J]);
+      S SA = L::sext(A[J], W);
+      S SDen = SA ? SA : S(1);
+      bool SOv = SA != 0 && ((SA == -1 && B[J] == Sign) ||
+                             L::sext(Prod, W) / SDen != L::sext(B[J], W));
+      switch (I.K) {
+      case Inst::MulNSW:
+        R[J] = Prod;
+        RP[J] |= L::all(SOv);
+        break;
+      case Inst::MulNUW:
+        R[J] = Prod;
+        RP[J] |= L::all(UOv);
+        break;
+      case Inst::MulNW:
+        R[J] = Prod;
+        RP[J] |= L::all(SOv || UOv);
+        break;
+      case Inst::SMulO:
+        R[J] = SOv;
+        break;
+      default:
+        R[J] = UOv;
+        break;
+      }
+    }
+    break;
+  case Inst::UDiv:
+  case Inst::UDivExact:
+  case Inst::URem:
+    for (size_t J = 0; J != N; ++J) {
+      bool Zero = B[J] == 0;
+      U Den = Zero ? U(1) : U(B[J]);
+      RU[J] |= L::all(Zero) & ~RP[J];
+      if (I.K == Inst::URem) {
+        R[J] = T(U(A[J]) % Den);
+      } else {
+        T Quot = T(U(A[J]) / Den);
+        R[J] = Quot;
+        if (I.K == Inst::UDivExact)
+          RP[J] |= L::all(T((U(Quot) * U(B[J])) & M) != A[J]);
+      }
+    }
+    break;
+  case Inst::SDiv:
+  case Inst::SDivExact:
+  case Inst::SRem:
+    for (size_t J = 0; J != N; ++J) {
+      bool Bad = B[J] == 0 || (A[J] == Sign && B[J] == M);
+      S Den = Bad ? S(1) : L::sext(B[J], W);
+      RU[J] |= L::all(Bad) & ~RP[J];
+      if (I.K == Inst::SRem) {
+        R[J] = T(U(L::sext(A[J], W) % Den) & M);
+      } else {
+        T Quot = T(U(L::sext(A[J], W) / Den) & M);
+        R[J] = Quot;
+        if (I.K == Inst::SDivExact)
+          RP[J] |= L::all(T((U(Quot) * U(B[J])) & M) != A[J]);
+      }
+    }
+    break;
+  case Inst::And:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J] & B[J];
+    break;
+  case Inst::Or:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J] | B[J];
+    break;
+  case Inst::Xor:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J] ^ B[J];
+    break;
+  case Inst::Shl:
+  case Inst::ShlNSW:
+  case Inst::ShlNUW:
+  case Inst::ShlNW:
+    for (size_t J = 0; J != N; ++J) {
+      bool Big = B[J] >= W;
+      unsigned Amt = Big ? 0 : unsigned(B[J]);
+      T Res = T((U(A[J]) << Amt) & M);
+      bool UOv = (U(Res) >> Amt) != U(A[J]);
+      bool SOv = (L::sext(Res, W) >> Amt) != L::sext(A[J], W);
+      R[J] = Res;
+      switch (I.K) {
+      case Inst::ShlNSW:
+        RP[J] |= L::all(Big || SOv);
+        break;
+      case Inst::ShlNUW:
+        RP[J] |= L::all(Big || UOv);
+        break;
+      case Inst::ShlNW:
+        RP[J] |= L::all(Big || SOv || UOv);
+        break;
+      default:
+        RP[J] |= L::all(Big);
+        break;
+      }
+    }
+    break;
+  case Inst::LShr:
+  case Inst::LShrExact:
+  case Inst::AShr:
+  case Inst::AShrExact:
+    for (size_t J = 0; J != N; ++J) {
+      bool Big = B[J] >= W;
+      unsigned Amt = Big ? 0 : unsigned(B[J]);
+      bool Arith = I.K == Inst::AShr || I.K == Inst::AShrExact;
+      T Res = Arith ? T(U(L::sext(A[J], W) >> Amt) & M) : T(U(A[J]) >> Amt);
+      bool Inexact = T((U(Res) << Amt) & M) != A[J];
+      R[J] = Res;
+      if (I.K == Inst::LShrExact || I.K == Inst::AShrExact)
+        RP[J] |= L::all(Big || Inexact);
+      else
+        RP[J] |= L::all(Big);
+    }
+    break;
+  case Inst::ZExt:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J];
+    break;
+  case Inst::SExt:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = T(U(L::sext(A[J], W)) & RM);
+    break;
+  case Inst::Trunc:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J] & RM;
+    break;
+  case Inst::Eq:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J] == B[J];
+    break;
+  case Inst::Ne:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J] != B[J];
+    break;
+  case Inst::Ult:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J] < B[J];
+    break;
+  case Inst::Ule:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = A[J] <= B[J];
+    break;
+  case Inst::Slt:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = L::sext(A[J], W) < L::sext(B[J], W);
+    break;
+  case Inst::Sle:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = L::sext(A[J], W) <= L::sext(B[J], W);
+    break;
+  case Inst::CtPop:
+    for (size_t J = 0; J != N; ++J)
+      R[J] = T(U(llvm::popcount(uint64_t(A[J]))) & RM);
+    break;
+  case Inst::Ctlz:
+    for (size_t J = 0; J != N; ++J) {
+      unsigned Count = A[J] ? llvm::countl_zero(uint64_t(A[J])) - (64 - W) : W;
+      R[J] = T(U(Count) & RM);
+    }
+    break;
+  case Inst::Cttz:
+    for (size_t J = 0; J != N; ++J) {
+      unsigned Count = A[J] ? llvm::countr_zero(uint64_t(A[J])) : W;
+      R[J] = T(U(Count) & RM);
+    }
+    break;
+  case Inst::FShl:
+    for (size_t J = 0; J != N; ++J) {
+      unsigned Amt = unsigned(C[J] % W);
+      R[J] = Amt == 0 ? A[J] :
+        T(((U(A[J]) << Amt) | (U(B[J]) >> (W - Amt))) & M);
+    }
+    break;
+  case Inst::FShr:
+    for (size_t J = 0; J != N; ++J) {
+      unsigned Amt = unsigned(C[J] % W);
+      R[J] = Amt == 0 ? B[J] :
+        T(((U(B[J]) >> Amt) | (U(A[J]) << (W - Amt))) & M);
+    }
+    break;
+  default:
+    llvm_unreachable("kind not supported by the batch evaluator");
+  }
+}
+
+template <typename T>
+LLVM_ATTRIBUTE_ALWAYS_INLINE void
+runCode(const BatchInstruction *Code, size_t NumCode, T *Val, T *Poison,
+        T *UB, size_t N) {
+  for (size_t I = 0; I != NumCode; ++I)
+    runInstruction(Code[I], Val, Poison, UB, N);
+}
+
+SOUPER_LANE_KERNEL void runBlock(const BatchInstruction *Code, size_t NumCode,
+                                 uint8_t *Val, uint8_t *Poison, uint8_t *UB,
+                                 size_t N) {
+  runCode(Code, NumCode, Val, Poison, UB, N);
+}
+
+SOUPER_LANE_KERNEL void runBlock(const BatchInstruction *Code, size_t NumCode,
+                                 uint16_t *Val, uint16_t *Poison, uint16_t *UB,
+                                 size_t N) {
+  runCode(Code, NumCode, Val, Poison, UB, N);
+}
+
+SOUPER_LANE_KERNEL void runBlock(const BatchInstruction *Code, size_t NumCode,
+                                 uint32_t *Val, uint32_t *Poison, uint32_t *UB,
+                                 size_t N) {
+  runCode(Code, NumCode, Val, Poison, UB, N);
+}
+
+SOUPER_LANE_KERNEL void runBlock(const BatchInstruction *Code, size_t NumCode,
+                                 uint64_t *Val, uint64_t *Poison, uint64_t *UB,
+                                 size_t N) {
+  runCode(Code, NumCode, Val, Poison, UB, N);
+}
+
+template <typename T>
+void runLanes(const std::vector<BatchInstruction> &Code,
+              const std::vector<std::pair<unsigned, uint64_t>> &Consts,
+              const std::vector<std::pair<unsigned, Inst *>> &Loads,
+              const std::vector<const uint64_t *> &Columns,
+              unsigned NumRegs, unsigned RootReg, size_t NumLanes,
+              BatchResult &Result) {
+  // Only instructions write to their registers, so constants are filled in
+  // once and the masks of leaves stay clear
+  std::vector<T> Val(NumRegs * BlockSize), Poison(NumRegs * BlockSize),
+    UB(NumRegs * BlockSize);
+  for (auto &C : Consts)
+    std::fill_n(&Val[C.first * BlockSize], BlockSize, T(C.second));
+
+  Result.Vals.resize(NumLanes);
+  Result.Poison.resize(NumLanes);
+  Result.UB.resize(NumLanes);
+  for (size_t First = 0; First < NumLanes; First += BlockSize) {
+    size_t N = std::min(BlockSize, NumLanes - First);
+    for (size_t I = 0; I != Loads.size(); ++I) {
+      const uint64_t *Col = Columns[I] + First;
+      T Mask = Lane<T>::mask(Loads[I].second->Width);
+      T *Dst = &Val[Loads[I].first * BlockSize];
+      for (size_t J = 0; J != N; ++J)
+        Dst[J] = T(Col[J]) & Mask;
+    }
+
+    runBlock(Code.data(), Code.size(), Val.data(), Poison.data(), UB.data(),
+             N);
+
+    size_t Root = RootReg * BlockSize;
+    for (size_t J = 0; J != N; ++J) {
+      Result.Vals[First + J] = Val[Root + J];
+      Result.Poison[First + J] = Poison[Root + J] != 0;
+      Result.UB[First + J] = UB[Root + J] != 0;
+    }
+  }
+}
+
+}
+
+bool BatchProgram::isSupported(Inst *Root) {
+  std::vector<Inst *> Stack{Root};
+  std::unordered_set<Inst *> Visited;
+  while (!Stack.empty()) {
+    Inst *I = Stack.back();
+    Stack.pop_back();
+    if (!Visited.insert(I).second)
+      continue;
+    if (I->Width == 0 || I->Width > 64 || !isSupportedKind(I->K) ||
+        (I->K == Inst::Var && I->SynthesisConstID != 0))
+      return false;
+    for (auto Op : I->Ops)
+      Stack.push_back(Op);
+  }
+  return true;
+}
+
+BatchProgram::BatchProgram(Inst *Root) {
+  std::unordered_map<Inst *, unsigned> RegOf;
+  unsigned MaxWidth = 1;
+
+  // Postorder, so every operand gets its register before its users
+  std::vector<std::pair<Inst *, unsigned>> Stack = {{Root, 0}};
+  while (!Stack.empty()) {
+    auto &Top = Stack.back();
+    Inst *I = Top.first;
+    if (Top.second == 0 && RegOf.count(I)) {
+      Stack.pop_back();
+      continue;
+    }
+    if (Top.second < I->Ops.size()) {
+      Inst *Op = I->Ops[Top.second++];
+      if (!RegOf.count(Op))
+        Stack.push_back({Op, 0});
+      continue;
+    }
+    Stack.pop_back();
+
+    unsigned Reg = NumRegs++;
+    RegOf[I] = Reg;
+    MaxWidth = std::max(MaxWidth, I->Width);
+    if (I->K == Inst::Const) {
+      Consts.push_back({Reg, I->Val.getZExtValue()});
+    } else if (I->Ops.empty()) {
+      Loads.push_back({Reg, I});
+    } else {
+      assert(I->Ops.size() <= 3);
+      BatchInstruction BI{I->K, I->Width, I->Ops[0]->Width, Reg, {}};
+      // Unused operand slots repeat the first operand, so that every
+      // instruction can merge the masks of three operands
+      for (unsigned J = 0; J != 3; ++J)
+        BI.Ops[J] = RegOf[I->Ops[J < I->Ops.size() ? J : 0]];
+      Code.push_back(BI);
+    }
+  }
+  RootReg = RegOf[Root];
+
+  while (LaneBytes * 8 < MaxWidth)
+    LaneBytes *= 2;
+}
+
+bool BatchProgram::evaluate(const BatchInputs &Inputs,
+                            BatchResult &Result) const {
+  std::vector<const uint64_t *> Columns;
+  for (auto &L : Loads) {
+    auto It = Inputs.Columns.find(L.second);
+    if (It == Inputs.Columns.end() || It->second.size() < Inputs.NumLanes)
+      return false;
+    Columns.push_back(It->second.data());
+  }
+
+  switch (LaneBytes) {
+  case 1:
+    runLanes<uint8_t>(Code, Consts, Loads, Columns, NumRegs, RootReg,
+                      Inputs.NumLanes, Result);
+    break;
+  case 2:
+    runLanes<uint16_t>(Code, Consts, Loads, Columns, NumRegs, RootReg,
+                       Inputs.NumLanes, Result);
+    break;
+  case 4:
+    runLanes<uint32_t>(Code, Consts, Loads, Columns, NumRegs, RootReg,
+                       Inputs.NumLanes, Result);
+    break;
+  default:
+    runLanes<uint64_t>(Code, Consts, Loads, Columns, NumRegs, RootReg,
+                       Inputs.NumLanes, Result);
+    break;
+  }
+  return true;
+}
@@ -0,0 +1,647 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "souper/Infer/BitSlice.h"
+
+#include "llvm/Support/ErrorHandling.h"
+
+#include <cassert>
+#include <unordered_set>
+
+using namespace souper;
+
+namespace {
+
+constexpr unsigned MaxWidth = BitSlicedProgram::MaxWidth;
+// Room for the double width products of the overflow checks
+constexpr unsigned MaxPlanes = 2 * MaxWidth;
+
+using Plane = BitPlane;
+
+Plane splat(bool B) {
+  Plane P;
+  for (auto &W : P.Words)
+    W = B ? ~uint64_t(0) : 0;
+  return P;
+}
+
+Plane operator&(const Plane &A, const Plane &B) {
+  Plane R;
+  for (unsigned I = 0; I < BitSliceWords; ++I)
+    R.Words[I] = A.Words[I] & B.Words[I];
+  return R;
+}
+
+Plane operator|(const Plane &A, const Plane &B) {
+  Plane R;
+  for (unsigned I = 0; I < BitSliceWords; ++I)
+    R.Words[I] = A.Words[I] | B.Words[I];
+  return R;
+}
+
+Plane operator^(const Plane &A, const Plane &B) {
+  Plane R;
+  for (unsigned I = 0; I < BitSliceWords; ++I)
+    R.Words[I] = A.Words[I] ^ B.Words[I];
+  return R;
+}
+
+Plane operator~(const Plane &A) {
+  Plane R;
+  for (unsigned I = 0; I < BitSliceWords; ++I)
+    R.Words[I] = ~A.Words[I];
+  return R;
+}
+
+Plane mux(const Plane &C, const Plane &T, const Plane &F) {
+  return (C & T) | (~C & F);
+}
+
+void constant(uint64_t V, unsigned W, Plane *Out) {
+  for (unsigned I = 0; I < W; ++I)
+    Out[I] = splat((V >> I) & 1);
+}
+
+// Sum = A + B + Carry on W planes, returning the carry out of the top
+// plane. TopCarry receives the carry into the top plane, for the signed
+// overflow checks.
+Plane add(const Plane *A, const Plane *B, Plane Carry, unsigned W, Plane *Sum,
+          Plane *TopCarry = nullptr) {
+  for (unsigned I = 0; I < W; ++I) {
+    if (TopCarry && I == W - 1)
+      *TopCarry = Carry;
+    Plane X = A[I] ^ B[I];
+    Plane NewCarry = (A[I] & B[I]) | (X & Carry);
+    Sum[I] = X ^ Carry;
+    Carry = NewCarry;
+  }
+  return Carry;
+}
+
+// Diff = A - B on W planes, returning the lanes that did not borrow
+Plane sub(const Plane *A, const Plane *B, unsigned W, Plane *Diff,
+          Plane *TopCarry = nullptr) {
+  Plane NotB[MaxPlanes + 1];
+  for (unsigned I = 0; I < W; ++I)
+    NotB[I] = ~B[I];
+  return add(A, NotB, splat(true), W, Diff, TopCarry);
+}
+
+void neg(const Plane *A, unsigned W, Plane *Out) {
+  Plane Zero[MaxPlanes];
+  constant(0, W, Zero);
+  sub(Zero, A, W, Out);
+}
+
+Plane isZero(const Plane *A, unsigned W) {
+  Plane R = splat(true);
+  for (unsigned I = 0; I < W; ++I)
+    R = R & ~A[I];
+  return R;
+}
+
+Plane eq(const Plane *A, const Plane *B, unsigned W) {
+  Plane R = splat(true);
+  for (unsigned I = 0; I < W; ++I)
+    R = R & ~(A[I] ^ B[I]);
+  return R;
+}
+
+Plane ult(const Plane *A, const Plane *B, unsigned W) {
+  Plane Diff[MaxPlanes];
+  return ~sub(A, B, W, Diff);
+}
+
+Plane slt(const Plane *A, const Plane *B, unsigned W) {
+  // Flipping the sign bits maps signed order onto unsigned order
+  Plane FA[MaxPlanes], FB[MaxPlanes];
+  for (unsigned I = 0; I < W; ++I) {
+    FA[I] = A[I];
+    FB[I] = B[I];
+  }
+  FA[W - 1] = ~FA[W - 1];
+  FB[W - 1] = ~FB[W - 1];
+  return ult(FA, FB, W);
+}
+
+// Out = A * B mod 2^W
+void mul(const Plane *A, const Plane *B, unsigned W, Plane *Out) {
+  constant(0, W, Out);
+  Plane Partial[MaxPlanes];
+  for (unsigned I = 0; I < W; ++I) {
+    for (unsigned J = 0; J < W; ++J)
+      Partial[J] = J >= I ? (A[J - I] & B[I]) : splat(false);
+    add(Out, Partial, splat(false), W, Out);
+  }
+}
+
+// Restoring division. Lanes dividing by zero get garbage.
+void udivrem(const Plane *A, const Plane *B, unsigned W, Plane *Q,
+             Plane *R) {
+  // The partial remainder needs one plane more than the operands
+  Plane Rem[MaxPlanes + 1], Den[MaxPlanes + 1], Diff[MaxPlanes + 1];
+  constant(0, W + 1, Rem);
+  for (unsigned I = 0; I < W; ++I)
+    Den[I] = B[I];
+  Den[W] = splat(false);
+
+  for (unsigned I = W; I-- > 0;) {
+    for (unsigned J = W; J > 0; --J)
+      Rem[J] = Rem[J - 1];
+    Rem[0] = A[I];
+    Plane Fits = sub(Rem, Den, W + 1, Diff);
+    for (unsigned J = 0; J <= W; ++J)
+      Rem[J] = mux(Fits, Diff[J], Rem[J]);
+    Q[I] = Fits;
+  }
+  for (unsigned I = 0; I < W; ++I)
+    R[I] = Rem[I];
+}
+
+enum class ShiftKind { Left, LogicalRight, ArithRight };
+
+// Barrel shifter over the W planes of A, by the amount in the SW planes of
+// S. Amounts of W or more are left to the caller.
+void shift(const Plane *A, unsigned W, const Plane *S, unsigned SW,
+           ShiftKind K, Plane *Out) {
+  Plane Fill = K == ShiftKind::ArithRight ? A[W - 1] : splat(false);
+  Plane Cur[MaxPlanes], Shifted[MaxPlanes];
+  for (unsigned J = 0; J < W; ++J)
+    Cur[J] = A[J];
+  for (unsigned Bit = 0; Bit < SW && (1u << Bit) < W; ++Bit) {
+    unsigned Dist = 1u << Bit;
+    for (unsigned J = 0; J < W; ++J) {
+      if (K == ShiftKind::Left)
+        Shifted[J] = J >= Dist ? Cur[J - Dist] : splat(false);
+      else
+        Shifted[J] = J + Dist < W ? Cur[J + Dist] : Fill;
+    }
+    for (unsigned J = 0; J < W; ++J)
+      Cur[J] = mux(S[Bit], Shifted[J], Cur[J]);
+  }
+  for (unsigned J = 0; J < W; ++J)
+    Out[J] = Cur[J];
+}
+
+// Lanes shifting by the width or more
+Plane isOversizedShift(const Plane *S, unsigned W) {
+  Plane Limit[MaxPlanes];
+  constant(W, W, Limit);
+  return ~ult(S, Limit, W);
+}
+
+// Overflow of the W bit product of A and B, computed at double width
+Plane mulOverflow(const Plane *A, const Plane *B, unsigned W, bool Signed) {
+  Plane XA[MaxPlanes], XB[MaxPlanes], Prod[MaxPlanes];
+  for (unsigned J = 0; J < 2 * W; ++J) {
+    XA[J] = J < W ? A[J] : (Signed ? A[W - 1] : splat(false));
+    XB[J] = J < W ? B[J] : (Signed ? B[W - 1] : splat(false));
+  }
+  mul(XA, XB, 2 * W, Prod);
+  // The high half must extend the low half
+  Plane Ext = Signed ? Prod[W - 1] : splat(false);
+  Plane Ov = splat(false);
+  for (unsigned J = W; J < 2 * W; ++J)
+    Ov = Ov | (Prod[J] ^ Ext);
+  return Ov;
+}
+
+bool isSupportedKind(Inst::Kind K) {
+  switch (K) {
+  case Inst::Const:
+  case Inst::Var:
+  case Inst::Add:
+  case Inst::AddNSW:
+  case Inst::AddNUW:
+  case Inst::AddNW:
+  case Inst::Sub:
+  case Inst::SubNSW:
+  case Inst::SubNUW:
+  case Inst::SubNW:
+  case Inst::Mul:
+  case Inst::MulNSW:
+  case Inst::MulNUW:
+  case Inst::MulNW:
+  case Inst::UDiv:
+  case Inst::SDiv:
+  case Inst::UDivExact:
+  case Inst::SDivExact:
+  case Inst::URem:
+  case Inst::SRem:
+  case Inst::And:
+  case Inst::Or:
+  case Inst::Xor:
+  case Inst::Shl:
+  case Inst::ShlNSW:
+  case Inst::ShlNUW:
+  case Inst::ShlNW:
+  case Inst::LShr:
+  case Inst::LShrExact:
+  case Inst::AShr:
+  case Inst::AShrExact:
+  case Inst::Select:
+  case Inst::ZExt:
+  case Inst::SExt:
+  case Inst::Trunc:
+  case Inst::Eq:
+  case Inst::Ne:
+  case Inst::Ult:
+  case Inst::Slt:
+  case Inst::Ule:
+  case Inst::Sle:
+  case Inst::CtPop:
+  case Inst::Ctlz:
+  case Inst::Cttz:
+  case Inst::BitReverse:
+  case Inst::FShl:
+  case Inst::FShr:
+  case Inst::SAddSat:
+  case Inst::UAddSat:
+  case Inst::SSubSat:
+  case Inst::USubSat:
+  case Inst::SAddO:
+  case Inst::UAddO:
+  case Inst::SSubO:
+  case Inst::USubO:
+  case Inst::SMulO:
+  case Inst::UMulO:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void evaluateSliced(Inst *I, const BitSlicedValue *const *Args,
+                    BitSlicedValue &R) {
+  const unsigned NumOps = I->Ops.size();
+  const Plane *A = Args[0]->Bits;
+  const Plane *B = NumOps > 1 ? Args[1]->Bits : nullptr;
+  const Plane *C = NumOps > 2 ? Args[2]->Bits : nullptr;
+  // Operand width, which is also the result width of arithmetic
+  const unsigned W = I->Ops[0]->Width;
+  const unsigned RW = I->Width;
+  Plane *Out = R.Bits;
+  for (unsigned J = 0; J < MaxWidth; ++J)
+    Out[J] = splat(false);
+
+  // UB propagates unconditionally, poison only from the chosen input of a
+  // select and from all inputs of anything else
+  R.UB = splat(false);
+  for (unsigned J = 0; J < NumOps; ++J)
+    R.UB = R.UB | Args[J]->UB;
+  if (I->K == Inst::Select) {
+    for (unsigned J = 0; J < RW; ++J)
+      Out[J] = mux(A[0], B[J], C[J]);
+    R.Poison = Args[0]->Poison | mux(A[0], Args[1]->Poison, Args[2]->Poison);
+    return;
+  }
+  R.Poison = splat(false);
+  for (unsigned J = 0; J < NumOps; ++J)
+    R.Poison = R.Poison | Args[J]->Poison;
+
+  // A poisoned operand makes the result poison rather than UB, so UB raised
+  // by an instruction itself is masked with the operand poison
+  switch (I->K) {
+  case Inst::Add:
+  case Inst::AddNSW:
+  case Inst::AddNUW:
+  case Inst::AddNW:
+  case Inst::SAddSat:
+  case Inst::UAddSat:
+  case Inst::SAddO:
+  case Inst::UAddO:
+  case Inst::Sub:
+  case Inst::SubNSW:
+  case Inst::SubNUW:
+  case Inst::SubNW:
+  case Inst::SSubSat:
+  case Inst::USubSat:
+  case Inst::SSubO:
+  case Inst::USubO: {
+    bool IsAdd = I->K == Inst::Add || I->K == Inst::AddNSW ||
+                 I->K == Inst::AddNUW || I->K == Inst::AddNW ||
+                 I->K == Inst::SAddSat || I->K == Inst::UAddSat ||
+                 I->K == Inst::SAddO || I->K == Inst::UAddO;
+    Plane Res[MaxPlanes], Top;
+    Plane Carry = IsAdd ? add(A, B, splat(false), W, Res, &Top)
+                        : sub(A, B, W, Res, &Top);
+    Plane SOv = Carry ^ Top;
+    // Unsigned overflow is a carry for addition and a borrow for subtraction
+    Plane UOv = IsAdd ? Carry : ~Carry;
+    switch (I->K) {
+    case Inst::AddNSW:
+    case Inst::SubNSW:
+      R.Poison = R.Poison | SOv;
+      break;
+    case Inst::AddNUW:
+    case Inst::SubNUW:
+      R.Poison = R.Poison | UOv;
+      break;
+    case Inst::AddNW:
+    case Inst::SubNW:
+      R.Poison = R.Poison | SOv | UOv;
+      break;
+    default:
+      break;
+    }
+    switch (I->K) {
+    case Inst::SAddSat:
+    case Inst::SSubSat:
+      // Saturate towards the sign of the first operand
+      for (unsigned J = 0; J + 1 < W; ++J)
+        Out[J] = mux(SOv, ~A[W - 1], Res[J]);
+      Out[W - 1] = mux(SOv, A[W - 1], Res[W - 1]);
+      break;
+    case Inst::UAddSat:
+      for (unsigned J = 0; J < W; ++J)
+        Out[J] = Res[J] | UOv;
+      break;
+    case Inst::USubSat:
+      for (unsigned J = 0; J < W; ++J)
+        Out[J] = Res[J] & ~UOv;
+      break;
+    case Inst::SAddO:
+    case Inst::SSubO:
+      Out[0] = SOv;
+      break;
+    case Inst::UAddO:
+    case Inst::USubO:
+      Out[0] = UOv;
+      break;
+    default:
+      for (unsigned J = 0; J < W; ++J)
+        Out[J] = Res[J];
+      break;
+    }
+    break;
+  }
+  case Inst::Mul:
+  case Inst::MulNSW:
+  case Inst::MulNUW:
+  case Inst::MulNW:
+    mul(A, B, W, Out);
+    if (I->K == Inst::MulNSW || I->K == Inst::MulNW)
+      R.Poison = R.Poison | mulOverflow(A, B, W, /*Signed=*/true);
+    if (I->K == Inst::MulNUW || I->K == Inst::MulNW)
+      R.Poison = R.Poison | mulOverflow(A, B, W, /*Signed=*/false);
+    break;
+  case Inst::SMulO:
+    Out[0] = mulOverflow(A, B, W, /*Signed=*/true);
+    break;
+  case Inst::UMulO:
+    Out[0] = mulOverflow(A, B, W, /*Signed=*/false);
+    break;
+  case Inst::UDiv:
+  case Inst::UDivExact:
+  case Inst::URem: {
+    Plane Q[MaxPlanes], Rem[MaxPlanes];
+    udivrem(A, B, W, Q, Rem);
+    R.UB = R.UB | (isZero(B, W) & ~R.Poison);
+    for (unsigned J = 0; J < W; ++J)
+      Out[J] = I->K == Inst::URem ? Rem[J] : Q[J];
+    if (I->K == Inst::UDivExact)
+      R.Poison = R.Poison | ~isZero(Rem, W);
+    break;
+  }
+  case Inst::SDiv:
+  case Inst::SDivExact:
+  case Inst::SRem: {
+    // Divide the magnitudes, then fix up the signs
+    Plane SignA = A[W - 1], SignB = B[W - 1];
+    Plane NegA[MaxPlanes], NegB[MaxPlanes], AbsA[MaxPlanes], AbsB[MaxPlanes];
+    neg(A, W, NegA);
+    neg(B, W, NegB);
+    for (unsigned J = 0; J < W; ++J) {
+      AbsA[J] = mux(SignA, NegA[J], A[J]);
+      AbsB[J] = mux(SignB, NegB[J], B[J]);
+    }
+    Plane Q[MaxPlanes], Rem[MaxPlanes], NegQ[MaxPlanes], NegRem[MaxPlanes];
+    udivrem(AbsA, AbsB, W, Q, Rem);
+    neg(Q, W, NegQ);
+    neg(Rem, W, NegRem);
+
+    Plane AIsMin = SignA & isZero(A, W - 1);
+    Plane BIsAllOnes = splat(true);
+    for (unsigned J = 0; J < W; ++J)
+      BIsAllOnes = BIsAllOnes & B[J];
+    R.UB = R.UB | ((isZero(B, W) | (AIsMin & BIsAllOnes)) & ~R.Poison);
+    for (unsigned J = 0; J < W; ++J)
+      Out[J] = I->K == Inst::SRem ? mux(SignA, NegRem[J], Rem[J])
+                                  : mux(SignA ^ SignB, NegQ[J], Q[J]);
+    if (I->K == Inst::SDivExact)
+      R.Poison = R.Poison | ~isZero(Rem, W);
+    break;
+  }
+  case Inst::And:
+    for (unsigned J = 0; J < W; ++J)
+      Out[J] = A[J] & B[J];
+    break;
+  case Inst::Or:
+    for (unsigned J = 0; J < W; ++J)
+      Out[J] = A[J] | B[J];
+    break;
+  case Inst::Xor:
+    for (unsigned J = 0; J < W; ++J)
+      Out[J] = A[J] ^ B[J];
+    break;
+  case Inst::Shl:
+  case Inst::ShlNSW:
+  case Inst::ShlNUW:
+  case Inst::ShlNW: {
+    shift(A, W, B, W, ShiftKind::Left, Out);
+    Plane Ov = isOversizedShift(B, W);
+    Plane Back[MaxPlanes];
+    if (I->K == Inst::ShlNSW || I->K == Inst::ShlNW) {
+      shift(Out, W, B, W, ShiftKind::ArithRight, Back);
+      Ov = Ov | ~eq(Back, A, W);
+    }
+    if (I->K == Inst::ShlNUW || I->K == Inst::ShlNW) {
+      shift(Out, W, B, W, ShiftKind::LogicalRight, Back);
+      Ov = Ov | ~eq(Back, A, W);
+    }
+    R.Poison = R.Poison | Ov;
+    break;
+  }
+  case Inst::LShr:
+  case Inst::LShrExact:
+  case Inst::AShr:
+  case Inst::AShrExact: {
+    bool Arith = I->K == Inst::AShr || I->K == Inst::AShrExact;
+    shift(A, W, B, W, Arith ? ShiftKind::ArithRight : ShiftKind::LogicalRight,
+          Out);
+    Plane Ov = isOversizedShift(B, W);
+    if (I->K == Inst::LShrExact || I->K == Inst::AShrExact) {
+      Plane Back[MaxPlanes];
+      shift(Out, W, B, W, ShiftKind::Left, Back);
+      Ov = Ov | ~eq(Back, A, W);
+    }
+    R.Poison = R.Poison | Ov;
+    break;
+  }
+  case Inst::ZExt:
+    for (unsigned J = 0; J < W; ++J)
+      Out[J] = A[J];
+    break;
+  case Inst::SExt:
+    for (unsigned J = 0; J < RW; ++J)
+      Out[J] = A[J < W ? J : W - 1];
+    break;
+  case Inst::Trunc:
+    for (unsigned J = 0; J < RW; ++J)
+      Out[J] = A[J];
+    break;
+  case Inst::Eq:
+    Out[0] = eq(A, B, W);
+    break;
+  case Inst::Ne:
+    Out[0] = ~eq(A, B, W);
+    break;
+  case Inst::Ult:
+    Out[0] = ult(A, B, W);
+    break;
+  case Inst::Ule:
+    Out[0] = ~ult(B, A, W);
+    break;
+  case Inst::Slt:
+    Out[0] = slt(A, B, W);
+    break;
+  case Inst::Sle:
+    Out[0] = ~slt(B, A, W);
+    break;
+  case Inst::CtPop:
+  case Inst::Ctlz:
+  case Inst::Cttz: {
+    // Counts fit in the width, so they are summed in place, one carry-in at
+    // a time
+    Plane Zero[MaxPlanes];
+    constant(0, W, Zero);
+    Plane Run = splat(true);
+    for (unsigned J = 0; J < W; ++J) {
+      Plane Bit;
+      if (I->K == Inst::CtPop) {
+        Bit = A[J];
+      } else {
+        Run = Run & ~A[I->K == Inst::Ctlz ? W - 1 - J : J];
+        Bit = Run;
+      }
+      add(Out, Zero, Bit, W, Out);
+    }
+    break;
+  }
+  case Inst::BitReverse:
+    for (unsigned J = 0; J < W; ++J)
+      Out[J] = A[W - 1 - J];
+    break;
+  case Inst::FShl:
+  case Inst::FShr: {
+    // Shift the concatenation A:B by C modulo the width
+    Plane Width[MaxPlanes], Q[MaxPlanes], Amt[MaxPlanes], Cat[MaxPlanes],
+      Shifted[MaxPlanes];
+    constant(W, W, Width);
+    udivrem(C, Width, W, Q, Amt);
+    for (unsigned J = 0; J < W; ++J) {
+      Cat[J] = B[J];
+      Cat[W + J] = A[J];
+    }
+    bool Left = I->K == Inst::FShl;
+    shift(Cat, 2 * W, Amt, W,
+          Left ? ShiftKind::Left : ShiftKind::LogicalRight, Shifted);
+    for (unsigned J = 0; J < W; ++J)
+      Out[J] = Shifted[Left ? W + J : J];
+    break;
+  }
+  default:
+    llvm_unreachable("kind not supported by the bit-sliced evaluator");
+  }
+}
+
+}
+
+bool BitSlicedProgram::isSupported(Inst *Root) {
+  std::vector<Inst *> Stack{Root};
+  std::unordered_set<Inst *> Visited;
+  while (!Stack.empty()) {
+    Inst *I = Stack.back();
+    Stack.pop_back();
+    if (!Visited.insert(I).second)
+      continue;
+    if (I->Width == 0 || I->Width > MaxWidth || !isSupportedKind(I->K) ||
+        (I->K == Inst::Var && I->SynthesisConstID != 0))
+      return false;
+    for (auto Op : I->Ops)
+      Stack.push_back(Op);
+  }
+  return true;
+}
+
+BitSlicedProgram::BitSlicedProgram(Inst *Root) {
+  std::unordered_map<Inst *, unsigned> RegOf;
+
+  // Postorder, so every operand gets its register before its users
+  std::vector<std::pair<Inst *, unsigned>> Stack = {{Root, 0}};
+  while (!Stack.empty()) {
+    auto &Top = Stack.back();
+    Inst *I = Top.first;
+    if (Top.second == 0 && RegOf.count(I)) {
+      Stack.pop_back();
+      continue;
+    }
+    if (Top.second < I->Ops.size()) {
+      Inst *Op = I->Ops[Top.second++];
+      if (!RegOf.count(Op))
+        Stack.push_back({Op, 0});
+      continue;
+    }
+    Stack.pop_back();
+
+    unsigned Reg = Regs.size();
+    RegOf[I] = Reg;
+    Regs.emplace_back();
+    auto &V = Regs.back();
+    constant(0, MaxWidth, V.Bits);
+    V.Poison = V.UB = splat(false);
+    if (I->K == Inst::Const) {
+      constant(I->Val.getZExtValue(), I->Width, V.Bits);
+    } else if (I->Ops.empty()) {
+      Loads.push_back({Reg, I});
+    } else {
+      assert(I->Ops.size() <= 3);
+      Instruction Ins{I, Reg, {}};
+      for (unsigned J = 0; J < I->Ops.size(); ++J)
+        Ins.Ops[J] = RegOf[I->Ops[J]];
+      Code.push_back(Ins);
+    }
+  }
+  RootReg = RegOf[Root];
+}
+
+bool BitSlicedProgram::evaluate(const BitSlicedInputs &Inputs,
+                                BitSlicedValue &Result) {
+  for (auto &L : Loads) {
+    auto It = Inputs.find(L.second);
+    if (It == Inputs.end() || It->second.size() < L.second->Width)
+      return false;
+    for (unsigned J = 0; J < L.second->Width; ++J)
+      Regs[L.first].Bits[J] = It->second[J];
+  }
+
+  const BitSlicedValue *Args[3];
+  for (auto &C : Code) {
+    for (unsigned J = 0; J < C.I->Ops.size(); ++J)
+      Args[J] = &Regs[C.Ops[J]];
+    evaluateSliced(C.I, Args, Regs[C.Dest]);
+  }
+  Result = Regs[RootReg];
+  return true;
+}
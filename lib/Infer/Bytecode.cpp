@@ -0,0 +1,73 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "souper/Infer/Bytecode.h"
+
+#include <unordered_map>
+
+using namespace souper;
+
+BytecodeProgram::BytecodeProgram(Inst *Root) {
+  std::unordered_map<Inst *, unsigned> RegOf;
+
+  // Postorder, so every operand gets its register before its users
+  std::vector<std::pair<Inst *, unsigned>> Stack = {{Root, 0}};
+  while (!Stack.empty()) {
+    auto &Top = Stack.back();
+    Inst *I = Top.first;
+    if (Top.second == 0 && RegOf.count(I)) {
+      Stack.pop_back();
+      continue;
+    }
+    if (Top.second < I->Ops.size()) {
+      Inst *Op = I->Ops[Top.second++];
+      if (!RegOf.count(Op))
+        Stack.push_back({Op, 0});
+      continue;
+    }
+    Stack.pop_back();
+
+    unsigned Reg = Regs.size();
+    RegOf[I] = Reg;
+    if (I->K == Inst::Const || I->K == Inst::UntypedConst) {
+      Regs.push_back(EvalValue(I->Val));
+    } else if (I->Ops.empty()) {
+      Regs.push_back(EvalValue());
+      Loads.push_back({Reg, I});
+    } else {
+      Regs.push_back(EvalValue());
+      Code.push_back({I, Reg, (unsigned)Operands.size(), (unsigned)I->Ops.size()});
+      for (auto Op : I->Ops)
+        Operands.push_back(RegOf[Op]);
+    }
+  }
+  RootReg = RegOf[Root];
+}
+
+EvalValue BytecodeProgram::evaluate(const ValueCache &Inputs) {
+  for (auto &L : Loads) {
+    auto It = Inputs.find(L.second);
+    // A missing input fails exactly as it does in the interpreter
+    Regs[L.first] = It != Inputs.end() ? It->second :
+                                         evaluateSingleInst(L.second, {});
+  }
+
+  for (auto &C : Code) {
+    Args.clear();
+    for (unsigned J = C.FirstOp, E = C.FirstOp + C.NumOps; J != E; ++J)
+      Args.push_back(Regs[Operands[J]]);
+    Regs[C.Dest] = evaluateSingleInst(C.I, Args);
+  }
+  return Regs[RootReg];
+}
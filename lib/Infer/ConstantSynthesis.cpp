@@ -20,6 +20,9 @@
 #include "souper/Infer/Interpreter.h"
 #include "souper/Infer/Pruning.h"
 
+#include <algorithm>
+#include <thread>
+
 extern unsigned DebugLevel;
 
 namespace {
@@ -30,6 +33,14 @@ namespace {
   static cl::opt<unsigned> MaxSpecializations("souper-constant-synthesis-max-num-specializations",
     cl::desc("Maximum number of input specializations in constant synthesis (default=15)."),
     cl::init(15));
+  static cl::opt<unsigned> ParallelStarts("souper-constant-synthesis-parallel-starts",
+    cl::desc("Number of CEGIS instances run in parallel from different input "
+             "specializations in constant synthesis (default=1)."),
+    cl::init(1));
+  static cl::opt<unsigned> CounterexamplesPerRound("souper-constant-synthesis-counterexamples-per-round",
+    cl::desc("Maximum number of distinct counterexamples added per failed guess "
+             "in constant synthesis (default=1)."),
+    cl::init(1));
 }
 
 namespace souper {
@@ -302,6 +313,389 @@ static void visitConstants(Inst *I, std::set<Inst *> &Visited,
   }
 }
 
+// An input set from the pruner, as a constraint that LHS and RHS agree on it
+static Inst *getSpecialization(InstMapping Mapping, ValueCache &VC,
+                               InstContext &IC) {
+  std::map<Inst *, llvm::APInt> VCCopy;
+  for (auto Pair : VC) {
+    if (Pair.second.hasValue()) {
+      VCCopy[Pair.first] = Pair.second.getValue();
+    }
+  }
+  if (VCCopy.empty())
+    return nullptr;
+
+  std::map<Inst *, Inst *> InstCache;
+  std::map<Block *, Block *> BlockCache;
+  return IC.getInst(Inst::Eq, 1,
+                    {getInstCopy(Mapping.LHS, IC, InstCache, BlockCache, &VCCopy, true),
+                     getInstCopy(Mapping.RHS, IC, InstCache, BlockCache, &VCCopy, true)});
+}
+
+// Reads the synthesized constants out of a model of the first query and
+// returns the constraint ruling out this assignment
+static Inst *getConstantsFromModel(const std::vector<Inst *> &ModelInsts,
+                                   const std::vector<llvm::APInt> &ModelVals,
+                                   std::set<Inst *> &ConstSet,
+                                   std::map<Inst *, llvm::APInt> &ConstMap,
+                                   InstContext &IC) {
+  Inst *TriedAnteLocal = IC.getConst(llvm::APInt(1, false));
+  for (unsigned J = 0; J != ModelInsts.size(); ++J) {
+    if (ConstSet.find(ModelInsts[J]) != ConstSet.end()) {
+      if (DebugLevel > 3) {
+        llvm::errs() << ModelInsts[J]->Name;
+        llvm::errs() << ": ";
+        llvm::errs() << ModelVals[J];
+        llvm::errs() << "\n";
+      }
+
+      Inst *Const = IC.getConst(ModelVals[J]);
+      ConstMap.insert(std::pair<Inst *, llvm::APInt>(ModelInsts[J], Const->Val));
+      Inst *Ne = IC.getInst(Inst::Ne, 1, {ModelInsts[J], Const});
+      if (ConstSet.size() == 1) {
+        TriedAnteLocal = Ne;
+      } else {
+        TriedAnteLocal = IC.getInst(Inst::Or, 1, {TriedAnteLocal, Ne});
+      }
+    }
+  }
+  return TriedAnteLocal;
+}
+
+// Turns a model of a failed second query into the constraint that LHS and
+// RHS agree on that input
+static Inst *getCounterexample(InstMapping Mapping,
+                               const std::vector<Inst *> &ModelInsts,
+                               const std::vector<llvm::APInt> &ModelVals,
+                               std::set<Inst *> &ConstSet, InstContext &IC) {
+  std::vector<Block *> Blocks = getBlocksFromPhis(Mapping.LHS);
+  for (auto Block : Blocks) {
+    Block->ConcretePred = 0;
+  }
+
+  std::map<Inst *, llvm::APInt> SubstConstMap;
+  ValueCache VC;
+  for (unsigned J = 0; J != ModelInsts.size(); ++J) {
+    Inst* Var = ModelInsts[J];
+    if (Var->Name == BlockPred && !ModelVals[J].isZero())
+      for (auto B : Blocks)
+        for (unsigned I = 0 ; I < B->PredVars.size(); ++I)
+          if (B->PredVars[I] == Var)
+            B->ConcretePred = I + 1;
+
+    if (ConstSet.find(Var) == ConstSet.end()) {
+      SubstConstMap.insert(std::pair<Inst *, llvm::APInt>(Var, ModelVals[J]));
+      VC.insert(std::pair<Inst *, llvm::APInt>(Var, ModelVals[J]));
+    }
+  }
+
+  Inst *ConcreteLHS = nullptr;
+  std::map<Inst *, Inst *> InstCache;
+  std::map<Block *, Block *> BlockCache;
+  if (EnableConcreteInterpreter) {
+    ConcreteInterpreter CI(Mapping.LHS, VC);
+    auto LHSV = CI.evaluateInst(Mapping.LHS);
+
+    if (!LHSV.hasValue()) {
+      llvm::report_fatal_error("the model returned from second query evaluates to poison for LHS");
+    }
+    ConcreteLHS = IC.getConst(LHSV.getValue());
+  } else {
+    ConcreteLHS = getInstCopy(Mapping.LHS, IC, InstCache,
+                              BlockCache, &SubstConstMap, true);
+  }
+
+  return IC.getInst(Inst::Eq, 1, {ConcreteLHS,
+                                  getInstCopy(Mapping.RHS, IC, InstCache,
+                                              BlockCache, &SubstConstMap, true)});
+}
+
+namespace {
+
+struct SolverJob {
+  std::string Query;
+  unsigned NumModels;
+  bool IsSat = false;
+  std::vector<llvm::APInt> Models;
+  std::error_code EC;
+};
+
+// Only the solver runs concurrently; queries are built and models are
+// consumed on the calling thread, since the KLEE expressions the queries
+// are built from are not thread-safe
+void solveJobs(SMTLIBSolver *SMTSolver, std::vector<SolverJob> &Jobs,
+               unsigned Timeout) {
+  if (Jobs.size() == 1) {
+    auto &J = Jobs[0];
+    J.EC = SMTSolver->isSatisfiable(J.Query, J.IsSat, J.NumModels, &J.Models,
+                                    Timeout);
+    return;
+  }
+  std::vector<std::thread> Threads;
+  for (auto &J : Jobs)
+    Threads.emplace_back([SMTSolver, &J, Timeout]() {
+      J.EC = SMTSolver->isSatisfiable(J.Query, J.IsSat, J.NumModels, &J.Models,
+                                      Timeout);
+    });
+  for (auto &T : Threads)
+    T.join();
+}
+
+}
+
+// Rules out the inputs of a counterexample, or returns null if it has none
+static Inst *getModelBlocker(const std::vector<Inst *> &ModelInsts,
+                             const std::vector<llvm::APInt> &ModelVals,
+                             std::set<Inst *> &ConstSet, InstContext &IC) {
+  Inst *Blocker = nullptr;
+  for (unsigned J = 0; J != ModelInsts.size(); ++J) {
+    Inst *Var = ModelInsts[J];
+    if (Var->K != Inst::Var || Var->Name == BlockPred ||
+        ConstSet.find(Var) != ConstSet.end())
+      continue;
+    Inst *Ne = IC.getInst(Inst::Ne, 1, {Var, IC.getConst(ModelVals[J])});
+    Blocker = Blocker ? IC.getInst(Inst::Or, 1, {Blocker, Ne}) : Ne;
+  }
+  return Blocker;
+}
+
+// Adds the counterexamples refuting each of RHSCopies to SubstAnte. Beyond
+// the first one, up to CounterexamplesPerRound - 1 more are found for each
+// guess by re-solving its second query with the inputs of all earlier
+// counterexamples excluded. Each counterexample also becomes a pruning input
+// of Pruner, if there is one.
+static Inst *addCounterexamples(SMTLIBSolver *SMTSolver, const BlockPCs &BPCs,
+                                const std::vector<InstMapping> &PCs,
+                                InstMapping Mapping, std::vector<Inst *> RHSCopies,
+                                std::vector<std::vector<Inst *>> ModelInsts,
+                                std::vector<std::vector<llvm::APInt>> ModelVals,
+                                std::set<Inst *> &ConstSet, InstContext &IC,
+                                unsigned Timeout, Inst *SubstAnte,
+                                PruningManager *Pruner) {
+  Inst *TrueConst = IC.getConst(llvm::APInt(1, true));
+  std::vector<std::vector<InstMapping>> Blocked(RHSCopies.size(), PCs);
+  unsigned NumAdded = 0;
+
+  for (unsigned Round = 1; ; ++Round) {
+    for (unsigned J = 0; J < RHSCopies.size(); ++J) {
+      SubstAnte = IC.getInst(Inst::And, 1,
+                             {getCounterexample(Mapping, ModelInsts[J], ModelVals[J],
+                                                ConstSet, IC),
+                              SubstAnte});
+      if (Pruner)
+        Pruner->addCounterexample(ModelInsts[J], ModelVals[J]);
+      ++NumAdded;
+    }
+    if (Round >= CounterexamplesPerRound)
+      break;
+
+    std::vector<SolverJob> Jobs;
+    std::vector<std::vector<Inst *>> JobModelInsts;
+    std::vector<unsigned> Owners;
+    for (unsigned J = 0; J < RHSCopies.size(); ++J) {
+      Inst *Blocker = getModelBlocker(ModelInsts[J], ModelVals[J], ConstSet, IC);
+      if (!Blocker)
+        continue;
+      // As a PC the blocker restricts the inputs rather than the result
+      Blocked[J].emplace_back(Blocker, TrueConst);
+      std::vector<Inst *> Insts;
+      std::string Query = BuildQuery(IC, BPCs, Blocked[J],
+                                     InstMapping(Mapping.LHS, RHSCopies[J]), &Insts, 0);
+      if (Query.empty())
+        continue;
+      Jobs.push_back({Query, (unsigned)Insts.size()});
+      JobModelInsts.push_back(std::move(Insts));
+      Owners.push_back(J);
+    }
+    if (Jobs.empty())
+      break;
+
+    solveJobs(SMTSolver, Jobs, Timeout);
+
+    std::vector<Inst *> NextRHSCopies;
+    std::vector<std::vector<Inst *>> NextModelInsts;
+    std::vector<std::vector<llvm::APInt>> NextModelVals;
+    std::vector<std::vector<InstMapping>> NextBlocked;
+    for (unsigned K = 0; K < Jobs.size(); ++K) {
+      // Errors only cut the search short, the guess is refuted already
+      if (Jobs[K].EC || !Jobs[K].IsSat)
+        continue;
+      NextRHSCopies.push_back(RHSCopies[Owners[K]]);
+      NextModelInsts.push_back(std::move(JobModelInsts[K]));
+      NextModelVals.push_back(std::move(Jobs[K].Models));
+      NextBlocked.push_back(std::move(Blocked[Owners[K]]));
+    }
+    if (NextRHSCopies.empty())
+      break;
+    if (DebugLevel > 3)
+      llvm::errs() << "found " << NextRHSCopies.size()
+                   << " more counterexamples in round " << Round << "\n";
+    RHSCopies = std::move(NextRHSCopies);
+    ModelInsts = std::move(NextModelInsts);
+    ModelVals = std::move(NextModelVals);
+    Blocked = std::move(NextBlocked);
+  }
+  if (DebugLevel > 3)
+    llvm::errs() << "counterexamples added this round: " << NumAdded << "\n";
+  return SubstAnte;
+}
+
+std::error_code
+ConstantSynthesis::synthesizeMultiStart(SMTLIBSolver *SMTSolver,
+                                        const BlockPCs &BPCs,
+                                        const std::vector<InstMapping> &PCs,
+                                        InstMapping Mapping, std::set<Inst *> &ConstSet,
+                                        std::map <Inst *, llvm::APInt> &ResultMap,
+                                        InstContext &IC, unsigned MaxTries, unsigned Timeout,
+                                        bool AvoidNops, unsigned NumStarts) {
+  Inst *TrueConst = IC.getConst(llvm::APInt(1, true));
+
+  // Input sets are dealt out round-robin, so every start begins from a
+  // different set of counterexamples
+  auto &InputVals = Pruner->getInputVals();
+  std::vector<Inst *> StartAnte(NumStarts, TrueConst);
+  std::vector<unsigned> NumSeeds(NumStarts, 0);
+  for (size_t I = 0; I < InputVals.size() &&
+                     I < (size_t)MaxSpecializations * NumStarts; ++I) {
+    if (auto Spec = getSpecialization(Mapping, InputVals[I], IC)) {
+      StartAnte[I % NumStarts] =
+        IC.getInst(Inst::And, 1, {Spec, StartAnte[I % NumStarts]});
+      ++NumSeeds[I % NumStarts];
+    }
+  }
+  if (DebugLevel > 3)
+    for (unsigned S = 0; S < NumStarts; ++S)
+      llvm::errs() << "start " << S << " is seeded with " << NumSeeds[S]
+                   << " input sets\n";
+
+  // Counterexamples and failed constants are shared by all starts
+  Inst *SubstAnte = TrueConst;
+  Inst *TriedAnte = TrueConst;
+
+  auto ConstConstraints = TrueConst;
+  std::set<Inst *> Visited;
+  visitConstants(Mapping.RHS, Visited, ConstConstraints, ConstSet, IC, AvoidNops);
+
+  std::vector<bool> Active(NumStarts, true);
+  std::error_code EC;
+  for (unsigned I = 0; I < MaxTries; ++I) {
+    std::vector<SolverJob> FirstJobs;
+    std::vector<std::vector<Inst *>> FirstModelInsts;
+    std::vector<unsigned> Starts;
+    for (unsigned S = 0; S < NumStarts; ++S) {
+      if (!Active[S])
+        continue;
+      Inst *Ante = IC.getInst(Inst::And, 1,
+                              {ConstConstraints,
+                               IC.getInst(Inst::And, 1,
+                                          {SubstAnte,
+                                           IC.getInst(Inst::And, 1, {TriedAnte, StartAnte[S]})})});
+      std::vector<Inst *> ModelInsts;
+      std::string Query = BuildQuery(IC, BPCs, PCs, InstMapping(Mapping.LHS, Mapping.RHS),
+                                     &ModelInsts, Ante, true, true);
+      if (Query.empty())
+        return std::make_error_code(std::errc::value_too_large);
+      FirstJobs.push_back({Query, (unsigned)ModelInsts.size()});
+      FirstModelInsts.push_back(std::move(ModelInsts));
+      Starts.push_back(S);
+    }
+    if (Starts.empty())
+      break;
+
+    solveJobs(SMTSolver, FirstJobs, Timeout);
+
+    std::vector<std::map<Inst *, llvm::APInt>> Candidates;
+    std::vector<Inst *> RHSCopies;
+    std::vector<SolverJob> SecondJobs;
+    std::vector<std::vector<Inst *>> SecondModelInsts;
+    for (unsigned J = 0; J < FirstJobs.size(); ++J) {
+      auto &Job = FirstJobs[J];
+      if (Job.EC) {
+        if (DebugLevel > 3)
+          llvm::errs() << "ConstantSynthesis: solver returns error on first query of start "
+                       << Starts[J] << "\n";
+        EC = Job.EC;
+        Active[Starts[J]] = false;
+        continue;
+      }
+
+      if (!Job.IsSat) {
+        // Every start's constraints are necessary, so no constant works
+        if (DebugLevel > 3)
+          llvm::errs() << "first query of start " << Starts[J]
+                       << " is UNSAT-- no more guesses\n";
+        return std::error_code();
+      }
+
+      std::map<Inst *, llvm::APInt> ConstMap;
+      TriedAnte = IC.getInst(Inst::And, 1,
+                             {TriedAnte,
+                              getConstantsFromModel(FirstModelInsts[J], Job.Models,
+                                                    ConstSet, ConstMap, IC)});
+      if (std::find(Candidates.begin(), Candidates.end(), ConstMap) != Candidates.end())
+        continue;
+
+      std::map<Inst *, Inst *> InstCache;
+      std::map<Block *, Block *> BlockCache;
+      Inst *RHSCopy = getInstCopy(Mapping.RHS, IC, InstCache, BlockCache, &ConstMap, false);
+
+      std::vector<Inst *> ModelInsts;
+      std::string Query = BuildQuery(IC, BPCs, PCs, InstMapping(Mapping.LHS, RHSCopy),
+                                     &ModelInsts, 0);
+      if (Query.empty())
+        return std::make_error_code(std::errc::value_too_large);
+      SecondJobs.push_back({Query, (unsigned)ModelInsts.size()});
+      SecondModelInsts.push_back(std::move(ModelInsts));
+      Candidates.push_back(std::move(ConstMap));
+      RHSCopies.push_back(RHSCopy);
+    }
+
+    if (DebugLevel > 3)
+      llvm::errs() << "attempt " << I << ": " << Candidates.size()
+                   << " distinct guesses from " << Starts.size() << " starts\n";
+
+    solveJobs(SMTSolver, SecondJobs, Timeout);
+
+    for (unsigned J = 0; J < SecondJobs.size(); ++J) {
+      if (!SecondJobs[J].EC && !SecondJobs[J].IsSat) {
+        if (DebugLevel > 3)
+          llvm::errs() << "second query is UNSAT-- this guess works\n";
+        ResultMap = std::move(Candidates[J]);
+        return std::error_code();
+      }
+    }
+
+    std::vector<Inst *> Refuted;
+    std::vector<std::vector<Inst *>> RefutedModelInsts;
+    std::vector<std::vector<llvm::APInt>> RefutedModelVals;
+    for (unsigned J = 0; J < SecondJobs.size(); ++J) {
+      auto &Job = SecondJobs[J];
+      if (Job.EC) {
+        if (DebugLevel > 3)
+          llvm::errs() << "ConstantSynthesis: solver returns error on second query\n";
+        EC = Job.EC;
+        continue;
+      }
+      if (DebugLevel > 3)
+        llvm::errs() << "attempt " << I << ": second query is SAT-- constant doesn't work\n";
+      Refuted.push_back(RHSCopies[J]);
+      RefutedModelInsts.push_back(std::move(SecondModelInsts[J]));
+      RefutedModelVals.push_back(std::move(Job.Models));
+    }
+    SubstAnte = addCounterexamples(SMTSolver, BPCs, PCs, Mapping, std::move(Refuted),
+                                   std::move(RefutedModelInsts),
+                                   std::move(RefutedModelVals), ConstSet, IC,
+                                   Timeout, SubstAnte, Pruner);
+  }
+
+  if (DebugLevel > 3) {
+    llvm::errs() << "number of constant synthesis rounds exceeds MaxTries(";
+    llvm::errs() << MaxTries;
+    llvm::errs() << ")\n";
+  }
+  return EC;
+}
+
 std::error_code
 ConstantSynthesis::synthesize(SMTLIBSolver *SMTSolver,
                               const BlockPCs &BPCs,
@@ -311,35 +705,29 @@ ConstantSynthesis::synthesize(SMTLIBSolver *SMTSolver,
                               InstContext &IC, unsigned MaxTries, unsigned Timeout,
                               bool AvoidNops) {
 
-  Inst *TrueConst = IC.getConst(llvm::APInt(1, true));
-  Inst *FalseConst = IC.getConst(llvm::APInt(1, false));
+  if (Pruner && ParallelStarts > 1 && Pruner->getInputVals().size() > 1) {
+    unsigned NumStarts = std::min<size_t>(ParallelStarts,
+                                          Pruner->getInputVals().size());
+    return synthesizeMultiStart(SMTSolver, BPCs, PCs, Mapping, ConstSet,
+                                ResultMap, IC, MaxTries, Timeout, AvoidNops,
+                                NumStarts);
+  }
 
+  Inst *TrueConst = IC.getConst(llvm::APInt(1, true));
 
   // generalization by substitution
   Inst *SubstAnte = TrueConst;
   Inst *TriedAnte = TrueConst;
   std::error_code EC;
 
-  if (Pruner) {
+  if (Pruner && SpecializeFirstQuery) {
     size_t Specializations = 0;
     for (auto &&VC : Pruner->getInputVals()) {
       if (Specializations++ >= MaxSpecializations) {
         break;
       }
-      std::map<Inst *, llvm::APInt> VCCopy;
-      for (auto Pair : VC) {
-        if (Pair.second.hasValue()) {
-          VCCopy[Pair.first] = Pair.second.getValue();
-        }
-      }
-      if (!VCCopy.empty()) {
-        std::map<Inst *, Inst *> InstCache;
-        std::map<Block *, Block *> BlockCache;
-        TriedAnte = IC.getInst(Inst::And, 1,
-                    {IC.getInst(Inst::Eq, 1,
-                    {getInstCopy(Mapping.LHS, IC, InstCache, BlockCache, &VCCopy, true),
-                    getInstCopy(Mapping.RHS, IC, InstCache, BlockCache, &VCCopy, true)}), TriedAnte});
-      }
+      if (auto Spec = getSpecialization(Mapping, VC, IC))
+        TriedAnte = IC.getInst(Inst::And, 1, {Spec, TriedAnte});
     }
   }
 
@@ -383,27 +771,9 @@ ConstantSynthesis::synthesize(SMTLIBSolver *SMTSolver,
     if (DebugLevel > 3)
       llvm::errs() << "first query is SAT, returning the model:\n";
 
-    Inst* TriedAnteLocal = FalseConst;
     std::map<Inst *, llvm::APInt> ConstMap;
-    for (unsigned J = 0; J != ModelInstsFirstQuery.size(); ++J) {
-      if (ConstSet.find(ModelInstsFirstQuery[J]) != ConstSet.end()) {
-        if (DebugLevel > 3) {
-          llvm::errs() << ModelInstsFirstQuery[J]->Name;
-          llvm::errs() << ": ";
-          llvm::errs() << ModelValsFirstQuery[J];
-          llvm::errs() << "\n";
-        }
-
-        Inst *Const = IC.getConst(ModelValsFirstQuery[J]);
-        ConstMap.insert(std::pair<Inst *, llvm::APInt>(ModelInstsFirstQuery[J], Const->Val));
-        Inst *Ne = IC.getInst(Inst::Ne, 1, {ModelInstsFirstQuery[J], Const});
-        if (ConstSet.size() == 1) {
-          TriedAnteLocal = Ne;
-        } else {
-          TriedAnteLocal = IC.getInst(Inst::Or, 1, {TriedAnteLocal, Ne});
-        }
-      }
-    }
+    Inst *TriedAnteLocal = getConstantsFromModel(ModelInstsFirstQuery, ModelValsFirstQuery,
+                                                 ConstSet, ConstMap, IC);
     TriedAnte = IC.getInst(Inst::And, 1, {TriedAnte, TriedAnteLocal});
 
     std::map<Inst *, Inst *> InstCache;
@@ -452,43 +822,9 @@ ConstantSynthesis::synthesize(SMTLIBSolver *SMTSolver,
         llvm::errs() << "attempt " << I << ": second query is SAT-- constant doesn't work\n";
       }
 
-      std::map<Inst *, llvm::APInt> SubstConstMap;
-      ValueCache VC;
-      for (unsigned J = 0; J != ModelInstsSecondQuery.size(); ++J) {
-        Inst* Var = ModelInstsSecondQuery[J];
-        if (Var->Name == BlockPred && !ModelValsSecondQuery[J].isZero())
-          for (auto B : Blocks)
-            for (unsigned I = 0 ; I < B->PredVars.size(); ++I)
-              if (B->PredVars[I] == Var)
-                B->ConcretePred = I + 1;
-
-        if (ConstSet.find(Var) == ConstSet.end()) {
-          SubstConstMap.insert(std::pair<Inst *, llvm::APInt>(Var, ModelValsSecondQuery[J]));
-          VC.insert(std::pair<Inst *, llvm::APInt>(Var, ModelValsSecondQuery[J]));
-        }
-      }
-
-      Inst *ConcreteLHS = nullptr;
-      std::map<Inst *, Inst *> InstCache;
-      std::map<Block *, Block *> BlockCache;
-      if (EnableConcreteInterpreter) {
-        ConcreteInterpreter CI(Mapping.LHS, VC);
-        auto LHSV = CI.evaluateInst(Mapping.LHS);
-
-        if (!LHSV.hasValue()) {
-          llvm::report_fatal_error("the model returned from second query evaluates to poison for LHS");
-        }
-        ConcreteLHS = IC.getConst(LHSV.getValue());
-      } else {
-        ConcreteLHS = getInstCopy(Mapping.LHS, IC, InstCache,
-                                  BlockCache, &SubstConstMap, true);
-      }
-
-      SubstAnte = IC.getInst(Inst::And, 1,
-                             {IC.getInst(Inst::Eq, 1, {ConcreteLHS,
-                                                       getInstCopy(Mapping.RHS, IC, InstCache,
-                                                                   BlockCache, &SubstConstMap, true)}),
-                              SubstAnte});
+      SubstAnte = addCounterexamples(SMTSolver, BPCs, PCs, Mapping, {RHSCopy},
+                                     {ModelInstsSecondQuery}, {ModelValsSecondQuery},
+                                     ConstSet, IC, Timeout, SubstAnte, Pruner);
     }
   }
 
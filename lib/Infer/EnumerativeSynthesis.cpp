@@ -18,6 +18,7 @@
 #include "souper/Infer/AliveDriver.h"
 #include "souper/Infer/ConstantSynthesis.h"
 #include "souper/Infer/EnumerativeSynthesis.h"
+#include "souper/Infer/ExhaustiveVerifier.h"
 #include "souper/Infer/Pruning.h"
 
 #include <queue>
@@ -105,6 +106,10 @@ namespace {
   static cl::opt<bool> TryShrinkConsts("souper-shrink-consts",
     cl::desc("Try to shrink constants (defaults=false)"),
     cl::init(false));
+  static cl::opt<unsigned> ExhaustiveMaxBits("souper-exhaustive-verification-max-bits",
+    cl::desc("Verify guesses by evaluating every input when the LHS inputs "
+             "span at most this many bits, 0 to disable (default=16)"),
+    cl::init(16));
 }
 
 // TODO
@@ -166,11 +171,14 @@ PruneFunc MkPruneFunc(std::vector<PruneFunc> Funcs) {
   };
 }
 
-bool CountPrune(Inst *I, std::vector<Inst *> &ReservedInsts, std::set<Inst*> Visited) {
-  return !(souper::countHelper(I, Visited) > MaxNumInstructions);
+bool CountPrune(Inst *I, std::vector<Inst *> &ReservedInsts,
+                const llvm::DenseSet<Inst *> &Free) {
+  // Counting all of I, which is memoized, bounds what counting only what is
+  // not free gives
+  return souper::instCount(I) <= MaxNumInstructions ||
+         souper::instCount(I, Free) <= MaxNumInstructions;
 }
 
-//TODO(manasij/zhengyang) souper::cost needs a caching layer
 template <typename Container>
 void sortGuesses(Container &Guesses) {
   // One of the real advantages of enumerative synthesis vs
@@ -654,21 +662,31 @@ std::error_code synthesizeWithAlive(SynthesisContext &SC, std::vector<Inst *> &R
   return EC;
 }
 
-std::error_code isConcreteCandidateSat(SynthesisContext &SC, Inst *RHSGuess, bool &IsSat) {
+std::error_code isConcreteCandidateSat(SynthesisContext &SC, Inst *RHSGuess, bool &IsSat,
+                                       PruningManager *Pruner) {
   std::error_code EC;
   InstMapping Mapping(SC.LHS, RHSGuess);
 
-  std::string Query2 = BuildQuery(SC.IC, SC.BPCs, SC.PCs, Mapping, 0, 0);
+  // With a pruner around, the input refuting the guess is kept for pruning
+  // the guesses still to come
+  std::vector<Inst *> ModelInsts;
+  std::vector<llvm::APInt> ModelVals;
+  std::string Query2 = BuildQuery(SC.IC, SC.BPCs, SC.PCs, Mapping,
+                                  Pruner ? &ModelInsts : 0, 0);
 
-  EC = SC.SMTSolver->isSatisfiable(Query2, IsSat, 0, 0, SC.Timeout);
+  EC = SC.SMTSolver->isSatisfiable(Query2, IsSat, ModelInsts.size(),
+                                   Pruner ? &ModelVals : 0, SC.Timeout);
   if (EC && DebugLevel > 1) {
     llvm::errs() << "verification query failed!\n";
   }
+  if (!EC && IsSat && Pruner)
+    Pruner->addCounterexample(ModelInsts, ModelVals);
   return EC;
 }
 
 std::error_code synthesizeWithKLEE(SynthesisContext &SC, std::vector<Inst *> &RHSs,
-                                   const std::vector<souper::Inst *> &Guesses) {
+                                   const std::vector<souper::Inst *> &Guesses,
+                                   ExhaustiveVerifier &EV, PruningManager *Pruner) {
   std::error_code EC;
 
   // find the valid one
@@ -702,7 +720,14 @@ std::error_code synthesizeWithKLEE(SynthesisContext &SC, std::vector<Inst *> &RH
     if (!GuessHasConstant) {
       bool IsSAT;
 
-      EC = isConcreteCandidateSat(SC, I, IsSAT);
+      auto Exhaustive = EV.verify(I);
+      if (Exhaustive != ExhaustiveVerifier::Result::Unknown) {
+        IsSAT = Exhaustive == ExhaustiveVerifier::Result::Invalid;
+        if (DebugLevel > 3)
+          llvm::errs() << "exhaustive check decided the guess\n";
+      } else {
+        EC = isConcreteCandidateSat(SC, I, IsSAT, Pruner);
+      }
       if (EC) {
         if (DebugLevel > 0)
           llvm::errs() << "OOPS: error from isConcreteCanddiateSat()\n";
@@ -719,7 +744,7 @@ std::error_code synthesizeWithKLEE(SynthesisContext &SC, std::vector<Inst *> &RH
       }
     } else {
       // guess has constant(s)
-      ConstantSynthesis CS;
+      ConstantSynthesis CS{Pruner, /*SpecializeFirstQuery=*/false};
       EC = CS.synthesize(SC.SMTSolver, SC.BPCs, SC.PCs, InstMapping (SC.LHS, I), ConstSet,
                          ResultConstMap, SC.IC, /*MaxTries=*/MaxTries, SC.Timeout,
                          /*AvoidNops=*/true);
@@ -790,13 +815,14 @@ std::error_code synthesizeWithKLEE(SynthesisContext &SC, std::vector<Inst *> &RH
 }
 
 std::error_code verify(SynthesisContext &SC, std::vector<Inst *> &RHSs,
-                       const std::vector<souper::Inst *> &Guesses) {
+                       const std::vector<souper::Inst *> &Guesses,
+                       ExhaustiveVerifier &EV, PruningManager *Pruner) {
   std::error_code EC;
   if (SkipSolver || Guesses.empty())
     return EC;
 
   return UseAlive ? synthesizeWithAlive(SC, RHSs, Guesses) :
-                    synthesizeWithKLEE(SC, RHSs, Guesses);
+                    synthesizeWithKLEE(SC, RHSs, Guesses, EV, Pruner);
 }
 
 std::error_code
@@ -836,11 +862,12 @@ EnumerativeSynthesis::synthesize(SMTLIBSolver *SMTSolver,
   findVars(SC.LHS, Inputs);
   PruningManager DataflowPruning(SC, Inputs, DebugLevel);
 
-  std::set<Inst*> Visited(Cands.begin(), Cands.end());
+  // Parts of the LHS come for free in guesses
+  llvm::DenseSet<Inst *> Free(Cands.begin(), Cands.end());
 
   // Cheaper tests go first
-  std::vector<PruneFunc> PruneFuncs = { [&Visited](Inst *I, std::vector<Inst*> &ReservedInsts)  {
-    return CountPrune(I, ReservedInsts, Visited);
+  std::vector<PruneFunc> PruneFuncs = { [&Free](Inst *I, std::vector<Inst*> &ReservedInsts)  {
+    return CountPrune(I, ReservedInsts, Free);
   }};
   if (EnableDataflowPruning) {
     DataflowPruning.init();
@@ -848,13 +875,21 @@ EnumerativeSynthesis::synthesize(SMTLIBSolver *SMTSolver,
   }
   auto PruneCallback = MkPruneFunc(PruneFuncs);
 
+  // Narrow LHSs are cheaper to check on every input than with the solver
+  ExhaustiveVerifier EV(SC.LHS, SC.PCs, SC.BPCs, ExhaustiveMaxBits);
+  if (DebugLevel > 1 && EV.isApplicable())
+    llvm::errs() << "using exhaustive verification for concrete guesses\n";
+
+  // Input sets for multi-start constant synthesis
+  PruningManager *Pruner = EnableDataflowPruning ? &DataflowPruning : nullptr;
+
   std::vector<Inst *> Guesses;
 
-  auto Generate = [&SC, &Guesses, &RHSs, &EC](Inst *Guess) {
+  auto Generate = [&SC, &Guesses, &RHSs, &EC, &EV, Pruner](Inst *Guess) {
     Guesses.push_back(Guess);
     if (Guesses.size() >= MaxV && !SkipSolver) {
       sortGuesses(Guesses);
-      EC = verify(SC, RHSs, Guesses);
+      EC = verify(SC, RHSs, Guesses, EV, Pruner);
       Guesses.clear();
       return SC.CheckAllGuesses || (!SC.CheckAllGuesses && RHSs.empty()); // Continue if no RHS
     }
@@ -889,7 +924,7 @@ EnumerativeSynthesis::synthesize(SMTLIBSolver *SMTSolver,
 
   if (!Guesses.empty() && !SkipSolver) {
     sortGuesses(Guesses);
-    EC = verify(SC, RHSs, Guesses);
+    EC = verify(SC, RHSs, Guesses, EV, Pruner);
   }
 
   // RHSs count, before duplication
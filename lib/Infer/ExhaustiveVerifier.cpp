@@ -0,0 +1,404 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "llvm/ADT/Statistic.h"
+#include "souper/Infer/ExhaustiveVerifier.h"
+
+#include <algorithm>
+#include <set>
+
+#define DEBUG_TYPE "souper"
+
+STATISTIC(ExhaustiveValid, "Number of guesses proved valid by exhaustive checking");
+STATISTIC(ExhaustiveInvalid, "Number of guesses refuted by exhaustive checking");
+STATISTIC(ExhaustiveUnknown, "Number of guesses exhaustive checking left to the solver");
+
+using namespace souper;
+using namespace llvm;
+
+namespace {
+
+// Kinds the concrete interpreter can't evaluate, or evaluates
+// nondeterministically
+bool isUnsupported(Inst *I) {
+  switch (I->K) {
+  case Inst::Hole:
+  case Inst::ReservedConst:
+  case Inst::ReservedInst:
+  case Inst::Freeze:
+  case Inst::None:
+    return true;
+  case Inst::Var:
+    return I->SynthesisConstID != 0;
+  default:
+    return false;
+  }
+}
+
+void collectInsts(Inst *Root, std::set<Inst *> &Insts) {
+  std::vector<Inst *> Found;
+  findInsts(Root, Found, [](Inst *) { return true; });
+  Insts.insert(Found.begin(), Found.end());
+}
+
+// Same facts as ExprBuilder::getDataflowConditions()
+bool isDataflowConsistent(Inst *I, const APInt &V) {
+  const VarFacts &F = *I->Facts;
+  if ((F.KnownZeros & V) != 0 || (F.KnownOnes & ~V) != 0)
+    return false;
+  if (F.NonZero && !V)
+    return false;
+  if (F.NonNegative && V.isNegative())
+    return false;
+  if (F.PowOfTwo && !V.isPowerOf2())
+    return false;
+  if (F.Negative && !V.isNegative())
+    return false;
+  if (F.NumSignBits > V.getNumSignBits())
+    return false;
+  if (!F.Range.isFullSet() && !F.Range.isEmptySet() && !F.Range.contains(V))
+    return false;
+
+  bool HasRefinement = false;
+  for (auto &R : F.RangeRefinement) {
+    if (R.isFullSet() || R.isEmptySet())
+      continue;
+    if (R.contains(V))
+      return true;
+    HasRefinement = true;
+  }
+  return !HasRefinement;
+}
+
+}
+
+ExhaustiveVerifier::ExhaustiveVerifier(Inst *LHS,
+                                       const std::vector<InstMapping> &PCs,
+                                       const BlockPCs &BPCs,
+                                       unsigned MaxInputBits)
+  : LHS(LHS), PCs(PCs), BPCs(BPCs) {
+  if (MaxInputBits == 0 || MaxInputBits >= 32)
+    return;
+
+  std::set<Inst *> Insts;
+  collectInsts(LHS, Insts);
+  for (auto &PC : PCs) {
+    collectInsts(PC.LHS, Insts);
+    collectInsts(PC.RHS, Insts);
+  }
+
+  std::set<Block *> LHSBlocks;
+  for (auto I : Insts)
+    if (I->K == Inst::Phi)
+      LHSBlocks.insert(I->B);
+
+  // Blockpcs only ever constrain the predecessors of phis in the LHS
+  for (auto &BPC : BPCs) {
+    if (LHSBlocks.count(BPC.B)) {
+      collectInsts(BPC.PC.LHS, Insts);
+      collectInsts(BPC.PC.RHS, Insts);
+    }
+  }
+
+  for (auto I : Insts) {
+    if (isUnsupported(I))
+      return;
+    if (I->K == Inst::Var)
+      Vars.push_back(I);
+    if (I->K == Inst::Phi || I->K == Inst::Select)
+      LHSPathSensitive = true;
+  }
+  Blocks.assign(LHSBlocks.begin(), LHSBlocks.end());
+
+  uint64_t Limit = uint64_t(1) << MaxInputBits;
+  NumInputs = 1;
+  for (auto V : Vars) {
+    if (V->Width > MaxInputBits)
+      return;
+    NumInputs <<= V->Width;
+    if (NumInputs > Limit)
+      return;
+  }
+  for (auto B : Blocks) {
+    NumInputs *= B->Preds;
+    if (NumInputs > Limit)
+      return;
+  }
+  Applicable = true;
+}
+
+void ExhaustiveVerifier::setInput(uint64_t Index, ValueCache &Cache) {
+  for (auto V : Vars) {
+    Cache[V] = EvalValue(APInt(V->Width, Index & ((uint64_t(1) << V->Width) - 1)));
+    Index >>= V->Width;
+  }
+  for (auto B : Blocks) {
+    B->ConcretePred = Index % B->Preds;
+    Index /= B->Preds;
+  }
+}
+
+bool ExhaustiveVerifier::blockPCsHold(ConcreteInterpreter &CI, bool &Uncertain) {
+  if (Blocks.empty())
+    return true;
+
+  // Only the blocks whose phis are on the path actually taken contribute
+  // their blockpcs, see ExprBuilder::getBlockPCs()
+  std::set<Block *> Taken;
+  std::set<Inst *> Visited;
+  std::vector<Inst *> Stack = {LHS};
+  while (!Stack.empty()) {
+    Inst *I = Stack.back();
+    Stack.pop_back();
+    if (!Visited.insert(I).second)
+      continue;
+    if (I->K == Inst::Phi) {
+      Taken.insert(I->B);
+      Stack.push_back(I->Ops[I->B->ConcretePred]);
+      continue;
+    }
+    for (auto Op : I->Ops)
+      Stack.push_back(Op);
+  }
+
+  for (auto &BPC : BPCs) {
+    if (!Taken.count(BPC.B) || BPC.PredIdx != BPC.B->ConcretePred)
+      continue;
+    auto L = CI.evaluateInst(BPC.PC.LHS);
+    auto R = CI.evaluateInst(BPC.PC.RHS);
+    if (!L.hasValue() || !R.hasValue()) {
+      // The solver sees a wrapped value here, not poison
+      Uncertain = true;
+      continue;
+    }
+    if (L.getValue() != R.getValue())
+      return false;
+  }
+  return true;
+}
+
+void ExhaustiveVerifier::buildTable() {
+  std::vector<unsigned> SavedPreds;
+  for (auto B : Blocks)
+    SavedPreds.push_back(B->ConcretePred);
+
+  Kinds.assign(NumInputs, InputKind::Skip);
+  LHSValues.assign(NumInputs, APInt(LHS->Width, 0));
+
+  for (uint64_t Index = 0; Index < NumInputs; ++Index) {
+    ValueCache Cache;
+    setInput(Index, Cache);
+
+    bool Consistent = true;
+    for (auto V : Vars)
+      Consistent &= isDataflowConsistent(V, Cache[V].getValue());
+    if (!Consistent)
+      continue;
+
+    ConcreteInterpreter CI(LHS, Cache);
+
+    bool PCsHold = true, Uncertain = false;
+    for (auto &PC : PCs) {
+      auto L = CI.evaluateInst(PC.LHS);
+      auto R = CI.evaluateInst(PC.RHS);
+      if (!L.hasValue() || !R.hasValue()) {
+        // UB in a PC falsifies the antecedent of the query
+        if (LHSPathSensitive)
+          Uncertain = true;
+        else
+          PCsHold = false;
+      } else if (L.getValue() != R.getValue()) {
+        PCsHold = false;
+      }
+    }
+    if (!PCsHold || !blockPCsHold(CI, Uncertain))
+      continue;
+
+    auto Val = CI.evaluateInst(LHS);
+    if (!Val.hasValue()) {
+      // Poison and UB on the LHS allow any RHS
+      if (LHSPathSensitive)
+        Kinds[Index] = InputKind::Unknown;
+      continue;
+    }
+    if (Uncertain) {
+      Kinds[Index] = InputKind::Unknown;
+      continue;
+    }
+    Kinds[Index] = InputKind::Check;
+    LHSValues[Index] = Val.getValue() & LHS->DemandedBits;
+  }
+
+  for (unsigned i = 0; i < Blocks.size(); ++i)
+    Blocks[i]->ConcretePred = SavedPreds[i];
+  TableBuilt = true;
+}
+
+ExhaustiveVerifier::Result ExhaustiveVerifier::verify(Inst *RHS) {
+  if (!Applicable)
+    return Result::Unknown;
+  if (RHS->Width != LHS->Width) {
+    ++ExhaustiveUnknown;
+    return Result::Unknown;
+  }
+
+  std::set<Inst *> Insts;
+  collectInsts(RHS, Insts);
+  bool RHSPathSensitive = false;
+  for (auto I : Insts) {
+    if (isUnsupported(I) ||
+        (I->K == Inst::Var &&
+         std::find(Vars.begin(), Vars.end(), I) == Vars.end()) ||
+        (I->K == Inst::Phi &&
+         std::find(Blocks.begin(), Blocks.end(), I->B) == Blocks.end())) {
+      ++ExhaustiveUnknown;
+      return Result::Unknown;
+    }
+    if (I->K == Inst::Phi || I->K == Inst::Select)
+      RHSPathSensitive = true;
+  }
+
+  if (!TableBuilt)
+    buildTable();
+
+  Result Res;
+  if (Blocks.empty() && LHS->Width <= BitSlicedProgram::MaxWidth &&
+      BitSlicedProgram::isSupported(RHS)) {
+    Res = verifySliced(RHS, RHSPathSensitive);
+  } else {
+    std::vector<unsigned> SavedPreds;
+    for (auto B : Blocks)
+      SavedPreds.push_back(B->ConcretePred);
+
+    Res = Result::Valid;
+    for (uint64_t Index = 0; Index < NumInputs; ++Index) {
+      if (Kinds[Index] == InputKind::Skip)
+        continue;
+      if (Kinds[Index] == InputKind::Unknown) {
+        Res = Result::Unknown;
+        continue;
+      }
+
+      ValueCache Cache;
+      setInput(Index, Cache);
+      ConcreteInterpreter CI(RHS, Cache);
+      auto Val = CI.evaluateInst(RHS);
+      if (!Val.hasValue()) {
+        if (RHSPathSensitive) {
+          Res = Result::Unknown;
+          continue;
+        }
+        Res = Result::Invalid;
+        break;
+      }
+      if ((Val.getValue() & LHS->DemandedBits) != LHSValues[Index]) {
+        Res = Result::Invalid;
+        break;
+      }
+    }
+
+    for (unsigned i = 0; i < Blocks.size(); ++i)
+      Blocks[i]->ConcretePred = SavedPreds[i];
+  }
+
+  switch (Res) {
+  case Result::Valid: ++ExhaustiveValid; break;
+  case Result::Invalid: ++ExhaustiveInvalid; break;
+  case Result::Unknown: ++ExhaustiveUnknown; break;
+  }
+  return Res;
+}
+
+void ExhaustiveVerifier::buildSlicedTable() {
+  uint64_t NumSlices = (NumInputs + BitSliceLanes - 1) / BitSliceLanes;
+  CheckPlanes.assign(NumSlices, BitPlane{});
+  UnknownPlanes.assign(NumSlices, BitPlane{});
+  LHSPlanes.assign(NumSlices * LHS->Width, BitPlane{});
+
+  for (uint64_t Index = 0; Index < NumInputs; ++Index) {
+    uint64_t Slice = Index / BitSliceLanes;
+    unsigned Word = (Index % BitSliceLanes) / 64;
+    uint64_t Bit = uint64_t(1) << (Index % 64);
+    if (Kinds[Index] == InputKind::Unknown) {
+      UnknownPlanes[Slice].Words[Word] |= Bit;
+    } else if (Kinds[Index] == InputKind::Check) {
+      CheckPlanes[Slice].Words[Word] |= Bit;
+      for (unsigned B = 0; B < LHS->Width; ++B)
+        if (LHSValues[Index][B])
+          LHSPlanes[Slice * LHS->Width + B].Words[Word] |= Bit;
+    }
+  }
+  SlicedTableBuilt = true;
+}
+
+ExhaustiveVerifier::Result ExhaustiveVerifier::verifySliced(Inst *RHS,
+                                                            bool RHSPathSensitive) {
+  if (!SlicedTableBuilt)
+    buildSlicedTable();
+
+  // Bit P of the input index, within a slice, for P below 9
+  static const uint64_t IndexBits[] = {
+    0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+    0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL
+  };
+
+  BitSlicedProgram Program(RHS);
+  BitSlicedInputs Inputs;
+  for (auto V : Vars)
+    Inputs[V].resize(V->Width);
+
+  Result Res = Result::Valid;
+  unsigned W = LHS->Width;
+  for (uint64_t Slice = 0; Slice < CheckPlanes.size(); ++Slice) {
+    // Same layout as setInput(): each var takes the next bits of the index
+    unsigned Pos = 0;
+    for (auto V : Vars) {
+      for (unsigned B = 0; B < V->Width; ++B, ++Pos) {
+        auto &P = Inputs[V][B];
+        for (unsigned Word = 0; Word < BitSliceWords; ++Word) {
+          uint64_t Index = (Slice * BitSliceWords + Word) * 64;
+          if (Pos < 6)
+            P.Words[Word] = IndexBits[Pos];
+          else
+            P.Words[Word] = ((Index >> Pos) & 1) ? ~uint64_t(0) : 0;
+        }
+      }
+    }
+
+    // Without planes for every var of the RHS, Val means nothing
+    BitSlicedValue Val;
+    if (!Program.evaluate(Inputs, Val))
+      return Result::Unknown;
+
+    for (unsigned Word = 0; Word < BitSliceWords; ++Word) {
+      uint64_t Check = CheckPlanes[Slice].Words[Word];
+      uint64_t Undefined = Val.Poison.Words[Word] | Val.UB.Words[Word];
+      uint64_t Differs = 0;
+      for (unsigned B = 0; B < W; ++B)
+        if (LHS->DemandedBits[B])
+          Differs |= Val.Bits[B].Words[Word] ^
+                     LHSPlanes[Slice * W + B].Words[Word];
+      if (Check & ~Undefined & Differs)
+        return Result::Invalid;
+      if (Check & Undefined) {
+        if (!RHSPathSensitive)
+          return Result::Invalid;
+        Res = Result::Unknown;
+      }
+      if (UnknownPlanes[Slice].Words[Word])
+        Res = Result::Unknown;
+    }
+  }
+  return Res;
+}
@@ -44,6 +44,11 @@ static cl::opt<unsigned> MaxWiringAttempts("souper-synthesis-wiring-iterations",
     cl::Hidden,
     cl::desc("Number of convergence iterations of wirings that contain constants"),
     cl::init(10));
+static cl::opt<bool> IncrementalSolving("souper-synthesis-incremental",
+    cl::desc("Keep the wiring constraints in an interactive solver session "
+             "and only add new counterexamples and forbidden wirings to it "
+             "(default=false)"),
+    cl::init(false));
 
 }
 
@@ -123,6 +128,49 @@ std::error_code InstSynthesis::synthesize(SMTLIBSolver *SMTSolver,
   if (EC)
     return EC;
 
+  // In an incremental session the constraints above are asserted once, and
+  // so is the wiring of every new counterexample and every forbidden wiring,
+  // instead of being rebuilt into a fresh query on every iteration
+  std::unique_ptr<SMTLIBSolverSession> Session;
+  if (IncrementalSolving)
+    Session = SMTSolver->startSession();
+  // Only used to read back the values of the location variables and constants
+  std::string ModelQuery;
+  std::vector<Inst *> ModelQueryInsts;
+  // Constraints asserted under the output location constraint of the current
+  // component number, to be asserted again once it is popped
+  std::vector<Inst *> Scoped;
+  unsigned AssertedPCs = 0, AssertedCexs = 0;
+  auto AssertNew = [&]() -> std::error_code {
+    for (; AssertedPCs < WiringPCs.size(); ++AssertedPCs) {
+      auto const &PC = WiringPCs[AssertedPCs];
+      Inst *C = PC.RHS == TrueConst ? PC.LHS :
+                                      IC.getInst(Inst::Eq, 1, {PC.LHS, PC.RHS});
+      if (std::error_code EC = assertConstraint(*Session, C))
+        return EC;
+      Scoped.push_back(C);
+    }
+    for (; AssertedCexs < S.size(); ++AssertedCexs) {
+      Inst *C = getConcreteInputWiring(WiringQuery, S[AssertedCexs],
+                                       AssertedCexs ? std::to_string(AssertedCexs) : "");
+      if (std::error_code EC = assertConstraint(*Session, C))
+        return EC;
+      Scoped.push_back(C);
+    }
+    return std::error_code();
+  };
+  if (Session) {
+    if (DebugLevel > 1)
+      llvm::outs() << "using an incremental solver session\n";
+    ModelQuery = BuildQuery(IC, {}, WiringPCs, InstMapping(WiringQuery, TrueConst),
+                            &ModelQueryInsts, /*Precondition=*/0, /*Negate=*/true);
+    if (ModelQuery.empty())
+      return std::make_error_code(std::errc::value_too_large);
+    if ((EC = AssertNew()))
+      return EC;
+    Scoped.clear();
+  }
+
   // Not-working candidate programs that contain constants must be forbidden
   // explicitly because constants are not constrainted by the inputs. Still, it
   // can take many iterations to converge. Therefore, we limit the number
@@ -156,33 +204,50 @@ std::error_code InstSynthesis::synthesize(SMTLIBSolver *SMTSolver,
     // Init fresh loop PCs
     auto LoopPCs = WiringPCs;
     LoopPCs.emplace_back(CompConstraint, TrueConst);
+    if (Session) {
+      if ((EC = Session->push()))
+        return EC;
+      if ((EC = assertConstraint(*Session, CompConstraint)))
+        return EC;
+    }
 
     // --------------------------------------------------------------------------
     // -------------- Counterexample driven synthesis loop ----------------------
     // --------------------------------------------------------------------------
     unsigned Refinements = 0;
     while (true) {
-      Inst *Query = TrueConst;
-      // Put each set of concrete inputs into a separate copy of the WiringQuery
-      // Solve the synthesis constraint.
-      Query = initConcreteInputWirings(Query, WiringQuery, Refinements, S);
-
       // Each solution corresponds to a syntactically distinct and well-formed
       // straight-line program obtained by composition of given components
       std::vector<Inst *> ModelInsts;
       std::vector<llvm::APInt> ModelVals;
-      InstMapping Mapping(Query, TrueConst);
-      // Negate the query to get a SAT model.
-      // Don't use original BPCs/PCs, they are useless
-      std::string QueryStr = BuildQuery(IC, {}, LoopPCs, Mapping,
-                                        &ModelInsts, /*Precondition=*/0, /*Negate=*/true);
-      if (QueryStr.empty())
-        return std::make_error_code(std::errc::value_too_large);
+      std::string QueryStr;
       bool IsSat;
-      if (DebugLevel > 1)
-        llvm::outs() << "solving synthesis constraint.. ";
-      EC = SMTSolver->isSatisfiable(QueryStr, IsSat, ModelInsts.size(),
-                                    &ModelVals, Timeout);
+      if (Session) {
+        if ((EC = AssertNew()))
+          return EC;
+        ModelInsts = ModelQueryInsts;
+        if (DebugLevel > 1)
+          llvm::outs() << "solving synthesis constraint.. ";
+        EC = Session->checkSat(IsSat, ModelQuery, ModelInsts.size(),
+                               &ModelVals, Timeout);
+      } else {
+        Inst *Query = TrueConst;
+        // Put each set of concrete inputs into a separate copy of the WiringQuery
+        // Solve the synthesis constraint.
+        Query = initConcreteInputWirings(Query, WiringQuery, Refinements, S);
+
+        InstMapping Mapping(Query, TrueConst);
+        // Negate the query to get a SAT model.
+        // Don't use original BPCs/PCs, they are useless
+        QueryStr = BuildQuery(IC, {}, LoopPCs, Mapping,
+                              &ModelInsts, /*Precondition=*/0, /*Negate=*/true);
+        if (QueryStr.empty())
+          return std::make_error_code(std::errc::value_too_large);
+        if (DebugLevel > 1)
+          llvm::outs() << "solving synthesis constraint.. ";
+        EC = SMTSolver->isSatisfiable(QueryStr, IsSat, ModelInsts.size(),
+                                      &ModelVals, Timeout);
+      }
       if (EC)
         return EC;
 
@@ -294,6 +359,16 @@ std::error_code InstSynthesis::synthesize(SMTLIBSolver *SMTSolver,
         forbidInvalidCandWiring(CandWiring, LoopPCs, WiringPCs, IC);
       }
     }
+
+    if (Session) {
+      // Everything learned for this component number holds for all others
+      if ((EC = AssertNew()) || (EC = Session->pop()))
+        return EC;
+      for (auto C : Scoped)
+        if ((EC = assertConstraint(*Session, C)))
+          return EC;
+      Scoped.clear();
+    }
   }
 
   if (DebugLevel > 0) {
@@ -1418,18 +1493,10 @@ Inst *InstSynthesis::initConcreteInputWirings(Inst *Query, Inst *WiringQuery,
                      << " to " << Input.second->Val << "\n";
       }
     }
-    if (K > 0) {
-      // Starting with the second concrete input set,
-      // copy component input variables for query separation
-      for (auto const &E : LocInstMap) {
-        if (E.first.find(COMP_INPUT_PREFIX) != std::string::npos) {
-          auto In = E.second.second;
-          std::string Name = E.first + LOC_SEP + std::to_string(Refinements);
-          InputMap[In] = LIC->createVar(In->Width, Name);
-        }
-      }
-    }
-    Inst *Copy = replaceVars(WiringQuery, *LIC, InputMap);
+    // Starting with the second concrete input set,
+    // copy component input variables for query separation
+    Inst *Copy = getConcreteInputWiring(WiringQuery, InputMap,
+                                        K > 0 ? std::to_string(Refinements) : "");
     Query = LIC->getInst(Inst::And, 1, {Query, Copy});
     Query->DemandedBits = APInt::getAllOnes(Query->Width);
   }
@@ -1437,6 +1504,32 @@ Inst *InstSynthesis::initConcreteInputWirings(Inst *Query, Inst *WiringQuery,
   return Query;
 }
 
+Inst *InstSynthesis::getConcreteInputWiring(Inst *WiringQuery,
+                                            std::map<Inst *, Inst *> InputMap,
+                                            const std::string &Suffix) {
+  if (!Suffix.empty()) {
+    for (auto const &E : LocInstMap) {
+      if (E.first.find(COMP_INPUT_PREFIX) != std::string::npos) {
+        auto In = E.second.second;
+        std::string Name = E.first + LOC_SEP + Suffix;
+        InputMap[In] = LIC->createVar(In->Width, Name);
+      }
+    }
+  }
+  return replaceVars(WiringQuery, *LIC, InputMap);
+}
+
+std::error_code InstSynthesis::assertConstraint(SMTLIBSolverSession &Session,
+                                                Inst *C) {
+  // Negated like the synthesis query, so that C itself is asserted
+  std::string QueryStr = BuildQuery(*LIC, {}, {}, InstMapping(C, TrueConst),
+                                    /*ModelVars=*/0, /*Precondition=*/0,
+                                    /*Negate=*/true);
+  if (QueryStr.empty())
+    return std::make_error_code(std::errc::value_too_large);
+  return Session.assertQuery(QueryStr);
+}
+
 void InstSynthesis::constrainConstWiring(const Inst *Cand,
                                          const ProgramWiring &CandWiring,
                                          std::map<ProgramWiring, unsigned> &NotWorkingConstWirings,
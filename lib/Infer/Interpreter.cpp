@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "llvm/ADT/SmallVector.h"
 #include "souper/Infer/Interpreter.h"
 
 namespace souper {
@@ -106,7 +107,7 @@ namespace souper {
   }
 
   EvalValue evaluateSDiv(llvm::APInt a, llvm::APInt b) {
-    if (b == 0 || (a.isMinSignedValue() && b == -1))
+    if (b == 0 || (a.isMinSignedValue() && b.isAllOnes()))
       return EvalValue::ub();
     return {a.sdiv(b)};
   }
@@ -139,7 +140,8 @@ namespace souper {
 #define ARG1 Args[1].getValue()
 #define ARG2 Args[2].getValue()
 
-  EvalValue ConcreteInterpreter::evaluateSingleInst(Inst *Inst, std::vector<EvalValue> &Args) {
+  EvalValue evaluateSingleInst(Inst *Inst, llvm::ArrayRef<EvalValue> Args,
+                               bool EvalPhiFirstBranch) {
     // UB propagates unconditionally
     for (auto &A : Args)
       if (A.K == EvalValue::ValueKind::UB)
@@ -238,7 +240,7 @@ namespace souper {
 
     case Inst::SDiv:
       if (ARG1 == 0 ||
-          (ARG0.isMinSignedValue() && ARG1 == -1))
+          (ARG0.isMinSignedValue() && ARG1.isAllOnes()))
         return EvalValue::ub();
       return {ARG0.sdiv(ARG1)};
 
@@ -456,16 +458,22 @@ namespace souper {
 #undef ARG2
 
   EvalValue ConcreteInterpreter::evaluateInst(Inst *Root) {
-    if (Cache.find(Root) != Cache.end())
-      return Cache[Root];
+    if (!Memoize)
+      Overlay.clear();
+    return evaluate(Root);
+  }
+
+  EvalValue ConcreteInterpreter::evaluate(Inst *Root) {
+    if (auto V = Cache.lookup(Root))
+      return *V;
+    if (auto V = Overlay.lookup(Root))
+      return *V;
 
-    // TODO SmallVector
-    std::vector<EvalValue> EvaluatedArgs;
+    llvm::SmallVector<EvalValue, 3> EvaluatedArgs;
     for (auto &&I : Root->Ops)
-      EvaluatedArgs.push_back(evaluateInst(I));
-    auto Result = evaluateSingleInst(Root, EvaluatedArgs);
-    if (CacheWritable)
-      Cache[Root] = Result;
+      EvaluatedArgs.push_back(evaluate(I));
+    auto Result = evaluateSingleInst(Root, EvaluatedArgs, EvalPhiFirstBranch);
+    (CacheWritable ? Cache : Overlay)[Root] = Result;
     return Result;
   }
 }
@@ -35,8 +35,8 @@ std::vector<std::map<Inst *, llvm::KnownBits>>
     std::map<Inst *, VarInfo> OriginalState;
 
     for (auto V : Vars) {
-      OriginalState[V].OriginalOne = V->KnownOnes;
-      OriginalState[V].OriginalZero = V->KnownZeros;
+      OriginalState[V].OriginalOne = V->Facts->KnownOnes;
+      OriginalState[V].OriginalZero = V->Facts->KnownZeros;
     }
 
     std::vector<std::map<Inst *, llvm::KnownBits>> Results;
@@ -67,8 +67,8 @@ std::vector<std::map<Inst *, llvm::KnownBits>>
       if (!Results.empty()) {
         auto KB = Results.back();
         for (auto V : Vars) {
-          V->KnownOnes = OriginalState[V].OriginalOne;
-          V->KnownZeros = OriginalState[V].OriginalZero;
+          V->Facts->KnownOnes = OriginalState[V].OriginalOne;
+          V->Facts->KnownZeros = OriginalState[V].OriginalZero;
         }
 
         for (size_t i = 0; i < Vars.size(); ++i) {
@@ -123,17 +123,17 @@ std::vector<std::map<Inst *, llvm::KnownBits>>
         }
       }
       for (unsigned J = 0; J < Vars.size(); ++J) {
-        Vars[J]->KnownZeros = Known[Vars[J]].Zero;
-        Vars[J]->KnownOnes = Known[Vars[J]].One;
+        Vars[J]->Facts->KnownZeros = Known[Vars[J]].Zero;
+        Vars[J]->Facts->KnownOnes = Known[Vars[J]].One;
       }
       for (unsigned J = 0; J < Vars.size(); ++J) {
         auto W = Vars[J]->Width;
         for (unsigned I=0; I< W; I++) {
           if (Known[Vars[J]].Zero[I]) {
             APInt ZeroGuess = Known[Vars[J]].Zero & ~APInt::getOneBitSet(W, I);
-            auto OldZero = Vars[J]->KnownZeros;
-            Vars[J]->KnownZeros = ZeroGuess;
-            Vars[J]->KnownOnes = Known[Vars[J]].One;
+            auto OldZero = Vars[J]->Facts->KnownZeros;
+            Vars[J]->Facts->KnownZeros = ZeroGuess;
+            Vars[J]->Facts->KnownOnes = Known[Vars[J]].One;
             if (DebugLevel >= 3)
               PrintReplacement(llvm::outs(), SC.BPCs, PCCopy, Mapping);
 
@@ -149,7 +149,7 @@ std::vector<std::map<Inst *, llvm::KnownBits>>
               Known[Vars[J]].Zero = ZeroGuess;
 
             } else {
-              Vars[J]->KnownZeros = OldZero;
+              Vars[J]->Facts->KnownZeros = OldZero;
               if (DebugLevel >= 3)
                 llvm::outs() << "Invalid\n";
             }
@@ -157,9 +157,9 @@ std::vector<std::map<Inst *, llvm::KnownBits>>
 
           if (Known[Vars[J]].One[I]) {
             APInt OneGuess = Known[Vars[J]].One & ~APInt::getOneBitSet(W, I);
-            auto OldOne = Vars[J]->KnownOnes;
-            Vars[J]->KnownZeros = Known[Vars[J]].Zero;
-            Vars[J]->KnownOnes = OneGuess;
+            auto OldOne = Vars[J]->Facts->KnownOnes;
+            Vars[J]->Facts->KnownZeros = Known[Vars[J]].Zero;
+            Vars[J]->Facts->KnownOnes = OneGuess;
 
             if (DebugLevel >= 3)
               PrintReplacement(llvm::outs(), SC.BPCs, PCCopy, Mapping);
@@ -175,7 +175,7 @@ std::vector<std::map<Inst *, llvm::KnownBits>>
                 llvm::outs() << "Valid\n";
               Known[Vars[J]].One = OneGuess;
             } else {
-              Vars[J]->KnownOnes = OldOne;
+              Vars[J]->Facts->KnownOnes = OldOne;
               if (DebugLevel >= 3) {
                 llvm::outs() << "Invalid\n";
               }
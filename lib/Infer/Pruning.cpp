@@ -13,11 +13,20 @@
 // limitations under the License.
 
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
 #include "souper/Infer/AbstractInterpreter.h"
+#include "souper/Infer/Bytecode.h"
 #include "souper/Infer/Pruning.h"
 #include "souper/Extractor/Candidates.h"
+#include <chrono>
 #include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <random>
 
 namespace {
   static llvm::cl::opt<bool> EnableHeavyDataflowPruning("souper-dataflow-pruning-heavy",
@@ -47,6 +56,89 @@ namespace {
   static llvm::cl::opt<bool> EnableBB("souper-dataflow-pruning-bb",
     llvm::cl::desc("Prune with bivalent-bits analysis (default=true)"),
     llvm::cl::init(true));
+
+  static llvm::cl::opt<unsigned> NumBatchInputs("souper-dataflow-pruning-batch-inputs",
+    llvm::cl::desc("Number of random inputs concrete guesses are evaluated on "
+                   "in batches, 0 to disable (default=1024)"),
+    llvm::cl::init(1024));
+
+  static llvm::cl::opt<unsigned> MaxCounterexamples("souper-dataflow-pruning-counterexamples",
+    llvm::cl::desc("Number of solver counterexamples kept as pruning inputs, "
+                   "0 to disable (default=32)"),
+    llvm::cl::init(32));
+
+  static llvm::cl::opt<unsigned> MemoGuesses("souper-dataflow-pruning-memo-guesses",
+    llvm::cl::desc("Number of guesses whose analysis results are kept for "
+                   "later guesses before starting over, 0 to disable "
+                   "(default=4096)"),
+    llvm::cl::init(4096));
+
+  static llvm::cl::opt<std::string> StatsJSONFile("souper-dataflow-pruning-stats-json",
+    llvm::cl::desc("Append the pruning statistics of each synthesis problem "
+                   "to this file, one JSON object per line"),
+    llvm::cl::init(""));
+}
+
+#define DEBUG_TYPE "souper"
+
+STATISTIC(Guesses, "Number of guesses checked by dataflow pruning");
+STATISTIC(GuessesPruned, "Number of guesses pruned by dataflow pruning");
+#define PRUNING_TECHNIQUE(Name, Key, Desc) \
+  STATISTIC(Pruned##Name, "Number of guesses pruned using " Desc); \
+  STATISTIC(Micros##Name, "Microseconds spent in " Desc);
+#include "souper/Infer/PruningTechniques.def"
+
+namespace {
+  using souper::PruningManager;
+
+  llvm::Statistic *const PrunedStats[] = {
+#define PRUNING_TECHNIQUE(Name, Key, Desc) &Pruned##Name,
+#include "souper/Infer/PruningTechniques.def"
+  };
+
+  llvm::Statistic *const MicrosStats[] = {
+#define PRUNING_TECHNIQUE(Name, Key, Desc) &Micros##Name,
+#include "souper/Infer/PruningTechniques.def"
+  };
+
+  const char *const TechniqueKeys[] = {
+#define PRUNING_TECHNIQUE(Name, Key, Desc) Key,
+#include "souper/Infer/PruningTechniques.def"
+  };
+
+  // Counts a check with a technique and, if Time is set, adds the time until
+  // the end of the scope
+  class TechniqueScope {
+    PruningManager::TechniqueStats &S;
+    bool Time;
+    std::chrono::steady_clock::time_point Start;
+  public:
+    TechniqueScope(PruningManager::TechniqueStats &S, bool Time)
+      : S(S), Time(Time) {
+      ++S.Checks;
+      if (Time)
+        Start = std::chrono::steady_clock::now();
+    }
+    ~TechniqueScope() {
+      if (Time)
+        S.Time += std::chrono::steady_clock::now() - Start;
+    }
+  };
+
+  // Runs the analysis of a technique within a TechniqueScope
+  template <typename F>
+  auto runTechnique(PruningManager::TechniqueStats &S, bool Time, F Analysis) {
+    TechniqueScope Scope(S, Time);
+    return Analysis();
+  }
+
+  uint64_t getMicros(std::chrono::nanoseconds Time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Time).count();
+  }
+
+  // Serializes the appends to StatsJSONFile of PruningManagers on different
+  // threads
+  std::mutex StatsJSONMutex;
 }
 
 namespace souper {
@@ -166,6 +258,9 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
   std::set<souper::Inst *> Constants;
   getConstants(RHS, Constants);
 
+  if (!Memos.empty() && ++MemoizedGuesses > MemoGuesses)
+    clearMemos();
+
   if (HA.findIfHole(RHS)) {
     // Do not attempt pruning if the RHS will provably produce top
     // for all abstract interpreters
@@ -173,6 +268,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
   }
 
   if (EnableBB && !Constants.empty()) {
+    TechniqueScope Scope(Stats[PruneRestrictedBits], TimeTechniques);
     auto RestrictedBits = RestrictedBitsAnalysis().findRestrictedBits(RHS);
     if ((~RestrictedBits & (LHSKnownBitsNoSpec.Zero | LHSKnownBitsNoSpec.One)) != 0) {
 //     if (RestrictedBits == 0 && (LHSKB.Zero != 0 || LHSKB.One != 0)) {
@@ -184,7 +280,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
         std::string Str(S);
         llvm::errs() << "  RB    : " << Str << "\n";
       }
-      return true;
+      return pruned(PruneRestrictedBits);
     }
 
 //     auto LHSCR = ConstantRangeAnalysis().findConstantRange(SC.LHS, BlankCI, false);
@@ -214,6 +310,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
   }
 
   if (!HasHole && EnableDemandedBitsPruning && EnableRB) {
+    TechniqueScope Scope(Stats[PruneDemandedBits], TimeTechniques);
     auto DontCareBits = DontCareBitsAnalysis().findDontCareBits(RHS);
 
     for (auto Pair : LHSMustDemandedBits) {
@@ -229,13 +326,32 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
                        << S2 << "\n";
           llvm::errs() << "  pruned using demanded bits analysis.\n";
         }
-        return true;
+        return pruned(PruneDemandedBits);
+      }
+    }
+  }
+
+  if (RHSIsConcrete && !BatchLHSVals.empty() &&
+      BatchProgram::isSupported(RHS)) {
+    TechniqueScope Scope(Stats[PruneBatch], TimeTechniques);
+    BatchResult R;
+    if (BatchProgram(RHS).evaluate(BatchInputVals, R)) {
+      uint64_t Demanded = SC.LHS->DemandedBits != 0 ?
+        SC.LHS->DemandedBits.getZExtValue() : ~0ULL;
+      for (size_t L = 0; L < BatchLHSVals.size(); ++L) {
+        if (R.hasValue(L) && ((R.Vals[L] ^ BatchLHSVals[L]) & Demanded)) {
+          if (StatsLevel > 2)
+            llvm::errs() << "  pruned using batched concrete evaluation!\n";
+          return pruned(PruneBatch);
+        }
       }
     }
   }
 
   bool FoundNonTopAnalysisResult = false;
   ForcedValueAnalysis FVA(RHS);
+  // Concrete RHSs are compiled once and then run on every input
+  std::optional<BytecodeProgram> RHSProgram;
   for (int I = 0; I < InputVals.size(); ++I) {
     if (I > 9 && !FoundNonTopAnalysisResult) {
       break;
@@ -260,7 +376,8 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
 
     if (LHSHasPhi && AbstractInterpretPhi) {
       auto LHSCR = LHSConstantRange[I];
-      auto RHSCR = ConstantRangeAnalysis().findConstantRange(RHS, ConcreteInterpreters[I]);
+      auto RHSCR = runTechnique(Stats[PrunePhiCR], TimeTechniques,
+                                [&] { return findConstantRange(RHS, I); });
       if (!RHSCR.isFullSet()) {
         FoundNonTopAnalysisResult = true;
       }
@@ -275,11 +392,12 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
               llvm::errs() << "Inst had a symbolic const.";
             }
         }
-        return true;
+        return pruned(PrunePhiCR);
       }
 
       auto LHSKB = LHSKnownBits[I];
-      auto RHSKB = KnownBitsAnalysis().findKnownBits(RHS, ConcreteInterpreters[I]);
+      auto RHSKB = runTechnique(Stats[PrunePhiKB], TimeTechniques,
+                                [&] { return findKnownBits(RHS, I); });
       if (!RHSKB.isUnknown()) {
         FoundNonTopAnalysisResult = true;
       }
@@ -294,7 +412,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
               llvm::errs() << "Inst had a symbolic const.";
             }
         }
-        return true;
+        return pruned(PrunePhiKB);
       }
 
     } else {
@@ -304,7 +422,8 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
         if (StatsLevel > 2)
           llvm::errs() << "  LHS value = " << Val << "\n";
         if (!RHSIsConcrete) {
-          auto CR = ConstantRangeAnalysis().findConstantRange(RHS, ConcreteInterpreters[I]);
+          auto CR = runTechnique(Stats[PruneCR], TimeTechniques,
+                                 [&] { return findConstantRange(RHS, I); });
           if (StatsLevel > 2)
             llvm::errs() << "  RHS ConstantRange = " << CR << "\n";
           if (EnableCR && !CR.contains(Val)) {
@@ -317,9 +436,10 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
               }
               llvm::errs() << "\n";
             }
-            return true;
+            return pruned(PruneCR);
           }
-          auto KB = KnownBitsAnalysis().findKnownBits(RHS, ConcreteInterpreters[I]);
+          auto KB = runTechnique(Stats[PruneKB], TimeTechniques,
+                                 [&] { return findKnownBits(RHS, I); });
           if (StatsLevel > 2)
             llvm::errs() << "  RHS KnownBits = " << KnownBitsAnalysis::knownBitsString(KB) << "\n";
           if (EnableKB && (KB.Zero & Val) != 0 || (KB.One & ~Val) != 0) {
@@ -332,10 +452,11 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
               }
               llvm::errs() << "\n";
             }
-            return true;
+            return pruned(PruneKB);
           }
 
           if (EnableFB && RHS->nReservedConsts > 0) {
+            TechniqueScope Scope(Stats[PruneForcedValue], TimeTechniques);
             if (FVA.force(Val, ConcreteInterpreters[I])) {
               // failed to force
               if (StatsLevel > 2) {
@@ -347,7 +468,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
                 }
                 llvm::errs() << "\n";
               }
-              return true;
+              return pruned(PruneForcedValue);
             }
           }
 
@@ -355,6 +476,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
             // !Concrete and !HasHole, must have a Symbolic Constant
             for (auto C : Constants) {
               if (ConstantLimits[C].size() <= MAX_PARTS) {
+                TechniqueScope Scope(Stats[PruneConstantCR], TimeTechniques);
                 ConstantLimits[C] = constantRangeNarrowing(C, Val, RHS,
                                       ConcreteInterpreters[I],
                                       ConstantLimits[C]);
@@ -372,14 +494,17 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
                       llvm::errs() << "Inst had a symbolic const.";
                     llvm::errs() << "\n";
                   }
-                  return true;
+                  return pruned(PruneConstantCR);
                 }
               }
 
-              auto KBRefinement = knownBitsNarrowing(C, Val, RHS,
-                                    ConcreteInterpreters[I],
-                                    ConstantKnownNotZero[C],
-                                    ConstantKnownNotOne[C]);
+              auto KBRefinement = runTechnique(
+                Stats[PruneConstantKB], TimeTechniques, [&] {
+                  return knownBitsNarrowing(C, Val, RHS,
+                                            ConcreteInterpreters[I],
+                                            ConstantKnownNotZero[C],
+                                            ConstantKnownNotOne[C]);
+                });
               ConstantKnownNotZero[C] = KBRefinement.first;
               ConstantKnownNotOne[C] = KBRefinement.second;
               llvm::KnownBits KNOTB;
@@ -395,7 +520,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
                   llvm::errs() << "Inst had a symbolic const.";
                   llvm::errs() << "\n";
                 }
-                return true;
+                return pruned(PruneConstantKB);
               } else {
                 if (StatsLevel > 2) {
                   llvm::errs() << "  KNOTB refined to: " <<
@@ -414,6 +539,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
                         llvm::errs() << "  pruned using KNOTB instantiation!  ";
                         llvm::errs() << "Inst had a symbolic const.\n";
                       }
+                      // Already counted for the technique that pruned it
                       return true;
                     }
                   }
@@ -423,7 +549,15 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
             }
           }
         } else {
-          auto RHSV = ConcreteInterpreters[I].evaluateInst(RHS);
+          TechniqueScope Scope(Stats[PruneConcrete], TimeTechniques);
+          EvalValue RHSV;
+          if (!Memos.empty()) {
+            RHSV = ConcreteInterpreters[I].evaluateInst(RHS);
+          } else {
+            if (!RHSProgram)
+              RHSProgram.emplace(RHS);
+            RHSV = RHSProgram->evaluate(InputVals[I]);
+          }
           if (RHSV.hasValue()) {
             auto RVal = RHSV.getValue();
             if (SC.LHS->DemandedBits != 0) {
@@ -435,7 +569,7 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
                 llvm::errs() << "  RHS value = " << RHSV.getValue() << "\n";
                 llvm::errs() << "  pruned using concrete interpreter!\n";
               }
-              return true;
+              return pruned(PruneConcrete);
             }
           }
         }
@@ -463,14 +597,15 @@ bool PruningManager::isInfeasible(souper::Inst *RHS,
 
         if (ResidualSize < 8192 && Rs.size() < 3) {
           // TODO: Tune. These thresholds control when the solver is involved
-          C.first->RangeRefinement = Rs;
+          C.first->Facts->RangeRefinement = Rs;
         }
       }
     }
   }
 
   if (!LHSHasPhi && EnableHeavyDataflowPruning) {
-    return isInfeasibleWithSolver(RHS, StatsLevel);
+    TechniqueScope Scope(Stats[PruneSolver], TimeTechniques);
+    return isInfeasibleWithSolver(RHS, StatsLevel) && pruned(PruneSolver);
   } else {
     return false;
   }
@@ -557,6 +692,70 @@ PruningManager::PruningManager(
                     StatsLevel(StatsLevel_),
                     InputVars(Inputs_) {}
 
+PruningManager::~PruningManager() {
+  // Pruning was disabled
+  if (!DataflowPrune)
+    return;
+
+  Guesses += TotalGuesses;
+  GuessesPruned += NumPruned;
+  for (unsigned T = 0; T < NumTechniques; ++T) {
+    *PrunedStats[T] += Stats[T].Pruned;
+    *MicrosStats[T] += getMicros(Stats[T].Time);
+  }
+
+  if (!StatsJSONFile.empty()) {
+    // The line is appended with a single write so that it is not interleaved
+    // with the lines of other threads, or of other processes sharing the file
+    std::string Line;
+    llvm::raw_string_ostream LineOut(Line);
+    printStatsJSON(LineOut);
+    LineOut << "\n";
+    LineOut.flush();
+
+    std::lock_guard<std::mutex> Guard(StatsJSONMutex);
+    std::error_code EC;
+    llvm::raw_fd_ostream Out(StatsJSONFile, EC, llvm::sys::fs::OF_Append);
+    if (EC) {
+      llvm::errs() << "Could not open " << StatsJSONFile << ": "
+                   << EC.message() << "\n";
+      return;
+    }
+    Out.SetUnbuffered();
+    Out << Line;
+  }
+}
+
+void PruningManager::printStats(llvm::raw_ostream &out) {
+  out << "Dataflow Pruned " << NumPruned << "/" << TotalGuesses << "\n";
+  for (unsigned T = 0; T < NumTechniques; ++T) {
+    if (!Stats[T].Checks)
+      continue;
+    out << "  " << TechniqueKeys[T] << ": pruned " << Stats[T].Pruned
+        << " in " << Stats[T].Checks << " checks";
+    if (TimeTechniques)
+      out << ", " << getMicros(Stats[T].Time) << " us";
+    out << "\n";
+  }
+}
+
+void PruningManager::printStatsJSON(llvm::raw_ostream &out) {
+  llvm::json::OStream J(out);
+  J.object([&] {
+    J.attribute("guesses", TotalGuesses);
+    J.attribute("pruned", NumPruned);
+    J.attributeObject("techniques", [&] {
+      for (unsigned T = 0; T < NumTechniques; ++T) {
+        J.attributeObject(TechniqueKeys[T], [&] {
+          J.attribute("checks", Stats[T].Checks);
+          J.attribute("pruned", Stats[T].Pruned);
+          J.attribute("micros", getMicros(Stats[T].Time));
+        });
+      }
+    });
+  });
+}
+
 void PruningManager::init() {
   setPhiConcretePreds(SC.LHS);
   Ante = SC.IC.getConst(llvm::APInt(1, true));
@@ -573,6 +772,9 @@ void PruningManager::init() {
     ConcreteInterpreters.emplace_back(SC.LHS, Input);
   }
 
+  if (NumBatchInputs)
+    initBatchInputs();
+
   if (hasGivenInst(SC.LHS, [](Inst *I){ return I->K == Inst::Phi;})) {
     LHSHasPhi = true;
     if (AbstractInterpretPhi) {
@@ -584,6 +786,17 @@ void PruningManager::init() {
     }
   }
 
+  // With a phi, values depend on the concrete predecessors of blocks,
+  // which constant synthesis changes between guesses
+  if (MemoGuesses && !LHSHasPhi) {
+    for (auto &CI : ConcreteInterpreters)
+      CI.setMemoize(true);
+    Memos.resize(InputVals.size());
+  }
+
+  TimeTechniques = StatsLevel > 0 || !StatsJSONFile.empty() ||
+                   llvm::AreStatisticsEnabled();
+
   if (StatsLevel > 1) {
     DataflowPrune= [this](Inst *I, std::vector<Inst *> &RI) {
       TotalGuesses++;
@@ -601,7 +814,7 @@ void PruningManager::init() {
       llvm::errs() << "Could not prune." << Inst::getKindName(I->K) << "\n\n";
       return true;
     };
-  } else if (StatsLevel == 1) {
+  } else {
       DataflowPrune= [this](Inst *I, std::vector<Inst *> &RI) {
       TotalGuesses++;
       if (isInfeasible(I, StatsLevel)) {
@@ -610,10 +823,6 @@ void PruningManager::init() {
       }
       return true;
     };
-  } else {
-    DataflowPrune= [this](Inst *I, std::vector<Inst *> &RI) {
-      return !isInfeasible(I, StatsLevel);
-    };
   }
 
   ConcreteInterpreter BlankCI;
@@ -633,36 +842,36 @@ void PruningManager::init() {
 bool isDataflowConsistent(ValueCache &Cache) {
   for (auto &&Pair : Cache) {
     if (Pair.second.hasValue()) {
-      auto *I = Pair.first;
+      const VarFacts &F = *Pair.first->Facts;
       llvm::APInt V = Pair.second.getValue();
 
-      if ((I->KnownZeros & V) != 0 || (I->KnownOnes & ~V) != 0) {
+      if ((F.KnownZeros & V) != 0 || (F.KnownOnes & ~V) != 0) {
         return false;
       }
 
-      if (!I->Range.isFullSet()) {
-        if (!I->Range.contains(V)) {
+      if (!F.Range.isFullSet()) {
+        if (!F.Range.contains(V)) {
           return false;
         }
       }
 
-      if (I->NonZero && !V) {
+      if (F.NonZero && !V) {
         return false;
       }
 
-      if (I->NonNegative && V.isNegative()) {
+      if (F.NonNegative && V.isNegative()) {
         return false;
       }
 
-      if (I->PowOfTwo && !V.isPowerOf2()) {
+      if (F.PowOfTwo && !V.isPowerOf2()) {
         return false;
       }
 
-      if (I->Negative && !V.isNegative()) {
+      if (F.Negative && !V.isNegative()) {
         return false;
       }
 
-      if (I->NumSignBits > V.getNumSignBits()) {
+      if (F.NumSignBits > V.getNumSignBits()) {
         return false;
       }
     }
@@ -852,6 +1061,156 @@ std::vector<ValueCache> PruningManager::generateInputSets(
   return InputSets;
 }
 
+void PruningManager::initBatchInputs() {
+  if (!BatchProgram::isSupported(SC.LHS) || !BatchProgram::isSupported(Ante))
+    return;
+
+  // Same mix as generateInputSets: edge values, small values and random ones
+  BatchInputs Candidates;
+  Candidates.NumLanes = NumBatchInputs;
+  std::mt19937_64 Rand(0);
+  for (auto &&I : InputVars) {
+    auto &Col = Candidates.Columns[I];
+    if (!Col.empty())
+      continue;
+    for (unsigned L = 0; L < NumBatchInputs; ++L) {
+      llvm::APInt Val(I->Width, Rand());
+      switch (Rand() % 4) {
+      case 0:
+        Val = getSpecialAPInt("abcde"[Rand() % 5], I->Width);
+        break;
+      case 1:
+        Val = llvm::APInt(I->Width, Rand() % I->Width);
+        break;
+      }
+      Col.push_back(Val.getZExtValue());
+    }
+  }
+
+  BatchResult AnteR, LHSR;
+  if (!BatchProgram(Ante).evaluate(Candidates, AnteR) ||
+      !BatchProgram(SC.LHS).evaluate(Candidates, LHSR))
+    return;
+
+  for (auto &&C : Candidates.Columns)
+    BatchInputVals.Columns[C.first];
+  for (unsigned L = 0; L < NumBatchInputs; ++L) {
+    if (!LHSR.hasValue(L) || !AnteR.hasValue(L) || AnteR.Vals[L] != 1)
+      continue;
+    ValueCache Cache;
+    for (auto &&C : Candidates.Columns)
+      Cache[C.first] = EvalValue(llvm::APInt(C.first->Width, C.second[L]));
+    if (!isDataflowConsistent(Cache))
+      continue;
+    for (auto &&C : Candidates.Columns)
+      BatchInputVals.Columns[C.first].push_back(C.second[L]);
+    BatchLHSVals.push_back(LHSR.Vals[L]);
+  }
+  BatchInputVals.NumLanes = BatchLHSVals.size();
+
+  if (StatsLevel > 2)
+    llvm::errs() << BatchLHSVals.size() << " of " << NumBatchInputs
+                 << " batch inputs satisfy the PCs\n";
+}
+
+bool PruningManager::addCounterexample(const std::vector<Inst *> &ModelInsts,
+                                       const std::vector<llvm::APInt> &ModelVals) {
+  // Inputs of a phi LHS come with their own abstract LHS results
+  if (!MaxCounterexamples || LHSHasPhi)
+    return false;
+
+  std::unordered_map<Inst *, llvm::APInt> Model;
+  for (unsigned J = 0; J != ModelInsts.size() && J != ModelVals.size(); ++J)
+    Model.insert({ModelInsts[J], ModelVals[J]});
+
+  ValueCache Cache;
+  for (auto &&I : InputVars) {
+    if (I->K != souper::Inst::Var)
+      continue;
+    auto It = Model.find(I);
+    if (It == Model.end() || It->second.getBitWidth() != I->Width)
+      return false;
+    Cache[I] = {It->second};
+  }
+
+  for (auto &&VC : InputVals)
+    if (getInputDistance(Cache, VC) == 0)
+      return false;
+
+  if (!isInputValid(Cache))
+    return false;
+  ConcreteInterpreter CI(SC.LHS, Cache);
+  if (!CI.evaluateInst(SC.LHS).hasValue())
+    return false;
+
+  // Up front, so isInfeasible() gets to them before it gives up
+  InputVals.insert(InputVals.begin(), std::move(Cache));
+  if (!Memos.empty()) {
+    CI.setMemoize(true);
+    Memos.insert(Memos.begin(), InputMemo());
+  }
+  ConcreteInterpreters.insert(ConcreteInterpreters.begin(), std::move(CI));
+  if (++NumCounterexamples > MaxCounterexamples)
+    evictCounterexample();
+
+  if (StatsLevel > 2)
+    llvm::errs() << "Added a counterexample, " << NumCounterexamples
+                 << " kept\n";
+  return true;
+}
+
+unsigned PruningManager::getInputDistance(ValueCache &A, ValueCache &B) {
+  unsigned Distance = 0;
+  for (auto &&I : InputVars) {
+    if (I->K != souper::Inst::Var)
+      continue;
+    Distance += (A[I].getValue() ^ B[I].getValue()).popcount();
+  }
+  return Distance;
+}
+
+void PruningManager::evictCounterexample() {
+  // The counterexample nearest to another one adds the least variety, ties
+  // go to the oldest
+  unsigned Victim = 0;
+  unsigned VictimNearest = std::numeric_limits<unsigned>::max();
+  for (unsigned I = 0; I < NumCounterexamples; ++I) {
+    unsigned Nearest = std::numeric_limits<unsigned>::max();
+    for (unsigned J = 0; J < NumCounterexamples; ++J)
+      if (J != I)
+        Nearest = std::min(Nearest, getInputDistance(InputVals[I], InputVals[J]));
+    if (Nearest <= VictimNearest) {
+      Victim = I;
+      VictimNearest = Nearest;
+    }
+  }
+  InputVals.erase(InputVals.begin() + Victim);
+  ConcreteInterpreters.erase(ConcreteInterpreters.begin() + Victim);
+  if (!Memos.empty())
+    Memos.erase(Memos.begin() + Victim);
+  --NumCounterexamples;
+}
+
+void PruningManager::clearMemos() {
+  for (auto &CI : ConcreteInterpreters)
+    CI.clearMemo();
+  for (auto &M : Memos)
+    M = InputMemo();
+  MemoizedGuesses = 0;
+}
+
+llvm::KnownBits PruningManager::findKnownBits(Inst *RHS, unsigned Input) {
+  if (Memos.empty())
+    return KnownBitsAnalysis().findKnownBits(RHS, ConcreteInterpreters[Input]);
+  return Memos[Input].KB.findKnownBits(RHS, ConcreteInterpreters[Input]);
+}
+
+llvm::ConstantRange PruningManager::findConstantRange(Inst *RHS, unsigned Input) {
+  if (Memos.empty())
+    return ConstantRangeAnalysis().findConstantRange(RHS, ConcreteInterpreters[Input]);
+  return Memos[Input].CR.findConstantRange(RHS, ConcreteInterpreters[Input]);
+}
+
 void ExprInfo::analyze(Inst *Root,
                        std::unordered_map<Inst *, ExprInfo> &Result) {
   ExprInfo EI{false, false, false};
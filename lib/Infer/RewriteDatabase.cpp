@@ -0,0 +1,420 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "llvm/Support/raw_ostream.h"
+#include "souper/Infer/RewriteDatabase.h"
+
+#include <algorithm>
+
+extern unsigned DebugLevel;
+
+using namespace souper;
+using namespace llvm;
+
+namespace {
+
+// Bounds on the tree expansion of an LHS, and on the number of commutative
+// nodes whose operand order is varied when indexing a rule
+const unsigned MaxPatternNodes = 64;
+const unsigned MaxTargetNodes = 256;
+const unsigned MaxCommutedNodes = 4;
+
+// Keys of the discrimination tree; everything else is keyed by its kind
+const unsigned VarKey = Inst::Var;
+const unsigned ConstSlotKey = Inst::ReservedConst;
+
+bool isSupported(Inst *I) {
+  switch (I->K) {
+  case Inst::Phi:
+  case Inst::Hole:
+  case Inst::UntypedConst:
+  case Inst::ReservedConst:
+  case Inst::ReservedInst:
+  case Inst::ExtractValue:
+  case Inst::None:
+    return false;
+  case Inst::Var:
+    return I->SynthesisConstID == 0;
+  default:
+    return !Inst::isOverflowIntrinsicMain(I->K) &&
+           !Inst::isOverflowIntrinsicSub(I->K);
+  }
+}
+
+bool allSupported(Inst *Root) {
+  std::vector<Inst *> Bad;
+  findInsts(Root, Bad, [](Inst *I) { return !isSupported(I); });
+  return Bad.empty();
+}
+
+// Moves a constant to another width if it denotes the same small signed
+// number there
+bool adaptConst(const APInt &V, unsigned Width, APInt &Out) {
+  if (V.getBitWidth() == Width) {
+    Out = V;
+    return true;
+  }
+  if (!V.isSignedIntN(Width))
+    return false;
+  Out = V.sextOrTrunc(Width);
+  return true;
+}
+
+bool mapWidth(std::map<unsigned, unsigned> &Widths, unsigned From,
+              unsigned To) {
+  if ((From == 1) != (To == 1))
+    return false;
+  auto It = Widths.find(From);
+  if (It != Widths.end())
+    return It->second == To;
+  Widths[From] = To;
+  return true;
+}
+
+// Extensions and truncations stay well formed only if the renaming keeps
+// the order of widths
+bool isMonotonic(const std::map<unsigned, unsigned> &Widths) {
+  unsigned Last = 0;
+  for (auto &P : Widths) {
+    if (P.second <= Last)
+      return false;
+    Last = P.second;
+  }
+  return true;
+}
+
+bool lookupWidth(const std::map<unsigned, unsigned> &Widths, unsigned From,
+                 unsigned &To) {
+  auto It = Widths.find(From);
+  if (It != Widths.end()) {
+    To = It->second;
+    return true;
+  }
+  // Widths only the RHS uses can't be renamed unless nothing was
+  for (auto &P : Widths)
+    if (P.first != P.second)
+      return false;
+  To = From;
+  return true;
+}
+
+}
+
+bool RewriteDatabase::flattenLHS(Inst *I, std::map<Inst *, int> &Slots,
+                                 bool GeneralizeConsts, unsigned Mask,
+                                 unsigned &CommIdx, Pattern &Out) {
+  if (Out.size() >= MaxPatternNodes)
+    return false;
+
+  PatternNode N;
+  N.K = I->K;
+  N.Width = I->Width;
+  if (I->K == Inst::Var || (I->K == Inst::Const && GeneralizeConsts)) {
+    auto It = Slots.find(I);
+    if (It == Slots.end())
+      It = Slots.insert({I, Slots.size()}).first;
+    N.Slot = It->second;
+    Out.push_back(N);
+    return true;
+  }
+  if (I->K == Inst::Const) {
+    N.Val = I->Val;
+    Out.push_back(N);
+    return true;
+  }
+  N.NumOps = I->Ops.size();
+  Out.push_back(N);
+
+  std::vector<Inst *> Ops(I->Ops.begin(), I->Ops.end());
+  if (Inst::isCommutative(I->K) && Ops.size() == 2) {
+    if (CommIdx < MaxCommutedNodes && (Mask >> CommIdx) & 1)
+      std::swap(Ops[0], Ops[1]);
+    ++CommIdx;
+  }
+  for (auto Op : Ops)
+    if (!flattenLHS(Op, Slots, GeneralizeConsts, Mask, CommIdx, Out))
+      return false;
+  return true;
+}
+
+bool RewriteDatabase::flattenTarget(Inst *I, FlatTerm &T) {
+  if (T.Insts.size() >= MaxTargetNodes)
+    return false;
+  unsigned Pos = T.Insts.size();
+  T.Insts.push_back(I);
+  T.Next.push_back(0);
+  for (auto Op : I->Ops)
+    if (!flattenTarget(Op, T))
+      return false;
+  T.Next[Pos] = T.Insts.size();
+  return true;
+}
+
+bool RewriteDatabase::buildRule(InstMapping Mapping, bool GeneralizeConsts,
+                                Rule &R) {
+  std::map<Inst *, int> Slots;
+  unsigned NumCommuted = 0;
+  Pattern First;
+  if (!flattenLHS(Mapping.LHS, Slots, GeneralizeConsts, 0, NumCommuted, First))
+    return false;
+  R.LHSVariants.push_back(First);
+  unsigned NumMasks = 1 << std::min(NumCommuted, MaxCommutedNodes);
+  for (unsigned Mask = 1; Mask < NumMasks; ++Mask) {
+    unsigned CommIdx = 0;
+    Pattern P;
+    flattenLHS(Mapping.LHS, Slots, GeneralizeConsts, Mask, CommIdx, P);
+    R.LHSVariants.push_back(P);
+  }
+  R.NumSlots = Slots.size();
+  R.Generalized = GeneralizeConsts;
+
+  // Post-order walk of the RHS DAG; it can only refer to LHS vars
+  std::map<Inst *, unsigned> Index;
+  std::vector<std::pair<Inst *, bool>> Stack = {{Mapping.RHS, false}};
+  while (!Stack.empty()) {
+    auto [I, Expanded] = Stack.back();
+    Stack.pop_back();
+    if (Index.count(I))
+      continue;
+    if (!Expanded && I->K != Inst::Var && I->K != Inst::Const) {
+      Stack.push_back({I, true});
+      for (auto Op : I->Ops)
+        Stack.push_back({Op, false});
+      continue;
+    }
+    PatternNode N;
+    N.K = I->K;
+    N.Width = I->Width;
+    if (I->K == Inst::Var) {
+      if (!Slots.count(I))
+        return false;
+      N.Slot = Slots[I];
+    } else if (I->K == Inst::Const) {
+      if (GeneralizeConsts && Slots.count(I))
+        N.Slot = Slots[I];
+      else
+        N.Val = I->Val;
+    } else {
+      for (auto Op : I->Ops)
+        N.Ops.push_back(Index[Op]);
+    }
+    Index[I] = R.RHS.size();
+    R.RHS.push_back(N);
+  }
+  return true;
+}
+
+InstMapping RewriteDatabase::buildMapping(const Rule &R) {
+  std::vector<Inst *> SlotInsts(R.NumSlots, nullptr);
+  auto getSlot = [&](const PatternNode &N) {
+    if (!SlotInsts[N.Slot])
+      SlotInsts[N.Slot] = PatternIC.createVar(N.Width,
+                                              "s" + std::to_string(N.Slot));
+    return SlotInsts[N.Slot];
+  };
+
+  const Pattern &P = R.LHSVariants.front();
+  unsigned Pos = 0;
+  std::function<Inst *()> buildLHS = [&]() -> Inst * {
+    const PatternNode &N = P[Pos++];
+    if (N.Slot >= 0)
+      return getSlot(N);
+    if (N.K == Inst::Const)
+      return PatternIC.getConst(N.Val);
+    std::vector<Inst *> Ops;
+    for (unsigned i = 0; i < N.NumOps; ++i)
+      Ops.push_back(buildLHS());
+    return PatternIC.getInst(N.K, N.Width, Ops);
+  };
+  Inst *LHS = buildLHS();
+
+  std::vector<Inst *> Built;
+  for (auto &N : R.RHS) {
+    if (N.Slot >= 0) {
+      Built.push_back(getSlot(N));
+    } else if (N.K == Inst::Const) {
+      Built.push_back(PatternIC.getConst(N.Val));
+    } else {
+      std::vector<Inst *> Ops;
+      for (auto O : N.Ops)
+        Ops.push_back(Built[O]);
+      Built.push_back(PatternIC.getInst(N.K, N.Width, Ops));
+    }
+  }
+  return InstMapping(LHS, Built.back());
+}
+
+void RewriteDatabase::insert(Rule R) {
+  unsigned RuleIdx = Rules.size();
+  for (unsigned V = 0; V < R.LHSVariants.size(); ++V) {
+    TrieNode *N = &Root;
+    for (auto &PN : R.LHSVariants[V]) {
+      unsigned Key = PN.K;
+      if (PN.Slot >= 0)
+        Key = PN.K == Inst::Var ? VarKey : ConstSlotKey;
+      auto &Child = N->Children[Key];
+      if (!Child)
+        Child = std::make_unique<TrieNode>();
+      N = Child.get();
+    }
+    N->Leaves.push_back({RuleIdx, V});
+  }
+  Rules.push_back(std::move(R));
+}
+
+bool RewriteDatabase::learn(InstMapping Mapping) {
+  if (Mapping.LHS->K == Inst::Var || Mapping.LHS->K == Inst::Const ||
+      Mapping.LHS == Mapping.RHS)
+    return false;
+  if (!allSupported(Mapping.LHS) || !allSupported(Mapping.RHS))
+    return false;
+
+  for (bool GeneralizeConsts : {true, false}) {
+    Rule R;
+    if (!buildRule(Mapping, GeneralizeConsts, R))
+      return false;
+
+    std::string Key;
+    raw_string_ostream OS(Key);
+    for (auto *P : {&R.LHSVariants.front(), &R.RHS}) {
+      for (auto &N : *P) {
+        OS << N.K << ':' << N.Width << ':' << N.Slot << ':';
+        if (N.K == Inst::Const && N.Slot < 0)
+          OS << N.Val;
+        for (auto O : N.Ops)
+          OS << ',' << O;
+        OS << ' ';
+      }
+      OS << "=> ";
+    }
+    OS.flush();
+    if (Known.count(Key))
+      return true;
+
+    if (!Check(PatternIC, buildMapping(R)))
+      continue;
+
+    Known.insert(Key);
+    insert(std::move(R));
+    if (DebugLevel > 2)
+      llvm::errs() << "rewrite db: learned rule " << Rules.size()
+                   << (GeneralizeConsts ? " with generalized constants\n" : "\n");
+    return true;
+  }
+  return false;
+}
+
+void RewriteDatabase::search(TrieNode *N, unsigned Pos, const FlatTerm &T,
+                             std::vector<std::pair<unsigned, unsigned>> &Matches) {
+  if (Pos == T.Insts.size()) {
+    Matches.insert(Matches.end(), N->Leaves.begin(), N->Leaves.end());
+    return;
+  }
+
+  Inst *I = T.Insts[Pos];
+  auto Visit = [&](unsigned Key, unsigned NextPos) {
+    auto It = N->Children.find(Key);
+    if (It != N->Children.end())
+      search(It->second.get(), NextPos, T, Matches);
+  };
+
+  if (I->K != Inst::Var)
+    Visit(I->K, Pos + 1);
+  if (I->K == Inst::Const)
+    Visit(ConstSlotKey, Pos + 1);
+  Visit(VarKey, T.Next[Pos]);
+}
+
+bool RewriteDatabase::unify(const Pattern &P, const FlatTerm &T,
+                            std::vector<Inst *> &Bindings,
+                            std::map<unsigned, unsigned> &Widths) {
+  unsigned J = 0;
+  for (auto &N : P) {
+    Inst *I = T.Insts[J];
+    if (!mapWidth(Widths, N.Width, I->Width))
+      return false;
+    if (N.Slot >= 0) {
+      if (Bindings[N.Slot] && Bindings[N.Slot] != I)
+        return false;
+      Bindings[N.Slot] = I;
+      J = T.Next[J];
+      continue;
+    }
+    if (N.K != I->K)
+      return false;
+    if (N.K == Inst::Const) {
+      APInt V;
+      if (!adaptConst(N.Val, I->Width, V) || V != I->Val)
+        return false;
+    }
+    ++J;
+  }
+  return isMonotonic(Widths);
+}
+
+Inst *RewriteDatabase::instantiate(const Rule &R, std::vector<Inst *> &Bindings,
+                                   std::map<unsigned, unsigned> &Widths,
+                                   InstContext &IC) {
+  std::vector<Inst *> Built;
+  for (auto &N : R.RHS) {
+    if (N.Slot >= 0) {
+      Built.push_back(Bindings[N.Slot]);
+      continue;
+    }
+    unsigned Width;
+    if (!lookupWidth(Widths, N.Width, Width))
+      return nullptr;
+    if (N.K == Inst::Const) {
+      APInt V;
+      if (!adaptConst(N.Val, Width, V))
+        return nullptr;
+      Built.push_back(IC.getConst(V));
+      continue;
+    }
+    std::vector<Inst *> Ops;
+    for (auto O : N.Ops)
+      Ops.push_back(Built[O]);
+    Built.push_back(IC.getInst(N.K, Width, Ops));
+  }
+  return Built.back();
+}
+
+void RewriteDatabase::lookup(Inst *LHS, InstContext &IC,
+                             std::vector<Inst *> &RHSs) {
+  if (Rules.empty())
+    return;
+
+  FlatTerm T;
+  if (!flattenTarget(LHS, T))
+    return;
+
+  std::vector<std::pair<unsigned, unsigned>> Matches;
+  search(&Root, 0, T, Matches);
+  std::stable_sort(Matches.begin(), Matches.end(),
+                   [this](const std::pair<unsigned, unsigned> &A,
+                          const std::pair<unsigned, unsigned> &B) {
+    return !Rules[A.first].Generalized && Rules[B.first].Generalized;
+  });
+
+  for (auto &M : Matches) {
+    const Rule &R = Rules[M.first];
+    std::vector<Inst *> Bindings(R.NumSlots, nullptr);
+    std::map<unsigned, unsigned> Widths;
+    if (!unify(R.LHSVariants[M.second], T, Bindings, Widths))
+      continue;
+    if (Inst *RHS = instantiate(R, Bindings, Widths, IC))
+      if (std::find(RHSs.begin(), RHSs.end(), RHS) == RHSs.end())
+        RHSs.push_back(RHS);
+  }
+}
@@ -0,0 +1,257 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "souper/Infer/SmallKnownBits.h"
+
+#include "llvm/ADT/bit.h"
+
+#include <algorithm>
+
+using namespace souper;
+
+unsigned SmallKnownBits::countMinTrailingZeros() const {
+  return llvm::countr_one(Zero);
+}
+
+unsigned SmallKnownBits::countMinLeadingZeros() const {
+  return llvm::countl_one(Zero << (64 - Width));
+}
+
+unsigned SmallKnownBits::countMinLeadingOnes() const {
+  return llvm::countl_one(One << (64 - Width));
+}
+
+unsigned SmallKnownBits::countMaxLeadingZeros() const {
+  return One ? llvm::countl_zero(One) - (64 - Width) : Width;
+}
+
+namespace {
+
+// KnownBits::computeForAddSub() without the temporaries: the sum of the
+// largest and of the smallest possible operands tells which carries are known
+SmallKnownBits addCarry(const SmallKnownBits &LHS, const SmallKnownBits &RHS,
+                        bool CarryZero, bool CarryOne) {
+  uint64_t Mask = LHS.mask();
+  uint64_t PossibleSumZero =
+    (LHS.getUMax() + RHS.getUMax() + !CarryZero) & Mask;
+  uint64_t PossibleSumOne = (LHS.One + RHS.One + CarryOne) & Mask;
+
+  uint64_t CarryKnownZero = ~(PossibleSumZero ^ LHS.Zero ^ RHS.Zero) & Mask;
+  uint64_t CarryKnownOne = PossibleSumOne ^ LHS.One ^ RHS.One;
+  uint64_t Known = (LHS.Zero | LHS.One) & (RHS.Zero | RHS.One) &
+                   (CarryKnownZero | CarryKnownOne);
+
+  SmallKnownBits Result(LHS.Width);
+  Result.Zero = ~PossibleSumZero & Known;
+  Result.One = PossibleSumOne & Known;
+  return Result;
+}
+
+SmallKnownBits addSub(bool Add, bool NSW, const SmallKnownBits &LHS,
+                      SmallKnownBits RHS) {
+  SmallKnownBits Result(LHS.Width);
+  if (Add) {
+    Result = addCarry(LHS, RHS, /*CarryZero=*/true, /*CarryOne=*/false);
+  } else {
+    std::swap(RHS.Zero, RHS.One);
+    Result = addCarry(LHS, RHS, /*CarryZero=*/false, /*CarryOne=*/true);
+  }
+
+  if (NSW && !Result.isSignKnown()) {
+    if (LHS.isNonNegative() && RHS.isNonNegative())
+      Result.Zero |= Result.signBit();
+    else if (LHS.isNegative() && RHS.isNegative())
+      Result.One |= Result.signBit();
+  }
+  return Result;
+}
+
+SmallKnownBits bit(bool One, bool Zero) {
+  SmallKnownBits Result(1);
+  Result.One = One;
+  Result.Zero = Zero;
+  return Result;
+}
+
+} // anonymous
+
+namespace souper {
+namespace SmallTransferFunctionsKB {
+
+SmallKnownBits add(const SmallKnownBits &LHS, const SmallKnownBits &RHS,
+                   bool NSW) {
+  return addSub(/*Add=*/true, NSW, LHS, RHS);
+}
+
+SmallKnownBits sub(const SmallKnownBits &LHS, const SmallKnownBits &RHS,
+                   bool NSW) {
+  return addSub(/*Add=*/false, NSW, LHS, RHS);
+}
+
+SmallKnownBits mul(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  SmallKnownBits Result(LHS.Width);
+  const unsigned Width = LHS.Width;
+
+  unsigned TrailingZeros =
+    LHS.countMinTrailingZeros() + RHS.countMinTrailingZeros();
+  Result.Zero = SmallKnownBits::lowBits(std::min(TrailingZeros, Width));
+
+  // The same unsigned arithmetic as the APInt version, wraparound included
+  unsigned ConfirmedLeadingZeros =
+    LHS.countMinLeadingZeros() + RHS.countMinLeadingZeros() - 1;
+  unsigned ResultSize = Width + RHS.Width - 1;
+  if (ResultSize - ConfirmedLeadingZeros < Width)
+    Result.Zero |=
+      Result.highBits(Width - (ResultSize - ConfirmedLeadingZeros));
+
+  if (LHS.One & RHS.One & 1)
+    Result.One = 1;
+  return Result;
+}
+
+SmallKnownBits udiv(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  SmallKnownBits Result(LHS.Width);
+  const unsigned Width = LHS.Width;
+
+  unsigned LeadZ = LHS.countMinLeadingZeros();
+  unsigned RHSMaxLeadingZeros = RHS.countMaxLeadingZeros();
+  if (RHSMaxLeadingZeros != Width)
+    LeadZ = std::min(Width, LeadZ + Width - RHSMaxLeadingZeros - 1);
+  Result.Zero = Result.highBits(LeadZ);
+  return Result;
+}
+
+SmallKnownBits urem(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  if (RHS.isConstant() && llvm::has_single_bit(RHS.One)) {
+    uint64_t LowBits = RHS.One - 1;
+    SmallKnownBits Result = LHS;
+    Result.Zero |= ~LowBits & LHS.mask();
+    Result.One &= LowBits;
+    return Result;
+  }
+
+  SmallKnownBits Result(LHS.Width);
+  Result.Zero = Result.highBits(
+    std::max(LHS.countMinLeadingZeros(), RHS.countMinLeadingZeros()));
+  return Result;
+}
+
+SmallKnownBits and_(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  SmallKnownBits Result = LHS;
+  Result.One &= RHS.One;
+  Result.Zero |= RHS.Zero;
+  return Result;
+}
+
+SmallKnownBits or_(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  SmallKnownBits Result = LHS;
+  Result.One |= RHS.One;
+  Result.Zero &= RHS.Zero;
+  return Result;
+}
+
+SmallKnownBits xor_(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  SmallKnownBits Result(LHS.Width);
+  Result.Zero = (LHS.Zero & RHS.Zero) | (LHS.One & RHS.One);
+  Result.One = (LHS.Zero & RHS.One) | (LHS.One & RHS.Zero);
+  return Result;
+}
+
+SmallKnownBits shl(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  SmallKnownBits Result(LHS.Width);
+  const unsigned Width = LHS.Width;
+
+  if (RHS.isConstant()) {
+    if (RHS.One >= Width)
+      return Result;
+    Result.One = (LHS.One << RHS.One) & LHS.mask();
+    Result.Zero = ((LHS.Zero << RHS.One) & LHS.mask()) |
+                  SmallKnownBits::lowBits(RHS.One);
+    return Result;
+  }
+
+  unsigned MinValue = RHS.One;
+  Result.Zero = SmallKnownBits::lowBits(
+    std::min(LHS.countMinTrailingZeros() + MinValue, Width));
+  return Result;
+}
+
+SmallKnownBits lshr(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  SmallKnownBits Result(LHS.Width);
+  const unsigned Width = LHS.Width;
+
+  if (RHS.isConstant()) {
+    if (RHS.One >= Width)
+      return Result;
+    Result.One = LHS.One >> RHS.One;
+    Result.Zero = (LHS.Zero >> RHS.One) | Result.highBits(RHS.One);
+    return Result;
+  }
+
+  unsigned MinValue = RHS.One;
+  Result.Zero = Result.highBits(
+    std::min(MinValue + LHS.countMinLeadingZeros(), Width));
+  return Result;
+}
+
+SmallKnownBits ashr(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  SmallKnownBits Result(LHS.Width);
+  const unsigned Width = LHS.Width;
+
+  unsigned MinValue = RHS.One;
+  if (LHS.isNegative())
+    Result.One = Result.highBits(
+      std::min(LHS.countMinLeadingOnes() + MinValue, Width));
+  else if (LHS.isNonNegative())
+    Result.Zero = Result.highBits(
+      std::min(LHS.countMinLeadingZeros() + MinValue, Width));
+  return Result;
+}
+
+SmallKnownBits eq(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  if (LHS.isConstant() && RHS.isConstant() && LHS.One == RHS.One)
+    return bit(/*One=*/true, /*Zero=*/false);
+  if ((LHS.One & RHS.Zero) || (LHS.Zero & RHS.One))
+    return bit(/*One=*/false, /*Zero=*/true);
+  return bit(false, false);
+}
+
+SmallKnownBits ne(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  return bit(/*One=*/(LHS.One & RHS.Zero) || (LHS.Zero & RHS.One),
+             /*Zero=*/LHS.isConstant() && RHS.isConstant() &&
+                      LHS.One == RHS.One);
+}
+
+SmallKnownBits ult(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  return bit(/*One=*/LHS.getUMax() < RHS.getUMin(),
+             /*Zero=*/LHS.getUMin() >= RHS.getUMax());
+}
+
+SmallKnownBits slt(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  return bit(/*One=*/LHS.getSMax() < RHS.getSMin(),
+             /*Zero=*/LHS.getSMin() >= RHS.getSMax());
+}
+
+SmallKnownBits ule(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  return bit(/*One=*/LHS.getUMax() <= RHS.getUMin(),
+             /*Zero=*/LHS.getUMin() > RHS.getUMax());
+}
+
+SmallKnownBits sle(const SmallKnownBits &LHS, const SmallKnownBits &RHS) {
+  return bit(/*One=*/LHS.getSMax() <= RHS.getSMin(),
+             /*Zero=*/LHS.getSMin() > RHS.getSMax());
+}
+
+} // ns SmallTransferFunctionsKB
+}
@@ -0,0 +1,94 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "souper/Infer/TransferTables.h"
+
+#include <cstdint>
+
+using namespace llvm;
+
+namespace {
+
+// See utils/gen-transfer-tables for the layout
+#include "souper/Infer/TransferTables.inc"
+
+static_assert(GeneratedMaxKBWidth == souper::TransferTables::MaxKBWidth &&
+              GeneratedMaxCRWidth == souper::TransferTables::MaxCRWidth,
+              "TransferTables.inc is out of date");
+
+const bool IsCmp[] = {
+#define TRANSFER_TABLE_OP(Name, HasKB, HasCR, IsCmp) IsCmp,
+#include "souper/Infer/TransferTableOps.def"
+};
+
+constexpr unsigned Pow3[] = {1, 3, 9, 27, 81, 243};
+static_assert(sizeof(Pow3) / sizeof(Pow3[0]) > souper::TransferTables::MaxKBWidth,
+              "Pow3 is too short");
+
+// One base 3 digit per bit: 0 for unknown, 1 for known zero, 2 for known one
+unsigned getKBIndex(const KnownBits &KB) {
+  uint64_t Zero = KB.Zero.getZExtValue(), One = KB.One.getZExtValue();
+  unsigned Index = 0;
+  for (unsigned Bit = KB.getBitWidth(); Bit--; )
+    Index = Index * 3 + (Zero >> Bit & 1) + 2 * (One >> Bit & 1);
+  return Index;
+}
+
+unsigned getCRIndex(const ConstantRange &CR) {
+  unsigned W = CR.getBitWidth();
+  return CR.getLower().getZExtValue() << W | CR.getUpper().getZExtValue();
+}
+
+} // anonymous
+
+namespace souper {
+namespace TransferTables {
+
+std::optional<KnownBits> lookupKB(Op O, const KnownBits &LHS,
+                                  const KnownBits &RHS) {
+  unsigned W = LHS.getBitWidth();
+  if (W > MaxKBWidth || RHS.getBitWidth() != W ||
+      LHS.hasConflict() || RHS.hasConflict())
+    return std::nullopt;
+  const uint8_t *Table = KBTables[O][W];
+  if (!Table)
+    return std::nullopt;
+
+  unsigned Entry = Table[getKBIndex(LHS) * Pow3[W] + getKBIndex(RHS)];
+  unsigned ResultW = IsCmp[O] ? 1 : W;
+  KnownBits Result(ResultW);
+  for (unsigned Bit = 0; Bit < ResultW; ++Bit, Entry /= 3) {
+    if (Entry % 3 == 1)
+      Result.Zero.setBit(Bit);
+    else if (Entry % 3 == 2)
+      Result.One.setBit(Bit);
+  }
+  return Result;
+}
+
+std::optional<ConstantRange> lookupCR(Op O, const ConstantRange &LHS,
+                                      const ConstantRange &RHS) {
+  unsigned W = LHS.getBitWidth();
+  if (W > MaxCRWidth || RHS.getBitWidth() != W)
+    return std::nullopt;
+  const uint8_t *Table = CRTables[O][W];
+  if (!Table)
+    return std::nullopt;
+
+  uint8_t Entry = Table[getCRIndex(LHS) << 2 * W | getCRIndex(RHS)];
+  return ConstantRange(APInt(W, Entry & 0xf), APInt(W, Entry >> 4));
+}
+
+}
+}
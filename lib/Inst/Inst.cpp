@@ -13,13 +13,16 @@
 // limitations under the License.
 
 #include "souper/Inst/Inst.h"
+#include "souper/Inst/InstIndexMap.h"
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/StringSwitch.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include <queue>
 #include <set>
+#include <unordered_set>
 
 using namespace souper;
 
@@ -72,8 +75,8 @@ bool Inst::operator<(const Inst &Other) const {
   if (Ops.size() > Other.Ops.size())
     return false;
 
-  const std::vector<Inst *> &OpsA = orderedOps();
-  const std::vector<Inst *> &OpsB = Other.orderedOps();
+  llvm::ArrayRef<Inst *> OpsA = orderedOps();
+  llvm::ArrayRef<Inst *> OpsB = Other.orderedOps();
 
   for (unsigned I = 0; I != OpsA.size(); ++I) {
     if (OpsA[I] == OpsB[I])
@@ -95,17 +98,78 @@ bool Inst::operator<(const Inst &Other) const {
   return false;
 }
 
-const std::vector<Inst *> &Inst::orderedOps() const {
-  if (!isCommutative(K))
+llvm::ArrayRef<Inst *> Inst::orderedOps() const {
+  if (OrderedOps.empty())
     return Ops;
+  return OrderedOps;
+}
 
-  if (OrderedOps.empty()) {
-    OrderedOps = Ops;
-    std::sort(OrderedOps.begin(), OrderedOps.end(), [](Inst *A, Inst *B) {
-      return *A < *B;
-    });
+// Fills in what a new Inst derives from its operands, before any other
+// thread can see it
+static void initFromOps(Inst *N) {
+  N->nReservedConsts = N->K == Inst::ReservedConst;
+  N->nHoles = N->K == Inst::Hole;
+  for (Inst *Op : N->Ops) {
+    N->nReservedConsts = llvm::SaturatingAdd(N->nReservedConsts,
+                                             Op->nReservedConsts);
+    N->nHoles = llvm::SaturatingAdd(N->nHoles, Op->nHoles);
+  }
+
+  if (!Inst::isCommutative(N->K))
+    return;
+  auto Less = [](Inst *A, Inst *B) { return *A < *B; };
+  if (std::is_sorted(N->Ops.begin(), N->Ops.end(), Less))
+    return;
+  N->OrderedOps.assign(N->Ops.begin(), N->Ops.end());
+  std::sort(N->OrderedOps.begin(), N->OrderedOps.end(), Less);
+}
+
+static void printVarFacts(llvm::raw_ostream &Out, const VarFacts &F) {
+  if (F.KnownZeros.getBoolValue() || F.KnownOnes.getBoolValue())
+    Out << " (knownBits=" << Inst::getKnownBitsString(F.KnownZeros, F.KnownOnes)
+        << ")";
+  if (F.NonNegative)
+    Out << " (nonNegative)";
+  if (F.Negative)
+    Out << " (negative)";
+  if (F.NonZero)
+    Out << " (nonZero)";
+  if (F.PowOfTwo)
+    Out << " (powerOfTwo)";
+  if (F.NumSignBits > 1)
+    Out << " (signBits=" << F.NumSignBits << ")";
+  if (!F.Range.isFullSet())
+    Out << " (range=[" << F.Range.getLower()
+        << "," << F.Range.getUpper() << "))";
+}
+
+// The elements of overflow instruction tuples are not printed on their own
+static bool isOverflowElement(Inst::Kind K) {
+  switch (K) {
+  case Inst::SAddO:
+  case Inst::UAddO:
+  case Inst::SSubO:
+  case Inst::USubO:
+  case Inst::SMulO:
+  case Inst::UMulO:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool isOverflowTuple(Inst::Kind K) {
+  switch (K) {
+  case Inst::SAddWithOverflow:
+  case Inst::UAddWithOverflow:
+  case Inst::SSubWithOverflow:
+  case Inst::USubWithOverflow:
+  case Inst::SMulWithOverflow:
+  case Inst::UMulWithOverflow:
+    return true;
+  default:
+    return false;
   }
-  return OrderedOps;
 }
 
 std::string ReplacementContext::printInst(Inst *I, llvm::raw_ostream &Out,
@@ -147,25 +211,16 @@ std::string ReplacementContext::printInstImpl(Inst *I, llvm::raw_ostream &Out,
     break;
   }
 
-  const std::vector<Inst *> &Ops = I->orderedOps();
+  llvm::ArrayRef<Inst *> Ops = I->orderedOps();
   for (unsigned Idx = 0; Idx != Ops.size(); ++Idx) {
     if (Idx == 0)
       OpsSS << " ";
     else
       OpsSS << ", ";
-    switch (I->K) {
-      default:
-        OpsSS << printInstImpl(Ops[Idx], Out, printNames, OrigI);
-        break;
-      case Inst::SAddWithOverflow:
-      case Inst::UAddWithOverflow:
-      case Inst::SSubWithOverflow:
-      case Inst::USubWithOverflow:
-      case Inst::SMulWithOverflow:
-      case Inst::UMulWithOverflow:
-        OpsSS << printInstImpl(I->Ops[1]->Ops[Idx], Out, printNames, OrigI);
-        break;
-    }
+    if (isOverflowTuple(I->K))
+      OpsSS << printInstImpl(I->Ops[1]->Ops[Idx], Out, printNames, OrigI);
+    else
+      OpsSS << printInstImpl(Ops[Idx], Out, printNames, OrigI);
   }
 
   std::string InstName = std::to_string(InstNames.size() + BlockNames.size());
@@ -174,45 +229,19 @@ std::string ReplacementContext::printInstImpl(Inst *I, llvm::raw_ostream &Out,
   setInst(InstName, I);
 
   // Skip the elements of overflow instruction tuple in souper IR
-  switch (I->K) {
-    case Inst::SAddO:
-    case Inst::UAddO:
-    case Inst::SSubO:
-    case Inst::USubO:
-    case Inst::SMulO:
-    case Inst::UMulO:
-      break;
-    default: {
-      Out << "%" << InstName << ":i" << I->Width << " = "
-          << Inst::getKindName(I->K);
-      if (I->K == Inst::Var) {
-        if (I->KnownZeros.getBoolValue() || I->KnownOnes.getBoolValue())
-          Out << " (knownBits=" << Inst::getKnownBitsString(I->KnownZeros, I->KnownOnes)
-              << ")";
-        if (I->NonNegative)
-          Out << " (nonNegative)";
-        if (I->Negative)
-          Out << " (negative)";
-        if (I->NonZero)
-          Out << " (nonZero)";
-        if (I->PowOfTwo)
-          Out << " (powerOfTwo)";
-        if (I->NumSignBits > 1)
-          Out << " (signBits=" << I->NumSignBits << ")";
-        if (!I->Range.isFullSet())
-          Out << " (range=[" << I->Range.getLower()
-              << "," << I->Range.getUpper() << "))";
-      }
-      Out << OpsSS.str();
-
-      if (OrigI->DepsWithExternalUses.find(I) != OrigI->DepsWithExternalUses.end())
-        Out << " (hasExternalUses)";
-
-      if (printNames && !I->Name.empty())
-        Out << " ; " << I->Name;
-      Out << '\n';
-      break;
-    }
+  if (!isOverflowElement(I->K)) {
+    Out << "%" << InstName << ":i" << I->Width << " = "
+        << Inst::getKindName(I->K);
+    if (I->K == Inst::Var)
+      printVarFacts(Out, *I->Facts);
+    Out << OpsSS.str();
+
+    if (OrigI->DepsWithExternalUses.find(I) != OrigI->DepsWithExternalUses.end())
+      Out << " (hasExternalUses)";
+
+    if (printNames && !I->Name.empty())
+      Out << " ; " << I->Name;
+    Out << '\n';
   }
 
   SS << "%" << InstName;
@@ -238,6 +267,169 @@ std::string ReplacementContext::printBlock(Block *B, llvm::raw_ostream &Out) {
   return BlockName;
 }
 
+void ReplacementPrinter::reset() {
+  for (const auto &N : Named)
+    InstNames[N.first] = 0;
+  Named.clear();
+  BlockNames.clear();
+  NumNames = 0;
+}
+
+// Prints the lines of I and of the Insts it uses that have no name yet,
+// in the order ReplacementContext::printInst does
+void ReplacementPrinter::printInst(llvm::raw_ostream &OS, Inst *I, Inst *OrigI,
+                                   bool printNames) {
+  if (I->Index < InstNames.size() && InstNames[I->Index])
+    return;
+  if (I->K == Inst::Const || I->K == Inst::UntypedConst)
+    return;
+
+  unsigned BlockName = 0;
+  if (I->K == Inst::Phi)
+    BlockName = printBlock(OS, I->B);
+  llvm::ArrayRef<Inst *> Ops = I->orderedOps();
+  bool Tuple = isOverflowTuple(I->K);
+  for (unsigned Idx = 0; Idx != Ops.size(); ++Idx)
+    printInst(OS, Tuple ? I->Ops[1]->Ops[Idx] : Ops[Idx], OrigI, printNames);
+
+  if (I->Index >= InstNames.size())
+    InstNames.resize(I->Index + 1);
+  unsigned Name = NumNames++;
+  InstNames[I->Index] = Name + 1;
+  Named.push_back({I->Index, I});
+
+  if (isOverflowElement(I->K))
+    return;
+  OS << '%' << Name << ":i" << I->Width << " = " << Inst::getKindName(I->K);
+  if (I->K == Inst::Var)
+    printVarFacts(OS, *I->Facts);
+  if (I->K == Inst::Phi)
+    OS << " %" << BlockName << ',';
+  for (unsigned Idx = 0; Idx != Ops.size(); ++Idx) {
+    OS << (Idx == 0 ? " " : ", ");
+    printRef(OS, Tuple ? I->Ops[1]->Ops[Idx] : Ops[Idx]);
+  }
+  if (OrigI->DepsWithExternalUses.find(I) != OrigI->DepsWithExternalUses.end())
+    OS << " (hasExternalUses)";
+  if (printNames && !I->Name.empty())
+    OS << " ; " << I->Name;
+  OS << '\n';
+}
+
+// Prints how an Inst that printInst has been called on is referred to
+void ReplacementPrinter::printRef(llvm::raw_ostream &OS, Inst *I) {
+  switch (I->K) {
+  case Inst::Const:
+    I->Val.print(OS, false);
+    OS << ":i" << I->Val.getBitWidth();
+    break;
+  case Inst::UntypedConst:
+    I->Val.print(OS, false);
+    break;
+  default:
+    assert(I->Index < InstNames.size() && InstNames[I->Index]);
+    OS << '%' << InstNames[I->Index] - 1;
+    break;
+  }
+}
+
+unsigned ReplacementPrinter::printBlock(llvm::raw_ostream &OS, Block *B) {
+  for (const auto &BN : BlockNames)
+    if (BN.first == B)
+      return BN.second;
+  unsigned Name = NumNames++;
+  BlockNames.push_back({B, Name});
+  OS << '%' << Name << " = block " << B->Preds << "\n";
+  return Name;
+}
+
+void ReplacementPrinter::printPCs(llvm::raw_ostream &OS,
+                                  const BlockPCs &BPCs,
+                                  const std::vector<InstMapping> &PCs,
+                                  bool printNames) {
+  for (const auto &PC : PCs) {
+    printInst(OS, PC.LHS, PC.LHS, printNames);
+    printInst(OS, PC.RHS, PC.RHS, printNames);
+    OS << "pc ";
+    printRef(OS, PC.LHS);
+    OS << ' ';
+    printRef(OS, PC.RHS);
+    OS << '\n';
+  }
+  for (const auto &BPC : BPCs) {
+    assert(BPC.B && "NULL Block pointer!");
+    unsigned BlockName = printBlock(OS, BPC.B);
+    printInst(OS, BPC.PC.LHS, BPC.PC.LHS, printNames);
+    printInst(OS, BPC.PC.RHS, BPC.PC.RHS, printNames);
+    OS << "blockpc %" << BlockName << ' ' << BPC.PredIdx << ' ';
+    printRef(OS, BPC.PC.LHS);
+    OS << ' ';
+    printRef(OS, BPC.PC.RHS);
+    OS << '\n';
+  }
+}
+
+void ReplacementPrinter::printAttributes(llvm::raw_ostream &OS, Inst *LHS) {
+  if (!LHS->DemandedBits.isAllOnes())
+    OS << " (demandedBits="
+       << Inst::getDemandedBitsString(LHS->DemandedBits) << ')';
+  if (LHS->HarvestKind == HarvestType::HarvestedFromUse)
+    OS << " (harvestedFromUse)";
+  OS << '\n';
+}
+
+llvm::StringRef ReplacementPrinter::printReplacement(
+    const BlockPCs &BPCs, const std::vector<InstMapping> &PCs,
+    InstMapping Mapping, bool printNames) {
+  assert(Mapping.LHS);
+  assert(Mapping.RHS);
+  reset();
+  Buf.clear();
+  llvm::raw_svector_ostream OS(Buf);
+  printPCs(OS, BPCs, PCs, printNames);
+  printInst(OS, Mapping.LHS, Mapping.LHS, printNames);
+  printInst(OS, Mapping.RHS, Mapping.RHS, printNames);
+  OS << "cand ";
+  printRef(OS, Mapping.LHS);
+  OS << ' ';
+  printRef(OS, Mapping.RHS);
+  printAttributes(OS, Mapping.LHS);
+  return Buf;
+}
+
+llvm::StringRef ReplacementPrinter::printLHS(
+    const BlockPCs &BPCs, const std::vector<InstMapping> &PCs, Inst *LHS,
+    bool printNames) {
+  assert(LHS);
+  reset();
+  Buf.clear();
+  llvm::raw_svector_ostream OS(Buf);
+  printPCs(OS, BPCs, PCs, printNames);
+  printInst(OS, LHS, LHS, printNames);
+  OS << "infer ";
+  printRef(OS, LHS);
+  printAttributes(OS, LHS);
+  return Buf;
+}
+
+llvm::StringRef ReplacementPrinter::printRHS(Inst *RHS, bool printNames) {
+  Buf.clear();
+  llvm::raw_svector_ostream OS(Buf);
+  printInst(OS, RHS, RHS, printNames);
+  OS << "result ";
+  printRef(OS, RHS);
+  OS << '\n';
+  return Buf;
+}
+
+void ReplacementPrinter::getContext(ReplacementContext &Context) const {
+  assert(Context.empty());
+  for (const auto &N : Named)
+    Context.setInst(std::to_string(InstNames[N.first] - 1), N.second);
+  for (const auto &BN : BlockNames)
+    Context.setBlock(std::to_string(BN.second), BN.first);
+}
+
 void ReplacementContext::clear() {
   InstNames.clear();
   BlockNames.clear();
@@ -272,22 +464,22 @@ bool ReplacementContext::empty() {
 }
 
 Inst *ReplacementContext::getInst(llvm::StringRef Name) {
-  auto InstIt = NameToInst.find(Name.str());
+  auto InstIt = NameToInst.find(Name);
   return (InstIt == NameToInst.end()) ? 0 : InstIt->second;
 }
 
 void ReplacementContext::setInst(llvm::StringRef Name, Inst *I) {
-  NameToInst[Name.str()] = I;
+  NameToInst[Name] = I;
   InstNames[I] = Name;
 }
 
 Block *ReplacementContext::getBlock(llvm::StringRef Name) {
-  auto BlockIt = NameToBlock.find(Name.str());
+  auto BlockIt = NameToBlock.find(Name);
   return (BlockIt == NameToBlock.end()) ? 0 : BlockIt->second;
 }
 
 void ReplacementContext::setBlock(llvm::StringRef Name, Block *B) {
-  NameToBlock[Name.str()] = B;
+  NameToBlock[Name] = B;
   BlockNames[B] = Name;
 }
 
@@ -464,7 +656,7 @@ const char *Inst::getKindName(Kind K) {
   }
 }
 
-Inst::Kind Inst::getKind(std::string Name) {
+Inst::Kind Inst::getKind(llvm::StringRef Name) {
   return llvm::StringSwitch<Inst::Kind>(Name)
                    .Case("var", Inst::Var)
                    .Case("phi", Inst::Phi)
@@ -545,7 +737,7 @@ void Inst::Profile(llvm::FoldingSetNodeID &ID) const {
     assert(0 && "Var instructions should not be in FoldingSet");
   case Phi:
     ID.AddPointer(B);
-    break;
+    [[fallthrough]];
   default:
     if (!DemandedBits.isAllOnes())
       ID.Add(DemandedBits);
@@ -566,22 +758,185 @@ void Inst::Print() {
 }
 #endif
 
+// What picks the shard of a hash-consed Inst. Unlike its profile, this
+// leaves out the attributes that setAttributes() changes.
+static llvm::hash_code hashStructure(Inst::Kind K, unsigned Width,
+                                     llvm::hash_code Extra,
+                                     llvm::ArrayRef<Inst *> Ops) {
+  return llvm::hash_combine(K, Width, Extra,
+                            llvm::hash_combine_range(Ops.begin(), Ops.end()));
+}
+
+InstContext::Shard &InstContext::getShard(llvm::hash_code Structure) {
+  return Shards[size_t(Structure) % NumShards];
+}
+
+InstContext::Shard &InstContext::getShard(const Inst *I) {
+  llvm::hash_code Extra = 0;
+  if (I->K == Inst::Const || I->K == Inst::UntypedConst)
+    Extra = llvm::hash_value(I->Val);
+  else if (I->K == Inst::Phi)
+    Extra = llvm::hash_value(I->B);
+  return getShard(hashStructure(I->K, I->Width, Extra, I->Ops));
+}
+
+InstContext::Shard &InstContext::getThreadShard() {
+  static std::atomic<unsigned> NextShard{0};
+  thread_local unsigned ThreadShard = NextShard++ % NumShards;
+  return Shards[ThreadShard];
+}
+
+Inst *InstContext::newInst(Shard &S) {
+  auto N = new (S.InstRecycler.Allocate(S.Allocator)) Inst;
+  size_t Free = NumFreeIndices.load(std::memory_order_relaxed);
+  while (Free && !NumFreeIndices.compare_exchange_weak(Free, Free - 1,
+                                                       std::memory_order_relaxed))
+    ;
+  N->Index = Free ? FreeIndices[Free - 1] : NumInsts++;
+  S.Insts.push_back(N);
+  return N;
+}
+
+Inst *InstContext::newInst() {
+  Shard &S = getThreadShard();
+  std::lock_guard<std::mutex> Guard(S.Lock);
+  return newInst(S);
+}
+
+void InstContext::releaseInst(Shard &S, Inst *I) {
+  switch (I->K) {
+  case Inst::Var:
+    I->Facts->~VarFacts();
+    FactsRecycler.Deallocate(Allocator, I->Facts);
+    break;
+  case Inst::Hole:
+  case Inst::ReservedConst:
+  case Inst::ReservedInst:
+    break;
+  default:
+    S.InstSet.RemoveNode(I);
+    break;
+  }
+  FreeIndices.push_back(I->Index);
+  I->~Inst();
+  S.InstRecycler.Deallocate(S.Allocator, I);
+}
+
+InstContext::~InstContext() {
+  for (auto &S : Shards) {
+    for (auto I : S.Insts) {
+      if (I->Facts)
+        I->Facts->~VarFacts();
+      I->~Inst();
+    }
+    S.InstRecycler.clear(S.Allocator);
+  }
+  for (auto B : Blocks)
+    B->~Block();
+  BlockRecycler.clear(Allocator);
+  FactsRecycler.clear(Allocator);
+}
+
+InstContext::Checkpoint InstContext::checkpoint() const {
+  Checkpoint C;
+  for (unsigned J = 0; J < NumShards; ++J)
+    C.NumInsts[J] = Shards[J].Insts.size();
+  C.NumBlocks = Blocks.size();
+  C.ReservedConstCounter = ReservedConstCounter;
+  return C;
+}
+
+void InstContext::rollback(const Checkpoint &C, llvm::ArrayRef<Inst *> Keep) {
+  assert(C.NumBlocks <= Blocks.size() &&
+         "Rolling back to a checkpoint that was rolled back over");
+
+  std::unordered_set<Inst *> KeptInsts;
+  std::unordered_set<Block *> KeptBlocks;
+  std::vector<Inst *> Worklist;
+  for (auto I : Keep)
+    if (I)
+      Worklist.push_back(I);
+  while (!Worklist.empty()) {
+    Inst *I = Worklist.back();
+    Worklist.pop_back();
+    if (!KeptInsts.insert(I).second)
+      continue;
+    Worklist.insert(Worklist.end(), I->Ops.begin(), I->Ops.end());
+    if (I->K == Inst::Phi && KeptBlocks.insert(I->B).second)
+      Worklist.insert(Worklist.end(), I->B->PredVars.begin(),
+                      I->B->PredVars.end());
+  }
+
+  // Kept Insts stay where they are, the others are removed from the
+  // context's tables and recycled
+  std::unordered_set<Inst *> ReleasedVars;
+  unsigned Counter = C.ReservedConstCounter;
+  FreeIndices.resize(NumFreeIndices);
+  for (unsigned J = 0; J < NumShards; ++J) {
+    Shard &S = Shards[J];
+    assert(C.NumInsts[J] <= S.Insts.size() &&
+           "Rolling back to a checkpoint that was rolled back over");
+    size_t Live = C.NumInsts[J];
+    for (size_t K = C.NumInsts[J]; K < S.Insts.size(); ++K) {
+      Inst *I = S.Insts[K];
+      if (KeptInsts.count(I)) {
+        S.Insts[Live++] = I;
+        if (I->K == Inst::ReservedConst)
+          Counter = std::max(Counter, I->SynthesisConstID);
+        continue;
+      }
+      if (I->K == Inst::Var)
+        ReleasedVars.insert(I);
+      releaseInst(S, I);
+    }
+    S.Insts.resize(Live);
+  }
+  NumFreeIndices = FreeIndices.size();
+  ReservedConstCounter = Counter;
+
+  if (!ReleasedVars.empty()) {
+    for (auto &P : VarInstsByWidth)
+      llvm::erase_if(P.second,
+                     [&](Inst *V) { return ReleasedVars.count(V); });
+  }
+
+  size_t Live = C.NumBlocks;
+  for (size_t J = C.NumBlocks; J < Blocks.size(); ++J) {
+    Block *B = Blocks[J];
+    if (KeptBlocks.count(B)) {
+      Blocks[Live++] = B;
+      continue;
+    }
+    B->~Block();
+    BlockRecycler.Deallocate(Allocator, B);
+  }
+  if (Live != Blocks.size()) {
+    Blocks.resize(Live);
+    NumBlocksByPreds.clear();
+    for (auto B : Blocks)
+      NumBlocksByPreds[B->Preds] = std::max(NumBlocksByPreds[B->Preds],
+                                            B->Number + 1);
+  }
+}
+
 Inst *InstContext::getConst(const llvm::APInt &Val) {
   llvm::FoldingSetNodeID ID;
   ID.AddInteger(Inst::Const);
   ID.AddInteger(Val.getBitWidth());
   Val.Profile(ID);
 
+  Shard &S = getShard(hashStructure(Inst::Const, Val.getBitWidth(),
+                                    llvm::hash_value(Val), {}));
+  std::lock_guard<std::mutex> Guard(S.Lock);
   void *IP = 0;
-  if (Inst *I = InstSet.FindNodeOrInsertPos(ID, IP))
+  if (Inst *I = S.InstSet.FindNodeOrInsertPos(ID, IP))
     return I;
 
-  auto N = new Inst;
-  Insts.emplace_back(N);
+  auto N = newInst(S);
   N->K = Inst::Const;
   N->Width = Val.getBitWidth();
   N->Val = Val;
-  InstSet.InsertNode(N, IP);
+  S.InstSet.InsertNode(N, IP);
   return N;
 }
 
@@ -591,41 +946,42 @@ Inst *InstContext::getUntypedConst(const llvm::APInt &Val) {
   ID.AddInteger(0);
   Val.Profile(ID);
 
+  Shard &S = getShard(hashStructure(Inst::UntypedConst, 0,
+                                    llvm::hash_value(Val), {}));
+  std::lock_guard<std::mutex> Guard(S.Lock);
   void *IP = 0;
-  if (Inst *I = InstSet.FindNodeOrInsertPos(ID, IP))
+  if (Inst *I = S.InstSet.FindNodeOrInsertPos(ID, IP))
     return I;
 
-  auto N = new Inst;
-  Insts.emplace_back(N);
+  auto N = newInst(S);
   N->K = Inst::UntypedConst;
   N->Width = 0;
   N->Val = Val;
-  InstSet.InsertNode(N, IP);
+  S.InstSet.InsertNode(N, IP);
   return N;
 }
 
 Inst *InstContext::getReservedConst() {
-  auto N = new Inst;
-  Insts.emplace_back(N);
+  auto N = newInst();
   N->K = Inst::ReservedConst;
   N->SynthesisConstID = ++ReservedConstCounter;
   N->Width = 0;
+  initFromOps(N);
   return N;
 }
 
 Inst *InstContext::getReservedInst() {
-  auto N = new Inst;
-  Insts.emplace_back(N);
+  auto N = newInst();
   N->K = Inst::ReservedInst;
   N->Width = 0;
   return N;
 }
 
 Inst *InstContext::createHole(unsigned Width) {
-  auto N = new Inst;
-  Insts.emplace_back(N);
+  auto N = newInst();
   N->K = Inst::Hole;
   N->Width = Width;
+  initFromOps(N);
   return N;
 }
 
@@ -635,27 +991,31 @@ Inst *InstContext::createVar(unsigned Width, llvm::StringRef Name,
                              bool NonNegative, bool PowOfTwo, bool Negative,
                              unsigned NumSignBits, llvm::APInt DemandedBits,
                              unsigned SynthesisConstID) {
+  std::lock_guard<std::mutex> Guard(Lock);
   // Create a new vector of Insts if Width is not found in VarInstsByWidth
+  // Vars released by rollback() may leave gaps in the numbering
   auto &InstList = VarInstsByWidth[Width];
-  unsigned Number = InstList.size();
-  auto I = new Inst;
-  InstList.emplace_back(I);
+  unsigned Number = InstList.empty() ? 0 : InstList.back()->Number + 1;
+  auto I = newInst();
+  InstList.push_back(I);
   assert(Range.getBitWidth() == Width && Zero.getBitWidth() == Width && One.getBitWidth() == Width);
 
   I->K = Inst::Var;
   I->Number = Number;
   I->Width = Width;
   I->Name = Name;
-  I->Range = Range;
-  I->KnownZeros = Zero;
-  I->KnownOnes = One;
-  I->NonZero = NonZero;
-  I->NonNegative = NonNegative;
-  I->PowOfTwo = PowOfTwo;
-  I->Negative = Negative;
-  I->NumSignBits = NumSignBits;
+  I->Facts = new (FactsRecycler.Allocate(Allocator)) VarFacts;
+  I->Facts->Range = Range;
+  I->Facts->KnownZeros = Zero;
+  I->Facts->KnownOnes = One;
+  I->Facts->NonZero = NonZero;
+  I->Facts->NonNegative = NonNegative;
+  I->Facts->PowOfTwo = PowOfTwo;
+  I->Facts->Negative = Negative;
+  I->Facts->NumSignBits = NumSignBits;
   I->DemandedBits = DemandedBits;
   I->SynthesisConstID = SynthesisConstID;
+  I->nReservedConsts = SynthesisConstID != 0;
   return I;
 }
 
@@ -678,10 +1038,14 @@ Inst *InstContext::createSynthesisConstant(unsigned Width, unsigned SynthesisCon
 
 
 Block *InstContext::createBlock(unsigned Preds) {
-  auto &BlockList = BlocksByPreds[Preds];
-  unsigned Number = BlockList.size();
-  auto B = new Block;
-  BlockList.emplace_back(B);
+  Block *B;
+  unsigned Number;
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Number = NumBlocksByPreds[Preds]++;
+    B = new (BlockRecycler.Allocate(Allocator)) Block;
+    Blocks.push_back(B);
+  }
 
   B->Number = Number;
   B->Preds = Preds;
@@ -695,23 +1059,28 @@ Inst *InstContext::getPhi(Block *B, const std::vector<Inst *> &Ops, llvm::APInt
   ID.AddInteger(Inst::Phi);
   ID.AddInteger(Ops[0]->Width);
   ID.AddPointer(B);
-  for (auto O : Ops)
-    ID.AddPointer(O);
   if (!DemandedBits.isAllOnes())
     ID.Add(DemandedBits);
+  for (auto O : Ops)
+    ID.AddPointer(O);
 
+  Shard &S = getShard(hashStructure(Inst::Phi, Ops[0]->Width,
+                                    llvm::hash_value(B), Ops));
+  std::lock_guard<std::mutex> Guard(S.Lock);
   void *IP = 0;
-  if (Inst *I = InstSet.FindNodeOrInsertPos(ID, IP))
+  if (Inst *I = S.InstSet.FindNodeOrInsertPos(ID, IP))
     return I;
 
-  auto N = new Inst;
-  Insts.emplace_back(N);
+  auto N = newInst(S);
   N->K = Inst::Phi;
   N->Width = Ops[0]->Width;
   N->B = B;
-  N->Ops = Ops;
+  N->Ops.assign(Ops.begin(), Ops.end());
   N->DemandedBits = DemandedBits;
-  InstSet.InsertNode(N, IP);
+  N->HarvestKind = HarvestType::HarvestedFromDef;
+  N->HarvestFrom = nullptr;
+  initFromOps(N);
+  S.InstSet.InsertNode(N, IP);
   return N;
 }
 
@@ -741,25 +1110,27 @@ Inst *InstContext::getInst(Inst::Kind K, unsigned Width,
   llvm::FoldingSetNodeID ID;
   ID.AddInteger(K);
   ID.AddInteger(Width);
-  for (auto O : *InstOps)
-    ID.AddPointer(O);
   if (!DemandedBits.isAllOnes())
     ID.Add(DemandedBits);
+  for (auto O : *InstOps)
+    ID.AddPointer(O);
 
+  Shard &S = getShard(hashStructure(K, Width, 0, *InstOps));
+  std::lock_guard<std::mutex> Guard(S.Lock);
   void *IP = 0;
-  if (Inst *I = InstSet.FindNodeOrInsertPos(ID, IP))
+  if (Inst *I = S.InstSet.FindNodeOrInsertPos(ID, IP))
     return I;
 
-  auto N = new Inst;
-  Insts.emplace_back(N);
+  auto N = newInst(S);
   N->K = K;
   N->Width = Width;
-  N->Ops = *InstOps;
+  N->Ops.assign(InstOps->begin(), InstOps->end());
   N->DemandedBits = DemandedBits;
   N->Available = Available;
   N->HarvestKind = HarvestType::HarvestedFromDef;
   N->HarvestFrom = nullptr;
-  InstSet.InsertNode(N, IP);
+  initFromOps(N);
+  S.InstSet.InsertNode(N, IP);
   return N;
 }
 
@@ -770,12 +1141,42 @@ Inst *InstContext::getInst(Inst::Kind K, unsigned Width,
   return getInst(K, Width, Ops, DemandedBits, Available);
 }
 
+void InstContext::setAttributes(Inst *I, const llvm::APInt &DemandedBits,
+                                HarvestType HarvestKind) {
+  Shard &S = getShard(I);
+  std::lock_guard<std::mutex> Guard(S.Lock);
+  // Constants never have their DemandedBits set
+  if (I->DemandedBits.getBitWidth() == DemandedBits.getBitWidth() &&
+      I->DemandedBits == DemandedBits && I->HarvestKind == HarvestKind)
+    return;
+
+  // Vars and the like are not in the table, so this is false for them
+  bool Hashed = S.InstSet.RemoveNode(I);
+  I->DemandedBits = DemandedBits;
+  I->HarvestKind = HarvestKind;
+  if (!Hashed)
+    return;
+
+  llvm::FoldingSetNodeID ID;
+  I->Profile(ID);
+  void *IP = 0;
+  if (!S.InstSet.FindNodeOrInsertPos(ID, IP))
+    S.InstSet.InsertNode(I, IP);
+}
+
+void InstContext::addDepWithExternalUses(Inst *I, Inst *Dep) {
+  Shard &S = getShard(I);
+  std::lock_guard<std::mutex> Guard(S.Lock);
+  I->DepsWithExternalUses.insert(Dep);
+}
+
 std::vector<Inst *> InstContext::getVariables() const {
   std::vector<Inst *> AllVariables;
+  std::lock_guard<std::mutex> Guard(Lock);
   for (const auto &OuterIter : VarInstsByWidth) {
     for (const auto &InnerIter : OuterIter.getSecond()) {
       assert(InnerIter->K == Inst::Kind::Var);
-      AllVariables.emplace_back(InnerIter.get());
+      AllVariables.emplace_back(InnerIter);
     }
   }
 
@@ -952,47 +1353,128 @@ int Inst::getCost(Inst::Kind K) {
   }
 }
 
-static int costHelper(Inst *I, Inst *Root, std::set<Inst *> &Visited,
-                      bool IgnoreDepsWithExternalUses) {
-  if (!Visited.insert(I).second)
-    return 0;
-  if (IgnoreDepsWithExternalUses && I != Root &&
-      Root->DepsWithExternalUses.find(I) != Root->DepsWithExternalUses.end()) {
-    return 0;
+// The cost of Root without its dependencies with external uses and what
+// only they reach
+static int costWithoutExternalDeps(Inst *Root) {
+  int Cost = 0;
+  InstVisitedSet Visited;
+  llvm::SmallVector<Inst *, 32> Worklist = {Root};
+  while (!Worklist.empty()) {
+    Inst *I = Worklist.pop_back_val();
+    if (!Visited.insert(I))
+      continue;
+    if (I != Root &&
+        Root->DepsWithExternalUses.find(I) != Root->DepsWithExternalUses.end())
+      continue;
+    Cost += Inst::getCost(I->K);
+    Worklist.append(I->Ops.begin(), I->Ops.end());
   }
-  int Cost = Inst::getCost(I->K);
-  for (auto Op : I->Ops)
-    Cost += costHelper(Op, Root, Visited, IgnoreDepsWithExternalUses);
   return Cost;
 }
 
-int souper::cost(Inst *I, bool IgnoreDepsWithExternalUses) {
-  std::set<Inst *> Visited;
-  return costHelper(I, I, Visited, IgnoreDepsWithExternalUses);
+static int costWeight(Inst *I) {
+  return Inst::getCost(I->K);
 }
 
-int souper::countHelper(Inst *I, std::set<Inst *> &Visited) {
-  if (!Visited.insert(I).second)
-    return 0;
-
-  int Count;
-
+static int countWeight(Inst *I) {
   // Main overflow intrinsics has a backing add/sub/mul operation which will be counted as one.
   // Sub overflow operations ({Add,Sub,Mul}O variants) are not counted as they are not real instructions
   if (I->K == Inst::Var || I->K == Inst::Const || I->K == Inst::UntypedConst ||
       Inst::isOverflowIntrinsicMain(I->K) || Inst::isOverflowIntrinsicSub(I->K))
-    Count = 0;
-  else
-    Count = 1;
+    return 0;
+  return 1;
+}
+
+// Sums Weight over the Insts that I reaches, each counted once however
+// often it is reached, and memoizes the sum in I->*Memo. Usually all the
+// operands of an Inst that reach anything of weight are the same Inst, and
+// the sum is that of the operand plus the weight of the Inst; such chains
+// are followed down to a known sum and memoized on the way back up.
+// Otherwise the operands may share Insts and they are walked.
+static int memoizedDAGSum(Inst *I, int (*Weight)(Inst *), int Inst::*Memo) {
+  llvm::SmallVector<Inst *, 16> Chain;
+  int Sum = 0;
+  while (I) {
+    int Memoized =
+      std::atomic_ref<int>(I->*Memo).load(std::memory_order_relaxed);
+    if (Memoized >= 0) {
+      Sum = Memoized;
+      break;
+    }
+
+    Inst *Heavy = nullptr;
+    bool MayShare = false;
+    for (Inst *Op : I->Ops) {
+      if (Op->Ops.empty() && Weight(Op) == 0)
+        continue;
+      if (Heavy && Op != Heavy) {
+        MayShare = true;
+        break;
+      }
+      Heavy = Op;
+    }
+
+    if (MayShare) {
+      InstVisitedSet Visited;
+      llvm::SmallVector<Inst *, 32> Worklist = {I};
+      while (!Worklist.empty()) {
+        Inst *J = Worklist.pop_back_val();
+        if (!Visited.insert(J))
+          continue;
+        Sum += Weight(J);
+        Worklist.append(J->Ops.begin(), J->Ops.end());
+      }
+      std::atomic_ref<int>(I->*Memo).store(Sum, std::memory_order_relaxed);
+      break;
+    }
 
+    Chain.push_back(I);
+    I = Heavy;
+  }
+
+  while (!Chain.empty()) {
+    Inst *J = Chain.pop_back_val();
+    Sum += Weight(J);
+    std::atomic_ref<int>(J->*Memo).store(Sum, std::memory_order_relaxed);
+  }
+  return Sum;
+}
+
+int souper::cost(Inst *I, bool IgnoreDepsWithExternalUses) {
+  if (IgnoreDepsWithExternalUses && !I->DepsWithExternalUses.empty())
+    return costWithoutExternalDeps(I);
+  return memoizedDAGSum(I, costWeight, &Inst::CachedCost);
+}
+
+int souper::countHelper(Inst *I, std::set<Inst *> &Visited) {
+  if (!Visited.insert(I).second)
+    return 0;
+
+  int Count = countWeight(I);
   for (auto Op : I->Ops)
     Count += countHelper(Op, Visited);
   return Count;
 }
 
 int souper::instCount(Inst *I) {
-  std::set<Inst *> Visited;
-  return countHelper(I, Visited);
+  return memoizedDAGSum(I, countWeight, &Inst::CachedInstCount);
+}
+
+int souper::instCount(Inst *I, const llvm::DenseSet<Inst *> &Free) {
+  if (Free.empty())
+    return instCount(I);
+
+  int Count = 0;
+  InstVisitedSet Visited;
+  llvm::SmallVector<Inst *, 16> Worklist = {I};
+  while (!Worklist.empty()) {
+    Inst *J = Worklist.pop_back_val();
+    if (Free.count(J) || !Visited.insert(J))
+      continue;
+    Count += countWeight(J);
+    Worklist.append(J->Ops.begin(), J->Ops.end());
+  }
+  return Count;
 }
 
 int souper::benefit(Inst *LHS, Inst *RHS) {
@@ -1080,36 +1562,61 @@ std::string souper::GetReplacementRHSString(Inst *RHS,
   return SS.str();
 }
 
-// breadth-first search
+static std::vector<std::unique_ptr<InstIndexMap<bool>>> &getFreeVisitedSets() {
+  thread_local std::vector<std::unique_ptr<InstIndexMap<bool>>> Free;
+  return Free;
+}
+
+InstVisitedSet::InstVisitedSet() {
+  auto &Free = getFreeVisitedSets();
+  if (Free.empty()) {
+    Set = std::make_unique<InstIndexMap<bool>>();
+  } else {
+    Set = std::move(Free.back());
+    Free.pop_back();
+  }
+}
+
+InstVisitedSet::~InstVisitedSet() {
+  Set->clear();
+  getFreeVisitedSets().push_back(std::move(Set));
+}
+
+void souper::forEachInst(Inst *Root, llvm::function_ref<void(Inst *)> Visit) {
+  // Insts are marked when they are queued rather than when they are
+  // visited, so each is queued once
+  InstVisitedSet Visited;
+  llvm::SmallVector<Inst *, 32> Queue = {Root};
+  Visited.insert(Root);
+  for (size_t Head = 0; Head != Queue.size(); ++Head) {
+    Inst *I = Queue[Head];
+    Visit(I);
+    for (auto Op : I->Ops)
+      if (Visited.insert(Op))
+        Queue.push_back(Op);
+  }
+}
+
 void souper::findCands(Inst *Root, std::set<Inst *> &Guesses,
 		       bool WidthMustMatch, bool FilterVars,int Max) {
-  std::set<Inst *> Visited;
-  std::queue<Inst *> Q;
-  Q.push(Root);
-  while (!Q.empty()) {
-    Inst *I = Q.front();
-    Q.pop();
-    if (Visited.insert(I).second) {
-      for (auto Op : I->Ops)
-        Q.push(Op);
-      if (I->Available && I->K != Inst::Const
-          && I->K != Inst::UntypedConst) {
-        if (WidthMustMatch && I->Width != Root->Width)
-          continue;
-        if (FilterVars && I->K == Inst::Var)
-          continue;
-        if (I->K == Inst::SAddWithOverflow || I->K == Inst::UAddWithOverflow ||
-            I->K == Inst::SSubWithOverflow || I->K == Inst::USubWithOverflow ||
-            I->K == Inst::SMulWithOverflow || I->K == Inst::UMulWithOverflow ||
-            I->K == Inst::SAddO || I->K == Inst::UAddO ||
-            I->K == Inst::SSubO || I->K == Inst::USubO ||
-            I->K == Inst::SMulO || I->K == Inst::UMulO)
-          continue;
-        if (Guesses.size() < Max)
-	  Guesses.insert(I);
-      }
+  forEachInst(Root, [&](Inst *I) {
+    if (I->Available && I->K != Inst::Const
+        && I->K != Inst::UntypedConst) {
+      if (WidthMustMatch && I->Width != Root->Width)
+        return;
+      if (FilterVars && I->K == Inst::Var)
+        return;
+      if (I->K == Inst::SAddWithOverflow || I->K == Inst::UAddWithOverflow ||
+          I->K == Inst::SSubWithOverflow || I->K == Inst::USubWithOverflow ||
+          I->K == Inst::SMulWithOverflow || I->K == Inst::UMulWithOverflow ||
+          I->K == Inst::SAddO || I->K == Inst::UAddO ||
+          I->K == Inst::SSubO || I->K == Inst::USubO ||
+          I->K == Inst::SMulO || I->K == Inst::UMulO)
+        return;
+      if (Guesses.size() < Max)
+        Guesses.insert(I);
     }
-  }
+  });
 }
 
 /* TODO call findCands instead */
@@ -1120,62 +1627,30 @@ void souper::findVars(Inst *Root, std::vector<Inst *> &Vars) {
 }
 
 void souper::findInsts(Inst *Root, std::vector<Inst *> &Insts, std::function<bool(Inst*)> Condition) {
-  // breadth-first search
   if (Root == nullptr)
     return;
 
-  std::set<Inst *> Visited;
-  std::queue<Inst *> Q;
-  Q.push(Root);
-  while (!Q.empty()) {
-    Inst *I = Q.front();
-    Q.pop();
-    if (!Visited.insert(I).second)
-      continue;
+  forEachInst(Root, [&](Inst *I) {
     if (Condition(I))
       Insts.push_back(I);
-    for (auto Op : I->Ops)
-      Q.push(Op);
-  }
-}
-
-void hasConstantHelper(Inst *I, std::set<Inst *> &Visited,
-                       std::set<Inst *> &ConstSet) {
-  if (I->K == Inst::Var && I->SynthesisConstID != 0) {
-    ConstSet.insert(I);
-  } else {
-    if (Visited.insert(I).second)
-      for (auto Op : I->Ops)
-        hasConstantHelper(Op, Visited, ConstSet);
-  }
+  });
 }
 
-// TODO do this a more efficient way
 void souper::getConstants(Inst *I, std::set<Inst *> &ConstSet) {
-  std::set<Inst *> Visited;
-  hasConstantHelper(I, Visited, ConstSet);
+  forEachInst(I, [&](Inst *J) {
+    if (J->K == Inst::Var && J->SynthesisConstID != 0)
+      ConstSet.insert(J);
+  });
 }
 
-
-
 // TODO: Convert to a more generic getGivenInst similar to hasGivenInst below
 void souper::getHoles(Inst *Root, std::vector<Inst *> &Holes) {
-  // breadth-first search
-  std::set<Inst *> Visited;
-  std::queue<Inst *> Q;
-  Q.push(Root);
-  while (!Q.empty()) {
-    Inst *I = Q.front();
-    Q.pop();
-    if (!Visited.insert(I).second)
-      continue;
+  forEachInst(Root, [&](Inst *I) {
     if (I->K == Inst::Hole) {
       assert(I->Width > 0);
       Holes.push_back(I);
     }
-    for (auto Op : I->Ops)
-      Q.push(Op);
-  }
+  });
 }
 
 bool souper::hasGivenInst(Inst *Root, std::function<bool(Inst*)> InstTester) {
@@ -1184,19 +1659,10 @@ bool souper::hasGivenInst(Inst *Root, std::function<bool(Inst*)> InstTester) {
   return Insts.size() > 0;
 }
 
-Inst *souper::getInstCopy(Inst *I, InstContext &IC,
-                          std::map<Inst *, Inst *> &InstCache,
-                          std::map<Block *, Block *> &BlockCache,
-                          std::map<Inst *, llvm::APInt> *ConstMap,
-                          bool CloneVars, bool CloneBlocks) {
-
-  if (InstCache.count(I))
-    return InstCache.at(I);
-
-  std::vector<Inst *> Ops;
-  for (auto const &Op : I->Ops)
-    Ops.push_back(getInstCopy(Op, IC, InstCache, BlockCache, ConstMap, CloneVars));
-
+static Inst *copyInst(Inst *I, const std::vector<Inst *> &Ops,
+                      InstContext &IC, std::map<Block *, Block *> &BlockCache,
+                      std::map<Inst *, llvm::APInt> *ConstMap,
+                      bool CloneVars, bool CloneBlocks) {
   Inst *Copy = 0;
   if (I->K == Inst::Var) {
     if (ConstMap) {
@@ -1214,10 +1680,11 @@ Inst *souper::getInstCopy(Inst *I, InstContext &IC,
     }
     if (!Copy) {
       if (CloneVars && I->SynthesisConstID == 0)
-        Copy = IC.createVar(I->Width, I->Name, I->Range, I->KnownZeros,
-                            I->KnownOnes, I->NonZero, I->NonNegative,
-                            I->PowOfTwo, I->Negative, I->NumSignBits,
-                            I->DemandedBits,
+        Copy = IC.createVar(I->Width, I->Name, I->Facts->Range,
+                            I->Facts->KnownZeros, I->Facts->KnownOnes,
+                            I->Facts->NonZero, I->Facts->NonNegative,
+                            I->Facts->PowOfTwo, I->Facts->Negative,
+                            I->Facts->NumSignBits, I->DemandedBits,
                             I->SynthesisConstID);
       else {
         Copy = I;
@@ -1241,10 +1708,49 @@ Inst *souper::getInstCopy(Inst *I, InstContext &IC,
     Copy = IC.getInst(I->K, I->Width, Ops, I->DemandedBits, I->Available);
   }
   assert(Copy);
-  InstCache[I] = Copy;
   return Copy;
 }
 
+Inst *souper::getInstCopy(Inst *I, InstContext &IC,
+                          std::map<Inst *, Inst *> &InstCache,
+                          std::map<Block *, Block *> &BlockCache,
+                          std::map<Inst *, llvm::APInt> *ConstMap,
+                          bool CloneVars, bool CloneBlocks) {
+  auto It = InstCache.find(I);
+  if (It != InstCache.end())
+    return It->second;
+
+  // Copies operands before users, in the order a depth-first recursion
+  // would, so the Insts and Blocks it creates come in the same order
+  struct Frame {
+    Inst *I;
+    unsigned NextOp;
+  };
+  llvm::SmallVector<Frame, 16> Stack = {{I, 0}};
+  std::vector<Inst *> Ops;
+  while (true) {
+    Frame &F = Stack.back();
+    if (F.NextOp != F.I->Ops.size()) {
+      Inst *Op = F.I->Ops[F.NextOp++];
+      if (!InstCache.count(Op))
+        Stack.push_back({Op, 0});
+      continue;
+    }
+
+    Inst *J = F.I;
+    Stack.pop_back();
+    Ops.clear();
+    for (auto Op : J->Ops)
+      Ops.push_back(InstCache.at(Op));
+    // Only the Block of a Phi at the root is kept when CloneBlocks is false
+    Inst *Copy = copyInst(J, Ops, IC, BlockCache, ConstMap, CloneVars,
+                          Stack.empty() ? CloneBlocks : true);
+    InstCache[J] = Copy;
+    if (Stack.empty())
+      return Copy;
+  }
+}
+
 Inst *souper::instJoin(Inst *I, Inst *EmptyInst, Inst *NewInst,
                        std::map<Inst *, Inst *> &InstCache,
                        InstContext &IC) {
@@ -1264,10 +1770,11 @@ Inst *souper::instJoin(Inst *I, Inst *EmptyInst, Inst *NewInst,
   } else if (I->K == Inst::Var) {
     // copy constant
     if (I->SynthesisConstID != 0) {
-      Copy = IC.createVar(I->Width, I->Name, I->Range, I->KnownZeros,
-                          I->KnownOnes, I->NonZero, I->NonNegative,
-                          I->PowOfTwo, I->Negative, I->NumSignBits,
-                          I->DemandedBits,
+      Copy = IC.createVar(I->Width, I->Name, I->Facts->Range,
+                          I->Facts->KnownZeros, I->Facts->KnownOnes,
+                          I->Facts->NonZero, I->Facts->NonNegative,
+                          I->Facts->PowOfTwo, I->Facts->Negative,
+                          I->Facts->NumSignBits, I->DemandedBits,
                           I->SynthesisConstID);
     } else {
       Copy = I;
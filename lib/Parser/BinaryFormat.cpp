@@ -0,0 +1,635 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The layout, with numbers in ULEB128 unless noted:
+//
+//   file        := magic (4 bytes) version replacement*
+//   replacement := NumRecords record* footer
+//   record      := BlockTag Preds
+//                | Kind (1 byte) Width Flags (1 byte) [DemandedBits]
+//                  operands [NumExternalUses InstId*]
+//   footer      := NumPCs (InstId InstId)*
+//                  NumBlockPCs (BlockId PredIdx InstId InstId)*
+//                  LHS (RHS + 1, or 0 without a RHS)
+//
+// Insts and Blocks are numbered separately, in the order of their records,
+// and records only refer to earlier ones. The operands depend on the kind:
+//
+//   Const                           words
+//   UntypedConst                    BitWidth words
+//   Var                             Name SynthesisConstID FactFlags
+//                                   NumSignBits [KnownZeros KnownOnes]
+//                                   [RangeLower RangeUpper]
+//   Hole, ReservedConst, ReservedInst  Name
+//   Phi                             BlockId NumOps InstId*
+//   others                          NumOps InstId*
+//
+// APInts are stored as their words, 8 bytes little-endian each, and strings
+// as their length and bytes. Kinds are numbered as in Inst::Kind, so
+// changing the kinds means bumping the version.
+
+#include "souper/Parser/BinaryFormat.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/LEB128.h"
+
+#include <climits>
+
+using namespace llvm;
+using namespace souper;
+
+namespace {
+
+const char Magic[4] = {'\xff', 'S', 'P', 'R'};
+const unsigned Version = 1;
+static_assert(Inst::None == 71, "Inst kinds changed, bump the version");
+
+const uint8_t BlockTag = 0xff;
+
+enum Flags : uint8_t {
+  NotAvailable = 1 << 0,
+  HarvestedFromUse = 1 << 1,
+  HasDemandedBits = 1 << 2,
+  HasExternalUses = 1 << 3,
+};
+
+enum FactFlags : uint8_t {
+  NonZero = 1 << 0,
+  NonNegative = 1 << 1,
+  PowOfTwo = 1 << 2,
+  Negative = 1 << 3,
+  HasKnownBits = 1 << 4,
+  HasRange = 1 << 5,
+};
+
+class BinaryWriter {
+  raw_ostream &Out;
+  // The records of the current replacement
+  SmallString<256> Buf;
+  raw_svector_ostream OS{Buf};
+  unsigned NumRecords = 0;
+  DenseMap<Inst *, unsigned> InstIds;
+  DenseMap<Block *, unsigned> BlockIds;
+
+  void writeNumber(uint64_t N, raw_ostream &S) { encodeULEB128(N, S); }
+  void writeNumber(uint64_t N) { writeNumber(N, OS); }
+
+  void writeAPInt(const APInt &V) {
+    for (unsigned J = 0; J < V.getNumWords(); ++J) {
+      char Word[8];
+      support::endian::write64le(Word, V.getRawData()[J]);
+      OS.write(Word, sizeof(Word));
+    }
+  }
+
+  void writeString(StringRef S) {
+    writeNumber(S.size());
+    OS << S;
+  }
+
+  void writeBlock(Block *B) {
+    if (BlockIds.count(B))
+      return;
+    OS << (char)BlockTag;
+    writeNumber(B->Preds);
+    unsigned Id = BlockIds.size();
+    BlockIds[B] = Id;
+    ++NumRecords;
+  }
+
+  void writeRecord(Inst *I);
+  void writeInst(Inst *Root);
+
+public:
+  BinaryWriter(raw_ostream &Out) : Out(Out) {}
+  void writeReplacement(const ParsedReplacement &R);
+};
+
+void BinaryWriter::writeRecord(Inst *I) {
+  if (I->K == Inst::Phi)
+    writeBlock(I->B);
+
+  OS << (char)I->K;
+  writeNumber(I->Width);
+  uint8_t F = 0;
+  if (!I->Available)
+    F |= NotAvailable;
+  if (I->HarvestKind == HarvestType::HarvestedFromUse)
+    F |= HarvestedFromUse;
+  bool DemandedBits = I->DemandedBits.getBitWidth() == I->Width &&
+                      !I->DemandedBits.isAllOnes();
+  if (DemandedBits)
+    F |= HasDemandedBits;
+  // Only dependencies written before are kept, which is all of them when
+  // they are operands, as the parser makes them
+  std::vector<unsigned> ExternalUses;
+  for (auto EU : I->DepsWithExternalUses) {
+    auto It = InstIds.find(EU);
+    if (It != InstIds.end())
+      ExternalUses.push_back(It->second);
+  }
+  llvm::sort(ExternalUses);
+  if (!ExternalUses.empty())
+    F |= HasExternalUses;
+  OS << (char)F;
+  if (DemandedBits)
+    writeAPInt(I->DemandedBits);
+
+  switch (I->K) {
+  case Inst::Const:
+    writeAPInt(I->Val);
+    break;
+  case Inst::UntypedConst:
+    writeNumber(I->Val.getBitWidth());
+    writeAPInt(I->Val);
+    break;
+  case Inst::Var: {
+    const VarFacts &VF = *I->Facts;
+    bool KnownBits = !VF.KnownZeros.isZero() || !VF.KnownOnes.isZero();
+    bool Range = !VF.Range.isFullSet();
+    writeString(I->Name);
+    writeNumber(I->SynthesisConstID);
+    OS << (char)((VF.NonZero ? NonZero : 0) |
+                 (VF.NonNegative ? NonNegative : 0) |
+                 (VF.PowOfTwo ? PowOfTwo : 0) |
+                 (VF.Negative ? Negative : 0) |
+                 (KnownBits ? HasKnownBits : 0) |
+                 (Range ? HasRange : 0));
+    writeNumber(VF.NumSignBits);
+    if (KnownBits) {
+      writeAPInt(VF.KnownZeros);
+      writeAPInt(VF.KnownOnes);
+    }
+    if (Range) {
+      writeAPInt(VF.Range.getLower());
+      writeAPInt(VF.Range.getUpper());
+    }
+    break;
+  }
+  case Inst::Hole:
+  case Inst::ReservedConst:
+  case Inst::ReservedInst:
+    writeString(I->Name);
+    break;
+  default:
+    if (I->K == Inst::Phi)
+      writeNumber(BlockIds[I->B]);
+    writeNumber(I->Ops.size());
+    for (auto Op : I->Ops)
+      writeNumber(InstIds[Op]);
+    break;
+  }
+
+  if (!ExternalUses.empty()) {
+    writeNumber(ExternalUses.size());
+    for (auto Id : ExternalUses)
+      writeNumber(Id);
+  }
+
+  unsigned Id = InstIds.size();
+  InstIds[I] = Id;
+  ++NumRecords;
+}
+
+// Writes the records of Root and of everything it reaches that has none yet,
+// operands first
+void BinaryWriter::writeInst(Inst *Root) {
+  if (InstIds.count(Root))
+    return;
+  std::vector<std::pair<Inst *, unsigned>> Stack{{Root, 0}};
+  while (!Stack.empty()) {
+    auto &Top = Stack.back();
+    Inst *I = Top.first;
+    if (Top.second < I->Ops.size()) {
+      Inst *Op = I->Ops[Top.second++];
+      if (!InstIds.count(Op))
+        Stack.push_back({Op, 0});
+      continue;
+    }
+    Stack.pop_back();
+    // Shared operands may be reached twice before their records are written
+    if (!InstIds.count(I))
+      writeRecord(I);
+  }
+}
+
+void BinaryWriter::writeReplacement(const ParsedReplacement &R) {
+  Buf.clear();
+  NumRecords = 0;
+  InstIds.clear();
+  BlockIds.clear();
+
+  for (const auto &PC : R.PCs) {
+    writeInst(PC.LHS);
+    writeInst(PC.RHS);
+  }
+  for (const auto &BPC : R.BPCs) {
+    writeBlock(BPC.B);
+    writeInst(BPC.PC.LHS);
+    writeInst(BPC.PC.RHS);
+  }
+  writeInst(R.Mapping.LHS);
+  if (R.Mapping.RHS)
+    writeInst(R.Mapping.RHS);
+
+  writeNumber(NumRecords, Out);
+  Out << Buf;
+  Buf.clear();
+  writeNumber(R.PCs.size());
+  for (const auto &PC : R.PCs) {
+    writeNumber(InstIds[PC.LHS]);
+    writeNumber(InstIds[PC.RHS]);
+  }
+  writeNumber(R.BPCs.size());
+  for (const auto &BPC : R.BPCs) {
+    writeNumber(BlockIds[BPC.B]);
+    writeNumber(BPC.PredIdx);
+    writeNumber(InstIds[BPC.PC.LHS]);
+    writeNumber(InstIds[BPC.PC.RHS]);
+  }
+  writeNumber(InstIds[R.Mapping.LHS]);
+  writeNumber(R.Mapping.RHS ? InstIds[R.Mapping.RHS] + 1 : 0);
+  Out << Buf;
+}
+
+class BinaryReader {
+  InstContext &IC;
+  StringRef Filename;
+  const uint8_t *Begin, *Cur, *End;
+  std::string &ErrStr;
+  std::vector<Inst *> Insts;
+  std::vector<Block *> Blocks;
+  // The attributes stored with each record of Insts. Only those of the LHS
+  // are set, as the parser does
+  struct Attributes {
+    APInt DemandedBits;
+    HarvestType HarvestKind;
+  };
+  std::vector<Attributes> InstAttributes;
+
+  bool fail(const Twine &Msg) {
+    ErrStr = (Filename + ": offset " + Twine(Cur - Begin) + ": " + Msg).str();
+    return false;
+  }
+
+  bool readByte(uint8_t &B) {
+    if (Cur == End)
+      return fail("unexpected end of input");
+    B = *Cur++;
+    return true;
+  }
+
+  bool readNumber(unsigned &N) {
+    unsigned Len;
+    const char *Error = nullptr;
+    uint64_t V = decodeULEB128(Cur, &Len, End, &Error);
+    if (Error)
+      return fail(Error);
+    if (V > UINT_MAX)
+      return fail("number out of range");
+    Cur += Len;
+    N = V;
+    return true;
+  }
+
+  bool readAPInt(unsigned Width, APInt &V) {
+    unsigned NumWords = APInt::getNumWords(Width);
+    if ((size_t)(End - Cur) < NumWords * 8u)
+      return fail("unexpected end of input");
+    SmallVector<uint64_t, 2> Words;
+    for (unsigned J = 0; J < NumWords; ++J, Cur += 8)
+      Words.push_back(support::endian::read64le(Cur));
+    V = APInt(Width, Words);
+    return true;
+  }
+
+  bool readString(std::string &S) {
+    unsigned Len;
+    if (!readNumber(Len))
+      return false;
+    if ((size_t)(End - Cur) < Len)
+      return fail("unexpected end of input");
+    S.assign((const char *)Cur, Len);
+    Cur += Len;
+    return true;
+  }
+
+  bool readInstId(Inst *&I) {
+    unsigned Id;
+    if (!readNumber(Id))
+      return false;
+    if (Id >= Insts.size())
+      return fail("reference to an undefined inst");
+    I = Insts[Id];
+    return true;
+  }
+
+  bool readBlockId(Block *&B) {
+    unsigned Id;
+    if (!readNumber(Id))
+      return false;
+    if (Id >= Blocks.size())
+      return fail("reference to an undefined block");
+    B = Blocks[Id];
+    return true;
+  }
+
+  bool readOps(std::vector<Inst *> &Ops) {
+    unsigned NumOps;
+    if (!readNumber(NumOps))
+      return false;
+    if (NumOps == 0)
+      return fail("inst without operands");
+    if (NumOps > (size_t)(End - Cur))
+      return fail("unexpected end of input");
+    Ops.resize(NumOps);
+    for (auto &Op : Ops)
+      if (!readInstId(Op))
+        return false;
+    return true;
+  }
+
+  bool typeCheckOverflow(Inst::Kind K, unsigned Width,
+                         const std::vector<Inst *> &Ops);
+
+  bool readRecord();
+  bool readReplacement(ParsedReplacement &R);
+
+public:
+  BinaryReader(InstContext &IC, StringRef Filename, StringRef Buf,
+               std::string &ErrStr)
+    : IC(IC), Filename(Filename), Begin((const uint8_t *)Buf.data()),
+      Cur(Begin), End(Begin + Buf.size()), ErrStr(ErrStr) {}
+  std::vector<ParsedReplacement> readReplacements();
+};
+
+// The parser makes the operands of an overflow intrinsic its backing
+// operation and its overflow bit, which were checked when they were read
+bool BinaryReader::typeCheckOverflow(Inst::Kind K, unsigned Width,
+                                     const std::vector<Inst *> &Ops) {
+  if (Ops.size() != 2 || Ops[0]->K != Inst::getBasicInstrForOverflow(K) ||
+      Ops[1]->K != Inst::getOverflowComplement(K) ||
+      Width != Ops[0]->Width + 1)
+    return fail("invalid " + Twine(Inst::getKindName(K)));
+  return true;
+}
+
+bool BinaryReader::readRecord() {
+  uint8_t Tag;
+  if (!readByte(Tag))
+    return false;
+  if (Tag == BlockTag) {
+    unsigned Preds;
+    if (!readNumber(Preds))
+      return false;
+    if (Preds == 0 || Preds > MaxPreds)
+      return fail("invalid number of block predecessors");
+    Blocks.push_back(IC.createBlock(Preds));
+    return true;
+  }
+  if (Tag >= Inst::None)
+    return fail("invalid inst kind " + Twine(Tag));
+  auto K = (Inst::Kind)Tag;
+
+  unsigned Width;
+  uint8_t F;
+  if (!readNumber(Width) || !readByte(F))
+    return false;
+  if (Width > MaxInstWidth)
+    return fail("width must be at most " + Twine(MaxInstWidth));
+  if (Width == 0 && K != Inst::UntypedConst && K != Inst::ReservedConst &&
+      K != Inst::ReservedInst)
+    return fail("inst without a width");
+  // Reserved Insts may not have a width yet, and then have no demanded bits
+  APInt DemandedBits;
+  if (Width)
+    DemandedBits = APInt::getAllOnes(Width);
+  if (F & HasDemandedBits) {
+    if (!Width)
+      return fail("demanded bits without a width");
+    if (!readAPInt(Width, DemandedBits))
+      return false;
+  }
+
+  Inst *I;
+  switch (K) {
+  case Inst::Const: {
+    APInt Val;
+    if (!readAPInt(Width, Val))
+      return false;
+    I = IC.getConst(Val);
+    break;
+  }
+  case Inst::UntypedConst: {
+    unsigned BitWidth;
+    APInt Val;
+    if (!readNumber(BitWidth))
+      return false;
+    if (BitWidth == 0)
+      return fail("constant without a width");
+    if (BitWidth > MaxInstWidth)
+      return fail("width must be at most " + Twine(MaxInstWidth));
+    if (!readAPInt(BitWidth, Val))
+      return false;
+    I = IC.getUntypedConst(Val);
+    break;
+  }
+  case Inst::Var: {
+    std::string Name;
+    unsigned SynthesisConstID, NumSignBits;
+    uint8_t Facts;
+    APInt Zero(Width, 0), One(Width, 0);
+    APInt Lower = APInt::getMaxValue(Width), Upper = Lower;
+    if (!readString(Name) || !readNumber(SynthesisConstID) ||
+        !readByte(Facts) || !readNumber(NumSignBits))
+      return false;
+    if ((Facts & HasKnownBits) &&
+        (!readAPInt(Width, Zero) || !readAPInt(Width, One)))
+      return false;
+    if ((Facts & HasRange) &&
+        (!readAPInt(Width, Lower) || !readAPInt(Width, Upper)))
+      return false;
+    if (Lower == Upper && !Lower.isMinValue() && !Lower.isMaxValue())
+      return fail("invalid range");
+    I = IC.createVar(Width, Name, ConstantRange(Lower, Upper), Zero, One,
+                     Facts & NonZero, Facts & NonNegative, Facts & PowOfTwo,
+                     Facts & Negative, NumSignBits, DemandedBits,
+                     SynthesisConstID);
+    break;
+  }
+  case Inst::Hole:
+  case Inst::ReservedConst:
+  case Inst::ReservedInst: {
+    std::string Name;
+    if (!readString(Name))
+      return false;
+    if (K == Inst::Hole)
+      I = IC.createHole(Width);
+    else if (K == Inst::ReservedConst)
+      I = IC.getReservedConst();
+    else
+      I = IC.getReservedInst();
+    I->Width = Width;
+    I->Name = Name;
+    break;
+  }
+  case Inst::Phi: {
+    Block *B;
+    std::vector<Inst *> Ops;
+    if (!readBlockId(B) || !readOps(Ops))
+      return false;
+    if (!typeCheckPhi(IC, Width, B, Ops, ErrStr))
+      return fail(ErrStr);
+    I = IC.getPhi(B, Ops);
+    break;
+  }
+  default: {
+    std::vector<Inst *> Ops;
+    if (!readOps(Ops))
+      return false;
+    if (Inst::isOverflowIntrinsicMain(K)) {
+      if (!typeCheckOverflow(K, Width, Ops))
+        return false;
+    } else if (!typeCheckInst(IC, K, Width, Ops, ErrStr)) {
+      return fail(ErrStr);
+    }
+    I = IC.getInst(K, Width, Ops, !(F & NotAvailable));
+    break;
+  }
+  }
+
+  InstAttributes.push_back({DemandedBits, F & HarvestedFromUse ?
+                                          HarvestType::HarvestedFromUse :
+                                          HarvestType::HarvestedFromDef});
+  if (F & HasExternalUses) {
+    unsigned NumExternalUses;
+    if (!readNumber(NumExternalUses))
+      return false;
+    for (unsigned J = 0; J < NumExternalUses; ++J) {
+      Inst *EU;
+      if (!readInstId(EU))
+        return false;
+      IC.addDepWithExternalUses(I, EU);
+    }
+  }
+  Insts.push_back(I);
+  return true;
+}
+
+bool BinaryReader::readReplacement(ParsedReplacement &R) {
+  Insts.clear();
+  Blocks.clear();
+  InstAttributes.clear();
+
+  unsigned NumRecords;
+  if (!readNumber(NumRecords))
+    return false;
+  for (unsigned J = 0; J < NumRecords; ++J)
+    if (!readRecord())
+      return false;
+
+  unsigned NumPCs, NumBPCs, RHSId;
+  if (!readNumber(NumPCs))
+    return false;
+  for (unsigned J = 0; J < NumPCs; ++J) {
+    InstMapping PC;
+    if (!readInstId(PC.LHS) || !readInstId(PC.RHS))
+      return false;
+    R.PCs.push_back(PC);
+  }
+  if (!readNumber(NumBPCs))
+    return false;
+  for (unsigned J = 0; J < NumBPCs; ++J) {
+    BlockPCMapping BPC;
+    if (!readBlockId(BPC.B) || !readNumber(BPC.PredIdx))
+      return false;
+    if (BPC.PredIdx >= BPC.B->Preds)
+      return fail("blockpc's predecessor number is larger than the number "
+                  "of predecessors of its block");
+    if (!readInstId(BPC.PC.LHS) || !readInstId(BPC.PC.RHS))
+      return false;
+    R.BPCs.push_back(BPC);
+  }
+  unsigned LHSId;
+  if (!readNumber(LHSId))
+    return false;
+  if (LHSId >= Insts.size())
+    return fail("reference to an undefined inst");
+  R.Mapping.LHS = Insts[LHSId];
+  // Like the parser, which sets the attributes of the infer or cand operand
+  // on the hash-consed Inst
+  if (R.Mapping.LHS->Width)
+    IC.setAttributes(R.Mapping.LHS, InstAttributes[LHSId].DemandedBits,
+                     InstAttributes[LHSId].HarvestKind);
+  if (!readNumber(RHSId))
+    return false;
+  if (RHSId) {
+    if (RHSId > Insts.size())
+      return fail("reference to an undefined inst");
+    R.Mapping.RHS = Insts[RHSId - 1];
+  }
+  return true;
+}
+
+std::vector<ParsedReplacement> BinaryReader::readReplacements() {
+  std::vector<ParsedReplacement> Reps;
+  if (!isBinaryReplacements(StringRef((const char *)Begin, End - Begin))) {
+    fail("not a binary replacement file");
+    return {};
+  }
+  Cur += sizeof(Magic);
+  unsigned V;
+  if (!readNumber(V))
+    return {};
+  if (V != Version) {
+    fail("unsupported version " + Twine(V));
+    return {};
+  }
+  while (Cur != End) {
+    ParsedReplacement R;
+    if (!readReplacement(R))
+      return {};
+    Reps.push_back(std::move(R));
+  }
+  return Reps;
+}
+
+}
+
+namespace souper {
+
+bool isBinaryReplacements(StringRef Buf) {
+  return Buf.startswith(StringRef(Magic, sizeof(Magic)));
+}
+
+void WriteBinaryReplacements(raw_ostream &OS,
+                             ArrayRef<ParsedReplacement> Reps) {
+  OS.write(Magic, sizeof(Magic));
+  encodeULEB128(Version, OS);
+  BinaryWriter W(OS);
+  for (const auto &R : Reps)
+    W.writeReplacement(R);
+}
+
+std::vector<ParsedReplacement> ReadBinaryReplacements(InstContext &IC,
+    StringRef Filename, StringRef Buf, std::string &ErrStr) {
+  BinaryReader R(IC, Filename, Buf, ErrStr);
+  return R.readReplacements();
+}
+
+}
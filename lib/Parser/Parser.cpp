@@ -18,10 +18,14 @@
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
 #include "souper/Extractor/Candidates.h"
 #include "souper/Inst/Inst.h"
 
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include <unordered_set>
 
@@ -53,7 +57,8 @@ struct Token {
   APInt Val;
   StringRef Name;
   unsigned Width;
-  std::string PatternString;
+  // Points into the input, like Pos
+  StringRef Pattern;
 
   StringRef str() const {
     return StringRef(Pos, Len);
@@ -70,8 +75,8 @@ struct Lexer {
   const char *LineBegin;
   unsigned LineNum;
 
-  Lexer(const char *Begin, const char *End)
-      : Begin(Begin), End(End), LineBegin(Begin), LineNum(1) {}
+  Lexer(const char *Begin, const char *End, unsigned LineNum = 1)
+      : Begin(Begin), End(End), LineBegin(Begin), LineNum(LineNum) {}
 
   Token getNextToken(std::string &ErrStr);
 
@@ -143,6 +148,10 @@ FoundChar:
         while (Begin != End && *Begin >= '0' && *Begin <= '9') {
           Width = Width*10 + (*Begin - '0');
           ++Begin;
+          if (Width > MaxInstWidth) {
+            ErrStr = "width must be at most " + utostr(MaxInstWidth);
+            return Token{Token::Error, WidthBegin, 0, APInt()};
+          }
         }
         if (Begin == WidthBegin) {
           ErrStr = "expected integer";
@@ -171,22 +180,21 @@ FoundChar:
       ++Begin;
     } while (Begin != End && ((*Begin >= 'a' && *Begin <= 'z') ||
              (*Begin == '.') || (*Begin >= 'A' && *Begin <= 'Z')));
-    std::string DataFlowFact = StringRef(TokenBegin, Begin - TokenBegin).str();
-    if (DataFlowFact == "knownBits") {
-      if (*Begin != '=') {
+    if (StringRef(TokenBegin, Begin - TokenBegin) == "knownBits") {
+      if (Begin == End || *Begin != '=') {
         ErrStr = "expected '=' for knownBits";
         return Token{Token::Error, Begin, 0, APInt()};
       }
       ++Begin;
       const char *PatternBegin = Begin;
-      while (*Begin == '0' || *Begin == '1' || *Begin == 'x')
+      while (Begin != End && (*Begin == '0' || *Begin == '1' || *Begin == 'x'))
         ++Begin;
       if (Begin == PatternBegin) {
         ErrStr = "expected [0|1|x]+ for knownBits";
         return Token{Token::Error, Begin, 0, APInt()};
       }
       return Token{Token::KnownBits, TokenBegin, size_t(Begin - TokenBegin), APInt(),
-                   "", 0, StringRef(PatternBegin, Begin - PatternBegin).str()};
+                   "", 0, StringRef(PatternBegin, Begin - PatternBegin)};
     } else
       return Token{Token::Ident, TokenBegin, size_t(Begin - TokenBegin), APInt()};
   }
@@ -213,6 +221,10 @@ FoundChar:
       while (Begin != End && *Begin >= '0' && *Begin <= '9') {
         Width = Width*10 + (*Begin - '0');
         ++Begin;
+        if (Width > MaxInstWidth) {
+          ErrStr = "width must be at most " + utostr(MaxInstWidth);
+          return Token{Token::Error, WidthBegin, 0, APInt()};
+        }
       }
       if (Begin == WidthBegin) {
         ErrStr = "expected integer";
@@ -286,9 +298,9 @@ struct Parser {
   Parser(StringRef FileName, StringRef Str, InstContext &IC,
          std::vector<ParsedReplacement> &Reps, ReplacementKind RK,
          std::vector<ReplacementContext> *RCsIn,
-         std::vector<ReplacementContext> *RCsOut)
+         std::vector<ReplacementContext> *RCsOut, unsigned FirstLine = 1)
       : FileName(FileName),
-        L(Str.data(), Str.data() + Str.size()),
+        L(Str.data(), Str.data() + Str.size(), FirstLine),
         IC(IC),
         Reps(Reps),
         RK(RK),
@@ -308,6 +320,8 @@ struct Parser {
   ReplacementContext Context;
   int Index = 0;
   int ReservedConstCounter = 0;
+  // In the order they were numbered by ReservedConstCounter
+  std::vector<Inst *> ReservedConsts;
 
   std::vector<InstMapping> PCs;
   BlockPCs BPCs;
@@ -327,14 +341,6 @@ struct Parser {
            ErrStr;
   }
 
-  bool lossy(const APInt &I, unsigned NewWidth) {
-    unsigned W = I.getBitWidth();
-    if (NewWidth >= W)
-      return false;
-    auto NI = I.trunc(NewWidth);
-    return NI.zext(W) != I && NI.sext(W) != I;
-  }
-
   bool consumeToken(std::string &ErrStr) {
     CurTok = L.getNextToken(ErrStr);
     if (CurTok.K == Token::Error) {
@@ -350,10 +356,6 @@ struct Parser {
 
   bool typeCheckPhi(unsigned Width, Block *B, std::vector<Inst *> &Ops,
                     std::string &ErrStr);
-  bool typeCheckInst(Inst::Kind IK, unsigned &Width, std::vector<Inst *> &Ops,
-                     std::string &ErrStr);
-  bool typeCheckOpsMatchingWidths(llvm::MutableArrayRef<Inst *> Ops,
-                                  std::string &ErrStr);
 
   bool parseLine(std::string &ErrStr);
 
@@ -361,7 +363,6 @@ struct Parser {
   std::vector<ParsedReplacement> parseReplacements(std::string &ErrStr);
   void nextReplacement();
   bool parseInstAttribute(std::string &ErrStr, Inst *LHS);
-  bool isOverflow(Inst::Kind IK);
 };
 
 }
@@ -406,13 +407,22 @@ Inst *Parser::parseInst(std::string &ErrStr) {
   }
 }
 
-bool Parser::isOverflow(Inst::Kind IK) {
+static bool lossy(const APInt &I, unsigned NewWidth) {
+  unsigned W = I.getBitWidth();
+  if (NewWidth >= W)
+    return false;
+  auto NI = I.trunc(NewWidth);
+  return NI.zext(W) != I && NI.sext(W) != I;
+}
+
+static bool isOverflow(Inst::Kind IK) {
   return (IK == Inst::SAddWithOverflow || IK == Inst::UAddWithOverflow ||
           IK == Inst::SSubWithOverflow || IK == Inst::USubWithOverflow ||
           IK == Inst::SMulWithOverflow || IK == Inst::UMulWithOverflow);
 }
 
-bool Parser::typeCheckOpsMatchingWidths(llvm::MutableArrayRef<Inst *> Ops,
+bool souper::typeCheckOpsMatchingWidths(InstContext &IC,
+                                        llvm::MutableArrayRef<Inst *> Ops,
                                         std::string &ErrStr) {
   unsigned Width = 0;
   for (auto Op : Ops) {
@@ -441,21 +451,15 @@ bool Parser::typeCheckOpsMatchingWidths(llvm::MutableArrayRef<Inst *> Ops,
   return true;
 }
 
-bool Parser::typeCheckPhi(unsigned Width, Block *B,
+bool souper::typeCheckPhi(InstContext &IC, unsigned Width, Block *B,
                           std::vector<Inst *> &Ops, std::string &ErrStr) {
   if (B->Preds != Ops.size()) {
     ErrStr = "phi has " + utostr(Ops.size()) +
       " operand(s) but preceding block has " + utostr(B->Preds);
     return false;
   }
-  auto IdxIt = BlockPCIdxMap.find(B);
-  if (IdxIt != BlockPCIdxMap.end() && IdxIt->second >= Ops.size()) {
-    ErrStr = "blockpc's predecessor number is larger "
-             "than the number of phi's operands";
-    return false;
-  }
 
-  if (!typeCheckOpsMatchingWidths(Ops, ErrStr))
+  if (!typeCheckOpsMatchingWidths(IC, Ops, ErrStr))
     return false;
 
   if (Width != 0 && Width != Ops[0]->Width) {
@@ -474,7 +478,19 @@ bool Parser::typeCheckPhi(unsigned Width, Block *B,
   return true;
 }
 
-bool Parser::typeCheckInst(Inst::Kind IK, unsigned &Width,
+bool Parser::typeCheckPhi(unsigned Width, Block *B,
+                          std::vector<Inst *> &Ops, std::string &ErrStr) {
+  auto IdxIt = BlockPCIdxMap.find(B);
+  if (B->Preds == Ops.size() && IdxIt != BlockPCIdxMap.end() &&
+      IdxIt->second >= Ops.size()) {
+    ErrStr = "blockpc's predecessor number is larger "
+             "than the number of phi's operands";
+    return false;
+  }
+  return souper::typeCheckPhi(IC, Width, B, Ops, ErrStr);
+}
+
+bool souper::typeCheckInst(InstContext &IC, Inst::Kind IK, unsigned &Width,
                            std::vector<Inst *> &Ops,
                            std::string &ErrStr) {
   unsigned MinOps = 2, MaxOps = 2;
@@ -628,7 +644,7 @@ bool Parser::typeCheckInst(Inst::Kind IK, unsigned &Width,
   // ExtractValue instruction is an index value. We don't type check
   // the operands width as the two elements vary in width.
   if (IK != Inst::ExtractValue) {
-    if (!typeCheckOpsMatchingWidths(OpsMatchingWidths, ErrStr))
+    if (!typeCheckOpsMatchingWidths(IC, OpsMatchingWidths, ErrStr))
       return false;
 
     for (auto Op : Ops) {
@@ -743,6 +759,7 @@ void Parser::nextReplacement() {
   PCs.clear();
   BPCs.clear();
   BlockPCIdxMap.clear();
+  ExternalUsesSet.clear();
   if (RCsOut)
     RCsOut->emplace_back(Context);
   ++Index;
@@ -763,7 +780,7 @@ InstMapping Parser::parseInstMapping(std::string &ErrStr) {
   if (!SrcRep[1])
     return InstMapping();
 
-  if (!typeCheckOpsMatchingWidths(SrcRep, ErrStr)) {
+  if (!typeCheckOpsMatchingWidths(IC, SrcRep, ErrStr)) {
     ErrStr = makeErrStr(ErrStr);
     return InstMapping();
   }
@@ -774,8 +791,8 @@ InstMapping Parser::parseInstMapping(std::string &ErrStr) {
 bool Parser::parseInstAttribute(std::string &ErrStr, Inst *LHS) {
   int DemandedBitsCount = 0;
   int HarvestKindCount = 0;
-  LHS->HarvestKind = HarvestType::HarvestedFromDef;
-  LHS->DemandedBits = APInt::getAllOnes(LHS->Width);
+  llvm::APInt DemandedBits = APInt::getAllOnes(LHS->Width);
+  HarvestType HarvestKind = HarvestType::HarvestedFromDef;
   while (CurTok.K == Token::OpenParen) {
     llvm::APInt DemandedBitsVal = APInt(LHS->Width, 0, false);
     llvm::APInt ConstOne(LHS->Width, 1, false);
@@ -824,7 +841,7 @@ bool Parser::parseInstAttribute(std::string &ErrStr, Inst *LHS) {
       }
       if (!consumeToken(ErrStr))
         return false;
-      LHS->DemandedBits = DemandedBitsVal;
+      DemandedBits = DemandedBitsVal;
     } else if (CurTok.str() == "harvestedFromUse") {
       HarvestKindCount++;
       if (HarvestKindCount > 1) {
@@ -839,12 +856,13 @@ bool Parser::parseInstAttribute(std::string &ErrStr, Inst *LHS) {
       }
       if (!consumeToken(ErrStr))
         return false;
-      LHS->HarvestKind = HarvestType::HarvestedFromUse;
+      HarvestKind = HarvestType::HarvestedFromUse;
     } else {
       ErrStr = makeErrStr("invalid Inst attribute string");
       return false;
     }
   }
+  IC.setAttributes(LHS, DemandedBits, HarvestKind);
   return true;
 }
 
@@ -1036,7 +1054,7 @@ bool Parser::parseLine(std::string &ErrStr) {
         return false;
       }
 
-      Inst::Kind IK = Inst::getKind(CurTok.str().str());
+      Inst::Kind IK = Inst::getKind(CurTok.str());
 
       if (IK == Inst::None) {
         if (CurTok.str() == "block") {
@@ -1077,8 +1095,7 @@ bool Parser::parseLine(std::string &ErrStr) {
 
       if (IK == Inst::Var || IK == Inst::ReservedConst || IK == Inst::ReservedInst) {
         llvm::APInt Zero(InstWidth, 0, false), One(InstWidth, 0, false),
-                    ConstOne(InstWidth, 1, false), Lower(InstWidth, 0, false),
-                    Upper(InstWidth, 0, false);
+                    Lower(InstWidth, 0, false), Upper(InstWidth, 0, false);
         llvm::ConstantRange Range(InstWidth, /*isFullSet*/true);
         bool NonZero = false, NonNegative = false, PowOfTwo = false, Negative = false,
           hasExternalUses = false;
@@ -1089,16 +1106,16 @@ bool Parser::parseLine(std::string &ErrStr) {
               return false;
             switch (CurTok.K) {
               case Token::KnownBits:
-                if (InstWidth != CurTok.PatternString.length()) {
+                if (InstWidth != CurTok.Pattern.size()) {
                   ErrStr = makeErrStr(TP, "knownbits pattern must be of same length as var width");
                   return false;
                 }
                 for (unsigned i = 0; i < InstWidth; ++i) {
-                  if (CurTok.PatternString[i] == '0')
-                    Zero += ConstOne.shl(CurTok.PatternString.length() - 1 - i);
-                  else if (CurTok.PatternString[i] == '1')
-                    One += ConstOne.shl(CurTok.PatternString.length() - 1 - i);
-                  else if (CurTok.PatternString[i] != 'x') {
+                  if (CurTok.Pattern[i] == '0')
+                    Zero.setBit(InstWidth - 1 - i);
+                  else if (CurTok.Pattern[i] == '1')
+                    One.setBit(InstWidth - 1 - i);
+                  else if (CurTok.Pattern[i] != 'x') {
                     ErrStr = makeErrStr(TP, "invalid knownBits string");
                     return false;
                   }
@@ -1238,10 +1255,12 @@ bool Parser::parseLine(std::string &ErrStr) {
           I = IC.createVar(InstWidth, InstName, Range, Zero, One, NonZero,
                            NonNegative, PowOfTwo, Negative, SignBits,
                            llvm::APInt::getAllOnes(InstWidth), 0);
-        else if (IK == Inst::ReservedConst)
+        else if (IK == Inst::ReservedConst) {
           I = IC.createVar(InstWidth, InstName, Range, Zero, One, NonZero,
                            NonNegative, PowOfTwo, Negative, SignBits,
                            llvm::APInt::getAllOnes(InstWidth), ++ReservedConstCounter);
+          ReservedConsts.push_back(I);
+        }
         else if (IK == Inst::ReservedInst) {
           I = IC.createHole(InstWidth);
           I->Name = InstName;
@@ -1320,7 +1339,7 @@ bool Parser::parseLine(std::string &ErrStr) {
         }
         I = IC.getPhi(B, Ops);
       } else {
-        if (!typeCheckInst(IK, InstWidth, Ops, ErrStr)) {
+        if (!typeCheckInst(IC, IK, InstWidth, Ops, ErrStr)) {
           ErrStr = makeErrStr(TP, ErrStr);
           return false;
         }
@@ -1365,7 +1384,7 @@ bool Parser::parseLine(std::string &ErrStr) {
       if (hasExternalUses)
         ExternalUsesSet.insert(I);
       for (auto EU: ExternalUsesSet)
-        I->DepsWithExternalUses.insert(EU);
+        IC.addDepWithExternalUses(I, EU);
       Context.setInst(InstName, I);
       return true;
     }
@@ -1473,9 +1492,10 @@ std::vector<ParsedReplacement> Parser::parseReplacements(std::string &ErrStr) {
 
 std::vector<ParsedReplacement> souper::ParseReplacements(
     InstContext &IC, llvm::StringRef Filename, llvm::StringRef Str,
-    std::string &ErrStr) {
+    std::string &ErrStr, unsigned FirstLine) {
   std::vector<ParsedReplacement> Reps;
-  Parser P(Filename, Str, IC, Reps, ReplacementKind::ParseBoth, 0, 0);
+  Parser P(Filename, Str, IC, Reps, ReplacementKind::ParseBoth, 0, 0,
+           FirstLine);
   std::vector<ParsedReplacement> R = P.parseReplacements(ErrStr);
   if (ErrStr == "") {
     for (auto i = R.begin(); i != R.end(); ++i) {
@@ -1488,10 +1508,12 @@ std::vector<ParsedReplacement> souper::ParseReplacements(
 
 std::vector<ParsedReplacement> souper::ParseReplacementLHSs(
     InstContext &IC, llvm::StringRef Filename, llvm::StringRef Str,
-    std::vector<ReplacementContext> &RCs, std::string &ErrStr) {
+    std::vector<ReplacementContext> &RCs, std::string &ErrStr,
+    unsigned FirstLine) {
   assert(RCs.size() == 0);
   std::vector<ParsedReplacement> Reps;
-  Parser P(Filename, Str, IC, Reps, ReplacementKind::ParseLHS, 0, &RCs);
+  Parser P(Filename, Str, IC, Reps, ReplacementKind::ParseLHS, 0, &RCs,
+           FirstLine);
   std::vector<ParsedReplacement> R = P.parseReplacements(ErrStr);
   if (ErrStr == "") {
     assert(RCs.size() == R.size());
@@ -1520,3 +1542,124 @@ std::vector<ParsedReplacement> souper::ParseReplacementRHSs(
   }
   return R;
 }
+
+namespace {
+
+// The result of parsing a run of replacements of a larger input on its own
+struct ParsedChunk {
+  std::vector<ParsedReplacement> Reps;
+  std::vector<ReplacementContext> Contexts;
+  std::vector<Inst *> ReservedConsts;
+  std::string ErrStr;
+};
+
+}
+
+static std::vector<ParsedReplacement> parseReplacementsParallel(
+    InstContext &IC, llvm::StringRef Filename, llvm::StringRef Str,
+    ReplacementKind RK, std::vector<ReplacementContext> *Contexts,
+    std::string &ErrStr, unsigned Threads) {
+  auto Slices = SplitReplacements(Str, RK == ReplacementKind::ParseLHS);
+  llvm::ThreadPoolStrategy Strategy = llvm::hardware_concurrency(Threads);
+  // A few chunks per thread even out replacements of different sizes
+  size_t NumChunks = std::min<size_t>(Slices.size(),
+                                      Strategy.compute_thread_count() * 4);
+  if (NumChunks <= 1) {
+    if (Contexts)
+      return ParseReplacementLHSs(IC, Filename, Str, *Contexts, ErrStr);
+    return ParseReplacements(IC, Filename, Str, ErrStr);
+  }
+
+  std::vector<ParsedChunk> Chunks(NumChunks);
+  {
+    llvm::ThreadPool Pool(Strategy);
+    for (size_t C = 0; C != NumChunks; ++C) {
+      const ReplacementSlice &First = Slices[Slices.size() * C / NumChunks];
+      const ReplacementSlice &Last = Slices[Slices.size() * (C + 1) / NumChunks - 1];
+      // Slices are adjacent, so a run of them is a piece of Str
+      StringRef ChunkStr(First.Str.begin(), Last.Str.end() - First.Str.begin());
+      unsigned Line = First.Line;
+      ParsedChunk &Chunk = Chunks[C];
+      Pool.async([&IC, Filename, RK, Contexts, ChunkStr, Line, &Chunk] {
+        Parser P(Filename, ChunkStr, IC, Chunk.Reps, RK, 0,
+                 Contexts ? &Chunk.Contexts : 0, Line);
+        P.parseReplacements(Chunk.ErrStr);
+        Chunk.ReservedConsts = std::move(P.ReservedConsts);
+      });
+    }
+    Pool.wait();
+  }
+
+  std::vector<ParsedReplacement> Reps;
+  unsigned NumReservedConsts = 0;
+  for (auto &Chunk : Chunks) {
+    // Number reservedconsts through the whole input, as a single parser
+    // would. They are not shared between replacements, so this is safe.
+    for (Inst *I : Chunk.ReservedConsts)
+      I->SynthesisConstID += NumReservedConsts;
+    NumReservedConsts += Chunk.ReservedConsts.size();
+    std::move(Chunk.Reps.begin(), Chunk.Reps.end(), std::back_inserter(Reps));
+    if (Contexts)
+      std::move(Chunk.Contexts.begin(), Chunk.Contexts.end(),
+                std::back_inserter(*Contexts));
+    // Later chunks were parsed for nothing, like the rest of the input
+    // after an error in a sequential parse
+    if (!Chunk.ErrStr.empty()) {
+      ErrStr = Chunk.ErrStr;
+      break;
+    }
+  }
+  return Reps;
+}
+
+std::vector<ParsedReplacement> souper::ParseReplacementsParallel(
+    InstContext &IC, llvm::StringRef Filename, llvm::StringRef Str,
+    std::string &ErrStr, unsigned Threads) {
+  return parseReplacementsParallel(IC, Filename, Str,
+                                   ReplacementKind::ParseBoth, 0, ErrStr,
+                                   Threads);
+}
+
+std::vector<ParsedReplacement> souper::ParseReplacementLHSsParallel(
+    InstContext &IC, llvm::StringRef Filename, llvm::StringRef Str,
+    std::vector<ReplacementContext> &Contexts, std::string &ErrStr,
+    unsigned Threads) {
+  assert(Contexts.size() == 0);
+  return parseReplacementsParallel(IC, Filename, Str,
+                                   ReplacementKind::ParseLHS, &Contexts,
+                                   ErrStr, Threads);
+}
+
+std::vector<ReplacementSlice> souper::SplitReplacements(llvm::StringRef Str,
+                                                        bool LHSOnly) {
+  std::vector<ReplacementSlice> Slices;
+  size_t Begin = 0;
+  unsigned BeginLine = 1, Line = 1;
+  // Whether the current slice has a statement, and its last one
+  bool HasStatement = false, Complete = false;
+  for (size_t Pos = 0; Pos < Str.size(); ++Line) {
+    size_t EOL = std::min(Str.find('\n', Pos), Str.size());
+    StringRef Stmt = Str.slice(Pos, EOL).ltrim(" \t\r");
+    if (!Stmt.empty() && Stmt[0] != ';') {
+      // The first statement after a complete replacement starts the next
+      if (Complete) {
+        Slices.push_back({Str.slice(Begin, Pos), BeginLine});
+        Begin = Pos;
+        BeginLine = Line;
+        Complete = false;
+      }
+      HasStatement = true;
+      StringRef Keyword = Stmt.take_until([](char C) {
+        return C == ' ' || C == '\t' || C == '\r' || C == ';';
+      });
+      if (Keyword == "cand" || Keyword == "result" ||
+          (LHSOnly && Keyword == "infer"))
+        Complete = true;
+    }
+    Pos = EOL + 1;
+  }
+  // An incomplete replacement is kept for the parser to complain about
+  if (HasStatement)
+    Slices.push_back({Str.substr(Begin), BeginLine});
+  return Slices;
+}
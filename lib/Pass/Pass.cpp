@@ -99,6 +99,8 @@ static void eliminateDeadCode(Function &F) {
 
 struct SouperPass : PassInfoMixin<SouperPass> {
   static char ID;
+  // Prints the profile keys of candidates
+  ReplacementPrinter Printer;
 
   Value* getOperand(Inst* I, unsigned index, Instruction *ReplacedInst,
                     ExprBuilderContext &EBC, DominatorTree &DT,
@@ -120,9 +122,7 @@ public:
     std::string Str;
     llvm::raw_string_ostream Loc(Str);
     Cand.Origin->getDebugLoc().print(Loc);
-    ReplacementContext Context;
-    std::string LHS = GetReplacementLHSString(Cand.BPCs, Cand.PCs,
-                                              Cand.Mapping.LHS, Context);
+    StringRef LHS = Printer.printLHS(Cand.BPCs, Cand.PCs, Cand.Mapping.LHS);
     LLVMContext &C = F->getContext();
     Module *M = F->getParent();
     Function *RegisterFunc = M->getFunction("_souper_profile_register");
@@ -258,10 +258,8 @@ public:
         llvm::raw_string_ostream Loc(Str);
         Cand.Origin->getDebugLoc().print(Loc);
         std::string HField = "sprofile " + Loc.str();
-        ReplacementContext Context;
-        KV->hIncrBy(GetReplacementLHSString(Cand.BPCs, Cand.PCs,
-                                            Cand.Mapping.LHS,
-                                            Context), HField, 1);
+        KV->hIncrBy(Printer.printLHS(Cand.BPCs, Cand.PCs, Cand.Mapping.LHS),
+                    HField, 1);
       }
       if (DynamicProfileAll) {
         dynamicProfile(&F, Cand);
@@ -24,12 +24,17 @@
 #include "llvm/Support/raw_ostream.h"
 #include "souper/SMTLIB2/Solver.h"
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <optional>
+#include <set>
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <system_error>
 
@@ -43,6 +48,12 @@ STATISTIC(Unsats, "Number of unsatisfiable SMT queries");
 
 SMTLIBSolver::~SMTLIBSolver() {}
 
+std::unique_ptr<SMTLIBSolverSession> SMTLIBSolver::startSession() {
+  return nullptr;
+}
+
+SMTLIBSolverSession::~SMTLIBSolverSession() {}
+
 namespace {
 
 // Bare bones SMT-LIB parser; enough to parse a get-value response.
@@ -202,17 +213,308 @@ std::vector<APInt> ParseModels(StringRef Models, unsigned NumModels,
   return ModelVals;
 }
 
+
+// Length of the command or response at the start of Text: a balanced
+// s-expression, or a bare word up to the end of its line
+size_t getSExprLength(StringRef Text) {
+  if (Text.empty() || Text[0] != '(')
+    return std::min(Text.find('\n'), Text.size());
+
+  unsigned Depth = 0;
+  for (size_t I = 0; I != Text.size(); ++I) {
+    switch (Text[I]) {
+    case '(':
+      ++Depth;
+      break;
+    case ')':
+      if (--Depth == 0)
+        return I + 1;
+      break;
+    case '"':
+    case '|': {
+      size_t End = Text.find(Text[I], I + 1);
+      if (End == StringRef::npos)
+        return StringRef::npos;
+      I = End;
+      break;
+    }
+    case ';': {
+      size_t End = Text.find('\n', I);
+      if (End == StringRef::npos)
+        return StringRef::npos;
+      I = End;
+      break;
+    }
+    }
+  }
+  return StringRef::npos;
+}
+
+// Top-level commands of an SMT-LIB script
+std::vector<StringRef> splitCommands(StringRef Script) {
+  std::vector<StringRef> Commands;
+  while (true) {
+    Script = Script.ltrim();
+    while (Script.startswith(";")) {
+      Script = Script.drop_front(std::min(Script.find('\n'), Script.size()));
+      Script = Script.ltrim();
+    }
+    if (Script.empty())
+      break;
+    size_t Len = getSExprLength(Script);
+    if (Len == StringRef::npos)
+      break;
+    Commands.push_back(Script.take_front(Len));
+    Script = Script.drop_front(Len);
+  }
+  return Commands;
+}
+
+// The I-th word of a command, e.g. 0 for its name and 1 for the symbol a
+// declaration introduces
+StringRef getCommandWord(StringRef Command, unsigned I) {
+  StringRef Rest = Command.drop_front().ltrim();
+  for (unsigned J = 0; ; ++J) {
+    size_t Len = Rest.startswith("|") ? Rest.find('|', 1) + 1 :
+                                        Rest.find_first_of(" \t\r\n()");
+    StringRef Word = Rest.take_front(Len);
+    if (J == I || Word.empty())
+      return Word;
+    Rest = Rest.drop_front(Word.size()).ltrim();
+  }
+}
+
+class ProcessSMTLIBSolverSession : public SMTLIBSolverSession {
+  pid_t Pid;
+  int FD;
+  bool Broken = false;
+  bool LogicSet = false;
+  // Output read but not consumed yet
+  std::string Pending;
+  std::set<std::string> Declared;
+  std::vector<std::string> Declarations;
+  // Number of declarations outside each open scope
+  std::vector<size_t> Scopes;
+
+  std::error_code write(StringRef Text) {
+    while (!Text.empty()) {
+      ssize_t N = ::send(FD, Text.data(), Text.size(), MSG_NOSIGNAL);
+      if (N < 0) {
+        if (errno == EINTR)
+          continue;
+        Broken = true;
+        return std::error_code(errno, std::generic_category());
+      }
+      Text = Text.drop_front(N);
+    }
+    return std::error_code();
+  }
+
+  // Reads one response; TimeoutMs == 0 waits forever
+  std::error_code read(std::string &Response, int TimeoutMs) {
+    while (true) {
+      StringRef Text = StringRef(Pending).ltrim();
+      if (!Text.empty()) {
+        size_t Len = getSExprLength(Text);
+        // Words are complete once their line is
+        if (Text[0] == '(' ? Len != StringRef::npos : Len != Text.size()) {
+          Response = Text.take_front(Len).str();
+          Pending = Text.drop_front(Len).str();
+          return std::error_code();
+        }
+      }
+
+      pollfd PFD = {FD, POLLIN, 0};
+      int Ready = ::poll(&PFD, 1, TimeoutMs ? TimeoutMs : -1);
+      if (Ready < 0 && errno == EINTR)
+        continue;
+      if (Ready == 0) {
+        Broken = true;
+        return std::make_error_code(std::errc::timed_out);
+      }
+      char Buf[4096];
+      ssize_t N = Ready < 0 ? -1 : ::read(FD, Buf, sizeof(Buf));
+      if (N < 0 && errno == EINTR)
+        continue;
+      if (N <= 0) {
+        Broken = true;
+        return std::make_error_code(std::errc::broken_pipe);
+      }
+      Pending.append(Buf, N);
+    }
+  }
+
+  std::error_code run(StringRef Command) {
+    if (Broken)
+      return std::make_error_code(std::errc::broken_pipe);
+    if (std::error_code EC = write(Command))
+      return EC;
+    if (std::error_code EC = write("\n"))
+      return EC;
+    std::string Response;
+    if (std::error_code EC = read(Response, 0))
+      return EC;
+    if (Response != "success")
+      return std::make_error_code(std::errc::protocol_error);
+    return std::error_code();
+  }
+
+  // Sends the logic and the missing declarations of Script, and its
+  // assertions if Assertions is set
+  std::error_code declare(StringRef Script, bool Assertions) {
+    for (StringRef Command : splitCommands(Script)) {
+      StringRef Name = getCommandWord(Command, 0);
+      if (Name == "set-logic") {
+        if (LogicSet)
+          continue;
+        LogicSet = true;
+      } else if (Name == "declare-fun" || Name == "declare-const" ||
+                 Name == "define-fun") {
+        std::string Symbol = getCommandWord(Command, 1).str();
+        if (!Declared.insert(Symbol).second)
+          continue;
+        Declarations.push_back(Symbol);
+      } else if (Name != "assert" || !Assertions) {
+        continue;
+      }
+      if (std::error_code EC = run(Command)) {
+        ++Errors;
+        return EC;
+      }
+    }
+    return std::error_code();
+  }
+
+public:
+  ProcessSMTLIBSolverSession(pid_t Pid, int FD) : Pid(Pid), FD(FD) {}
+
+  ~ProcessSMTLIBSolverSession() {
+    if (!Broken)
+      write("(exit)\n");
+    ::close(FD);
+    if (Broken)
+      ::kill(Pid, SIGKILL);
+    ::waitpid(Pid, nullptr, 0);
+  }
+
+  std::error_code init() {
+    if (std::error_code EC = write("(set-option :print-success true)\n"))
+      return EC;
+    std::string Response;
+    if (std::error_code EC = read(Response, 0))
+      return EC;
+    if (Response != "success")
+      return std::make_error_code(std::errc::protocol_error);
+    return std::error_code();
+  }
+
+  std::error_code assertQuery(StringRef Query) override {
+    return declare(Query, /*Assertions=*/true);
+  }
+
+  std::error_code push() override {
+    if (std::error_code EC = run("(push 1)"))
+      return EC;
+    Scopes.push_back(Declarations.size());
+    return std::error_code();
+  }
+
+  std::error_code pop() override {
+    if (Scopes.empty())
+      return std::make_error_code(std::errc::invalid_argument);
+    if (std::error_code EC = run("(pop 1)"))
+      return EC;
+    // Declarations are scoped like assertions
+    while (Declarations.size() > Scopes.back()) {
+      Declared.erase(Declarations.back());
+      Declarations.pop_back();
+    }
+    Scopes.pop_back();
+    return std::error_code();
+  }
+
+  std::error_code checkSat(bool &Result, StringRef ModelQuery,
+                           unsigned NumModels, std::vector<APInt> *Models,
+                           unsigned Timeout) override {
+    if (std::error_code EC = declare(ModelQuery, /*Assertions=*/false))
+      return EC;
+    if (Timeout) {
+      if (std::error_code EC =
+              run("(set-option :timeout " + std::to_string(Timeout * 1000) + ")"))
+        return EC;
+    }
+    if (std::error_code EC = write("(check-sat)\n"))
+      return EC;
+
+    // Give the solver's own timeout a chance to fire first
+    std::string Response;
+    if (std::error_code EC = read(Response, Timeout ? (Timeout + 5) * 1000 : 0)) {
+      if (EC == std::errc::timed_out)
+        ++Timeouts;
+      else
+        ++Errors;
+      return EC;
+    }
+
+    if (Response == "unsat") {
+      Result = false;
+      ++Unsats;
+      return std::error_code();
+    }
+    if (Response == "unknown") {
+      ++Timeouts;
+      return std::make_error_code(std::errc::timed_out);
+    }
+    if (Response != "sat") {
+      ++Errors;
+      return std::make_error_code(std::errc::protocol_error);
+    }
+
+    Result = true;
+    ++Sats;
+    if (!Models)
+      return std::error_code();
+
+    std::string Values;
+    for (StringRef Command : splitCommands(ModelQuery)) {
+      if (getCommandWord(Command, 0) != "get-value")
+        continue;
+      std::string Value;
+      if (std::error_code EC = write(Command.str() + "\n")) {
+        ++Errors;
+        return EC;
+      }
+      if (std::error_code EC = read(Value, 0)) {
+        ++Errors;
+        return EC;
+      }
+      Values += Value;
+    }
+
+    std::string ErrStr;
+    *Models = ParseModels(Values, NumModels, ErrStr);
+    if (!ErrStr.empty()) {
+      ++Errors;
+      return std::make_error_code(std::errc::protocol_error);
+    }
+    return std::error_code();
+  }
+};
+
 class ProcessSMTLIBSolver : public SMTLIBSolver {
   std::string Name;
   bool Keep;
   SolverProgram Prog;
   std::vector<std::string> Args;
   std::vector<const char *> ArgPtrs;
+  std::string SessionPath;
 
 public:
   ProcessSMTLIBSolver(std::string Name, bool Keep, SolverProgram Prog,
-                      const std::vector<std::string> &Args)
-      : Name(Name), Keep(Keep), Prog(Prog), Args(Args) {
+                      const std::vector<std::string> &Args,
+                      StringRef SessionPath = "")
+      : Name(Name), Keep(Keep), Prog(Prog), Args(Args),
+        SessionPath(SessionPath.str()) {
     std::transform(Args.begin(), Args.end(), std::back_inserter(ArgPtrs),
                    [](const std::string &Arg) { return Arg.c_str(); });
     ArgPtrs.push_back(0);
@@ -222,6 +524,55 @@ public:
     return Name;
   }
 
+  std::unique_ptr<SMTLIBSolverSession> startSession() override {
+    if (SessionPath.empty())
+      return nullptr;
+
+    std::vector<const char *> Argv = {SessionPath.c_str()};
+    for (const auto &Arg : Args)
+      Argv.push_back(Arg.c_str());
+    Argv.push_back(nullptr);
+
+    // One socket serves as both stdin and stdout of the solver; unlike a
+    // pipe it lets writes to a dead solver fail without SIGPIPE
+    int FDs[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, FDs) == -1)
+      return nullptr;
+
+    pid_t Pid = fork();
+    if (Pid == -1) {
+      ::close(FDs[0]);
+      ::close(FDs[1]);
+      return nullptr;
+    }
+    if (Pid == 0) {
+      int ErrFD = open("/dev/null", O_WRONLY);
+      if (ErrFD == -1) _exit(1);
+      if (dup2(FDs[1], STDIN_FILENO) == -1) _exit(1);
+      if (dup2(FDs[1], STDOUT_FILENO) == -1) _exit(1);
+      if (dup2(ErrFD, STDERR_FILENO) == -1) _exit(1);
+
+      rlimit rlim;
+      if (getrlimit(RLIMIT_NOFILE, &rlim) == -1) _exit(1);
+
+      for (unsigned fd = 3; fd != rlim.rlim_cur; ++fd) {
+        close(fd);
+      }
+
+      execv(SessionPath.c_str(), const_cast<char **>(Argv.data()));
+      _exit(1);
+    }
+
+    ::close(FDs[1]);
+    std::unique_ptr<ProcessSMTLIBSolverSession> Session(
+        new ProcessSMTLIBSolverSession(Pid, FDs[0]));
+    if (Session->init()) {
+      ++Errors;
+      return nullptr;
+    }
+    return Session;
+  }
+
   std::error_code isSatisfiable(StringRef Query, bool &Result,
                                 unsigned NumModels, std::vector<APInt> *Models,
                                 unsigned Timeout) override {
@@ -367,7 +718,8 @@ SolverProgram souper::makeInternalSolverProgram(int MainPtr(int argc,
 }
 
 std::unique_ptr<SMTLIBSolver> souper::createZ3Solver(SolverProgram Prog,
-                                                     bool Keep) {
+                                                     bool Keep,
+                                                     StringRef SessionPath) {
   return std::unique_ptr<SMTLIBSolver>(
-      new ProcessSMTLIBSolver("Z3", Keep, Prog, {"-smt2", "-in"}));
+      new ProcessSMTLIBSolver("Z3", Keep, Prog, {"-smt2", "-in"}, SessionPath));
 }
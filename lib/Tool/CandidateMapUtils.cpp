@@ -54,11 +54,10 @@ bool SolveCandidateMap(llvm::raw_ostream &OS, CandidateMap &M,
 
     std::vector<int> Profile;
     std::map<std::string,int> Index;
+    ReplacementPrinter Printer;
     for (int I=0; I < M.size(); ++I) {
       auto &Cand = M[I];
-      ReplacementContext Context;
-      auto S = GetReplacementLHSString(Cand.BPCs, Cand.PCs,
-                                       Cand.Mapping.LHS, Context);
+      auto S = Printer.printLHS(Cand.BPCs, Cand.PCs, Cand.Mapping.LHS).str();
       if (Index.find(S) == Index.end()) {
         Index[S] = I;
         Profile.push_back(1);
@@ -79,9 +78,8 @@ bool SolveCandidateMap(llvm::raw_ostream &OS, CandidateMap &M,
         Instruction *I = Cand.Origin;
         I->getDebugLoc().print(Loc);
         std::string HField = "sprofile " + Loc.str();
-        ReplacementContext Context;
-        KVForStaticProfile->hIncrBy(GetReplacementLHSString(Cand.BPCs,
-            Cand.PCs, Cand.Mapping.LHS, Context), HField, 1);
+        KVForStaticProfile->hIncrBy(Printer.printLHS(Cand.BPCs, Cand.PCs,
+            Cand.Mapping.LHS), HField, 1);
       }
 
       if (isInferDFA()) {
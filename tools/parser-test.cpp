@@ -14,6 +14,7 @@
 
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "souper/Parser/BinaryFormat.h"
 #include "souper/Parser/Parser.h"
 #include <unistd.h>
 
@@ -21,10 +22,16 @@ using namespace souper;
 using namespace llvm;
 
 int main(int argc, char **argv) {
-  int Arg = 1, LHSOnly = 0;
-  if (Arg < argc && strcmp(argv[Arg], "-LHS") == 0) {
-    LHSOnly = 1;
-    ++Arg;
+  int Arg = 1, LHSOnly = 0, Binary = 0, EmitBinary = 0;
+  for (; Arg < argc; ++Arg) {
+    if (strcmp(argv[Arg], "-LHS") == 0)
+      LHSOnly = 1;
+    else if (strcmp(argv[Arg], "-binary") == 0)
+      Binary = 1;
+    else if (strcmp(argv[Arg], "-emit-binary") == 0)
+      EmitBinary = 1;
+    else
+      break;
   }
   auto MB = MemoryBuffer::getFileOrSTDIN(argc >= (Arg+1) ? argv[Arg] : "-");
   if (MB) {
@@ -32,7 +39,10 @@ int main(int argc, char **argv) {
     std::string ErrStr;
     std::vector<ParsedReplacement> Reps;
     std::vector<ReplacementContext> Contexts;
-    if (LHSOnly)
+    if (Binary)
+      Reps = ReadBinaryReplacements(IC, MB.get()->getBufferIdentifier(),
+                                    MB.get()->getBuffer(), ErrStr);
+    else if (LHSOnly)
       Reps = ParseReplacementLHSs(IC, MB.get()->getBufferIdentifier(),
                                   MB.get()->getBuffer(), Contexts, ErrStr);
     else
@@ -43,8 +53,13 @@ int main(int argc, char **argv) {
       return 1;
     }
 
+    if (EmitBinary) {
+      WriteBinaryReplacements(llvm::outs(), Reps);
+      return 0;
+    }
+
     for (const auto &R : Reps) {
-      if (LHSOnly) {
+      if (LHSOnly || !R.Mapping.RHS) {
         ReplacementContext Context;
         R.printLHS(llvm::outs(), Context);
       } else {
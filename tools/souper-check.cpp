@@ -19,6 +19,7 @@
 #include "souper/Infer/ConstantSynthesis.h"
 #include "souper/Infer/Pruning.h"
 #include "souper/Inst/InstGraph.h"
+#include "souper/Parser/BinaryFormat.h"
 #include "souper/Parser/Parser.h"
 #include "souper/Tool/GetSolver.h"
 #include "souper/Util/DfaUtils.h"
@@ -39,6 +40,21 @@ static cl::opt<std::string>
 InputFilename(cl::Positional, cl::desc("<input souper optimization>"),
               cl::init("-"));
 
+static cl::opt<bool> BinaryInput("binary",
+    cl::desc("Read replacements in the binary format instead of as text "
+             "(default=false)"),
+    cl::init(false));
+
+static cl::opt<bool> StreamInput("stream",
+    cl::desc("Parse, check and release one replacement at a time, so that "
+             "memory use does not grow with the input (default=false)"),
+    cl::init(false));
+
+static cl::opt<unsigned> ParseThreads("parse-threads",
+    cl::desc("Parse text input on this many threads, 0 for one per core "
+             "(default=1)"),
+    cl::init(1));
+
 static cl::opt<bool> PrintCounterExample("print-counterexample",
     cl::desc("Print counterexample (default=true)"),
     cl::init(true));
@@ -88,17 +104,37 @@ static cl::opt<bool> CheckAllGuesses("souper-check-all-guesses",
     cl::desc("Continue even after a valid RHS is found. (default=false)"),
     cl::init(false));
 
-int SolveInst(const MemoryBufferRef &MB, Solver *S) {
+struct CheckStats {
+  int Success = 0, Fail = 0, Error = 0;
+};
+
+// Checks the replacements of Buf, which starts on line FirstLine of the input
+int SolveInst(StringRef Filename, StringRef Buf, unsigned FirstLine,
+              Solver *S, CheckStats &Stats) {
   InstContext IC;
   std::string ErrStr;
 
   std::vector<ParsedReplacement> Reps;
   std::vector<ReplacementContext> Contexts;
-  if (InferRHS || ParseLHSOnly || isInferDFA()) {
-    Reps = ParseReplacementLHSs(IC, MB.getBufferIdentifier(), MB.getBuffer(),
-                                Contexts, ErrStr);
+  if (BinaryInput) {
+    Reps = ReadBinaryReplacements(IC, Filename, Buf, ErrStr);
+    // Inferred RHSs refer to the LHS by the names it is printed with
+    if (InferRHS || ParseLHSOnly || isInferDFA()) {
+      for (const auto &Rep : Reps) {
+        Contexts.emplace_back();
+        Rep.printLHS(llvm::nulls(), Contexts.back());
+      }
+    }
+  } else if (ParseThreads != 1 && !StreamInput) {
+    if (InferRHS || ParseLHSOnly || isInferDFA())
+      Reps = ParseReplacementLHSsParallel(IC, Filename, Buf, Contexts, ErrStr,
+                                          ParseThreads);
+    else
+      Reps = ParseReplacementsParallel(IC, Filename, Buf, ErrStr, ParseThreads);
+  } else if (InferRHS || ParseLHSOnly || isInferDFA()) {
+    Reps = ParseReplacementLHSs(IC, Filename, Buf, Contexts, ErrStr, FirstLine);
   } else {
-    Reps = ParseReplacements(IC, MB.getBufferIdentifier(), MB.getBuffer(), ErrStr);
+    Reps = ParseReplacements(IC, Filename, Buf, ErrStr, FirstLine);
   }
   if (!ErrStr.empty()) {
     llvm::errs() << ErrStr << '\n';
@@ -112,14 +148,12 @@ int SolveInst(const MemoryBufferRef &MB, Solver *S) {
     }
   }
 
-  if (ParseOnly || ParseLHSOnly) {
-    llvm::outs() << "; parsing successful\n";
+  if (ParseOnly || ParseLHSOnly)
     return 0;
-  }
 
   unsigned Index = 0;
   int Ret = 0;
-  int Success = 0, Fail = 0, Error = 0;
+  int &Success = Stats.Success, &Fail = Stats.Fail, &Error = Stats.Error;
   for (auto Rep : Reps) {
     if (isInferDFA()) {
       if (InferNeg) {
@@ -373,9 +407,6 @@ int SolveInst(const MemoryBufferRef &MB, Solver *S) {
     if (PrintRepl || PrintReplSplit)
       llvm::outs() << "\n";
   }
-  if ((Success + Fail + Error) > 1)
-    llvm::outs() << "successes = " << Success << ", failures = " << Fail <<
-      ", errors = " << Error << "\n";
   return Ret;
 }
 
@@ -387,10 +418,38 @@ int main(int argc, char **argv) {
   if (!ParseOnly && !ParseLHSOnly)
     S = GetSolver(KV);
 
-  auto MB = MemoryBuffer::getFileOrSTDIN(InputFilename);
+  if (StreamInput && BinaryInput) {
+    llvm::errs() << "-stream only applies to text input\n";
+    return 1;
+  }
+
+  // Without a null terminator, large files are always mapped rather than
+  // read into memory
+  auto MB = MemoryBuffer::getFileOrSTDIN(InputFilename, /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
   if (!MB) {
     llvm::errs() << MB.getError().message() << '\n';
     return 1;
   }
-  return SolveInst((*MB)->getMemBufferRef(), S.get());
+  StringRef Filename = (*MB)->getBufferIdentifier();
+  StringRef Buf = (*MB)->getBuffer();
+
+  CheckStats Stats;
+  int Ret = 0;
+  if (StreamInput) {
+    bool LHSOnly = InferRHS || ParseLHSOnly || isInferDFA();
+    // A replacement that does not parse is reported and skipped
+    for (const auto &Slice : SplitReplacements(Buf, LHSOnly))
+      Ret |= SolveInst(Filename, Slice.Str, Slice.Line, S.get(), Stats);
+  } else {
+    Ret = SolveInst(Filename, Buf, 1, S.get(), Stats);
+  }
+
+  if ((ParseOnly || ParseLHSOnly) && !Ret)
+    llvm::outs() << "; parsing successful\n";
+
+  if ((Stats.Success + Stats.Fail + Stats.Error) > 1)
+    llvm::outs() << "successes = " << Stats.Success << ", failures = "
+                 << Stats.Fail << ", errors = " << Stats.Error << "\n";
+  return Ret;
 }
@@ -13,10 +13,15 @@
 // limitations under the License.
 
 #include "llvm/Support/raw_ostream.h"
+#include "souper/Infer/ExhaustiveVerifier.h"
 #include "souper/Infer/Interpreter.h"
+#include "souper/Infer/RewriteDatabase.h"
 #include "souper/Inst/Inst.h"
+#include "souper/Inst/InstIndexMap.h"
 #include "gtest/gtest.h"
 
+#include <thread>
+
 using namespace souper;
 
 TEST(InstTest, Fold) {
@@ -45,6 +50,84 @@ TEST(InstTest, Fold) {
   ASSERT_NE(I1SI3, I3SI1);
 }
 
+TEST(InstTest, CostAndCount) {
+  InstContext IC;
+
+  Inst *X = IC.createVar(32, "x");
+  Inst *Y = IC.createVar(32, "y");
+  Inst *C = IC.getConst(llvm::APInt(32, 1));
+  Inst *Add = IC.getInst(Inst::Add, 32, {X, C});
+  Inst *Mul = IC.getInst(Inst::Mul, 32, {Add, Y});
+  Inst *Shl = IC.getInst(Inst::Shl, 32, {Add, C});
+  // Add is shared and counted once
+  Inst *Sub = IC.getInst(Inst::Sub, 32, {Mul, Shl});
+  Inst *Xor = IC.getInst(Inst::Xor, 32, {Sub, Sub});
+
+  for (Inst *I : {X, C, Add, Mul, Shl, Sub, Xor}) {
+    std::set<Inst *> Visited;
+    int Count = countHelper(I, Visited);
+    EXPECT_EQ(Count, instCount(I));
+    // Memoized
+    EXPECT_EQ(Count, instCount(I));
+  }
+  EXPECT_EQ(0, instCount(X));
+  EXPECT_EQ(4, instCount(Sub));
+  EXPECT_EQ(5, instCount(Xor));
+
+  int AddCost = Inst::getCost(Inst::Add), MulCost = Inst::getCost(Inst::Mul),
+      ShlCost = Inst::getCost(Inst::Shl), SubCost = Inst::getCost(Inst::Sub);
+  EXPECT_EQ(AddCost, cost(Add));
+  EXPECT_EQ(AddCost + MulCost, cost(Mul));
+  EXPECT_EQ(AddCost + MulCost + ShlCost + SubCost, cost(Sub));
+  EXPECT_EQ(cost(Sub) + Inst::getCost(Inst::Xor), cost(Xor));
+
+  // A guess on top of part of an LHS
+  llvm::DenseSet<Inst *> Free = {Add, Mul};
+  EXPECT_EQ(2, instCount(Sub, Free));
+  EXPECT_EQ(0, instCount(Mul, Free));
+  EXPECT_EQ(instCount(Xor), instCount(Xor, {}));
+}
+
+TEST(InstTest, DeepTraversals) {
+  InstContext IC;
+
+  // Deep enough to overflow the stack of a recursive traversal
+  const int Depth = 200000;
+  Inst *X = IC.createVar(32, "x");
+  Inst *First = IC.getInst(Inst::Sub, 32, {X, X});
+  Inst *I = First;
+  for (int N = 1; N != Depth; ++N)
+    I = IC.getInst(N % 2 ? Inst::Add : Inst::Xor, 32, {I, X});
+
+  std::vector<Inst *> Vars;
+  findVars(I, Vars);
+  ASSERT_EQ(1u, Vars.size());
+  EXPECT_EQ(X, Vars[0]);
+
+  int Visits = 0, NestedVisits = 0;
+  forEachInst(I, [&](Inst *J) {
+    ++Visits;
+    // Traversals may nest
+    if (J == First)
+      forEachInst(J, [&](Inst *) { ++NestedVisits; });
+  });
+  EXPECT_EQ(Depth + 1, Visits);
+  EXPECT_EQ(2, NestedVisits);
+
+  std::map<Inst *, Inst *> InstCache;
+  std::map<Block *, Block *> BlockCache;
+  Inst *Y = IC.createVar(32, "y");
+  std::map<Inst *, llvm::APInt> ConstMap;
+  InstCache[X] = Y;
+  Inst *Copy = getInstCopy(I, IC, InstCache, BlockCache, &ConstMap, false);
+  Vars.clear();
+  findVars(Copy, Vars);
+  ASSERT_EQ(1u, Vars.size());
+  EXPECT_EQ(Y, Vars[0]);
+
+  EXPECT_EQ(Depth, instCount(I));
+}
+
 TEST(InstTest, Print) {
   InstContext IC;
 
@@ -63,3 +146,303 @@ TEST(InstTest, Print) {
   EXPECT_EQ("%0:i64 = add 1:i64, 2:i64\n"
             "%1:i64 = mul 3:i64, %0\n", SS.str());
 }
+
+TEST(InstTest, RewriteDatabase) {
+  // Stand in for the solver: rules are learned at i8, which the
+  // exhaustive verifier can decide
+  RewriteDatabase DB([](InstContext &IC, InstMapping Rule) {
+    std::vector<InstMapping> PCs;
+    BlockPCs BPCs;
+    return ExhaustiveVerifier(Rule.LHS, PCs, BPCs, 16).verify(Rule.RHS) ==
+      ExhaustiveVerifier::Result::Valid;
+  });
+
+  InstContext IC;
+  auto C = [&IC](unsigned W, uint64_t V) {
+    return IC.getConst(llvm::APInt(W, V));
+  };
+
+  Inst *X = IC.createVar(8, "x");
+  Inst *XorXor = IC.getInst(Inst::Xor, 8,
+                            {IC.getInst(Inst::Xor, 8, {X, C(8, 5)}), C(8, 5)});
+  ASSERT_TRUE(DB.learn(InstMapping(XorXor, X)));
+  Inst *AddAdd = IC.getInst(Inst::Add, 8,
+                            {IC.getInst(Inst::Add, 8, {X, C(8, 3)}), C(8, 4)});
+  ASSERT_TRUE(DB.learn(InstMapping(AddAdd, IC.getInst(Inst::Add, 8, {X, C(8, 7)}))));
+  ASSERT_FALSE(DB.learn(InstMapping(AddAdd, X)));
+  ASSERT_EQ(DB.size(), 2u);
+
+  // Constants of the first rule are generalized, and both rules apply
+  // to other widths and to vars replaced by arbitrary subtrees
+  Inst *Y = IC.createVar(32, "y");
+  Inst *Z = IC.createVar(32, "z");
+  Inst *YZ = IC.getInst(Inst::Mul, 32, {Y, Z});
+  std::vector<Inst *> RHSs;
+  DB.lookup(IC.getInst(Inst::Xor, 32,
+                       {C(32, 9), IC.getInst(Inst::Xor, 32, {YZ, C(32, 9)})}),
+            IC, RHSs);
+  ASSERT_EQ(RHSs, std::vector<Inst *>{YZ});
+
+  RHSs.clear();
+  DB.lookup(IC.getInst(Inst::Xor, 32,
+                       {C(32, 9), IC.getInst(Inst::Xor, 32, {YZ, C(32, 7)})}),
+            IC, RHSs);
+  ASSERT_TRUE(RHSs.empty());
+
+  RHSs.clear();
+  DB.lookup(IC.getInst(Inst::Add, 32,
+                       {IC.getInst(Inst::Add, 32, {Y, C(32, 3)}), C(32, 4)}),
+            IC, RHSs);
+  ASSERT_EQ(RHSs, std::vector<Inst *>{IC.getInst(Inst::Add, 32, {Y, C(32, 7)})});
+
+  RHSs.clear();
+  DB.lookup(IC.getInst(Inst::Add, 32,
+                       {IC.getInst(Inst::Add, 32, {Y, C(32, 1)}), C(32, 2)}),
+            IC, RHSs);
+  ASSERT_TRUE(RHSs.empty());
+}
+
+TEST(InstTest, InstIndexMap) {
+  InstContext IC;
+
+  Inst *X = IC.createVar(32, "x");
+  std::vector<Inst *> Insts = {X};
+  for (unsigned I = 0; I < 300; ++I)
+    Insts.push_back(IC.getInst(Inst::Add, 32, {Insts.back(),
+                                               IC.getConst(llvm::APInt(32, I))}));
+  ASSERT_EQ(IC.getNumInsts(), 601u);
+
+  InstIndexMap<unsigned> Map;
+  ASSERT_FALSE(Map.count(X));
+  for (unsigned I = 0; I < Insts.size(); I += 2)
+    Map[Insts[I]] = I;
+  for (unsigned I = 0; I < Insts.size(); ++I) {
+    if (I % 2)
+      ASSERT_EQ(Map.lookup(Insts[I]), nullptr);
+    else
+      ASSERT_EQ(Map.at(Insts[I]), I);
+  }
+  ASSERT_FALSE(Map.emplace(X, 7u).second);
+  ASSERT_EQ(Map.at(X), 0u);
+
+  // Insts of another context share indices with those of IC
+  InstContext Other;
+  Inst *Y = Other.createVar(32, "y");
+  ASSERT_EQ(Y->Index, X->Index);
+  ASSERT_TRUE(Map.emplace(Y, 5u).second);
+  ASSERT_EQ(Map.at(Y), 5u);
+  ASSERT_EQ(Map.at(X), 0u);
+
+  Map.clear();
+  ASSERT_FALSE(Map.count(X));
+  ASSERT_FALSE(Map.count(Y));
+  ASSERT_TRUE(Map.emplace(Y, 6u).second);
+  ASSERT_EQ(Map.at(Y), 6u);
+  ASSERT_FALSE(Map.count(X));
+}
+
+TEST(InstTest, VarFacts) {
+  InstContext IC;
+
+  llvm::ConstantRange Range(llvm::APInt(8, 1), llvm::APInt(8, 100));
+  Inst *X = IC.createVar(8, "x", Range, llvm::APInt(8, 0x80),
+                         llvm::APInt(8, 1), /*NonZero=*/true,
+                         /*NonNegative=*/true, /*PowOfTwo=*/false,
+                         /*Negative=*/false, /*NumSignBits=*/2,
+                         llvm::APInt::getAllOnes(8), /*SynthesisConstID=*/0);
+  ASSERT_NE(X->Facts, nullptr);
+  ASSERT_EQ(X->Facts->Range, Range);
+  ASSERT_EQ(X->Facts->KnownZeros, llvm::APInt(8, 0x80));
+  ASSERT_TRUE(X->Facts->NonZero);
+  ASSERT_EQ(X->Facts->NumSignBits, 2u);
+
+  // Only Vars have facts
+  Inst *Add = IC.getInst(Inst::Add, 8, {X, IC.getConst(llvm::APInt(8, 1))});
+  ASSERT_EQ(Add->Facts, nullptr);
+
+  // Copies of Vars have their own facts
+  std::map<Inst *, Inst *> InstCache;
+  std::map<Block *, Block *> BlockCache;
+  Inst *Copy = getInstCopy(Add, IC, InstCache, BlockCache, nullptr,
+                           /*CloneVars=*/true);
+  Inst *XCopy = Copy->Ops[0]->K == Inst::Var ? Copy->Ops[0] : Copy->Ops[1];
+  ASSERT_NE(XCopy, X);
+  ASSERT_NE(XCopy->Facts, X->Facts);
+  ASSERT_EQ(XCopy->Facts->Range, Range);
+  ASSERT_EQ(XCopy->Facts->KnownOnes, llvm::APInt(8, 1));
+
+  // Phis keep their operands past the inline ones
+  Block *B = IC.createBlock(5);
+  std::vector<Inst *> PhiOps;
+  for (unsigned I = 0; I < 5; ++I)
+    PhiOps.push_back(IC.getConst(llvm::APInt(8, I)));
+  Inst *Phi = IC.getPhi(B, PhiOps);
+  ASSERT_EQ(Phi->Ops.size(), 5u);
+  ASSERT_TRUE(std::equal(PhiOps.begin(), PhiOps.end(), Phi->Ops.begin()));
+}
+
+TEST(InstTest, Rollback) {
+  InstContext IC;
+
+  Inst *X = IC.createVar(8, "x");
+  Inst *One = IC.getConst(llvm::APInt(8, 1));
+  unsigned NumInsts = IC.getNumInsts();
+
+  for (unsigned Round = 0; Round < 100; ++Round) {
+    std::vector<Inst *> Keep;
+    {
+      InstContextScope Scope(IC, Keep);
+      Inst *Y = IC.createVar(8, "y");
+      Inst *Two = IC.getConst(llvm::APInt(8, 2));
+      Inst *Add = IC.getInst(Inst::Add, 8, {X, Two});
+      IC.getInst(Inst::Mul, 8, {Add, Y});
+      IC.getInst(Inst::Sub, 8, {Add, One});
+      Block *B = IC.createBlock(2);
+      Keep.push_back(IC.getPhi(B, {Add, X}));
+    }
+
+    // The phi, its block with the block's predicate, the add and 2 survive
+    // and are still hash-consed
+    Inst *Phi = Keep.front();
+    ASSERT_EQ(Phi->B->PredVars.size(), 1u);
+    Inst *Two = IC.getConst(llvm::APInt(8, 2));
+    ASSERT_EQ(IC.getInst(Inst::Add, 8, {X, Two}), Phi->Ops[0]);
+    ASSERT_EQ(IC.getVariables().size(), Round + 2);
+
+    // The other three are gone, and later rounds reuse their indices
+    ASSERT_EQ(IC.getNumInsts(), NumInsts + 7 + 2 * Round);
+
+    // Without Keep, the context is back to where it was
+    auto C = IC.checkpoint();
+    unsigned SubIndex = IC.getInst(Inst::Sub, 8, {X, One})->Index;
+    IC.rollback(C);
+    Inst *Sub2 = IC.getInst(Inst::Sub, 8, {X, One});
+    ASSERT_EQ(Sub2->Index, SubIndex);
+    IC.rollback(C);
+  }
+}
+
+TEST(InstTest, Concurrent) {
+  InstContext IC;
+  Inst *X = IC.createVar(32, "x");
+
+  // Every thread builds the same sums of constants over x, and a var and
+  // a block of its own
+  const unsigned NumThreads = 8, NumSums = 1000;
+  std::vector<std::vector<Inst *>> Results(NumThreads);
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T)
+    Threads.emplace_back([&, T]() {
+      for (unsigned J = 0; J < NumSums; ++J)
+        Results[T].push_back(IC.getInst(Inst::Add, 32,
+                                        {X, IC.getConst(llvm::APInt(32, J))}));
+      Results[T].push_back(IC.createVar(32, "y"));
+      IC.createBlock(3);
+    });
+  for (auto &T : Threads)
+    T.join();
+
+  // The sums are hash-consed across threads, and Insts never share an Index
+  std::set<unsigned> Indices;
+  for (unsigned T = 0; T < NumThreads; ++T) {
+    ASSERT_EQ(Results[T].size(), NumSums + 1);
+    for (unsigned J = 0; J < NumSums; ++J)
+      ASSERT_EQ(Results[T][J], Results[0][J]);
+    for (auto I : Results[T])
+      Indices.insert(I->Index);
+  }
+  ASSERT_EQ(Indices.size(), NumSums + NumThreads);
+  ASSERT_EQ(IC.getNumInsts(), 1 + 2 * NumSums + NumThreads * 3);
+
+  // Vars of a width are numbered without gaps
+  std::set<unsigned> Numbers;
+  for (auto V : IC.getVariables())
+    if (V->Width == 32)
+      Numbers.insert(V->Number);
+  ASSERT_EQ(IC.getVariables().size(), 1 + NumThreads * 3);
+  ASSERT_EQ(Numbers.size(), 1 + NumThreads);
+  ASSERT_EQ(*Numbers.rbegin(), NumThreads);
+}
+
+TEST(InstTest, ConcurrentPrinting) {
+  InstContext IC;
+  Inst *X = IC.createVar(8, "x");
+  Inst *Y = IC.createVar(8, "y");
+
+  // Every thread builds and prints the same commutative Insts, whose
+  // operands are shared Insts with operands of their own, while the others
+  // create and print them too
+  const unsigned NumThreads = 8, NumInsts = 256;
+  std::vector<std::vector<std::string>> Printed(NumThreads);
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T)
+    Threads.emplace_back([&, T]() {
+      for (unsigned J = 0; J < NumInsts; ++J) {
+        Inst *C = IC.getConst(llvm::APInt(8, J));
+        Inst *Sum = IC.getInst(Inst::Add, 8, {Y, C});
+        Inst *Prod = IC.getInst(Inst::Mul, 8, {X, C});
+        Inst *I = IC.getInst(Inst::Xor, 8,
+                             {IC.getInst(Inst::And, 8, {Prod, Sum}),
+                              IC.getInst(Inst::Or, 8, {Sum, Prod})});
+        std::string Str;
+        llvm::raw_string_ostream SS(Str);
+        ReplacementContext Context;
+        Context.printInst(I, SS, /*printNames=*/false);
+        Printed[T].push_back(SS.str());
+      }
+    });
+  for (auto &T : Threads)
+    T.join();
+
+  for (unsigned T = 1; T < NumThreads; ++T)
+    ASSERT_EQ(Printed[T], Printed[0]);
+  // Operands are printed in the same order however the Insts were built
+  InstContext IC2;
+  Inst *X2 = IC2.createVar(8, "x");
+  Inst *Y2 = IC2.createVar(8, "y");
+  Inst *C = IC2.getConst(llvm::APInt(8, 5));
+  Inst *Sum = IC2.getInst(Inst::Add, 8, {C, Y2});
+  Inst *Prod = IC2.getInst(Inst::Mul, 8, {C, X2});
+  Inst *I = IC2.getInst(Inst::Xor, 8,
+                        {IC2.getInst(Inst::Or, 8, {Prod, Sum}),
+                         IC2.getInst(Inst::And, 8, {Sum, Prod})});
+  std::string Str;
+  llvm::raw_string_ostream SS(Str);
+  ReplacementContext Context;
+  Context.printInst(I, SS, /*printNames=*/false);
+  ASSERT_EQ(SS.str(), Printed[0][5]);
+}
+
+TEST(InstTest, SetAttributes) {
+  InstContext IC;
+  Inst *X = IC.createVar(8, "x");
+  Inst *One = IC.getConst(llvm::APInt(8, 1));
+  Inst *I = IC.getInst(Inst::Add, 8, {X, One});
+
+  // I is hash-consed under its new demanded bits, and no longer under the
+  // old ones
+  llvm::APInt Low(8, 0x0F);
+  IC.setAttributes(I, Low, HarvestType::HarvestedFromDef);
+  ASSERT_EQ(IC.getInst(Inst::Add, 8, {X, One}, Low, true), I);
+  Inst *All = IC.getInst(Inst::Add, 8, {X, One});
+  ASSERT_NE(All, I);
+  ASSERT_TRUE(All->DemandedBits.isAllOnes());
+
+  // An Inst already hash-consed under the new attributes keeps its place
+  IC.setAttributes(All, Low, HarvestType::HarvestedFromDef);
+  ASSERT_EQ(IC.getInst(Inst::Add, 8, {X, One}, Low, true), I);
+
+  // Threads sharing an Inst may set its attributes at the same time
+  Inst *Shared = IC.getInst(Inst::Mul, 8, {One, IC.getConst(llvm::APInt(8, 3))});
+  const unsigned NumThreads = 8;
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T)
+    Threads.emplace_back([&, T]() {
+      IC.setAttributes(Shared, Low, HarvestType::HarvestedFromUse);
+      IC.addDepWithExternalUses(Shared, IC.getConst(llvm::APInt(8, T)));
+    });
+  for (auto &T : Threads)
+    T.join();
+  ASSERT_EQ(Shared->DemandedBits, Low);
+  ASSERT_EQ(Shared->DepsWithExternalUses.size(), NumThreads);
+}
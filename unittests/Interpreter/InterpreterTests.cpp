@@ -20,10 +20,17 @@
 #include "InterpreterInfra.h"
 #include "souper/Infer/Interpreter.h"
 #include "souper/Infer/AbstractInterpreter.h"
+#include "souper/Infer/BatchEvaluator.h"
+#include "souper/Infer/BitSlice.h"
+#include "souper/Infer/Bytecode.h"
+#include "souper/Infer/ExhaustiveVerifier.h"
+#include "souper/Infer/SmallKnownBits.h"
+#include "souper/Infer/TransferTables.h"
 #include "souper/Inst/Inst.h"
 #include "gtest/gtest.h"
 
 #include <iostream>
+#include <map>
 
 namespace {
   static llvm::cl::opt<bool> CheckRBPrecision("check-rb-precision",
@@ -81,6 +88,190 @@ TEST(InterpreterTests, KBTransferFunctions) {
   }
 }
 
+TEST(InterpreterTests, SmallKnownBits) {
+  // TransferTables covers the word sized transfer functions at small
+  // widths; on constants both they and the APInt fallback are exact, which
+  // checks the full word and the boundary between the two
+  auto constKB = [](const APInt &V) { return KnownBits::makeConstant(V); };
+  auto isConst = [](const KnownBits &KB, const APInt &V) {
+    return KB.isConstant() && KB.getConstant() == V;
+  };
+  uint64_t Vals[] = {0, 1, 2, 7, 31, 63, 64, 0x7fffffffffffffffULL,
+                     0x8000000000000000ULL, 0xdeadbeefcafef00dULL,
+                     ~0ULL};
+  for (unsigned W : {31, 32, 63, 64, 65}) {
+    for (auto X : Vals) {
+      for (auto Y : Vals) {
+        APInt A(W, X), B(W, Y);
+        auto KA = constKB(A), KB = constKB(B);
+        if (SmallKnownBits::fits(KA))
+          ASSERT_TRUE(isConst(SmallKnownBits(KA).toKnownBits(), A));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::add(KA, KB), A + B));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::sub(KA, KB), A - B));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::and_(KA, KB), A & B));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::or_(KA, KB), A | B));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::xor_(KA, KB), A ^ B));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::ult(KA, KB),
+                            APInt(1, A.ult(B))));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::slt(KA, KB),
+                            APInt(1, A.slt(B))));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::sle(KA, KB),
+                            APInt(1, A.sle(B))));
+        ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::eq(KA, KB),
+                            APInt(1, A == B)));
+        if (B.ult(W)) {
+          ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::shl(KA, KB), A.shl(B)));
+          ASSERT_TRUE(isConst(BinaryTransferFunctionsKB::lshr(KA, KB),
+                              A.lshr(B)));
+        }
+      }
+    }
+  }
+}
+
+TEST(InterpreterTests, TransferTables) {
+  // The known bits tables must be exactly what brute force finds with the
+  // interpreter. A sound transfer function cannot know more, which also
+  // checks the word sized ones at the widths the tables take over from them.
+  using SmallFn = SmallKnownBits (*)(const SmallKnownBits &,
+                                     const SmallKnownBits &);
+  struct {
+    Inst::Kind K;
+    TransferTables::Op Op;
+    SmallFn Fn;
+  } KBCases[] = {
+    {Inst::Add, TransferTables::Add,
+     [](const SmallKnownBits &L, const SmallKnownBits &R) {
+       return SmallTransferFunctionsKB::add(L, R, /*NSW=*/false); }},
+    {Inst::AddNSW, TransferTables::AddNSW,
+     [](const SmallKnownBits &L, const SmallKnownBits &R) {
+       return SmallTransferFunctionsKB::add(L, R, /*NSW=*/true); }},
+    {Inst::Sub, TransferTables::Sub,
+     [](const SmallKnownBits &L, const SmallKnownBits &R) {
+       return SmallTransferFunctionsKB::sub(L, R, /*NSW=*/false); }},
+    {Inst::SubNSW, TransferTables::SubNSW,
+     [](const SmallKnownBits &L, const SmallKnownBits &R) {
+       return SmallTransferFunctionsKB::sub(L, R, /*NSW=*/true); }},
+    {Inst::Mul, TransferTables::Mul, SmallTransferFunctionsKB::mul},
+    {Inst::UDiv, TransferTables::UDiv, SmallTransferFunctionsKB::udiv},
+    {Inst::URem, TransferTables::URem, SmallTransferFunctionsKB::urem},
+    {Inst::Shl, TransferTables::Shl, SmallTransferFunctionsKB::shl},
+    {Inst::LShr, TransferTables::LShr, SmallTransferFunctionsKB::lshr},
+    {Inst::AShr, TransferTables::AShr, SmallTransferFunctionsKB::ashr},
+    {Inst::Eq, TransferTables::Eq, SmallTransferFunctionsKB::eq},
+    {Inst::Ne, TransferTables::Ne, SmallTransferFunctionsKB::ne},
+    {Inst::Ult, TransferTables::Ult, SmallTransferFunctionsKB::ult},
+    {Inst::Slt, TransferTables::Slt, SmallTransferFunctionsKB::slt},
+    {Inst::Ule, TransferTables::Ule, SmallTransferFunctionsKB::ule},
+    {Inst::Sle, TransferTables::Sle, SmallTransferFunctionsKB::sle},
+  };
+  for (unsigned W = 1; W <= TransferTables::MaxKBWidth; ++W) {
+    // Brute forcing every pair at the widest width takes too long, so only
+    // every Stride-th left operand is checked there
+    const unsigned Stride = W == TransferTables::MaxKBWidth ? 13 : 1;
+    KBTesting KBT(W);
+    for (auto &C : KBCases) {
+      InstContext IC;
+      Inst *I = IC.getInst(C.K, Inst::isCmp(C.K) ? 1 : W,
+                           {IC.createVar(W, "x"), IC.createVar(W, "y")});
+      KnownBits X(W);
+      unsigned XIndex = 0;
+      do {
+        if (XIndex++ % Stride)
+          continue;
+        KnownBits Y(W);
+        do {
+          auto Best = TransferTables::lookupKB(C.Op, X, Y);
+          ASSERT_TRUE(Best.has_value());
+          EvalValueKB Expected = KBT.bruteForce(X, Y, I);
+          if (!Expected.hasValue()) {
+            ASSERT_TRUE(Best->isUnknown());
+            continue;
+          }
+          ASSERT_EQ(Best->Zero, Expected.ValueKB.Zero);
+          ASSERT_EQ(Best->One, Expected.ValueKB.One);
+          auto Small = C.Fn(SmallKnownBits(X), SmallKnownBits(Y)).toKnownBits();
+          ASSERT_TRUE(Small.Zero.isSubsetOf(Best->Zero) &&
+                      Small.One.isSubsetOf(Best->One))
+            << Inst::getKindName(C.K) << ' '
+            << KnownBitsAnalysis::knownBitsString(X) << ' '
+            << KnownBitsAnalysis::knownBitsString(Y);
+        } while (KBTesting::nextKB(Y));
+      } while (KBTesting::nextKB(X));
+    }
+  }
+
+  // The constant range tables must cover every defined result and be no
+  // larger than what ConstantRange computes
+  using RangeFn = ConstantRange (*)(const ConstantRange &,
+                                    const ConstantRange &);
+  struct {
+    Inst::Kind K;
+    TransferTables::Op Op;
+    RangeFn Fn;
+  } CRCases[] = {
+    {Inst::Add, TransferTables::Add,
+     [](const ConstantRange &L, const ConstantRange &R) { return L.add(R); }},
+    {Inst::AddNSW, TransferTables::AddNSW,
+     [](const ConstantRange &L, const ConstantRange &R) { return L.add(R); }},
+    {Inst::Sub, TransferTables::Sub,
+     [](const ConstantRange &L, const ConstantRange &R) { return L.sub(R); }},
+    {Inst::Mul, TransferTables::Mul,
+     [](const ConstantRange &L, const ConstantRange &R) {
+       return L.multiply(R); }},
+    {Inst::UDiv, TransferTables::UDiv,
+     [](const ConstantRange &L, const ConstantRange &R) { return L.udiv(R); }},
+    {Inst::And, TransferTables::And, BinaryTransferFunctionsCR::binaryAnd},
+    {Inst::Or, TransferTables::Or, BinaryTransferFunctionsCR::binaryOr},
+    {Inst::Shl, TransferTables::Shl,
+     [](const ConstantRange &L, const ConstantRange &R) { return L.shl(R); }},
+    {Inst::LShr, TransferTables::LShr,
+     [](const ConstantRange &L, const ConstantRange &R) { return L.lshr(R); }},
+    {Inst::AShr, TransferTables::AShr,
+     [](const ConstantRange &L, const ConstantRange &R) { return L.ashr(R); }},
+  };
+  for (unsigned W = 1; W <= TransferTables::MaxCRWidth; ++W) {
+    const unsigned Stride = W == TransferTables::MaxCRWidth ? 13 : 1;
+    for (auto &C : CRCases) {
+      InstContext IC;
+      Inst *X = IC.createVar(W, "x"), *Y = IC.createVar(W, "y");
+      Inst *I = IC.getInst(C.K, W, {X, Y});
+      ConstantRange L(W, /*isFullSet=*/false);
+      unsigned LIndex = 0;
+      do {
+        if (LIndex++ % Stride) {
+          L = CRTesting::nextCR(L);
+          continue;
+        }
+        ConstantRange R(W, /*isFullSet=*/false);
+        do {
+          auto Best = TransferTables::lookupCR(C.Op, L, R);
+          ASSERT_TRUE(Best.has_value());
+          bool Defined = false;
+          for (unsigned A = 0; A < (1u << W); ++A) {
+            for (unsigned B = 0; B < (1u << W); ++B) {
+              if (!L.contains(APInt(W, A)) || !R.contains(APInt(W, B)))
+                continue;
+              ValueCache Vals{{X, APInt(W, A)}, {Y, APInt(W, B)}};
+              ConcreteInterpreter CI(Vals);
+              auto V = CI.evaluateInst(I);
+              if (!V.hasValue())
+                continue;
+              Defined = true;
+              ASSERT_TRUE(Best->contains(V.getValue()));
+            }
+          }
+          if (Defined)
+            ASSERT_TRUE(getSetSize(*Best).ule(getSetSize(C.Fn(L, R))))
+              << Inst::getKindName(C.K);
+          R = CRTesting::nextCR(R);
+        } while (!R.isEmptySet());
+        L = CRTesting::nextCR(L);
+      } while (!L.isEmptySet());
+    }
+  }
+}
+
 TEST(InterpreterTests, CRTransferFunctions) {
   for (int WIDTH = 1; WIDTH <= MAX_WIDTH; ++WIDTH) {
     CRTesting crObj(WIDTH);
@@ -213,3 +404,310 @@ TEST(InterpreterTests, ConcreteCache) {
   // We would have got 0xFF if evaluateInst had returned result from cache.
   ASSERT_EQ(Val.getValue(), APInt(8, 0x0F, true));
 }
+
+TEST(InterpreterTests, ConcreteMemo) {
+  InstContext IC;
+
+  Inst *X = IC.createVar(8, "x");
+  Inst *Y = IC.createVar(8, "y");
+  Inst *C = IC.getConst(llvm::APInt(8, 3));
+  Inst *Shared = IC.getInst(Inst::Mul, 8, {X, IC.getInst(Inst::Add, 8, {Y, C})});
+  std::vector<Inst *> Roots = {
+    IC.getInst(Inst::Sub, 8, {Shared, X}),
+    IC.getInst(Inst::Xor, 8, {Shared, Y}),
+    IC.getInst(Inst::UDiv, 8, {Shared, IC.getInst(Inst::Sub, 8, {Y, Y})}),
+    Shared,
+  };
+
+  ValueCache InputValues = {{X, APInt(8, 7)}, {Y, APInt(8, 200)}};
+  ConcreteInterpreter Memo(InputValues);
+  Memo.setMemoize(true);
+  for (auto R : Roots) {
+    ConcreteInterpreter Fresh(InputValues);
+    auto Expected = Fresh.evaluateInst(R);
+    auto Got = Memo.evaluateInst(R);
+    ASSERT_EQ(Got.K, Expected.K);
+    if (Expected.hasValue())
+      ASSERT_EQ(Got.getValue(), Expected.getValue());
+  }
+
+  // Memoized values are kept until the memo is cleared, even once the
+  // input of a phi changes with the concrete predecessor of its block
+  Block *B = IC.createBlock(2);
+  Inst *P = IC.getInst(Inst::Add, 8, {IC.getPhi(B, {X, Y}), C});
+  B->ConcretePred = 0;
+  ASSERT_EQ(Memo.evaluateInst(P).getValue(), APInt(8, 10));
+  B->ConcretePred = 1;
+  ASSERT_EQ(Memo.evaluateInst(P).getValue(), APInt(8, 10));
+  Memo.clearMemo();
+  ASSERT_EQ(Memo.evaluateInst(P).getValue(), APInt(8, 203));
+  ASSERT_EQ(Memo.evaluateInst(Roots[0]).getValue(),
+            APInt(8, (7 * 203 - 7) & 0xFF));
+}
+
+TEST(InterpreterTests, ExhaustiveVerifier) {
+  InstContext IC;
+  std::vector<InstMapping> PCs;
+  BlockPCs BPCs;
+
+  Inst *X = IC.createVar(8, "x");
+  Inst *One = IC.getConst(llvm::APInt(8, 1));
+  Inst *LHS = IC.getInst(Inst::Add, 8, {X, X});
+
+  ExhaustiveVerifier EV(LHS, PCs, BPCs, 16);
+  ASSERT_TRUE(EV.isApplicable());
+  ASSERT_EQ(EV.verify(IC.getInst(Inst::Shl, 8, {X, One})),
+            ExhaustiveVerifier::Result::Valid);
+  ASSERT_EQ(EV.verify(IC.getInst(Inst::Mul, 8, {X, IC.getConst(llvm::APInt(8, 3))})),
+            ExhaustiveVerifier::Result::Invalid);
+
+  // Poison on the LHS allows anything, poison on the RHS is a failure
+  Inst *Wrap = IC.getInst(Inst::Add, 8, {X, One});
+  Inst *NoWrap = IC.getInst(Inst::AddNSW, 8, {X, One});
+  ASSERT_EQ(ExhaustiveVerifier(NoWrap, PCs, BPCs, 16).verify(Wrap),
+            ExhaustiveVerifier::Result::Valid);
+  ASSERT_EQ(ExhaustiveVerifier(Wrap, PCs, BPCs, 16).verify(NoWrap),
+            ExhaustiveVerifier::Result::Invalid);
+
+  // Inputs violating a PC are not checked
+  Inst *Masked = IC.getInst(Inst::And, 8, {X, IC.getConst(llvm::APInt(8, 3))});
+  ASSERT_EQ(ExhaustiveVerifier(Masked, PCs, BPCs, 16).verify(X),
+            ExhaustiveVerifier::Result::Invalid);
+  PCs.emplace_back(IC.getInst(Inst::Ult, 1, {X, IC.getConst(llvm::APInt(8, 4))}),
+                   IC.getConst(llvm::APInt(1, 1)));
+  ASSERT_EQ(ExhaustiveVerifier(Masked, PCs, BPCs, 16).verify(X),
+            ExhaustiveVerifier::Result::Valid);
+
+  // 24 input bits don't fit the budget
+  Inst *Y = IC.createVar(16, "y");
+  Inst *Wide = IC.getInst(Inst::Add, 16, {IC.getInst(Inst::ZExt, 16, {X}), Y});
+  ASSERT_FALSE(ExhaustiveVerifier(Wide, PCs, BPCs, 16).isApplicable());
+}
+
+TEST(InterpreterTests, Bytecode) {
+  InstContext IC;
+
+  Inst *X = IC.createVar(8, "x");
+  Inst *Y = IC.createVar(8, "y");
+  Inst *One = IC.getConst(llvm::APInt(8, 1));
+  // Shared subexpression, a poison-producing op, a select blocking poison
+  // and a division that is UB for y == 0
+  Inst *Sum = IC.getInst(Inst::AddNSW, 8, {X, One});
+  Inst *Div = IC.getInst(Inst::UDiv, 8, {Sum, Y});
+  Inst *Cmp = IC.getInst(Inst::Ult, 1, {X, Y});
+  Inst *Sel = IC.getInst(Inst::Select, 8, {Cmp, Sum, Div});
+  Inst *Root = IC.getInst(Inst::Xor, 8, {Sel, Sum});
+
+  BytecodeProgram P(Root);
+  ASSERT_EQ(P.getNumInstructions(), 5u);
+
+  for (unsigned XV = 0; XV < 256; ++XV) {
+    for (unsigned YV = 0; YV < 256; YV += 17) {
+      ValueCache Inputs = {{X, EvalValue(llvm::APInt(8, XV))},
+                           {Y, EvalValue(llvm::APInt(8, YV))}};
+      ConcreteInterpreter CI(Inputs);
+      EvalValue Expected = CI.evaluateInst(Root);
+      EvalValue Actual = P.evaluate(Inputs);
+      ASSERT_EQ(Actual.K, Expected.K);
+      if (Expected.hasValue())
+        ASSERT_EQ(Actual.getValue(), Expected.getValue());
+    }
+  }
+}
+
+namespace {
+  // Checks every lane of a batch evaluation of Root against the interpreter
+  void checkBatch(Inst *Root, const BatchInputs &Inputs) {
+    ASSERT_TRUE(BatchProgram::isSupported(Root));
+    BatchResult R;
+    ASSERT_TRUE(BatchProgram(Root).evaluate(Inputs, R));
+    for (size_t L = 0; L < Inputs.NumLanes; ++L) {
+      ValueCache VC;
+      for (auto &C : Inputs.Columns)
+        VC[C.first] = EvalValue(llvm::APInt(C.first->Width, C.second[L]));
+      EvalValue Expected = ConcreteInterpreter(VC).evaluateInst(Root);
+      if (Expected.K == EvalValue::ValueKind::UB) {
+        ASSERT_TRUE(R.UB[L]);
+      } else if (Expected.K == EvalValue::ValueKind::Poison) {
+        ASSERT_FALSE(R.UB[L]);
+        ASSERT_TRUE(R.Poison[L]);
+      } else {
+        ASSERT_TRUE(R.hasValue(L));
+        ASSERT_EQ(R.Vals[L], Expected.getValue().getZExtValue());
+      }
+    }
+  }
+}
+
+TEST(InterpreterTests, BatchEvaluator) {
+  InstContext IC;
+  std::srand(0);
+
+  Inst::Kind Binary[] = {
+    Inst::Add, Inst::AddNSW, Inst::AddNUW, Inst::AddNW,
+    Inst::Sub, Inst::SubNSW, Inst::SubNUW, Inst::SubNW,
+    Inst::Mul, Inst::MulNSW, Inst::MulNUW, Inst::MulNW,
+    Inst::UDiv, Inst::SDiv, Inst::UDivExact, Inst::SDivExact,
+    Inst::URem, Inst::SRem, Inst::And, Inst::Or, Inst::Xor,
+    Inst::Shl, Inst::ShlNSW, Inst::ShlNUW, Inst::ShlNW,
+    Inst::LShr, Inst::LShrExact, Inst::AShr, Inst::AShrExact,
+    Inst::SAddSat, Inst::UAddSat, Inst::SSubSat, Inst::USubSat
+  };
+  Inst::Kind Predicates[] = {
+    Inst::Eq, Inst::Ne, Inst::Ult, Inst::Slt, Inst::Ule, Inst::Sle,
+    Inst::SAddO, Inst::UAddO, Inst::SSubO, Inst::USubO, Inst::SMulO,
+    Inst::UMulO
+  };
+
+  for (unsigned W : {1, 3, 8, 13, 16, 31, 32, 33, 63, 64}) {
+    Inst *X = IC.createVar(W, "x");
+    Inst *Y = IC.createVar(W, "y");
+    Inst *Z = IC.createVar(W, "z");
+    Inst *B = IC.createVar(1, "b");
+
+    // Mostly edge values, so that overflow, division and shift corner cases
+    // all show up
+    llvm::APInt Special[] = {
+      llvm::APInt(W, 0), llvm::APInt(W, 1), llvm::APInt::getAllOnes(W),
+      llvm::APInt::getSignedMinValue(W), llvm::APInt::getSignedMaxValue(W),
+      llvm::APInt(W, W - 1)
+    };
+    BatchInputs Inputs;
+    Inputs.NumLanes = 600;
+    for (auto V : {X, Y, Z, B}) {
+      auto &Col = Inputs.Columns[V];
+      for (size_t L = 0; L < Inputs.NumLanes; ++L) {
+        llvm::APInt Val(V->Width, ((uint64_t)std::rand() << 32) ^ std::rand());
+        if (std::rand() % 2)
+          Val = Special[std::rand() % 6].zextOrTrunc(V->Width);
+        Col.push_back(Val.getZExtValue());
+      }
+    }
+
+    for (auto K : Binary)
+      checkBatch(IC.getInst(K, W, {X, Y}), Inputs);
+    for (auto K : Predicates)
+      checkBatch(IC.getInst(K, 1, {X, Y}), Inputs);
+    for (auto K : {Inst::CtPop, Inst::Ctlz, Inst::Cttz})
+      checkBatch(IC.getInst(K, W, {X}), Inputs);
+    for (auto K : {Inst::FShl, Inst::FShr})
+      checkBatch(IC.getInst(K, W, {X, Y, Z}), Inputs);
+
+    // Poison and UB through a select and casts
+    Inst *Poisonous = IC.getInst(Inst::AddNSW, W, {X, Y});
+    Inst *Div = IC.getInst(Inst::UDiv, W, {X, Z});
+    Inst *Sel = IC.getInst(Inst::Select, W, {B, Poisonous, Div});
+    checkBatch(Sel, Inputs);
+    checkBatch(IC.getInst(Inst::Select, W, {IC.getInst(Inst::Ult, 1, {X, Y}),
+                                            Sel, Poisonous}), Inputs);
+    if (W < 64) {
+      checkBatch(IC.getInst(Inst::SExt, 64, {Sel}), Inputs);
+      checkBatch(IC.getInst(Inst::ZExt, W + 1, {Poisonous}), Inputs);
+    }
+    if (W > 1)
+      checkBatch(IC.getInst(Inst::Trunc, W - 1,
+                            {IC.getInst(Inst::Mul, W, {Sel, X})}), Inputs);
+  }
+}
+
+namespace {
+  // Checks every lane of a bit-sliced evaluation of Root, on the inputs in
+  // Vals, against the interpreter
+  void checkBitSliced(Inst *Root,
+                      const std::map<Inst *, std::vector<uint64_t>> &Vals) {
+    ASSERT_TRUE(BitSlicedProgram::isSupported(Root));
+    BitSlicedInputs Inputs;
+    for (auto &V : Vals) {
+      auto &Planes = Inputs[V.first];
+      Planes.assign(V.first->Width, BitPlane{});
+      for (unsigned L = 0; L < BitSliceLanes; ++L)
+        for (unsigned B = 0; B < V.first->Width; ++B)
+          if ((V.second[L] >> B) & 1)
+            Planes[B].Words[L / 64] |= uint64_t(1) << (L % 64);
+    }
+    BitSlicedValue R;
+    ASSERT_TRUE(BitSlicedProgram(Root).evaluate(Inputs, R));
+
+    for (unsigned L = 0; L < BitSliceLanes; ++L) {
+      auto Lane = [L](const BitPlane &P) {
+        return (P.Words[L / 64] >> (L % 64)) & 1;
+      };
+      ValueCache VC;
+      for (auto &V : Vals)
+        VC[V.first] = EvalValue(llvm::APInt(V.first->Width, V.second[L]));
+      EvalValue Expected = ConcreteInterpreter(VC).evaluateInst(Root);
+      if (Expected.K == EvalValue::ValueKind::UB) {
+        ASSERT_TRUE(Lane(R.UB));
+      } else if (Expected.K == EvalValue::ValueKind::Poison) {
+        ASSERT_FALSE(Lane(R.UB));
+        ASSERT_TRUE(Lane(R.Poison));
+      } else {
+        ASSERT_FALSE(Lane(R.UB) || Lane(R.Poison));
+        uint64_t Val = 0;
+        for (unsigned B = 0; B < Root->Width; ++B)
+          Val |= Lane(R.Bits[B]) << B;
+        ASSERT_EQ(Val, Expected.getValue().getZExtValue());
+      }
+    }
+  }
+}
+
+TEST(InterpreterTests, BitSlicedEvaluator) {
+  InstContext IC;
+
+  Inst::Kind Binary[] = {
+    Inst::Add, Inst::AddNSW, Inst::AddNUW, Inst::AddNW,
+    Inst::Sub, Inst::SubNSW, Inst::SubNUW, Inst::SubNW,
+    Inst::Mul, Inst::MulNSW, Inst::MulNUW, Inst::MulNW,
+    Inst::UDiv, Inst::SDiv, Inst::UDivExact, Inst::SDivExact,
+    Inst::URem, Inst::SRem, Inst::And, Inst::Or, Inst::Xor,
+    Inst::Shl, Inst::ShlNSW, Inst::ShlNUW, Inst::ShlNW,
+    Inst::LShr, Inst::LShrExact, Inst::AShr, Inst::AShrExact,
+    Inst::SAddSat, Inst::UAddSat, Inst::SSubSat, Inst::USubSat
+  };
+  Inst::Kind Predicates[] = {
+    Inst::Eq, Inst::Ne, Inst::Ult, Inst::Slt, Inst::Ule, Inst::Sle,
+    Inst::SAddO, Inst::UAddO, Inst::SSubO, Inst::USubO, Inst::SMulO,
+    Inst::UMulO
+  };
+
+  for (unsigned W = 1; W <= BitSlicedProgram::MaxWidth; ++W) {
+    Inst *X = IC.createVar(W, "x");
+    Inst *Y = IC.createVar(W, "y");
+    Inst *Z = IC.createVar(W, "z");
+
+    // Every pair of x and y where that fits a slice, random values otherwise
+    std::map<Inst *, std::vector<uint64_t>> Vals;
+    uint64_t Mask = (uint64_t(1) << W) - 1;
+    for (unsigned L = 0; L < BitSliceLanes; ++L) {
+      bool Pairs = 2 * W <= 9;
+      Vals[X].push_back(Pairs ? L & Mask : std::rand() & Mask);
+      Vals[Y].push_back(Pairs ? (L >> W) & Mask : std::rand() & Mask);
+      Vals[Z].push_back(std::rand() & Mask);
+    }
+
+    for (auto K : Binary)
+      checkBitSliced(IC.getInst(K, W, {X, Y}), Vals);
+    for (auto K : Predicates)
+      checkBitSliced(IC.getInst(K, 1, {X, Y}), Vals);
+    for (auto K : {Inst::CtPop, Inst::Ctlz, Inst::Cttz, Inst::BitReverse})
+      checkBitSliced(IC.getInst(K, W, {X}), Vals);
+    for (auto K : {Inst::FShl, Inst::FShr})
+      checkBitSliced(IC.getInst(K, W, {X, Y, Z}), Vals);
+
+    // Poison and UB through a select and casts
+    Inst *Poisonous = IC.getInst(Inst::AddNSW, W, {X, Y});
+    Inst *Div = IC.getInst(Inst::UDiv, W, {X, Z});
+    Inst *Sel = IC.getInst(Inst::Select, W,
+                           {IC.getInst(Inst::Ult, 1, {Y, Z}), Poisonous, Div});
+    checkBitSliced(Sel, Vals);
+    if (W < BitSlicedProgram::MaxWidth) {
+      checkBitSliced(IC.getInst(Inst::SExt, BitSlicedProgram::MaxWidth, {Sel}),
+                     Vals);
+      checkBitSliced(IC.getInst(Inst::ZExt, W + 1, {Poisonous}), Vals);
+    }
+    if (W > 1)
+      checkBitSliced(IC.getInst(Inst::Trunc, W - 1,
+                                {IC.getInst(Inst::Mul, W, {Sel, X})}), Vals);
+  }
+}
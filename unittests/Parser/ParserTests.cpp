@@ -12,10 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include "souper/Parser/BinaryFormat.h"
 #include "souper/Parser/Parser.h"
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+
 using namespace souper;
 
 TEST(ParserTest, Errors) {
@@ -30,6 +37,8 @@ TEST(ParserTest, Errors) {
       { "0:j", "<input>:1:3: expected 'i'" },
       { "0:ix", "<input>:1:4: expected integer" },
       { "0:i0", "<input>:1:4: width must be at least 1" },
+      { "%0:i8388609", "<input>:1:5: width must be at most 8388608" },
+      { "0:i99999999999", "<input>:1:4: width must be at most 8388608" },
       { "?", "<input>:1:1: unexpected '?'" },
       { "%0:i32 = var-check", "<input>:1:14: unexpected character following a negative sign" },
       { "%0:i32 = add -2, -a", "<input>:1:19: unexpected character following a negative sign" },
@@ -798,20 +807,26 @@ cand %1 0:i1 (demandedBits=0) (harvestedFromUse)
   };
 
   InstContext IC;
+  // Shared by all tests, to check that it forgets each replacement
+  ReplacementPrinter Printer;
   for (const auto &T : Tests) {
     std::string ErrStr;
     auto R = ParseReplacement(IC, "<input>", T, ErrStr);
     ASSERT_EQ("", ErrStr);
     EXPECT_EQ(R.getString(/*printNames=*/true), T);
+    EXPECT_EQ(T, Printer.printReplacement(R.BPCs, R.PCs, R.Mapping,
+                                          /*printNames=*/true));
 
     ReplacementContext Context1, Context2, Context3;
     auto LHS = R.getLHSString(Context1);
+    EXPECT_EQ(LHS, Printer.printLHS(R.BPCs, R.PCs, R.Mapping.LHS));
     auto R2 = ParseReplacementLHS(IC, "<input>", LHS, Context2, ErrStr);
     ASSERT_EQ("", ErrStr);
     auto LHS2 = R2.getLHSString(Context3);
     EXPECT_EQ(LHS, LHS2);
 
     auto RHS = R.getRHSString(Context1);
+    EXPECT_EQ(RHS, Printer.printRHS(R.Mapping.RHS));
     auto R3 = ParseReplacementRHS(IC, "<input>", RHS, Context2, ErrStr);
     ASSERT_EQ("", ErrStr);
     auto RHS2 = R3.getRHSString(Context3);
@@ -828,15 +843,18 @@ cand %1 0:i1 (demandedBits=0) (harvestedFromUse)
     auto R = ParseReplacement(IC, "<input>", T.Test, ErrStr);
     ASSERT_EQ("", ErrStr);
     EXPECT_EQ(R.getString(), T.Want);
+    EXPECT_EQ(T.Want, Printer.printReplacement(R.BPCs, R.PCs, R.Mapping));
 
     ReplacementContext Context1, Context2, Context3;
     auto LHS = R.getLHSString(Context1);
+    EXPECT_EQ(LHS, Printer.printLHS(R.BPCs, R.PCs, R.Mapping.LHS));
     auto R2 = ParseReplacementLHS(IC, "<input>", LHS, Context2, ErrStr);
     ASSERT_EQ("", ErrStr);
     auto LHS2 = R2.getLHSString(Context3);
     EXPECT_EQ(LHS, LHS2);
 
     auto RHS = R.getRHSString(Context1);
+    EXPECT_EQ(RHS, Printer.printRHS(R.Mapping.RHS));
     auto R3 = ParseReplacementRHS(IC, "<input>", RHS, Context2, ErrStr);
     ASSERT_EQ("", ErrStr);
     auto RHS2 = R3.getRHSString(Context3);
@@ -849,6 +867,27 @@ cand %1 0:i1 (demandedBits=0) (harvestedFromUse)
   }
 }
 
+TEST(ParserTest, PrinterOutlivesContext) {
+  const std::string Tests[] = {
+    "%0:i8 = var\n%1:i8 = add 1:i8, %0\n%2:i8 = mul %1, %1\ninfer %2\n",
+    "%0:i16 = var\n%1:i16 = shl %0, 2:i16\ninfer %1\n",
+  };
+
+  // The printer forgets the Insts of a context that is gone without
+  // looking at them
+  ReplacementPrinter Printer;
+  for (unsigned Round = 0; Round != 2; ++Round) {
+    for (const auto &T : Tests) {
+      auto IC = std::make_unique<InstContext>();
+      std::string ErrStr;
+      ReplacementContext Context;
+      auto R = ParseReplacementLHS(*IC, "<input>", T, Context, ErrStr);
+      ASSERT_EQ("", ErrStr);
+      EXPECT_EQ(T, Printer.printLHS(R.BPCs, R.PCs, R.Mapping.LHS));
+    }
+  }
+}
+
 int countSubstring(const std::string& str, const std::string& sub)
 {
   if (sub.length() == 0)
@@ -1069,3 +1108,360 @@ cand %4 %7
     EXPECT_EQ(T.Test, UnSplit);
   }
 }
+
+TEST(ParserTest, BinaryRoundTrip) {
+  std::string Tests[] = {
+      R"i(%0:i1 = var ; 0
+cand %0 0:i1
+)i",
+      R"i(%0 = block 2
+%1:i32 = var ; 1
+%2:i32 = lshr %1, 31:i32
+%3:i32 = var ; 3
+%4:i32 = udiv %2, %3
+%5:i1 = eq 0:i32, %3
+%6:i32 = zext %5
+%7:i32 = phi %0, %4, %6
+%8:i32 = ashr %7, 1:i32
+%9:i1 = eq 0:i32, %8
+cand %9 1:i1
+)i",
+      R"i(%0:i8 = var (knownBits=0xxxxxx1) (nonNegative) (signBits=2) (range=[1,101)) ; 0
+%1:i1 = ne 0:i8, %0
+pc %1 1:i1
+%2 = block 3
+%3:i8 = var (nonZero) (powerOfTwo) ; 3
+blockpc %2 1 %3 4:i8
+%4:i8 = phi %2, %0, %3, 7:i8
+%5:i8 = mul %4, %4
+%6:i8 = add %5, %0
+cand %6 %0
+)i",
+      R"i(%0:i130 = var ; 0
+%1:i130 = add 1361129467683753853853498429727072845823:i130, %0
+%2:i130 = xor %0, %1
+cand %2 %1
+)i",
+      R"i(%0:i32 = var ; 0
+%1:i32 = var ; 1
+%2:i33 = sadd.with.overflow %0, %1
+%3:i32 = extractvalue %2, 0:i32
+%4:i1 = extractvalue %2, 1:i32 (hasExternalUses)
+%5:i32 = select %4, %3, 0:i32
+cand %5 %0
+)i",
+      R"i(%0:i4 = var ; 0
+%1:i4 = shl %0, 1:i4
+infer %1 (demandedBits=1110) (harvestedFromUse)
+%2:i4 = reservedconst ; 2
+%3:i4 = add %0, %2
+result %3
+)i",
+  };
+
+  InstContext IC;
+  for (const auto &T : Tests) {
+    std::string ErrStr;
+    auto Reps = ParseReplacements(IC, "<input>", T, ErrStr);
+    ASSERT_EQ("", ErrStr);
+
+    std::string Binary;
+    llvm::raw_string_ostream OS(Binary);
+    WriteBinaryReplacements(OS, Reps);
+    OS.flush();
+    ASSERT_TRUE(isBinaryReplacements(Binary));
+
+    InstContext IC2;
+    auto BinaryReps = ReadBinaryReplacements(IC2, "<binary>", Binary, ErrStr);
+    ASSERT_EQ("", ErrStr);
+    ASSERT_EQ(Reps.size(), BinaryReps.size());
+    for (unsigned J = 0; J < Reps.size(); ++J)
+      EXPECT_EQ(Reps[J].getString(/*printNames=*/true),
+                BinaryReps[J].getString(/*printNames=*/true));
+
+    // Every proper prefix is an error, not a crash
+    for (size_t Len = 0; Len < Binary.size(); ++Len) {
+      ErrStr.clear();
+      auto Truncated = ReadBinaryReplacements(IC2, "<binary>",
+                                              Binary.substr(0, Len), ErrStr);
+      if (Len > 4 && ErrStr.empty())
+        EXPECT_LT(Truncated.size(), Reps.size());
+    }
+  }
+}
+
+TEST(ParserTest, BinaryErrors) {
+  InstContext IC;
+  std::string ErrStr;
+  ReadBinaryReplacements(IC, "<binary>", "%0:i1 = var\n", ErrStr);
+  EXPECT_EQ("<binary>: offset 0: not a binary replacement file", ErrStr);
+
+  ErrStr.clear();
+  ReadBinaryReplacements(IC, "<binary>", llvm::StringRef("\xffSPR\x02", 5),
+                         ErrStr);
+  EXPECT_EQ("<binary>: offset 5: unsupported version 2", ErrStr);
+
+  // One record: an add of inst 0, which does not exist yet
+  ErrStr.clear();
+  ReadBinaryReplacements(IC, "<binary>",
+                         llvm::StringRef("\xffSPR\x01\x01\x05\x08\x00\x01\x00",
+                                         11),
+                         ErrStr);
+  EXPECT_EQ("<binary>: offset 11: reference to an undefined inst", ErrStr);
+
+  // Files of one replacement, from its number of records on
+  auto Read = [&](std::initializer_list<unsigned char> Bytes) {
+    std::string Buf("\xffSPR\x01", 5);
+    Buf.append(Bytes.begin(), Bytes.end());
+    ErrStr.clear();
+    ReadBinaryReplacements(IC, "<binary>", Buf, ErrStr);
+    return ErrStr;
+  };
+  const unsigned char Var = Inst::Var, Phi = Inst::Phi, Add = Inst::Add,
+                      SAddWO = Inst::SAddWithOverflow, Block = 0xff;
+
+  // %0:i8388609 = var
+  EXPECT_EQ("<binary>: offset 12: width must be at most 8388608",
+            Read({1, Var, 0x81, 0x80, 0x80, 0x04, 0}));
+  // %1:i8 = add %0
+  EXPECT_EQ("<binary>: offset 18: expected 2 operands, found 1",
+            Read({2, Var, 8, 0, 0, 0, 0, 0, Add, 8, 0, 1, 0}));
+  // %2:i8 = add %0:i8, %1:i4
+  EXPECT_EQ("<binary>: offset 26: operands have different widths",
+            Read({3, Var, 8, 0, 0, 0, 0, 0, Var, 4, 0, 0, 0, 0, 0,
+                  Add, 8, 0, 2, 0, 1}));
+  // %1:i4 = add %0:i8, %0
+  EXPECT_EQ("<binary>: offset 19: inst must have width of 8, has width 4",
+            Read({2, Var, 8, 0, 0, 0, 0, 0, Add, 4, 0, 2, 0, 0}));
+  // %2:i9 = sadd.with.overflow %0, %0, which the parser would have expanded
+  EXPECT_EQ("<binary>: offset 19: invalid sadd.with.overflow",
+            Read({2, Var, 8, 0, 0, 0, 0, 0, SAddWO, 9, 0, 2, 0, 0}));
+  // A phi of one operand in a block of two predecessors
+  EXPECT_EQ("<binary>: offset 21: phi has 1 operand(s) but preceding block "
+            "has 2",
+            Read({3, Block, 2, Var, 8, 0, 0, 0, 0, 0,
+                  Phi, 8, 0, 0, 1, 0}));
+  // A blockpc for the third predecessor of a block of two
+  EXPECT_EQ("<binary>: offset 19: blockpc's predecessor number is larger "
+            "than the number of predecessors of its block",
+            Read({2, Block, 2, Var, 1, 0, 0, 0, 0, 0,
+                  0, 1, 0, 2, 0, 0, 0, 0}));
+}
+
+TEST(ParserTest, SplitReplacements) {
+  std::string Str = R"i(; leading comment
+%0:i32 = var
+%1:i32 = add %0, 0:i32
+cand %1 %0 ; trailing comment
+
+%0:i8 = var
+infer %0
+result %0
+%0:i1 = var
+%1:i1 = foo %0
+cand %1 %0
+)i";
+
+  auto Slices = SplitReplacements(Str, /*LHSOnly=*/false);
+  ASSERT_EQ(3u, Slices.size());
+  EXPECT_EQ(1u, Slices[0].Line);
+  EXPECT_EQ(6u, Slices[1].Line);
+  EXPECT_EQ(9u, Slices[2].Line);
+  EXPECT_TRUE(Slices[0].Str.startswith("; leading comment"));
+  EXPECT_TRUE(Slices[1].Str.startswith("%0:i8 = var"));
+
+  InstContext IC;
+  std::string ErrStr;
+  for (unsigned J = 0; J < 2; ++J) {
+    auto Reps = ParseReplacements(IC, "<input>", Slices[J].Str, ErrStr,
+                                  Slices[J].Line);
+    ASSERT_EQ("", ErrStr);
+    EXPECT_EQ(1u, Reps.size());
+  }
+  // Errors refer to lines of the whole input
+  ParseReplacements(IC, "<input>", Slices[2].Str, ErrStr, Slices[2].Line);
+  EXPECT_EQ("<input>:10:9: unexpected inst kind: 'foo'", ErrStr);
+
+  // For LHSs, infer ends a replacement and what follows is left to the
+  // parser to reject
+  auto LHSSlices = SplitReplacements("%0:i8 = var\ninfer %0\n"
+                                     "%1:i8 = var\ninfer %1\n; end\n",
+                                     /*LHSOnly=*/true);
+  ASSERT_EQ(2u, LHSSlices.size());
+  EXPECT_EQ("%1:i8 = var\ninfer %1\n; end\n", LHSSlices[1].Str);
+
+  EXPECT_TRUE(SplitReplacements("; nothing\n\n", /*LHSOnly=*/false).empty());
+
+  // Slices are not null terminated, so the lexer must stop at their end
+  llvm::StringRef Cut = "%0:i8 = var (knownBits=1x0x1x0x)";
+  ParseReplacements(IC, "<input>", Cut.take_front(Cut.find('=', 8)), ErrStr);
+  EXPECT_EQ("<input>:1:23: expected '=' for knownBits", ErrStr);
+  ParseReplacements(IC, "<input>", Cut.take_front(Cut.find('1')), ErrStr);
+  EXPECT_EQ("<input>:1:24: expected [0|1|x]+ for knownBits", ErrStr);
+}
+
+TEST(ParserTest, Parallel) {
+  std::string Str;
+  for (unsigned J = 0; J < 300; ++J) {
+    Str += "; replacement " + std::to_string(J) + "\n";
+    Str += "%0:i8 = var\n";
+    Str += "%1:i8 = reservedconst\n";
+    Str += "%2:i8 = add %0, " + std::to_string(J % 256) + ":i8\n";
+    Str += "%3:i8 = mul %2, %1\n";
+    Str += "cand %3 %1\n\n";
+  }
+
+  InstContext SeqIC, ParIC;
+  std::string SeqErr, ParErr;
+  auto Seq = ParseReplacements(SeqIC, "<input>", Str, SeqErr);
+  auto Par = ParseReplacementsParallel(ParIC, "<input>", Str, ParErr, 4);
+  ASSERT_EQ("", SeqErr);
+  ASSERT_EQ("", ParErr);
+  ASSERT_EQ(Seq.size(), Par.size());
+  for (unsigned J = 0; J < Seq.size(); ++J) {
+    EXPECT_EQ(Seq[J].getString(), Par[J].getString());
+    EXPECT_EQ(Seq[J].Mapping.RHS->SynthesisConstID,
+              Par[J].Mapping.RHS->SynthesisConstID);
+  }
+
+  // The first error wins, and the replacements before it are kept
+  std::string Bad = Str;
+  Bad.replace(Bad.find("add", Bad.size() / 3), 3, "foo");
+  Bad.replace(Bad.find("mul", 2 * Bad.size() / 3), 3, "bar");
+  SeqErr.clear();
+  Seq = ParseReplacements(SeqIC, "<input>", Bad, SeqErr);
+  Par = ParseReplacementsParallel(ParIC, "<input>", Bad, ParErr, 4);
+  EXPECT_NE("", SeqErr);
+  EXPECT_EQ(SeqErr, ParErr);
+  EXPECT_EQ(Seq.size(), Par.size());
+
+  std::string LHSStr;
+  for (unsigned J = 0; J < 300; ++J) {
+    LHSStr += "%0:i8 = var\n";
+    LHSStr += "%1:i8 = sub %0, " + std::to_string(J % 256) + ":i8\n";
+    LHSStr += "infer %1\n";
+  }
+  std::vector<ReplacementContext> SeqRCs, ParRCs;
+  SeqErr.clear();
+  ParErr.clear();
+  Seq = ParseReplacementLHSs(SeqIC, "<input>", LHSStr, SeqRCs, SeqErr);
+  Par = ParseReplacementLHSsParallel(ParIC, "<input>", LHSStr, ParRCs, ParErr,
+                                     4);
+  ASSERT_EQ("", SeqErr);
+  ASSERT_EQ("", ParErr);
+  ASSERT_EQ(Seq.size(), Par.size());
+  ASSERT_EQ(Seq.size(), ParRCs.size());
+  for (unsigned J = 0; J < Seq.size(); ++J) {
+    ReplacementContext SeqRC, ParRC;
+    EXPECT_EQ(Seq[J].getLHSString(SeqRC), Par[J].getLHSString(ParRC));
+    EXPECT_EQ(Par[J].Mapping.LHS, ParRCs[J].getInst("1"));
+  }
+
+  // Insts that depend on no var are shared between the threads, which all
+  // give them attributes
+  std::string SharedStr;
+  for (unsigned J = 0; J < 300; ++J) {
+    SharedStr += "%0:i8 = add 1:i8, 2:i8 (hasExternalUses)\n";
+    SharedStr += "%1:i8 = mul 3:i8, %0\n";
+    SharedStr += "infer %1 (demandedBits=00001111)\n";
+  }
+  SeqRCs.clear();
+  ParRCs.clear();
+  SeqErr.clear();
+  ParErr.clear();
+  Seq = ParseReplacementLHSs(SeqIC, "<input>", SharedStr, SeqRCs, SeqErr);
+  Par = ParseReplacementLHSsParallel(ParIC, "<input>", SharedStr, ParRCs,
+                                     ParErr, 4);
+  ASSERT_EQ("", SeqErr);
+  ASSERT_EQ("", ParErr);
+  ASSERT_EQ(Seq.size(), Par.size());
+  for (unsigned J = 0; J < Seq.size(); ++J) {
+    ReplacementContext SeqRC, ParRC;
+    EXPECT_EQ(Seq[J].getLHSString(SeqRC), Par[J].getLHSString(ParRC));
+    EXPECT_EQ(Par[J].Mapping.LHS->DemandedBits, llvm::APInt(8, 0x0F));
+  }
+}
+
+// Parser and printer throughput, for tracking performance rather than
+// correctness. Run with --gtest_also_run_disabled_tests;
+// SOUPER_PARSER_BENCH_MB sets the amount of input (default 16).
+TEST(ParserTest, DISABLED_Throughput) {
+  const char *Rep = R"i(%0:i32 = var (knownBits=xxxxxxxxxxxxxxxxxxxxxxxxxxxxxx00) (range=[0,4096))
+%1:i32 = var (nonZero)
+%2:i32 = add %0, %1
+%3:i32 = shl %2, 3:i32
+%4:i1 = ult %3, %1
+pc %4 1:i1
+%5:i32 = mul %3, 8:i32 (hasExternalUses)
+%6:i32 = select %4, %5, %0
+cand %6 %5
+)i";
+  size_t MB = 16;
+  if (const char *Env = getenv("SOUPER_PARSER_BENCH_MB"))
+    MB = std::max(1, atoi(Env));
+  std::string Text;
+  while (Text.size() < MB << 20) {
+    Text += Rep;
+    Text += '\n';
+  }
+
+  auto MBPerSec = [](size_t Bytes, std::chrono::steady_clock::duration D) {
+    double Secs = std::chrono::duration<double>(D).count();
+    return double(Bytes) / (1 << 20) / std::max(Secs, 1e-9);
+  };
+
+  InstContext IC;
+  std::string ErrStr;
+  auto Start = std::chrono::steady_clock::now();
+  auto Reps = ParseReplacements(IC, "<input>", Text, ErrStr);
+  auto ParseTime = std::chrono::steady_clock::now() - Start;
+  ASSERT_EQ("", ErrStr);
+
+  InstContext ParIC;
+  Start = std::chrono::steady_clock::now();
+  auto ParReps = ParseReplacementsParallel(ParIC, "<input>", Text, ErrStr);
+  auto ParTime = std::chrono::steady_clock::now() - Start;
+  ASSERT_EQ("", ErrStr);
+  ASSERT_EQ(Reps.size(), ParReps.size());
+
+  std::string Binary;
+  llvm::raw_string_ostream OS(Binary);
+  WriteBinaryReplacements(OS, Reps);
+  OS.flush();
+
+  InstContext BinIC;
+  Start = std::chrono::steady_clock::now();
+  auto BinReps = ReadBinaryReplacements(BinIC, "<input>", Binary, ErrStr);
+  auto ReadTime = std::chrono::steady_clock::now() - Start;
+  ASSERT_EQ("", ErrStr);
+  ASSERT_EQ(Reps.size(), BinReps.size());
+
+  // Printing, as done for cache keys
+  size_t Printed = 0;
+  Start = std::chrono::steady_clock::now();
+  for (const auto &R : Reps)
+    Printed += R.getString().size();
+  auto PrintTime = std::chrono::steady_clock::now() - Start;
+  ReplacementPrinter Printer;
+  Start = std::chrono::steady_clock::now();
+  for (const auto &R : Reps)
+    Printer.printReplacement(R.BPCs, R.PCs, R.Mapping);
+  auto PrinterTime = std::chrono::steady_clock::now() - Start;
+
+  llvm::outs() << Reps.size() << " replacements\n";
+  llvm::outs() << "parse: " << Text.size() << " bytes, "
+               << llvm::format("%.1f", MBPerSec(Text.size(), ParseTime))
+               << " MB/s\n";
+  llvm::outs() << "parallel parse: "
+               << llvm::format("%.1f", MBPerSec(Text.size(), ParTime))
+               << " MB/s\n";
+  llvm::outs() << "binary read: " << Binary.size() << " bytes, "
+               << llvm::format("%.1f", MBPerSec(Binary.size(), ReadTime))
+               << " MB/s\n";
+  llvm::outs() << "print: " << Printed << " bytes, "
+               << llvm::format("%.1f", MBPerSec(Printed, PrintTime))
+               << " MB/s\n";
+  llvm::outs() << "ReplacementPrinter: "
+               << llvm::format("%.1f", MBPerSec(Printed, PrinterTime))
+               << " MB/s\n";
+}
@@ -0,0 +1,323 @@
+// Copyright 2019 The Souper Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Writes the tables behind TransferTables.h. For each operation of
+// TransferTableOps.def and each width up to the table limits, every pair of
+// abstract operands is concretized, the operation is evaluated on all pairs
+// of values the way the interpreter does it, and the most precise abstract
+// value covering the defined results is recorded.
+//
+// Known bits are indexed in base 3, one digit per bit: 0 for unknown, 1 for
+// known zero and 2 for known one. A result is stored as its own index, which
+// fits a byte up to 5 bits. Constant ranges are indexed by Lower << W |
+// Upper, with the empty set as [0, 0) and the full set as [Max, Max), and
+// stored as Lower | Upper << 4.
+//
+// This tool runs on the build host, so it only needs the standard library.
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+
+// 9^W known bits and 16^W constant range entries of a byte per operation
+constexpr unsigned MaxKBWidth = 5;
+constexpr unsigned MaxCRWidth = 4;
+static_assert(MaxKBWidth <= 5 && MaxCRWidth <= 4,
+              "results do not fit a byte");
+
+enum Op {
+#define TRANSFER_TABLE_OP(Name, HasKB, HasCR, IsCmp) Name,
+#include "souper/Infer/TransferTableOps.def"
+};
+
+struct OpInfo {
+  const char *Name;
+  bool HasKB, HasCR, IsCmp;
+};
+
+const OpInfo Ops[] = {
+#define TRANSFER_TABLE_OP(Name, HasKB, HasCR, IsCmp) \
+  {#Name, HasKB, HasCR, IsCmp},
+#include "souper/Infer/TransferTableOps.def"
+};
+
+uint64_t mask(unsigned W) { return (1ULL << W) - 1; }
+
+int64_t signExtend(uint64_t V, unsigned W) {
+  return (int64_t)(V << (64 - W)) >> (64 - W);
+}
+
+// Nothing if the result is UB or poison
+std::optional<uint64_t> evaluate(Op O, uint64_t A, uint64_t B, unsigned W) {
+  int64_t SA = signExtend(A, W), SB = signExtend(B, W);
+  int64_t SMin = signExtend(1ULL << (W - 1), W), SMax = mask(W - 1);
+  switch (O) {
+  case Add:
+    return (A + B) & mask(W);
+  case AddNSW:
+    if (SA + SB < SMin || SA + SB > SMax)
+      return std::nullopt;
+    return (A + B) & mask(W);
+  case Sub:
+    return (A - B) & mask(W);
+  case SubNSW:
+    if (SA - SB < SMin || SA - SB > SMax)
+      return std::nullopt;
+    return (A - B) & mask(W);
+  case Mul:
+    return (A * B) & mask(W);
+  case UDiv:
+    if (B == 0)
+      return std::nullopt;
+    return A / B;
+  case URem:
+    if (B == 0)
+      return std::nullopt;
+    return A % B;
+  case And:
+    return A & B;
+  case Or:
+    return A | B;
+  case Shl:
+    if (B >= W)
+      return std::nullopt;
+    return (A << B) & mask(W);
+  case LShr:
+    if (B >= W)
+      return std::nullopt;
+    return A >> B;
+  case AShr:
+    if (B >= W)
+      return std::nullopt;
+    return (uint64_t)(SA >> B) & mask(W);
+  case Eq:
+    return A == B;
+  case Ne:
+    return A != B;
+  case Ult:
+    return A < B;
+  case Slt:
+    return SA < SB;
+  case Ule:
+    return A <= B;
+  case Sle:
+    return SA <= SB;
+  }
+  return std::nullopt;
+}
+
+unsigned pow3(unsigned N) {
+  unsigned P = 1;
+  while (N--)
+    P *= 3;
+  return P;
+}
+
+// The base 3 index of the known bits Zero and One
+uint8_t indexKB(uint64_t Zero, uint64_t One, unsigned W) {
+  unsigned Index = 0;
+  for (unsigned Bit = W; Bit--; )
+    Index = Index * 3 + (Zero >> Bit & 1) + 2 * (One >> Bit & 1);
+  return (uint8_t)Index;
+}
+
+// The values of the known bits with base 3 index Index
+std::vector<uint64_t> concretizeKB(unsigned Index, unsigned W) {
+  uint64_t Zero = 0, One = 0;
+  for (unsigned Bit = 0; Bit < W; ++Bit, Index /= 3) {
+    if (Index % 3 == 1)
+      Zero |= 1ULL << Bit;
+    else if (Index % 3 == 2)
+      One |= 1ULL << Bit;
+  }
+  std::vector<uint64_t> Values;
+  for (uint64_t V = 0; V <= mask(W); ++V)
+    if (!(V & Zero) && (V & One) == One)
+      Values.push_back(V);
+  return Values;
+}
+
+std::vector<uint8_t> makeKBTable(Op O, unsigned W) {
+  unsigned ResultW = Ops[O].IsCmp ? 1 : W;
+  unsigned N = pow3(W);
+  std::vector<std::vector<uint64_t>> Values;
+  for (unsigned I = 0; I < N; ++I)
+    Values.push_back(concretizeKB(I, W));
+
+  std::vector<uint8_t> Table;
+  for (unsigned L = 0; L < N; ++L) {
+    for (unsigned R = 0; R < N; ++R) {
+      uint64_t Zero = mask(ResultW), One = mask(ResultW);
+      bool Defined = false;
+      for (auto A : Values[L]) {
+        for (auto B : Values[R]) {
+          if (auto V = evaluate(O, A, B, W)) {
+            Defined = true;
+            Zero &= ~*V;
+            One &= *V;
+          }
+        }
+      }
+      if (!Defined)
+        Zero = One = 0;
+      Table.push_back(indexKB(Zero, One, ResultW));
+    }
+  }
+  return Table;
+}
+
+// The values in [Lower, Upper) as a bit set
+uint64_t concretizeCR(unsigned Lower, unsigned Upper, unsigned W) {
+  if (Lower == Upper)
+    return Lower ? mask(1 << W) : 0;
+  uint64_t Set = 0;
+  for (unsigned V = Lower; V != Upper; V = (V + 1) & mask(W))
+    Set |= 1ULL << V;
+  return Set;
+}
+
+// The smallest range containing Set: the complement of the largest gap
+// between its values, wrapping around. Encoded like the table entries.
+uint8_t bestCR(uint64_t Set, unsigned W) {
+  unsigned Range = 1 << W;
+  if (Set == 0)
+    return 0;
+  if (Set == mask(Range))
+    return mask(W) | mask(W) << 4;
+
+  // Start the scan at a value in the set so that the gap wrapping around is
+  // seen in one piece
+  unsigned Start = 0;
+  while (!(Set >> Start & 1))
+    ++Start;
+  unsigned GapStart = 0, GapSize = 0, Size = 0;
+  for (unsigned I = 1; I <= Range; ++I) {
+    unsigned V = (Start + I) % Range;
+    if (Set >> V & 1) {
+      if (Size > GapSize) {
+        GapSize = Size;
+        GapStart = (V + Range - Size) % Range;
+      }
+      Size = 0;
+    } else {
+      ++Size;
+    }
+  }
+  unsigned Lower = (GapStart + GapSize) % Range;
+  unsigned Upper = GapStart;
+  return Lower | Upper << 4;
+}
+
+std::vector<uint8_t> makeCRTable(Op O, unsigned W) {
+  unsigned N = 1 << (2 * W);
+  std::vector<uint64_t> Sets;
+  std::vector<bool> Valid;
+  for (unsigned I = 0; I < N; ++I) {
+    unsigned Lower = I >> W, Upper = I & mask(W);
+    Sets.push_back(concretizeCR(Lower, Upper, W));
+    Valid.push_back(Lower != Upper || Lower == 0 || Lower == mask(W));
+  }
+
+  std::vector<uint8_t> Table;
+  for (unsigned L = 0; L < N; ++L) {
+    for (unsigned R = 0; R < N; ++R) {
+      if (!Valid[L] || !Valid[R] || !Sets[L] || !Sets[R]) {
+        Table.push_back(0);
+        continue;
+      }
+      uint64_t Result = 0;
+      for (unsigned A = 0; A <= mask(W); ++A) {
+        if (!(Sets[L] >> A & 1))
+          continue;
+        for (unsigned B = 0; B <= mask(W); ++B) {
+          if (!(Sets[R] >> B & 1))
+            continue;
+          if (auto V = evaluate(O, A, B, W))
+            Result |= 1ULL << *V;
+        }
+      }
+      // Nothing is defined, so the result is unknown
+      if (!Result)
+        Result = mask(1 << W);
+      Table.push_back(bestCR(Result, W));
+    }
+  }
+  return Table;
+}
+
+void writeTable(FILE *Out, const std::string &Name,
+                const std::vector<uint8_t> &Table) {
+  // Decimal without padding keeps the largest tables to a few hundred KB
+  // of source each
+  fprintf(Out, "constexpr uint8_t %s[%zu] = {", Name.c_str(), Table.size());
+  for (size_t I = 0; I < Table.size(); ++I)
+    fprintf(Out, "%s%u,", I % 32 ? "" : "\n", Table[I]);
+  fprintf(Out, "\n};\n\n");
+}
+
+void writeIndex(FILE *Out, const char *Kind, unsigned MaxWidth,
+                bool OpInfo::*Has) {
+  fprintf(Out, "constexpr const uint8_t *%sTables[][%u] = {\n", Kind,
+          MaxWidth + 1);
+  for (auto &Info : Ops) {
+    fprintf(Out, "  /* %s */ {nullptr", Info.Name);
+    for (unsigned W = 1; W <= MaxWidth; ++W) {
+      if (Info.*Has)
+        fprintf(Out, ", %s%s%u", Kind, Info.Name, W);
+      else
+        fprintf(Out, ", nullptr");
+    }
+    fprintf(Out, "},\n");
+  }
+  fprintf(Out, "};\n\n");
+}
+
+} // anonymous
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <output file>\n", argv[0]);
+    return 1;
+  }
+  FILE *Out = fopen(argv[1], "w");
+  if (!Out) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  fprintf(Out, "// Generated by souper-gen-transfer-tables, do not edit.\n\n");
+  fprintf(Out, "constexpr unsigned GeneratedMaxKBWidth = %u;\n", MaxKBWidth);
+  fprintf(Out, "constexpr unsigned GeneratedMaxCRWidth = %u;\n\n", MaxCRWidth);
+
+  for (unsigned O = 0; O < sizeof(Ops) / sizeof(Ops[0]); ++O) {
+    for (unsigned W = 1; W <= MaxKBWidth && Ops[O].HasKB; ++W)
+      writeTable(Out, "KB" + std::string(Ops[O].Name) + std::to_string(W),
+                 makeKBTable((Op)O, W));
+    for (unsigned W = 1; W <= MaxCRWidth && Ops[O].HasCR; ++W)
+      writeTable(Out, "CR" + std::string(Ops[O].Name) + std::to_string(W),
+                 makeCRTable((Op)O, W));
+  }
+  writeIndex(Out, "KB", MaxKBWidth, &OpInfo::HasKB);
+  writeIndex(Out, "CR", MaxCRWidth, &OpInfo::HasCR);
+
+  if (fclose(Out)) {
+    perror(argv[1]);
+    return 1;
+  }
+  return 0;
+}
@@ -12,21 +12,34 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// Exhaustively checks known bits transfer functions for a binary
+// instruction against the best possible results, over every pair of known
+// bits operands at each width. Without arguments it reports on Souper's own
+// transfer function; given a shared object exporting a null terminated
+// AllFuncs array, as gen_xfer.pl builds, it prints a score for each
+// function in it.
+
 #include "llvm/IR/ConstantRange.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/KnownBits.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "Verification.h"
 #include "InterpreterInfra.h"
 #include "souper/Infer/AbstractInterpreter.h"
+#include "souper/Infer/BatchEvaluator.h"
 #include "souper/Infer/Interpreter.h"
 #include "souper/Inst/Inst.h"
-#include "gtest/gtest.h"
 
 #include "funcs.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <dlfcn.h>
+#include <functional>
 #include <iostream>
+#include <thread>
 
 using namespace llvm;
 using namespace souper;
@@ -35,200 +48,398 @@ unsigned DebugLevel;
 
 namespace {
 
-//const auto K = Inst::And;
-//const auto K = Inst::Or;
-//const auto K = Inst::Xor;
-const auto K = Inst::Add;
-//const auto K = Inst::Sub;
-//const auto K = Inst::Mul;
-//const auto K = Inst::URem;
-//const auto K = Inst::Shl;
-//const auto K = Inst::MulNW;
-//const auto K = Inst::UDiv;
-//const auto K = Inst::LShr;
-//const auto K = Inst::SDiv;
-
-// TODO expose to command line
-const bool ARG0CONST = false;
-const bool ARG1CONST = false;
-
-// TODO expose to command line
-
-#if 1
-
-#define MAX_W 6
-
-#else
-
-#define TESTONE 1
-#define MAX_W 6
-//#define VERBOSE 0
-
-#endif
-
-#ifdef TESTONE
-static KnownBits f(const KnownBits &x, const KnownBits &y) {
-  const int WIDTH = x.One.getBitWidth();
-  const APInt t0 = operator+(y.One, x.One);
-  const APInt t1 = ~y.Zero;
-  const APInt t2 = -t1;
-  const APInt t3 = -x.Zero;
-  const APInt t4 = -t3;
-  const APInt t5 = ~t4;
-  const APInt t6 = operator-(t5, t2);
-  const APInt t7 = (APInt::getAllOnesValue(WIDTH).getBoolValue()) ? (t6) : (x.Zero);
-  const APInt t8 = operator&(t7, t0);
-  const APInt t9 = operator|(x.Zero, y.Zero);
-  const APInt t10 = operator&(t8, t9);
-  KnownBits ret(WIDTH);
-  ret.One = t10;
-  ret.Zero = APInt::getMinValue(WIDTH);
-  return ret;
+static cl::opt<std::string> FuncFile(cl::Positional,
+    cl::desc("<shared object with candidate functions>"),
+    cl::init(""));
+
+static cl::opt<std::string> OpName("op",
+    cl::desc("Binary instruction whose transfer functions are checked "
+             "(default=add)"),
+    cl::init("add"));
+
+static cl::opt<unsigned> MinWidth("min-width",
+    cl::desc("Smallest width checked (default=1)"),
+    cl::init(1));
+
+static cl::opt<unsigned> MaxWidth("max-width",
+    cl::desc("Largest width checked, at most 8 (default=6)"),
+    cl::init(6));
+
+static cl::opt<bool> Arg0Const("arg0-const",
+    cl::desc("Only check constant first operands"),
+    cl::init(false));
+
+static cl::opt<bool> Arg1Const("arg1-const",
+    cl::desc("Only check constant second operands"),
+    cl::init(false));
+
+static cl::opt<unsigned> NumJobs("jobs",
+    cl::desc("Number of threads sharing the work (default=all cores)"),
+    cl::init(0));
+
+// Oracle entries hold both masks of a result in a byte each
+constexpr unsigned MaxOracleWidth = 8;
+
+bool isBinary(Inst::Kind K) {
+  switch (K) {
+  case Inst::Add: case Inst::AddNSW: case Inst::AddNUW: case Inst::AddNW:
+  case Inst::Sub: case Inst::SubNSW: case Inst::SubNUW: case Inst::SubNW:
+  case Inst::Mul: case Inst::MulNSW: case Inst::MulNUW: case Inst::MulNW:
+  case Inst::UDiv: case Inst::SDiv: case Inst::UDivExact: case Inst::SDivExact:
+  case Inst::URem: case Inst::SRem:
+  case Inst::And: case Inst::Or: case Inst::Xor:
+  case Inst::Shl: case Inst::ShlNSW: case Inst::ShlNUW: case Inst::ShlNW:
+  case Inst::LShr: case Inst::LShrExact: case Inst::AShr: case Inst::AShrExact:
+  case Inst::Eq: case Inst::Ne: case Inst::Ult: case Inst::Slt:
+  case Inst::Ule: case Inst::Sle:
+    return true;
+  default:
+    return false;
+  }
 }
-#endif
 
-struct triple {
-  KnownBits In0, In1, Out;
+// Known bits operands are numbered in base 3, one digit per bit: 0 for
+// unknown, 1 for known zero and 2 for known one
+struct Operands {
+  unsigned W, N;
+  // Place value of the lowest unknown bit of each operand, 0 if constant
+  std::vector<unsigned> LowestUnknown;
+  // Value of each constant operand
+  std::vector<uint64_t> Value;
+
+  explicit Operands(unsigned W) : W(W), N(1) {
+    for (unsigned I = 0; I < W; ++I)
+      N *= 3;
+    for (unsigned X = 0; X < N; ++X) {
+      unsigned Lowest = 0;
+      uint64_t V = 0;
+      for (unsigned Bit = 0, Digits = X, P = 1; Bit < W;
+           ++Bit, Digits /= 3, P *= 3) {
+        if (Digits % 3 == 0 && !Lowest)
+          Lowest = P;
+        if (Digits % 3 == 2)
+          V |= 1ULL << Bit;
+      }
+      LowestUnknown.push_back(Lowest);
+      Value.push_back(V);
+    }
+  }
+
+  KnownBits get(unsigned X) const {
+    KnownBits KB(W);
+    for (unsigned Bit = 0; Bit < W; ++Bit, X /= 3) {
+      if (X % 3 == 1)
+        KB.Zero.setBit(Bit);
+      else if (X % 3 == 2)
+        KB.One.setBit(Bit);
+    }
+    return KB;
+  }
+
+  std::vector<unsigned> domain(bool ConstOnly) const {
+    std::vector<unsigned> D;
+    for (unsigned X = 0; X < N; ++X)
+      if (!ConstOnly || !LowestUnknown[X])
+        D.push_back(X);
+    return D;
+  }
 };
 
-std::vector<std::vector<triple>> Oracle;
+// The best known bits of the result for every pair of operands, found from
+// the concrete results by merging the two ways of fixing an unknown bit,
+// lowest first. Zero is in the low byte of an entry and One in the high
+// byte; with no defined result both are all ones, which merging ignores.
+class Oracle {
+  const Operands &Ops;
+  std::vector<uint16_t> Entries;
+
+public:
+  static constexpr uint16_t Undefined = 0xffff;
+
+  Oracle(Inst::Kind K, const Operands &Ops) : Ops(Ops) {
+    unsigned W = Ops.W, N = Ops.N;
+    std::vector<uint16_t> Concrete = evaluateAll(K, W);
+    Entries.resize((size_t)N * N);
+    // Fixing an unknown bit raises the index, so go downwards
+    for (unsigned X = N; X--; ) {
+      unsigned PX = Ops.LowestUnknown[X];
+      for (unsigned Y = N; Y--; ) {
+        unsigned PY = Ops.LowestUnknown[Y];
+        uint16_t &E = Entries[(size_t)X * N + Y];
+        if (PX)
+          E = get(X + PX, Y) & get(X + 2 * PX, Y);
+        else if (PY)
+          E = get(X, Y + PY) & get(X, Y + 2 * PY);
+        else
+          E = Concrete[Ops.Value[X] << W | Ops.Value[Y]];
+      }
+    }
+  }
 
-bool nextTrivialKB(llvm::KnownBits &x) {
-  x.One += 1;
-  x.Zero = ~x.One;
-  return x.One != 0;
-}
+  uint16_t get(unsigned X, unsigned Y) const {
+    return Entries[(size_t)X * Ops.N + Y];
+  }
 
-void genKB(Inst::Kind K, int W) {
-  int val = 0, noVal = 0;
-  llvm::KnownBits x(W);
-  if (ARG0CONST)
-    x.Zero.setAllBits();
-  do {
-    llvm::KnownBits y(W);
-    if (ARG1CONST)
-      y.Zero.setAllBits();
-    do {
-      KBTesting kbObj(W);
-      InstContext IC;
-      auto Op0 = IC.createVar(W, "Op0");
-      auto Op1 = IC.createVar(W, "Op1");
-      auto I = IC.getInst(K, W, {Op0, Op1});
-      std::unordered_map<Inst *, llvm::KnownBits> C{{Op0, x}, {Op1, y}};
-      KBTesting KBTest(W);
-      EvalValueKB Res = KBTest.bruteForce(x, y, I);
-      if (!Res.hasValue()) {
-        ++noVal;
-        continue;
+private:
+  // The result of K on every pair of values, indexed by A << W | B
+  static std::vector<uint16_t> evaluateAll(Inst::Kind K, unsigned W) {
+    InstContext IC;
+    Inst *Op0 = IC.createVar(W, "Op0");
+    Inst *Op1 = IC.createVar(W, "Op1");
+    unsigned ResultW = Inst::isCmp(K) ? 1 : W;
+    Inst *I = IC.getInst(K, ResultW, {Op0, Op1});
+    uint64_t Mask = (1ULL << ResultW) - 1;
+    size_t Lanes = 1ULL << 2 * W;
+
+    std::vector<uint16_t> Results(Lanes, Undefined);
+    auto set = [&](size_t Lane, uint64_t V) {
+      Results[Lane] = (~V & Mask) | V << 8;
+    };
+
+    if (BatchProgram::isSupported(I)) {
+      BatchInputs Inputs;
+      Inputs.NumLanes = Lanes;
+      auto &A = Inputs.Columns[Op0], &B = Inputs.Columns[Op1];
+      for (size_t Lane = 0; Lane < Lanes; ++Lane) {
+        A.push_back(Lane >> W);
+        B.push_back(Lane & ((1ULL << W) - 1));
       }
-      KnownBits KB = Res.getValueKB();
-      if (KB.hasConflict())
-        llvm::report_fatal_error("conflict in oracle");
-      ++val;
-      Oracle[W].push_back({x, y, KB});
-    } while (ARG1CONST ? nextTrivialKB(y) : KBTesting::nextKB(y));
-  } while (ARG0CONST ? nextTrivialKB(x) : KBTesting::nextKB(x));
-  llvm::outs() << "at width = " << W << ", " << val << " have values, " << noVal
-               << " do not\n";
-}
+      BatchResult R;
+      BatchProgram(I).evaluate(Inputs, R);
+      for (size_t Lane = 0; Lane < Lanes; ++Lane)
+        if (R.hasValue(Lane))
+          set(Lane, R.Vals[Lane]);
+      return Results;
+    }
+
+    for (size_t Lane = 0; Lane < Lanes; ++Lane) {
+      ValueCache Vals{{Op0, APInt(W, Lane >> W)},
+                      {Op1, APInt(W, Lane & ((1ULL << W) - 1))}};
+      ConcreteInterpreter CI(Vals);
+      EvalValue V = CI.evaluateInst(I);
+      if (V.hasValue())
+        set(Lane, V.getValue().getZExtValue());
+    }
+    return Results;
+  }
+};
+
+struct Stats {
+  long Pairs = 0, Undefined = 0, Optimal = 0;
+  long ActualKnown = 0, MaxKnown = 0;
+  long ImpreciseBits = 0, ImpreciseZeroes = 0, ImpreciseOnes = 0;
+  long UnsoundBits = 0, Conflicts = 0;
+  // The first pair of operands with an unsound result, if any
+  long FirstUnsound = -1;
+  KnownBits UnsoundResult;
+
+  void add(const Stats &S) {
+    Pairs += S.Pairs;
+    Undefined += S.Undefined;
+    Optimal += S.Optimal;
+    ActualKnown += S.ActualKnown;
+    MaxKnown += S.MaxKnown;
+    ImpreciseBits += S.ImpreciseBits;
+    ImpreciseZeroes += S.ImpreciseZeroes;
+    ImpreciseOnes += S.ImpreciseOnes;
+    UnsoundBits += S.UnsoundBits;
+    Conflicts += S.Conflicts;
+    if (S.FirstUnsound != -1 &&
+        (FirstUnsound == -1 || S.FirstUnsound < FirstUnsound)) {
+      FirstUnsound = S.FirstUnsound;
+      UnsoundResult = S.UnsoundResult;
+    }
+  }
+
+  long score() const { return UnsoundBits * 1000 + ImpreciseBits; }
+};
 
 void compare(const KnownBits &Calculated, const KnownBits &Expected,
-             long &ImpreciseBits, long &ImpreciseZeroes, long &ImpreciseOnes,
-             long &UnsoundBits, long &MaxKnown, long &ActualKnown) {
+             Stats &S) {
+  long UnsoundBefore = S.UnsoundBits, ImpreciseBefore = S.ImpreciseBits;
   for (int i = 0; i < Expected.getBitWidth(); ++i) {
     if (Calculated.One[i] || Calculated.Zero[i])
-      ++ActualKnown;
+      ++S.ActualKnown;
     if (Expected.Zero[i]) {
-      ++MaxKnown;
+      ++S.MaxKnown;
       if (Calculated.One[i])
-        ++UnsoundBits;
+        ++S.UnsoundBits;
       if (!Calculated.Zero[i]) {
-        ++ImpreciseBits;
-        ++ImpreciseZeroes;
+        ++S.ImpreciseBits;
+        ++S.ImpreciseZeroes;
       }
     }
     if (Expected.One[i]) {
-      ++MaxKnown;
+      ++S.MaxKnown;
       if (Calculated.Zero[i])
-        ++UnsoundBits;
+        ++S.UnsoundBits;
       if (!Calculated.One[i]) {
-        ++ImpreciseBits;
-        ++ImpreciseOnes;
+        ++S.ImpreciseBits;
+        ++S.ImpreciseOnes;
       }
     }
     if (!Expected.Zero[i] && !Expected.One[i]) {
       if (Calculated.Zero[i] || Calculated.One[i])
-        ++UnsoundBits;
+        ++S.UnsoundBits;
     }
     if (Calculated.Zero[i] && Calculated.One[i])
-      ++UnsoundBits;
+      ++S.UnsoundBits;
   }
+  if (S.UnsoundBits == UnsoundBefore && S.ImpreciseBits == ImpreciseBefore)
+    ++S.Optimal;
 }
 
-void checkKB(Inst::Kind K, TestFn Func, int W,
-             long &ImpreciseBits,
-             long &ImpreciseZeroes,
-             long &ImpreciseOnes,
-             long &UnsoundBits,
-             long &MaxKnown,
-             long &ActualKnown) {
-  for (auto &t : Oracle[W]) {
-    KnownBits Cand = Func(t.In0, t.In1);
-    if (Cand.hasConflict()) {
-      UnsoundBits += 10000;
-      return;
+typedef std::function<KnownBits(const KnownBits &, const KnownBits &)>
+  CheckedFn;
+
+// Checks every function made by MakeFns on all pairs of operands at width
+// W. Each thread gets its own functions, and rows of the pair space are
+// handed out to the threads as they finish the previous ones.
+std::vector<Stats>
+checkWidth(Inst::Kind K, unsigned W,
+           std::function<std::vector<CheckedFn>(unsigned W)> MakeFns,
+           size_t NumFns, unsigned Threads) {
+  Operands Ops(W);
+  Oracle O(K, Ops);
+  unsigned ResultW = Inst::isCmp(K) ? 1 : W;
+  std::vector<unsigned> Xs = Ops.domain(Arg0Const), Ys = Ops.domain(Arg1Const);
+
+  std::atomic<size_t> NextRow(0);
+  std::vector<std::vector<Stats>> ThreadStats(Threads,
+                                              std::vector<Stats>(NumFns));
+  auto Work = [&](unsigned T) {
+    std::vector<CheckedFn> Fns = MakeFns(W);
+    auto &S = ThreadStats[T];
+    for (size_t Row; (Row = NextRow++) < Xs.size(); ) {
+      unsigned X = Xs[Row];
+      KnownBits KX = Ops.get(X);
+      for (unsigned Y : Ys) {
+        uint16_t E = O.get(X, Y);
+        if (E == Oracle::Undefined) {
+          for (auto &FS : S)
+            ++FS.Undefined;
+          continue;
+        }
+        KnownBits Expected(ResultW);
+        Expected.Zero = APInt(ResultW, E & 0xff);
+        Expected.One = APInt(ResultW, E >> 8);
+        KnownBits KY = Ops.get(Y);
+        for (size_t F = 0; F < Fns.size(); ++F) {
+          KnownBits Cand = Fns[F](KX, KY);
+          auto &FS = S[F];
+          ++FS.Pairs;
+          long UnsoundBefore = FS.UnsoundBits;
+          if (Cand.getBitWidth() != ResultW || Cand.hasConflict()) {
+            ++FS.Conflicts;
+            FS.UnsoundBits += 10000;
+          } else {
+            compare(Cand, Expected, FS);
+          }
+          long Pair = (long)X * Ops.N + Y;
+          if (FS.UnsoundBits != UnsoundBefore &&
+              (FS.FirstUnsound == -1 || Pair < FS.FirstUnsound)) {
+            FS.FirstUnsound = Pair;
+            FS.UnsoundResult = Cand;
+          }
+        }
+      }
     }
-#if defined(VERBOSE) && defined(TESTONE)
-    llvm::outs() << KnownBitsAnalysis::knownBitsString(t.In0) << " op "
-                 << KnownBitsAnalysis::knownBitsString(t.In1) << " = "
-                 << KnownBitsAnalysis::knownBitsString(Cand) << " (expecting "
-                 << KnownBitsAnalysis::knownBitsString(t.Out) << ") ";
-    int oldImprecise = ImpreciseBits;
-    int oldUnsound = UnsoundBits;
-#endif
-    compare(Cand, t.Out, ImpreciseBits, ImpreciseZeroes, ImpreciseOnes,
-            UnsoundBits, MaxKnown, ActualKnown);
-#if defined(VERBOSE) && defined(TESTONE)
-    llvm::outs() << (ImpreciseBits - oldImprecise) << " "
-                 << ((UnsoundBits - oldUnsound) ? "<--- unsound!!!" : "")
+  };
+
+  std::vector<std::thread> Pool;
+  for (unsigned T = 1; T < Threads; ++T)
+    Pool.emplace_back(Work, T);
+  Work(0);
+  for (auto &T : Pool)
+    T.join();
+
+  std::vector<Stats> Result(NumFns);
+  for (auto &TS : ThreadStats)
+    for (size_t F = 0; F < NumFns; ++F)
+      Result[F].add(TS[F]);
+  return Result;
+}
+
+// Souper's transfer function for K, with an InstContext of its own since
+// those are not thread-safe
+std::vector<CheckedFn> makeBuiltinFn(Inst::Kind K, unsigned W) {
+  auto IC = std::make_shared<InstContext>();
+  Inst *Op0 = IC->createVar(W, "Op0");
+  Inst *Op1 = IC->createVar(W, "Op1");
+  Inst *I = IC->getInst(K, Inst::isCmp(K) ? 1 : W, {Op0, Op1});
+  return {[IC, Op0, Op1, I](const KnownBits &X, const KnownBits &Y) {
+    std::unordered_map<Inst *, KnownBits> C{{Op0, X}, {Op1, Y}};
+    KnownBitsAnalysis KB(C);
+    ConcreteInterpreter BlankCI;
+    return KB.findKnownBits(I, BlankCI, /*UsePartialEval=*/false);
+  }};
+}
+
+std::string percent(long Part, long Whole) {
+  return Whole ? std::to_string(100.0 * Part / Whole) + "%" : "n/a";
+}
+
+void printReport(Inst::Kind K, unsigned W, const Stats &S, double Seconds) {
+  Operands Ops(W);
+  llvm::outs() << Inst::getKindName(K) << " at width " << W << ": "
+               << S.Pairs << " operand pairs with values, " << S.Undefined
+               << " without (" << format("%.2f", Seconds) << "s)\n";
+  llvm::outs() << "  actual known bits: " << S.ActualKnown << "\n";
+  llvm::outs() << "  max known bits: " << S.MaxKnown << "\n";
+  llvm::outs() << "  precision = " << percent(S.ActualKnown, S.MaxKnown)
+               << "\n";
+  llvm::outs() << "  optimal results: " << S.Optimal << " ("
+               << percent(S.Optimal, S.Pairs) << ")\n";
+  llvm::outs() << "  imprecise: " << S.ImpreciseBits << "\n";
+  llvm::outs() << "  imprecise zeroes: " << S.ImpreciseZeroes << "\n";
+  llvm::outs() << "  imprecise ones  : " << S.ImpreciseOnes << "\n";
+  llvm::outs() << "  unsound: " << S.UnsoundBits << "\n";
+  llvm::outs() << "  conflicting results: " << S.Conflicts << "\n";
+  if (S.FirstUnsound != -1) {
+    unsigned X = S.FirstUnsound / Ops.N, Y = S.FirstUnsound % Ops.N;
+    llvm::outs() << "  first unsound: "
+                 << KnownBitsAnalysis::knownBitsString(Ops.get(X)) << " "
+                 << Inst::getKindName(K) << " "
+                 << KnownBitsAnalysis::knownBitsString(Ops.get(Y)) << " = "
+                 << KnownBitsAnalysis::knownBitsString(S.UnsoundResult)
                  << "\n";
-#endif
   }
 }
 
 } // namespace
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    llvm::errs() << "usage: bulk_tests /full/path/to/file.so\n";
-    exit(1);
-  }
+  cl::ParseCommandLineOptions(argc, argv);
 
-  for (int W = 0; W <= MAX_W; ++W) {
-    Oracle.push_back(std::vector<triple>());
-    if (W >= 1)
-      genKB(K, W);
+  Inst::Kind K = Inst::getKind(OpName);
+  if (!isBinary(K)) {
+    llvm::errs() << "bulk_tests: '" << OpName
+                 << "' is not a binary instruction\n";
+    return 1;
   }
-
-#ifdef TESTONE
-  for (int W = 1; W <= MAX_W; ++W) {
-    long ImpreciseBits = 0, UnsoundBits = 0, MaxKnown = 0,
-      ActualKnown = 0, ImpreciseZeroes = 0, ImpreciseOnes = 0;
-    checkKB(K, f, W, ImpreciseBits, ImpreciseZeroes, ImpreciseOnes,
-            UnsoundBits, MaxKnown, ActualKnown);
-    llvm::outs() << W << "\n";
-    llvm::outs() << "  actual known bits: " << ActualKnown << "\n";
-    llvm::outs() << "  max known bits: " << MaxKnown << "\n";
-    llvm::outs() << "  precision = " << std::to_string(100.0 * ActualKnown / MaxKnown) << "%\n";
-    llvm::outs() << "  unsound: " << UnsoundBits << "\n";
-    llvm::outs() << "  imprecise: " << ImpreciseBits << "\n";
-    llvm::outs() << "  imprecise zeroes: " << ImpreciseZeroes << "\n";
-    llvm::outs() << "  imprecise ones  : " << ImpreciseOnes << "\n";
+  if (MinWidth < 1 || MinWidth > MaxWidth || MaxWidth > MaxOracleWidth) {
+    llvm::errs() << "bulk_tests: widths must satisfy 1 <= min-width <= "
+                 << "max-width <= " << MaxOracleWidth << "\n";
+    return 1;
+  }
+  unsigned Threads = NumJobs;
+  if (!Threads)
+    Threads = std::max(1u, std::thread::hardware_concurrency());
+
+  if (FuncFile.empty()) {
+    for (unsigned W = MinWidth; W <= MaxWidth; ++W) {
+      auto Start = std::chrono::steady_clock::now();
+      auto S = checkWidth(K, W,
+                          [K](unsigned W) { return makeBuiltinFn(K, W); },
+                          1, Threads);
+      std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+      printReport(K, W, S[0], Elapsed.count());
+    }
+    return 0;
   }
-#else
-  char *FuncFile = argv[1];
 
-  void *handle = dlopen(FuncFile, RTLD_LAZY);
+  void *handle = dlopen(FuncFile.c_str(), RTLD_LAZY);
   if (!handle) {
     llvm::errs() << dlerror() << "\n";
     exit(1);
@@ -240,22 +451,27 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
-  for (int I = 0; Funcs[I]; ++I) {
-    llvm::outs() << I << " ";
+  size_t NumFns = 0;
+  while (Funcs[NumFns])
+    ++NumFns;
+  std::vector<Stats> Total(NumFns);
+  for (unsigned W = MinWidth; W <= MaxWidth; ++W) {
+    auto S = checkWidth(K, W,
+                        [Funcs, NumFns](unsigned) {
+                          return std::vector<CheckedFn>(Funcs, Funcs + NumFns);
+                        },
+                        NumFns, Threads);
+    for (size_t I = 0; I < NumFns; ++I)
+      Total[I].add(S[I]);
+  }
 
+  for (size_t I = 0; I < NumFns; ++I) {
+    llvm::outs() << I << " ";
     llvm::outs() << (void *)Funcs[I] << " ";
-
-    long ImpreciseBits = 0, UnsoundBits = 0, MaxKnown = 0, ActualKnown = 0;
-    long ImpreciseZeroes = 0, ImpreciseOnes = 0;
-    for (int W = 1; W <= MAX_W; ++W)
-      checkKB(K, Funcs[I], W, ImpreciseBits, ImpreciseZeroes, ImpreciseOnes,
-              UnsoundBits, MaxKnown, ActualKnown);
-    double Score = (UnsoundBits * 1000) + ImpreciseBits;
-    llvm::outs() << "score = " << (long)Score << "\n";
+    llvm::outs() << "score = " << Total[I].score() << "\n";
   }
 
   dlclose(handle);
-#endif
 
 //  // Verification stub
 //  z3::context ctx;